@@ -35,27 +35,35 @@
 #include "libdex/CmdUtils.h"
 #include "libdex/DexCatch.h"
 #include "libdex/DexClass.h"
+#include "libdex/DexContainer.h"
 #include "libdex/DexDebugInfo.h"
 #include "libdex/DexOpcodes.h"
 #include "libdex/DexProto.h"
+#include "libdex/DexUtf.h"
+#include "libdex/DexVerifyCache.h"
 #include "libdex/InstrUtils.h"
 #include "libdex/SysUtil.h"
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <errno.h>
 #include <assert.h>
 #include <inttypes.h>
+#include <time.h>
 
 static const char* gProgName = "dexdump";
 
 enum OutputFormat {
     OUTPUT_PLAIN = 0,               /* default */
     OUTPUT_XML,                     /* fancy */
+    OUTPUT_JSON,                    /* one JSON object per line */
+    OUTPUT_BINARY,                  /* length-prefixed records */
 };
 
 /* command-line options */
@@ -70,6 +78,12 @@ struct Options {
     const char* tempFileName;
     bool exportsOnly;
     bool verbose;
+    int numThreads;
+    const char* batchListName;
+    const char* summaryFileName;
+    bool useVerifyCache;
+    bool showVerifyStats;
+    bool showPageFaults;
 };
 
 struct Options gOptions;
@@ -81,6 +95,264 @@ struct FieldMethodInfo {
     const char* signature;
 };
 
+/*
+ * Output normally goes straight to stdout.  When classes are dumped in
+ * parallel, each one is rendered into its own buffer on a worker thread,
+ * and the buffers are written out in class order.
+ */
+struct OutputBuffer {
+    char*   data;
+    size_t  len;
+    size_t  capacity;
+};
+
+/* buffer for the current thread; NULL means stdout */
+static __thread OutputBuffer* gOutputBuf = NULL;
+
+/*
+ * Make room for "len" more bytes, plus a trailing '\0', in "pBuf".
+ */
+static void outReserve(OutputBuffer* pBuf, size_t len)
+{
+    if (pBuf->len + len + 1 <= pBuf->capacity)
+        return;
+
+    size_t newCapacity = (pBuf->capacity == 0) ? 4096 : pBuf->capacity * 2;
+    while (newCapacity < pBuf->len + len + 1)
+        newCapacity *= 2;
+
+    char* newData = (char*) realloc(pBuf->data, newCapacity);
+    if (newData == NULL) {
+        fprintf(stderr, "%s: out of memory\n", gProgName);
+        abort();
+    }
+    pBuf->data = newData;
+    pBuf->capacity = newCapacity;
+}
+
+/*
+ * Write "len" bytes of output.
+ */
+static void outWrite(const char* data, size_t len)
+{
+    OutputBuffer* pBuf = gOutputBuf;
+
+    if (pBuf == NULL) {
+        fwrite(data, 1, len, stdout);
+        return;
+    }
+
+    outReserve(pBuf, len);
+    memcpy(pBuf->data + pBuf->len, data, len);
+    pBuf->len += len;
+}
+
+/*
+ * Write a string, without adding a newline.
+ */
+static void outString(const char* str)
+{
+    outWrite(str, strlen(str));
+}
+
+/*
+ * Write a single character.
+ */
+static void outPutc(char c)
+{
+    OutputBuffer* pBuf = gOutputBuf;
+
+    if (pBuf == NULL) {
+        putchar(c);
+        return;
+    }
+
+    outReserve(pBuf, 1);
+    pBuf->data[pBuf->len++] = c;
+}
+
+/*
+ * printf() to the output.
+ */
+static void outPrintf(const char* format, ...)
+    __attribute__ ((format (printf, 1, 2)));
+static void outPrintf(const char* format, ...)
+{
+    OutputBuffer* pBuf = gOutputBuf;
+    va_list args;
+
+    va_start(args, format);
+    if (pBuf == NULL) {
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+
+    size_t avail = pBuf->capacity - pBuf->len;
+    va_list copy;
+    va_copy(copy, args);
+    int len = vsnprintf(pBuf->data + pBuf->len, avail, format, args);
+    va_end(args);
+
+    if (len >= 0 && (size_t) len >= avail) {
+        outReserve(pBuf, len);
+        vsnprintf(pBuf->data + pBuf->len, len + 1, format, copy);
+    }
+    va_end(copy);
+
+    if (len > 0)
+        pBuf->len += len;
+}
+
+/*
+ * Write a modified UTF-8 string as a quoted JSON string.  Anything
+ * outside printable ASCII is written as a \u escape, so the output is
+ * plain ASCII no matter what the DEX file contains.
+ */
+static void outJsonString(const char* str)
+{
+    const char* start = str;
+
+    outPutc('"');
+    while (*str != '\0') {
+        unsigned char ch = *str;
+
+        if (ch >= 0x20 && ch < 0x7f && ch != '"' && ch != '\\') {
+            str++;
+            continue;
+        }
+
+        outWrite(start, str - start);
+        if (ch == '"' || ch == '\\') {
+            outPutc('\\');
+            outPutc(ch);
+            str++;
+        } else {
+            outPrintf("\\u%04x", dexGetUtf16FromUtf8(&str));
+        }
+        start = str;
+    }
+    outWrite(start, str - start);
+    outPutc('"');
+}
+
+/*
+ * Write an unsigned LEB128 value.
+ */
+static void outUleb128(u4 val)
+{
+    char buf[5];
+    int len = 0;
+
+    do {
+        buf[len] = val & 0x7f;
+        val >>= 7;
+        if (val != 0)
+            buf[len] |= 0x80;
+        len++;
+    } while (val != 0);
+
+    outWrite(buf, len);
+}
+
+/*
+ * Write a string for the binary layout: the length in bytes as a
+ * uleb128, then the modified UTF-8 data, without the trailing '\0'.
+ */
+static void outBinaryString(const char* str)
+{
+    size_t len = strlen(str);
+
+    outUleb128(len);
+    outWrite(str, len);
+}
+
+/*
+ * The binary layout is a series of records, each one a tag byte, the
+ * length of the rest of the record as a little-endian u4, and the body.
+ * "uleb" is an unsigned LEB128 value and "str" is a string as written
+ * by outBinaryString().
+ *
+ *   'D' (one per DEX file):
+ *     str fileName, str version, uleb classDefsSize
+ *   'C' (one per class):
+ *     uleb classDefIdx, uleb accessFlags, str descriptor,
+ *     str superclass ("" if none),
+ *     uleb count, count * str interface,
+ *     uleb count, count * field (static fields),
+ *     uleb count, count * field (instance fields),
+ *     uleb count, count * method (direct methods),
+ *     uleb count, count * method (virtual methods),
+ *     str sourceFile ("" if none)
+ *
+ *   field:  uleb fieldIdx, str name, str type, uleb accessFlags
+ *   method: uleb methodIdx, str name, str type, uleb accessFlags,
+ *           uleb registers, uleb ins, uleb outs, uleb tries,
+ *           uleb insnsSize (all 0 if the method has no code), then for
+ *           each of strings, types, fields and methods referenced by
+ *           the code: u4 count, count * uleb index
+ */
+
+/*
+ * Binary records have to be built in memory, so their length can be
+ * filled in.  When output is going straight to stdout, which only
+ * happens on the main thread, records are built here and written out
+ * as each one is finished.
+ */
+static OutputBuffer gRecordBuf;
+
+/*
+ * Write a placeholder for a 4-byte little-endian value that will be
+ * filled in with outPatchU4().  Returns the placeholder's offset.
+ */
+static size_t outPlaceholderU4(void)
+{
+    assert(gOutputBuf != NULL);
+    outWrite("\0\0\0\0", 4);
+    return gOutputBuf->len - 4;
+}
+
+/*
+ * Fill in a placeholder from outPlaceholderU4().
+ */
+static void outPatchU4(size_t offset, u4 val)
+{
+    u1* ptr = (u1*) gOutputBuf->data + offset;
+
+    ptr[0] = val;
+    ptr[1] = val >> 8;
+    ptr[2] = val >> 16;
+    ptr[3] = val >> 24;
+}
+
+/*
+ * Start a binary record with the given tag.  Returns a value to pass to
+ * outEndRecord().
+ */
+static size_t outBeginRecord(char tag)
+{
+    if (gOutputBuf == NULL) {
+        gOutputBuf = &gRecordBuf;
+        gOutputBuf->len = 0;
+    }
+
+    outPutc(tag);
+    return outPlaceholderU4();
+}
+
+/*
+ * Finish a binary record by filling in its length.
+ */
+static void outEndRecord(size_t lengthOffset)
+{
+    outPatchU4(lengthOffset, gOutputBuf->len - (lengthOffset + 4));
+
+    if (gOutputBuf == &gRecordBuf) {
+        fwrite(gRecordBuf.data, 1, gRecordBuf.len, stdout);
+        gOutputBuf = NULL;
+    }
+}
+
 /*
  * Get 2 little-endian bytes.
  */
@@ -97,6 +369,28 @@ static inline u4 get4LE(unsigned char const* pSrc)
     return pSrc[0] | (pSrc[1] << 8) | (pSrc[2] << 16) | (pSrc[3] << 24);
 }
 
+/*
+ * Write "val" in lower-case hex, zero-padded to at least "minDigits"
+ * digits, at "cp".  Returns a pointer just past the last digit.
+ */
+static char* formatHex(char* cp, u8 val, int minDigits)
+{
+    static const char kHexDigits[] = "0123456789abcdef";
+    char tmp[16];
+    int len = 0;
+
+    do {
+        tmp[len++] = kHexDigits[val & 0x0f];
+        val >>= 4;
+    } while (val != 0);
+    while (len < minDigits)
+        tmp[len++] = '0';
+
+    while (len > 0)
+        *cp++ = tmp[--len];
+    return cp;
+}
+
 /*
  * Converts a single-character primitive type into its human-readable
  * equivalent.
@@ -119,17 +413,16 @@ static const char* primitiveTypeLabel(char typeChar)
 }
 
 /*
- * Converts a type descriptor to human-readable "dotted" form.  For
+ * Writes a type descriptor in human-readable "dotted" form.  For
  * example, "Ljava/lang/String;" becomes "java.lang.String", and
  * "[I" becomes "int[]".  Also converts '$' to '.', which means this
  * form can't be converted back to a descriptor.
  */
-static char* descriptorToDot(const char* str)
+static void outDescriptorDot(const char* str)
 {
     int targetLen = strlen(str);
     int offset = 0;
     int arrayDepth = 0;
-    char* newStr;
 
     /* strip leading [s; will be added to end */
     while (targetLen > 1 && str[offset] == '[') {
@@ -153,37 +446,33 @@ static char* descriptorToDot(const char* str)
         }
     }
 
-    newStr = (char*)malloc(targetLen + arrayDepth * 2 +1);
-
-    /* copy class name over */
-    int i;
-    for (i = 0; i < targetLen; i++) {
-        char ch = str[offset + i];
-        newStr[i] = (ch == '/' || ch == '$') ? '.' : ch;
+    /* copy class name over, a run at a time */
+    const char* start = str + offset;
+    const char* end = start + targetLen;
+    const char* cp;
+    for (cp = start; cp < end; cp++) {
+        if (*cp == '/' || *cp == '$') {
+            outWrite(start, cp - start);
+            outPutc('.');
+            start = cp + 1;
+        }
     }
+    outWrite(start, end - start);
 
     /* add the appropriate number of brackets for arrays */
-    while (arrayDepth-- > 0) {
-        newStr[i++] = '[';
-        newStr[i++] = ']';
-    }
-    newStr[i] = '\0';
-    assert(i == targetLen + arrayDepth * 2);
-
-    return newStr;
+    while (arrayDepth-- > 0)
+        outWrite("[]", 2);
 }
 
 /*
- * Converts the class name portion of a type descriptor to human-readable
+ * Writes the class name portion of a type descriptor in human-readable
  * "dotted" form.
- *
- * Returns a newly-allocated string.
  */
-static char* descriptorClassToDot(const char* str)
+static void outDescriptorClassDot(const char* str)
 {
     const char* lastSlash;
-    char* newStr;
-    char* cp;
+    const char* end;
+    const char* cp;
 
     /* reduce to just the class name, trimming trailing ';' */
     lastSlash = strrchr(str, '/');
@@ -192,14 +481,15 @@ static char* descriptorClassToDot(const char* str)
     else
         lastSlash++;                /* start past '/' */
 
-    newStr = strdup(lastSlash);
-    newStr[strlen(lastSlash)-1] = '\0';
-    for (cp = newStr; *cp != '\0'; cp++) {
-        if (*cp == '$')
-            *cp = '.';
+    end = lastSlash + strlen(lastSlash) - 1;
+    for (cp = lastSlash; cp < end; cp++) {
+        if (*cp == '$') {
+            outWrite(lastSlash, cp - lastSlash);
+            outPutc('.');
+            lastSlash = cp + 1;
+        }
     }
-
-    return newStr;
+    outWrite(lastSlash, end - lastSlash);
 }
 
 /*
@@ -225,20 +515,6 @@ static const char* quotedVisibility(u4 accessFlags)
         return "\"package\"";
 }
 
-/*
- * Count the number of '1' bits in a word.
- */
-static int countOnes(u4 val)
-{
-    int count = 0;
-
-    val = val - ((val >> 1) & 0x55555555);
-    val = (val & 0x33333333) + ((val >> 2) & 0x33333333);
-    count = (((val + (val >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
-
-    return count;
-}
-
 /*
  * Flag for use with createAccessFlagStr().
  */
@@ -247,15 +523,24 @@ enum AccessFor {
     kAccessForMAX
 };
 
+#define NUM_FLAGS   18
+
 /*
- * Create a new string with human-readable access flags.
+ * Size of a buffer for createAccessFlagStr(): enough for every flag, using
+ * the longest name ("DECLARED_SYNCHRONIZED") as the base metric, plus a
+ * space between each.
+ */
+#define ACCESS_FLAG_STR_LEN  (NUM_FLAGS * (21+1) + 1)
+
+/*
+ * Fill "str", which must hold ACCESS_FLAG_STR_LEN bytes, with
+ * human-readable access flags.  Returns "str".
  *
  * In the base language the access_flags fields are type u2; in Dalvik
  * they're u4.
  */
-static char* createAccessFlagStr(u4 flags, AccessFor forWhat)
+static char* createAccessFlagStr(u4 flags, AccessFor forWhat, char* str)
 {
-#define NUM_FLAGS   18
     static const char* kAccessStrings[kAccessForMAX][NUM_FLAGS] = {
         {
             /* class, inner class */
@@ -321,18 +606,8 @@ static char* createAccessFlagStr(u4 flags, AccessFor forWhat)
             "?",                /* 0x20000 */
         },
     };
-    const int kLongest = 21;        /* strlen of longest string above */
-    int i, count;
-    char* str;
-    char* cp;
-
-    /*
-     * Allocate enough storage to hold the expected number of strings,
-     * plus a space between each.  We over-allocate, using the longest
-     * string above as the base metric.
-     */
-    count = countOnes(flags);
-    cp = str = (char*) malloc(count * (kLongest+1) +1);
+    char* cp = str;
+    int i;
 
     for (i = 0; i < NUM_FLAGS; i++) {
         if (flags & 0x01) {
@@ -399,59 +674,59 @@ void dumpFileHeader(const DexFile* pDexFile)
     assert(sizeof(pHeader->magic) == sizeof(pOptHeader->magic));
 
     if (pOptHeader != NULL) {
-        printf("Optimized DEX file header:\n");
+        outPrintf("Optimized DEX file header:\n");
 
         asciify(sanitized, pOptHeader->magic, sizeof(pOptHeader->magic));
-        printf("magic               : '%s'\n", sanitized);
-        printf("dex_offset          : %d (0x%06x)\n",
+        outPrintf("magic               : '%s'\n", sanitized);
+        outPrintf("dex_offset          : %d (0x%06x)\n",
             pOptHeader->dexOffset, pOptHeader->dexOffset);
-        printf("dex_length          : %d\n", pOptHeader->dexLength);
-        printf("deps_offset         : %d (0x%06x)\n",
+        outPrintf("dex_length          : %d\n", pOptHeader->dexLength);
+        outPrintf("deps_offset         : %d (0x%06x)\n",
             pOptHeader->depsOffset, pOptHeader->depsOffset);
-        printf("deps_length         : %d\n", pOptHeader->depsLength);
-        printf("opt_offset          : %d (0x%06x)\n",
+        outPrintf("deps_length         : %d\n", pOptHeader->depsLength);
+        outPrintf("opt_offset          : %d (0x%06x)\n",
             pOptHeader->optOffset, pOptHeader->optOffset);
-        printf("opt_length          : %d\n", pOptHeader->optLength);
-        printf("flags               : %08x\n", pOptHeader->flags);
-        printf("checksum            : %08x\n", pOptHeader->checksum);
-        printf("\n");
+        outPrintf("opt_length          : %d\n", pOptHeader->optLength);
+        outPrintf("flags               : %08x\n", pOptHeader->flags);
+        outPrintf("checksum            : %08x\n", pOptHeader->checksum);
+        outPrintf("\n");
     }
 
-    printf("DEX file header:\n");
+    outPrintf("DEX file header:\n");
     asciify(sanitized, pHeader->magic, sizeof(pHeader->magic));
-    printf("magic               : '%s'\n", sanitized);
-    printf("checksum            : %08x\n", pHeader->checksum);
-    printf("signature           : %02x%02x...%02x%02x\n",
+    outPrintf("magic               : '%s'\n", sanitized);
+    outPrintf("checksum            : %08x\n", pHeader->checksum);
+    outPrintf("signature           : %02x%02x...%02x%02x\n",
         pHeader->signature[0], pHeader->signature[1],
         pHeader->signature[kSHA1DigestLen-2],
         pHeader->signature[kSHA1DigestLen-1]);
-    printf("file_size           : %d\n", pHeader->fileSize);
-    printf("header_size         : %d\n", pHeader->headerSize);
-    printf("link_size           : %d\n", pHeader->linkSize);
-    printf("link_off            : %d (0x%06x)\n",
+    outPrintf("file_size           : %d\n", pHeader->fileSize);
+    outPrintf("header_size         : %d\n", pHeader->headerSize);
+    outPrintf("link_size           : %d\n", pHeader->linkSize);
+    outPrintf("link_off            : %d (0x%06x)\n",
         pHeader->linkOff, pHeader->linkOff);
-    printf("string_ids_size     : %d\n", pHeader->stringIdsSize);
-    printf("string_ids_off      : %d (0x%06x)\n",
+    outPrintf("string_ids_size     : %d\n", pHeader->stringIdsSize);
+    outPrintf("string_ids_off      : %d (0x%06x)\n",
         pHeader->stringIdsOff, pHeader->stringIdsOff);
-    printf("type_ids_size       : %d\n", pHeader->typeIdsSize);
-    printf("type_ids_off        : %d (0x%06x)\n",
+    outPrintf("type_ids_size       : %d\n", pHeader->typeIdsSize);
+    outPrintf("type_ids_off        : %d (0x%06x)\n",
         pHeader->typeIdsOff, pHeader->typeIdsOff);
-    printf("proto_ids_size       : %d\n", pHeader->protoIdsSize);
-    printf("proto_ids_off        : %d (0x%06x)\n",
+    outPrintf("proto_ids_size       : %d\n", pHeader->protoIdsSize);
+    outPrintf("proto_ids_off        : %d (0x%06x)\n",
         pHeader->protoIdsOff, pHeader->protoIdsOff);
-    printf("field_ids_size      : %d\n", pHeader->fieldIdsSize);
-    printf("field_ids_off       : %d (0x%06x)\n",
+    outPrintf("field_ids_size      : %d\n", pHeader->fieldIdsSize);
+    outPrintf("field_ids_off       : %d (0x%06x)\n",
         pHeader->fieldIdsOff, pHeader->fieldIdsOff);
-    printf("method_ids_size     : %d\n", pHeader->methodIdsSize);
-    printf("method_ids_off      : %d (0x%06x)\n",
+    outPrintf("method_ids_size     : %d\n", pHeader->methodIdsSize);
+    outPrintf("method_ids_off      : %d (0x%06x)\n",
         pHeader->methodIdsOff, pHeader->methodIdsOff);
-    printf("class_defs_size     : %d\n", pHeader->classDefsSize);
-    printf("class_defs_off      : %d (0x%06x)\n",
+    outPrintf("class_defs_size     : %d\n", pHeader->classDefsSize);
+    outPrintf("class_defs_off      : %d (0x%06x)\n",
         pHeader->classDefsOff, pHeader->classDefsOff);
-    printf("data_size           : %d\n", pHeader->dataSize);
-    printf("data_off            : %d (0x%06x)\n",
+    outPrintf("data_size           : %d\n", pHeader->dataSize);
+    outPrintf("data_off            : %d (0x%06x)\n",
         pHeader->dataOff, pHeader->dataOff);
-    printf("\n");
+    outPrintf("\n");
 }
 
 /*
@@ -463,12 +738,12 @@ void dumpOptDirectory(const DexFile* pDexFile)
     if (pOptHeader == NULL)
         return;
 
-    printf("OPT section contents:\n");
+    outPrintf("OPT section contents:\n");
 
     const u4* pOpt = (const u4*) ((u1*) pOptHeader + pOptHeader->optOffset);
 
     if (*pOpt == 0) {
-        printf("(1.0 format, only class lookup table is present)\n\n");
+        outPrintf("(1.0 format, only class lookup table is present)\n\n");
         return;
     }
 
@@ -485,22 +760,101 @@ void dumpOptDirectory(const DexFile* pDexFile)
         case kDexChunkClassLookup:
             verboseStr = "class lookup hash table";
             break;
+        case kDexChunkClassLookup2:
+            verboseStr = "class lookup hash table, v2";
+            break;
         case kDexChunkRegisterMaps:
             verboseStr = "register maps";
             break;
+        case kDexChunkCodeIndex:
+            verboseStr = "code index";
+            break;
         default:
             verboseStr = "(unknown chunk type)";
             break;
         }
 
-        printf("Chunk %08x (%c%c%c%c) - %s (%d bytes)\n", *pOpt,
+        outPrintf("Chunk %08x (%c%c%c%c) - %s (%d bytes)\n", *pOpt,
             *pOpt >> 24, (char)(*pOpt >> 16), (char)(*pOpt >> 8), (char)*pOpt,
             verboseStr, size);
 
         size = (size + 8 + 7) & ~7;
         pOpt += size / sizeof(u4);
     }
-    printf("\n");
+    outPrintf("\n");
+}
+
+/*
+ * Get the name the DEX format spec uses for a map item type.
+ */
+static const char* mapItemTypeName(u2 type)
+{
+    switch (type) {
+    case kDexTypeHeaderItem:               return "header_item";
+    case kDexTypeStringIdItem:             return "string_id_item";
+    case kDexTypeTypeIdItem:               return "type_id_item";
+    case kDexTypeProtoIdItem:              return "proto_id_item";
+    case kDexTypeFieldIdItem:              return "field_id_item";
+    case kDexTypeMethodIdItem:             return "method_id_item";
+    case kDexTypeClassDefItem:             return "class_def_item";
+    case kDexTypeMapList:                  return "map_list";
+    case kDexTypeTypeList:                 return "type_list";
+    case kDexTypeAnnotationSetRefList:     return "annotation_set_ref_list";
+    case kDexTypeAnnotationSetItem:        return "annotation_set_item";
+    case kDexTypeClassDataItem:            return "class_data_item";
+    case kDexTypeCodeItem:                 return "code_item";
+    case kDexTypeStringDataItem:           return "string_data_item";
+    case kDexTypeDebugInfoItem:            return "debug_info_item";
+    case kDexTypeAnnotationItem:           return "annotation_item";
+    case kDexTypeEncodedArrayItem:         return "encoded_array_item";
+    case kDexTypeAnnotationsDirectoryItem: return "annotations_directory_item";
+    default:                               return "(unknown)";
+    }
+}
+
+/*
+ * Verify a copy of the file again, timing each section, and show where
+ * the time goes.  The copy keeps the mapping itself untouched.
+ */
+void dumpVerifyStats(const DexFile* pDexFile)
+{
+    const DexHeader* pHeader = pDexFile->pHeader;
+    DexVerifyStats stats;
+    u4 i;
+
+    if (pDexFile->pOptHeader != NULL) {
+        outPrintf("Verification statistics: not available for optimized DEX\n\n");
+        return;
+    }
+
+    u1* copy = (u1*) malloc(pHeader->fileSize);
+    if (copy == NULL) {
+        fprintf(stderr, "ERROR: unable to allocate %u bytes\n",
+            pHeader->fileSize);
+        return;
+    }
+    memcpy(copy, pDexFile->baseAddr, pHeader->fileSize);
+
+    int result = dexSwapAndVerifyWithStats(copy, pHeader->fileSize,
+        gOptions.numThreads, &stats);
+    free(copy);
+
+    outPrintf("Verification statistics:\n");
+    outPrintf("result              : %s\n", (result == 0) ? "ok" : "FAILED");
+    outPrintf("total_time          : %.3f ms\n", stats.totalNanos / 1e6);
+    outPrintf("header_time         : %.3f ms\n", stats.headerNanos / 1e6);
+    outPrintf("data_map_lookups    : %" PRIu64 "\n", stats.dataMapLookups);
+    outPrintf("  type %-26s %8s %10s %10s %10s\n", "section", "items",
+        "bytes", "swap_ms", "cross_ms");
+    for (i = 0; i < stats.numSections; i++) {
+        const DexVerifySectionStats* pSection = &stats.sections[i];
+
+        outPrintf("  %04x %-26s %8u %10u %10.3f %10.3f\n",
+            pSection->type, mapItemTypeName(pSection->type),
+            pSection->itemCount, pSection->byteCount,
+            pSection->swapNanos / 1e6, pSection->crossNanos / 1e6);
+    }
+    outPrintf("\n");
 }
 
 /*
@@ -514,32 +868,33 @@ void dumpClassDef(DexFile* pDexFile, int idx)
 
     pClassDef = dexGetClassDef(pDexFile, idx);
     pEncodedData = dexGetClassData(pDexFile, pClassDef);
-    pClassData = dexReadAndVerifyClassData(&pEncodedData, NULL);
+    pClassData = dexReadAndVerifyClassData(&pEncodedData,
+        pDexFile->baseAddr + pDexFile->pHeader->fileSize);
 
     if (pClassData == NULL) {
         fprintf(stderr, "Trouble reading class data\n");
         return;
     }
 
-    printf("Class #%d header:\n", idx);
-    printf("class_idx           : %d\n", pClassDef->classIdx);
-    printf("access_flags        : %d (0x%04x)\n",
+    outPrintf("Class #%d header:\n", idx);
+    outPrintf("class_idx           : %d\n", pClassDef->classIdx);
+    outPrintf("access_flags        : %d (0x%04x)\n",
         pClassDef->accessFlags, pClassDef->accessFlags);
-    printf("superclass_idx      : %d\n", pClassDef->superclassIdx);
-    printf("interfaces_off      : %d (0x%06x)\n",
+    outPrintf("superclass_idx      : %d\n", pClassDef->superclassIdx);
+    outPrintf("interfaces_off      : %d (0x%06x)\n",
         pClassDef->interfacesOff, pClassDef->interfacesOff);
-    printf("source_file_idx     : %d\n", pClassDef->sourceFileIdx);
-    printf("annotations_off     : %d (0x%06x)\n",
+    outPrintf("source_file_idx     : %d\n", pClassDef->sourceFileIdx);
+    outPrintf("annotations_off     : %d (0x%06x)\n",
         pClassDef->annotationsOff, pClassDef->annotationsOff);
-    printf("class_data_off      : %d (0x%06x)\n",
+    outPrintf("class_data_off      : %d (0x%06x)\n",
         pClassDef->classDataOff, pClassDef->classDataOff);
-    printf("static_fields_size  : %d\n", pClassData->header.staticFieldsSize);
-    printf("instance_fields_size: %d\n",
+    outPrintf("static_fields_size  : %d\n", pClassData->header.staticFieldsSize);
+    outPrintf("instance_fields_size: %d\n",
             pClassData->header.instanceFieldsSize);
-    printf("direct_methods_size : %d\n", pClassData->header.directMethodsSize);
-    printf("virtual_methods_size: %d\n",
+    outPrintf("direct_methods_size : %d\n", pClassData->header.directMethodsSize);
+    outPrintf("virtual_methods_size: %d\n",
             pClassData->header.virtualMethodsSize);
-    printf("\n");
+    outPrintf("\n");
 
     free(pClassData);
 }
@@ -554,11 +909,17 @@ void dumpInterface(const DexFile* pDexFile, const DexTypeItem* pTypeItem,
         dexStringByTypeIdx(pDexFile, pTypeItem->typeIdx);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : '%s'\n", i, interfaceName);
+        outPrintf("    #%d              : '%s'\n", i, interfaceName);
+    } else if (gOptions.outputFormat == OUTPUT_XML) {
+        outString("<implements name=\"");
+        outDescriptorDot(interfaceName);
+        outString("\">\n</implements>\n");
+    } else if (gOptions.outputFormat == OUTPUT_JSON) {
+        if (i != 0)
+            outPutc(',');
+        outJsonString(interfaceName);
     } else {
-        char* dotted = descriptorToDot(interfaceName);
-        printf("<implements name=\"%s\">\n</implements>\n", dotted);
-        free(dotted);
+        outBinaryString(interfaceName);
     }
 }
 
@@ -570,11 +931,11 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
     u4 triesSize = pCode->triesSize;
 
     if (triesSize == 0) {
-        printf("      catches       : (none)\n");
+        outPrintf("      catches       : (none)\n");
         return;
     }
 
-    printf("      catches       : %d\n", triesSize);
+    outPrintf("      catches       : %d\n", triesSize);
 
     const DexTry* pTries = dexGetTries(pCode);
     u4 i;
@@ -585,7 +946,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
         u4 end = start + pTry->insnCount;
         DexCatchIterator iterator;
 
-        printf("        0x%04x - 0x%04x\n", start, end);
+        outPrintf("        0x%04x - 0x%04x\n", start, end);
 
         dexCatchIteratorInit(&iterator, pCode, pTry->handlerOff);
 
@@ -600,7 +961,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
             descriptor = (handler->typeIdx == kDexNoIndex) ? "<any>" :
                 dexStringByTypeIdx(pDexFile, handler->typeIdx);
 
-            printf("          %s -> 0x%04x\n", descriptor,
+            outPrintf("          %s -> 0x%04x\n", descriptor,
                     handler->address);
         }
     }
@@ -608,7 +969,7 @@ void dumpCatches(DexFile* pDexFile, const DexCode* pCode)
 
 static int dumpPositionsCb(void * /* cnxt */, u4 address, u4 lineNum)
 {
-    printf("        0x%04x line=%d\n", address, lineNum);
+    outPrintf("        0x%04x line=%d\n", address, lineNum);
     return 0;
 }
 
@@ -618,7 +979,7 @@ static int dumpPositionsCb(void * /* cnxt */, u4 address, u4 lineNum)
 void dumpPositions(DexFile* pDexFile, const DexCode* pCode,
         const DexMethod *pDexMethod)
 {
-    printf("      positions     : \n");
+    outPrintf("      positions     : \n");
     const DexMethodId *pMethodId
             = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
     const char *classDescriptor
@@ -632,7 +993,7 @@ static void dumpLocalsCb(void * /* cnxt */, u2 reg, u4 startAddress,
         u4 endAddress, const char *name, const char *descriptor,
         const char *signature)
 {
-    printf("        0x%04x - 0x%04x reg=%d %s %s %s\n",
+    outPrintf("        0x%04x - 0x%04x reg=%d %s %s %s\n",
             startAddress, endAddress, reg, name, descriptor,
             signature);
 }
@@ -643,7 +1004,7 @@ static void dumpLocalsCb(void * /* cnxt */, u2 reg, u4 startAddress,
 void dumpLocals(DexFile* pDexFile, const DexCode* pCode,
         const DexMethod *pDexMethod)
 {
-    printf("      locals        : \n");
+    outPrintf("      locals        : \n");
 
     const DexMethodId *pMethodId
             = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
@@ -655,7 +1016,8 @@ void dumpLocals(DexFile* pDexFile, const DexCode* pCode,
 }
 
 /*
- * Get information about a method.
+ * Get information about a method.  The signature is the DexFile's interned
+ * copy, so it stays valid for as long as the DexFile does.
  */
 bool getMethodInfo(DexFile* pDexFile, u4 methodIdx, FieldMethodInfo* pMethInfo)
 {
@@ -666,7 +1028,10 @@ bool getMethodInfo(DexFile* pDexFile, u4 methodIdx, FieldMethodInfo* pMethInfo)
 
     pMethodId = dexGetMethodId(pDexFile, methodIdx);
     pMethInfo->name = dexStringById(pDexFile, pMethodId->nameIdx);
-    pMethInfo->signature = dexCopyDescriptorFromMethodId(pDexFile, pMethodId);
+    pMethInfo->signature =
+        dexGetInternedDescriptorFromMethodId(pDexFile, pMethodId);
+    if (pMethInfo->signature == NULL)
+        return false;
 
     pMethInfo->classDescriptor =
             dexStringByTypeIdx(pDexFile, pMethodId->classIdx);
@@ -701,22 +1066,11 @@ const char* getClassDescriptor(DexFile* pDexFile, u4 classIdx)
 }
 
 /*
- * Helper for dumpInstruction(), which builds the string
- * representation for the index in the given instruction. This will
- * first try to use the given buffer, but if the result won't fit,
- * then this will allocate a new buffer to hold the result. A pointer
- * to the buffer which holds the full result is always returned, and
- * this can be compared with the one passed in, to see if the result
- * needs to be free()d.
+ * Get the index in the given instruction, and the number of hex digits
+ * to show it with.
  */
-static char* indexString(DexFile* pDexFile, const DecodedInstruction* pDecInsn, size_t bufSize)
+static u4 getInstructionIndex(const DecodedInstruction* pDecInsn, u4* pWidth)
 {
-    char* buf = (char*)malloc(bufSize);
-    if (buf == NULL) {
-      return NULL;
-    }
-
-    int outSize;
     u4 index;
     u4 width;
 
@@ -748,56 +1102,67 @@ static char* indexString(DexFile* pDexFile, const DecodedInstruction* pDecInsn,
         break;
     }
 
+    *pWidth = width;
+    return index;
+}
+
+/*
+ * Helper for dumpInstruction(), which writes the representation of the
+ * index in the given instruction.
+ */
+static void dumpIndex(DexFile* pDexFile, const DecodedInstruction* pDecInsn)
+{
+    u4 width;
+    u4 index = getInstructionIndex(pDecInsn, &width);
+
     switch (pDecInsn->indexType) {
     case kIndexUnknown:
         /*
          * This function shouldn't ever get called for this type, but do
          * something sensible here, just to help with debugging.
          */
-        outSize = snprintf(buf, bufSize, "<unknown-index>");
+        outPrintf("<unknown-index>");
         break;
     case kIndexNone:
         /*
          * This function shouldn't ever get called for this type, but do
          * something sensible here, just to help with debugging.
          */
-        outSize = snprintf(buf, bufSize, "<no-index>");
+        outPrintf("<no-index>");
         break;
     case kIndexVaries:
         /*
          * This one should never show up in a dexdump, so no need to try
          * to get fancy here.
          */
-        outSize = snprintf(buf, bufSize, "<index-varies> // thing@%0*x",
-                width, index);
+        outPrintf("<index-varies> // thing@%0*x", width, index);
         break;
     case kIndexTypeRef:
         if (index < pDexFile->pHeader->typeIdsSize) {
-            outSize = snprintf(buf, bufSize, "%s // type@%0*x",
-                               getClassDescriptor(pDexFile, index), width, index);
+            outPrintf("%s // type@%0*x",
+                getClassDescriptor(pDexFile, index), width, index);
         } else {
-            outSize = snprintf(buf, bufSize, "<type?> // type@%0*x", width, index);
+            outPrintf("<type?> // type@%0*x", width, index);
         }
         break;
     case kIndexStringRef:
         if (index < pDexFile->pHeader->stringIdsSize) {
-            outSize = snprintf(buf, bufSize, "\"%s\" // string@%0*x",
-                               dexStringById(pDexFile, index), width, index);
+            outPrintf("\"%s\" // string@%0*x",
+                dexStringById(pDexFile, index), width, index);
         } else {
-            outSize = snprintf(buf, bufSize, "<string?> // string@%0*x",
-                               width, index);
+            outPrintf("<string?> // string@%0*x", width, index);
         }
         break;
     case kIndexMethodRef:
         {
             FieldMethodInfo methInfo;
+
             if (getMethodInfo(pDexFile, index, &methInfo)) {
-                outSize = snprintf(buf, bufSize, "%s.%s:%s // method@%0*x",
+                outPrintf("%s.%s:%s // method@%0*x",
                         methInfo.classDescriptor, methInfo.name,
                         methInfo.signature, width, index);
-                free((void *) methInfo.signature);
             } else {
-                outSize = snprintf(buf, bufSize, "<method?> // method@%0*x",
+                outPrintf("<method?> // method@%0*x",
                         width, index);
             }
         }
@@ -806,42 +1171,30 @@ static char* indexString(DexFile* pDexFile, const DecodedInstruction* pDecInsn,
         {
             FieldMethodInfo fieldInfo;
             if (getFieldInfo(pDexFile, index, &fieldInfo)) {
-                outSize = snprintf(buf, bufSize, "%s.%s:%s // field@%0*x",
+                outPrintf("%s.%s:%s // field@%0*x",
                         fieldInfo.classDescriptor, fieldInfo.name,
                         fieldInfo.signature, width, index);
             } else {
-                outSize = snprintf(buf, bufSize, "<field?> // field@%0*x",
+                outPrintf("<field?> // field@%0*x",
                         width, index);
             }
         }
         break;
     case kIndexInlineMethod:
-        outSize = snprintf(buf, bufSize, "[%0*x] // inline #%0*x",
+        outPrintf("[%0*x] // inline #%0*x",
                 width, index, width, index);
         break;
     case kIndexVtableOffset:
-        outSize = snprintf(buf, bufSize, "[%0*x] // vtable #%0*x",
+        outPrintf("[%0*x] // vtable #%0*x",
                 width, index, width, index);
         break;
     case kIndexFieldOffset:
-        outSize = snprintf(buf, bufSize, "[obj+%0*x]", width, index);
+        outPrintf("[obj+%0*x]", width, index);
         break;
     default:
-        outSize = snprintf(buf, bufSize, "<?>");
+        outPrintf("<?>");
         break;
     }
-
-    if (outSize >= (int) bufSize) {
-        /*
-         * The buffer wasn't big enough; allocate and retry. Note:
-         * snprintf() doesn't count the '\0' as part of its returned
-         * size, so we add explicit space for it here.
-         */
-        free(buf);
-        return indexString(pDexFile, pDecInsn, outSize + 1);
-    } else {
-        return buf;
-    }
 }
 
 /*
@@ -851,131 +1204,139 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
     int insnWidth, const DecodedInstruction* pDecInsn)
 {
     const u2* insns = pCode->insns;
+    char prefix[16 + 1 + 8*5 + 1];
+    char* cp;
     int i;
 
+    /*
+     * The address and hex columns are built by hand; this is by far the
+     * most common output, and printf() is slow for this.
+     */
+
     // Address of instruction (expressed as byte offset).
-    printf("%06zx:", ((u1*)insns - pDexFile->baseAddr) + insnIdx*2);
+    cp = formatHex(prefix, ((u1*)insns - pDexFile->baseAddr) + insnIdx*2, 6);
+    *cp++ = ':';
 
     for (i = 0; i < 8; i++) {
         if (i < insnWidth) {
             if (i == 7) {
-                printf(" ... ");
+                memcpy(cp, " ... ", 5);
+                cp += 5;
             } else {
                 /* print 16-bit value in little-endian order */
                 const u1* bytePtr = (const u1*) &insns[insnIdx+i];
-                printf(" %02x%02x", bytePtr[0], bytePtr[1]);
+                *cp++ = ' ';
+                cp = formatHex(cp, bytePtr[0], 2);
+                cp = formatHex(cp, bytePtr[1], 2);
             }
         } else {
-            fputs("     ", stdout);
+            memcpy(cp, "     ", 5);
+            cp += 5;
         }
     }
+    outWrite(prefix, cp - prefix);
 
     if (pDecInsn->opcode == OP_NOP) {
         u2 instr = get2LE((const u1*) &insns[insnIdx]);
         if (instr == kPackedSwitchSignature) {
-            printf("|%04x: packed-switch-data (%d units)",
+            outPrintf("|%04x: packed-switch-data (%d units)",
                 insnIdx, insnWidth);
         } else if (instr == kSparseSwitchSignature) {
-            printf("|%04x: sparse-switch-data (%d units)",
+            outPrintf("|%04x: sparse-switch-data (%d units)",
                 insnIdx, insnWidth);
         } else if (instr == kArrayDataSignature) {
-            printf("|%04x: array-data (%d units)",
+            outPrintf("|%04x: array-data (%d units)",
                 insnIdx, insnWidth);
         } else {
-            printf("|%04x: nop // spacer", insnIdx);
+            outPrintf("|%04x: nop // spacer", insnIdx);
         }
     } else {
-        printf("|%04x: %s", insnIdx, dexGetOpcodeName(pDecInsn->opcode));
-    }
-
-    // Provide an initial buffer that usually suffices, although indexString()
-    // may reallocate the buffer if more space is needed.
-    char* indexBuf = NULL;
-    if (pDecInsn->indexType != kIndexNone) {
-        indexBuf = indexString(pDexFile, pDecInsn, 200);
+        outPrintf("|%04x: %s", insnIdx, dexGetOpcodeName(pDecInsn->opcode));
     }
 
     switch (dexGetFormatFromOpcode(pDecInsn->opcode)) {
     case kFmt10x:        // op
         break;
     case kFmt12x:        // op vA, vB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt11n:        // op vA, #+B
-        printf(" v%d, #int %d // #%x",
+        outPrintf(" v%d, #int %d // #%x",
             pDecInsn->vA, (s4)pDecInsn->vB, (u1)pDecInsn->vB);
         break;
     case kFmt11x:        // op vAA
-        printf(" v%d", pDecInsn->vA);
+        outPrintf(" v%d", pDecInsn->vA);
         break;
     case kFmt10t:        // op +AA
     case kFmt20t:        // op +AAAA
         {
             s4 targ = (s4) pDecInsn->vA;
-            printf(" %04x // %c%04x",
+            outPrintf(" %04x // %c%04x",
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt22x:        // op vAA, vBBBB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt21t:        // op vAA, +BBBB
         {
             s4 targ = (s4) pDecInsn->vB;
-            printf(" v%d, %04x // %c%04x", pDecInsn->vA,
+            outPrintf(" v%d, %04x // %c%04x", pDecInsn->vA,
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt21s:        // op vAA, #+BBBB
-        printf(" v%d, #int %d // #%x",
+        outPrintf(" v%d, #int %d // #%x",
             pDecInsn->vA, (s4)pDecInsn->vB, (u2)pDecInsn->vB);
         break;
     case kFmt21h:        // op vAA, #+BBBB0000[00000000]
         // The printed format varies a bit based on the actual opcode.
         if (pDecInsn->opcode == OP_CONST_HIGH16) {
             s4 value = pDecInsn->vB << 16;
-            printf(" v%d, #int %d // #%x",
+            outPrintf(" v%d, #int %d // #%x",
                 pDecInsn->vA, value, (u2)pDecInsn->vB);
         } else {
             s8 value = ((s8) pDecInsn->vB) << 48;
-            printf(" v%d, #long %" PRId64 " // #%x",
+            outPrintf(" v%d, #long %" PRId64 " // #%x",
                 pDecInsn->vA, value, (u2)pDecInsn->vB);
         }
         break;
     case kFmt21c:        // op vAA, thing@BBBB
     case kFmt31c:        // op vAA, thing@BBBBBBBB
-        printf(" v%d, %s", pDecInsn->vA, indexBuf);
+        outPrintf(" v%d, ", pDecInsn->vA);
+        dumpIndex(pDexFile, pDecInsn);
         break;
     case kFmt23x:        // op vAA, vBB, vCC
-        printf(" v%d, v%d, v%d", pDecInsn->vA, pDecInsn->vB, pDecInsn->vC);
+        outPrintf(" v%d, v%d, v%d", pDecInsn->vA, pDecInsn->vB, pDecInsn->vC);
         break;
     case kFmt22b:        // op vAA, vBB, #+CC
-        printf(" v%d, v%d, #int %d // #%02x",
+        outPrintf(" v%d, v%d, #int %d // #%02x",
             pDecInsn->vA, pDecInsn->vB, (s4)pDecInsn->vC, (u1)pDecInsn->vC);
         break;
     case kFmt22t:        // op vA, vB, +CCCC
         {
             s4 targ = (s4) pDecInsn->vC;
-            printf(" v%d, v%d, %04x // %c%04x", pDecInsn->vA, pDecInsn->vB,
+            outPrintf(" v%d, v%d, %04x // %c%04x", pDecInsn->vA, pDecInsn->vB,
                 insnIdx + targ,
                 (targ < 0) ? '-' : '+',
                 (targ < 0) ? -targ : targ);
         }
         break;
     case kFmt22s:        // op vA, vB, #+CCCC
-        printf(" v%d, v%d, #int %d // #%04x",
+        outPrintf(" v%d, v%d, #int %d // #%04x",
             pDecInsn->vA, pDecInsn->vB, (s4)pDecInsn->vC, (u2)pDecInsn->vC);
         break;
     case kFmt22c:        // op vA, vB, thing@CCCC
     case kFmt22cs:       // [opt] op vA, vB, field offset CCCC
-        printf(" v%d, v%d, %s", pDecInsn->vA, pDecInsn->vB, indexBuf);
+        outPrintf(" v%d, v%d, ", pDecInsn->vA, pDecInsn->vB);
+        dumpIndex(pDexFile, pDecInsn);
         break;
     case kFmt30t:
-        printf(" #%08x", pDecInsn->vA);
+        outPrintf(" #%08x", pDecInsn->vA);
         break;
     case kFmt31i:        // op vAA, #+BBBBBBBB
         {
@@ -985,29 +1346,30 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
                 u4 i;
             } conv;
             conv.i = pDecInsn->vB;
-            printf(" v%d, #float %f // #%08x",
+            outPrintf(" v%d, #float %f // #%08x",
                 pDecInsn->vA, conv.f, pDecInsn->vB);
         }
         break;
     case kFmt31t:       // op vAA, offset +BBBBBBBB
-        printf(" v%d, %08x // +%08x",
+        outPrintf(" v%d, %08x // +%08x",
             pDecInsn->vA, insnIdx + pDecInsn->vB, pDecInsn->vB);
         break;
     case kFmt32x:        // op vAAAA, vBBBB
-        printf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
+        outPrintf(" v%d, v%d", pDecInsn->vA, pDecInsn->vB);
         break;
     case kFmt35c:        // op {vC, vD, vE, vF, vG}, thing@BBBB
     case kFmt35ms:       // [opt] invoke-virtual+super
     case kFmt35mi:       // [opt] inline invoke
         {
-            fputs(" {", stdout);
+            outString(" {");
             for (i = 0; i < (int) pDecInsn->vA; i++) {
                 if (i == 0)
-                    printf("v%d", pDecInsn->arg[i]);
+                    outPrintf("v%d", pDecInsn->arg[i]);
                 else
-                    printf(", v%d", pDecInsn->arg[i]);
+                    outPrintf(", v%d", pDecInsn->arg[i]);
             }
-            printf("}, %s", indexBuf);
+            outString("}, ");
+            dumpIndex(pDexFile, pDecInsn);
         }
         break;
     case kFmt3rc:        // op {vCCCC .. v(CCCC+AA-1)}, thing@BBBB
@@ -1018,14 +1380,15 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
              * This doesn't match the "dx" output when some of the args are
              * 64-bit values -- dx only shows the first register.
              */
-            fputs(" {", stdout);
+            outString(" {");
             for (i = 0; i < (int) pDecInsn->vA; i++) {
                 if (i == 0)
-                    printf("v%d", pDecInsn->vC + i);
+                    outPrintf("v%d", pDecInsn->vC + i);
                 else
-                    printf(", v%d", pDecInsn->vC + i);
+                    outPrintf(", v%d", pDecInsn->vC + i);
             }
-            printf("}, %s", indexBuf);
+            outString("}, ");
+            dumpIndex(pDexFile, pDecInsn);
         }
         break;
     case kFmt51l:        // op vAA, #+BBBBBBBBBBBBBBBB
@@ -1036,20 +1399,80 @@ void dumpInstruction(DexFile* pDexFile, const DexCode* pCode, int insnIdx,
                 u8 j;
             } conv;
             conv.j = pDecInsn->vB_wide;
-            printf(" v%d, #double %f // #%016" PRIx64,
+            outPrintf(" v%d, #double %f // #%016" PRIx64,
                 pDecInsn->vA, conv.d, pDecInsn->vB_wide);
         }
         break;
     case kFmt00x:        // unknown op or breakpoint
         break;
     default:
-        printf(" ???");
+        outPrintf(" ???");
         break;
     }
 
-    putchar('\n');
+    outPutc('\n');
+}
+
+/*
+ * Get the width, in code units, of the instruction at "insns".  Returns 0
+ * if it isn't a valid instruction.
+ *
+ * Note: This code parallels the function dexGetWidthFromInstruction() in
+ * InstrUtils.c, but this version can deal with data in either endianness.
+ *
+ * TODO: Figure out if this really matters, and possibly change this to
+ * just use dexGetWidthFromInstruction().
+ */
+static int getInstructionWidth(const u2* insns)
+{
+    u2 instr = get2LE((const u1*)insns);
+
+    if (instr == kPackedSwitchSignature) {
+        return 4 + get2LE((const u1*)(insns+1)) * 2;
+    } else if (instr == kSparseSwitchSignature) {
+        return 2 + get2LE((const u1*)(insns+1)) * 4;
+    } else if (instr == kArrayDataSignature) {
+        int width = get2LE((const u1*)(insns+1));
+        int size = get2LE((const u1*)(insns+2)) |
+                   (get2LE((const u1*)(insns+3))<<16);
+        // The plus 1 is to round up for odd size and width.
+        return 4 + ((size * width) + 1) / 2;
+    } else {
+        Opcode opcode = dexOpcodeFromCodeUnit(instr);
+        return dexGetWidthFromOpcode(opcode);
+    }
+}
+
+/*
+ * Write the indices of "indexType" referenced by the instructions in
+ * "pInsns", for the JSON or binary layout.  Returns the number written.
+ */
+static u4 dumpReferences(const DecodedInsns* pInsns,
+    InstructionIndexType indexType)
+{
+    u4 count = 0;
+    u4 i;
+
+    for (i = 0; i < pInsns->count; i++) {
+        Opcode opcode = (Opcode) pInsns->opcodes[i];
+
+        /* (the switch and array data tables are nops, so never match) */
+        if (dexGetIndexTypeFromOpcode(opcode) == indexType) {
+            DecodedInstruction decInsn;
+            u4 width;
+
+            dexGetDecodedInsn(pInsns, i, &decInsn);
+            u4 index = getInstructionIndex(&decInsn, &width);
+            if (gOptions.outputFormat == OUTPUT_JSON) {
+                outPrintf((count == 0) ? "%u" : ",%u", index);
+            } else {
+                outUleb128(index);
+            }
+            count++;
+        }
+    }
 
-    free(indexBuf);
+    return count;
 }
 
 /*
@@ -1060,9 +1483,10 @@ void dumpBytecodes(DexFile* pDexFile, const DexMethod* pDexMethod)
     const DexCode* pCode = dexGetCode(pDexFile, pDexMethod);
     const u2* insns;
     int insnIdx;
+    DecodedInsns decoded;
+    u4 i;
     FieldMethodInfo methInfo;
     int startAddr;
-    char* className = NULL;
 
     assert(pCode->insnsSize > 0);
     insns = pCode->insns;
@@ -1073,46 +1497,39 @@ void dumpBytecodes(DexFile* pDexFile, const DexMethod* pDexMethod)
 
     getMethodInfo(pDexFile, pDexMethod->methodIdx, &methInfo);
     startAddr = ((u1*)pCode - pDexFile->baseAddr);
-    className = descriptorToDot(methInfo.classDescriptor);
 
-    printf("%06x:                                        |[%06x] %s.%s:%s\n",
-        startAddr, startAddr,
-        className, methInfo.name, methInfo.signature);
-    free((void *) methInfo.signature);
+    outPrintf("%06x:                                        |[%06x] ",
+        startAddr, startAddr);
+    outDescriptorDot(methInfo.classDescriptor);
+    outPrintf(".%s:%s\n", methInfo.name, methInfo.signature);
+
+    /*
+     * Decode the whole method up front.  If the decoder stops early, the
+     * rest is shown one instruction at a time, as best we can.
+     */
+    dexDecodedInsnsInit(&decoded);
+    dexDecodeInsns(insns, pCode->insnsSize, &decoded);
+    for (i = 0; i < decoded.count; i++) {
+        DecodedInstruction decInsn;
+
+        dexGetDecodedInsn(&decoded, i, &decInsn);
+        dumpInstruction(pDexFile, pCode, decoded.offsets[i],
+            decoded.offsets[i + 1] - decoded.offsets[i], &decInsn);
+    }
+
+    insnIdx = decoded.offsets[decoded.count];
+    insns += insnIdx;
+    dexDecodedInsnsRelease(&decoded);
 
-    insnIdx = 0;
     while (insnIdx < (int) pCode->insnsSize) {
         int insnWidth;
         DecodedInstruction decInsn;
-        u2 instr;
 
-        /*
-         * Note: This code parallels the function
-         * dexGetWidthFromInstruction() in InstrUtils.c, but this version
-         * can deal with data in either endianness.
-         *
-         * TODO: Figure out if this really matters, and possibly change
-         * this to just use dexGetWidthFromInstruction().
-         */
-        instr = get2LE((const u1*)insns);
-        if (instr == kPackedSwitchSignature) {
-            insnWidth = 4 + get2LE((const u1*)(insns+1)) * 2;
-        } else if (instr == kSparseSwitchSignature) {
-            insnWidth = 2 + get2LE((const u1*)(insns+1)) * 4;
-        } else if (instr == kArrayDataSignature) {
-            int width = get2LE((const u1*)(insns+1));
-            int size = get2LE((const u1*)(insns+2)) |
-                       (get2LE((const u1*)(insns+3))<<16);
-            // The plus 1 is to round up for odd size and width.
-            insnWidth = 4 + ((size * width) + 1) / 2;
-        } else {
-            Opcode opcode = dexOpcodeFromCodeUnit(instr);
-            insnWidth = dexGetWidthFromOpcode(opcode);
-            if (insnWidth == 0) {
-                fprintf(stderr,
-                    "GLITCH: zero-width instruction at idx=0x%04x\n", insnIdx);
-                break;
-            }
+        insnWidth = getInstructionWidth(insns);
+        if (insnWidth == 0) {
+            fprintf(stderr,
+                "GLITCH: zero-width instruction at idx=0x%04x\n", insnIdx);
+            break;
         }
 
         dexDecodeInstruction(insns, &decInsn);
@@ -1121,8 +1538,6 @@ void dumpBytecodes(DexFile* pDexFile, const DexMethod* pDexMethod)
         insns += insnWidth;
         insnIdx += insnWidth;
     }
-
-    free(className);
 }
 
 /*
@@ -1132,10 +1547,10 @@ void dumpCode(DexFile* pDexFile, const DexMethod* pDexMethod)
 {
     const DexCode* pCode = dexGetCode(pDexFile, pDexMethod);
 
-    printf("      registers     : %d\n", pCode->registersSize);
-    printf("      ins           : %d\n", pCode->insSize);
-    printf("      outs          : %d\n", pCode->outsSize);
-    printf("      insns size    : %d 16-bit code units\n", pCode->insnsSize);
+    outPrintf("      registers     : %d\n", pCode->registersSize);
+    outPrintf("      ins           : %d\n", pCode->insSize);
+    outPrintf("      outs          : %d\n", pCode->outsSize);
+    outPrintf("      insns size    : %d 16-bit code units\n", pCode->insnsSize);
 
     if (gOptions.disassemble)
         dumpBytecodes(pDexFile, pDexMethod);
@@ -1146,6 +1561,67 @@ void dumpCode(DexFile* pDexFile, const DexMethod* pDexMethod)
     dumpLocals(pDexFile, pCode, pDexMethod);
 }
 
+/*
+ * Write the code size and the string, type, field, and method ids
+ * referenced by a method, for the JSON or binary layout.
+ */
+static void dumpMethodCodeSummary(DexFile* pDexFile, const DexMethod* pDexMethod)
+{
+    static const InstructionIndexType kIndexTypes[] = {
+        kIndexStringRef, kIndexTypeRef, kIndexFieldRef, kIndexMethodRef
+    };
+    static const char* kJsonNames[] = {
+        "strings", "types", "fields", "methods"
+    };
+    const size_t kNumIndexTypes = sizeof(kIndexTypes) / sizeof(kIndexTypes[0]);
+    const DexCode* pCode = NULL;
+    DecodedInsns insns;
+    size_t i;
+
+    if (pDexMethod->codeOff != 0)
+        pCode = dexGetCode(pDexFile, pDexMethod);
+
+    /* anything past an undecodable instruction is left out */
+    dexDecodedInsnsInit(&insns);
+    if (pCode != NULL)
+        dexDecodeInsns(pCode->insns, pCode->insnsSize, &insns);
+
+    if (gOptions.outputFormat == OUTPUT_JSON) {
+        if (pCode == NULL)
+            goto bail;
+
+        outPrintf(",\"registers\":%u,\"ins\":%u,\"outs\":%u"
+            ",\"tries\":%u,\"insnsSize\":%u",
+            pCode->registersSize, pCode->insSize, pCode->outsSize,
+            pCode->triesSize, pCode->insnsSize);
+        for (i = 0; i < kNumIndexTypes; i++) {
+            outPrintf(",\"%s\":[", kJsonNames[i]);
+            dumpReferences(&insns, kIndexTypes[i]);
+            outPutc(']');
+        }
+    } else {
+        if (pCode == NULL) {
+            /* no code: zero sizes, and four empty lists */
+            static const char kNoCode[5 + 4*4] = { 0 };
+            outWrite(kNoCode, sizeof(kNoCode));
+            goto bail;
+        }
+
+        outUleb128(pCode->registersSize);
+        outUleb128(pCode->insSize);
+        outUleb128(pCode->outsSize);
+        outUleb128(pCode->triesSize);
+        outUleb128(pCode->insnsSize);
+        for (i = 0; i < kNumIndexTypes; i++) {
+            size_t countOffset = outPlaceholderU4();
+            outPatchU4(countOffset, dumpReferences(&insns, kIndexTypes[i]));
+        }
+    }
+
+bail:
+    dexDecodedInsnsRelease(&insns);
+}
+
 /*
  * Dump a method.
  */
@@ -1154,8 +1630,9 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
     const DexMethodId* pMethodId;
     const char* backDescriptor;
     const char* name;
-    char* typeDescriptor = NULL;
-    char* accessStr = NULL;
+    const char* typeDescriptor;
+    char accessStr[ACCESS_FLAG_STR_LEN];
+    DexStringCache typeCache;
 
     if (gOptions.exportsOnly &&
         (pDexMethod->accessFlags & (ACC_PUBLIC | ACC_PROTECTED)) == 0)
@@ -1163,46 +1640,46 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
         return;
     }
 
+    dexStringCacheInit(&typeCache);
+
     pMethodId = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
     name = dexStringById(pDexFile, pMethodId->nameIdx);
-    typeDescriptor = dexCopyDescriptorFromMethodId(pDexFile, pMethodId);
+    typeDescriptor = dexGetDescriptorFromMethodId(pDexFile, pMethodId,
+        &typeCache);
 
     backDescriptor = dexStringByTypeIdx(pDexFile, pMethodId->classIdx);
 
-    accessStr = createAccessFlagStr(pDexMethod->accessFlags,
-                    kAccessForMethod);
+    createAccessFlagStr(pDexMethod->accessFlags, kAccessForMethod, accessStr);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : (in %s)\n", i, backDescriptor);
-        printf("      name          : '%s'\n", name);
-        printf("      type          : '%s'\n", typeDescriptor);
-        printf("      access        : 0x%04x (%s)\n",
+        outPrintf("    #%d              : (in %s)\n", i, backDescriptor);
+        outPrintf("      name          : '%s'\n", name);
+        outPrintf("      type          : '%s'\n", typeDescriptor);
+        outPrintf("      access        : 0x%04x (%s)\n",
             pDexMethod->accessFlags, accessStr);
 
         if (pDexMethod->codeOff == 0) {
-            printf("      code          : (none)\n");
+            outPrintf("      code          : (none)\n");
         } else {
-            printf("      code          -\n");
+            outPrintf("      code          -\n");
             dumpCode(pDexFile, pDexMethod);
         }
 
         if (gOptions.disassemble)
-            putchar('\n');
+            outPutc('\n');
     } else if (gOptions.outputFormat == OUTPUT_XML) {
         bool constructor = (name[0] == '<');
 
         if (constructor) {
-            char* tmp;
-
-            tmp = descriptorClassToDot(backDescriptor);
-            printf("<constructor name=\"%s\"\n", tmp);
-            free(tmp);
+            outString("<constructor name=\"");
+            outDescriptorClassDot(backDescriptor);
+            outString("\"\n");
 
-            tmp = descriptorToDot(backDescriptor);
-            printf(" type=\"%s\"\n", tmp);
-            free(tmp);
+            outString(" type=\"");
+            outDescriptorDot(backDescriptor);
+            outString("\"\n");
         } else {
-            printf("<method name=\"%s\"\n", name);
+            outPrintf("<method name=\"%s\"\n", name);
 
             const char* returnType = strrchr(typeDescriptor, ')');
             if (returnType == NULL) {
@@ -1211,30 +1688,30 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
                 goto bail;
             }
 
-            char* tmp = descriptorToDot(returnType+1);
-            printf(" return=\"%s\"\n", tmp);
-            free(tmp);
+            outString(" return=\"");
+            outDescriptorDot(returnType+1);
+            outString("\"\n");
 
-            printf(" abstract=%s\n",
+            outPrintf(" abstract=%s\n",
                 quotedBool((pDexMethod->accessFlags & ACC_ABSTRACT) != 0));
-            printf(" native=%s\n",
+            outPrintf(" native=%s\n",
                 quotedBool((pDexMethod->accessFlags & ACC_NATIVE) != 0));
 
             bool isSync =
                 (pDexMethod->accessFlags & ACC_SYNCHRONIZED) != 0 ||
                 (pDexMethod->accessFlags & ACC_DECLARED_SYNCHRONIZED) != 0;
-            printf(" synchronized=%s\n", quotedBool(isSync));
+            outPrintf(" synchronized=%s\n", quotedBool(isSync));
         }
 
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pDexMethod->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pDexMethod->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pDexMethod->accessFlags));
 
-        printf(">\n");
+        outPrintf(">\n");
 
         /*
          * Parameters.
@@ -1272,21 +1749,34 @@ void dumpMethod(DexFile* pDexFile, const DexMethod* pDexMethod, int i)
             /* null terminate and display */
             *cp++ = '\0';
 
-            char* tmp = descriptorToDot(tmpBuf);
-            printf("<parameter name=\"arg%d\" type=\"%s\">\n</parameter>\n",
-                argNum++, tmp);
-            free(tmp);
+            outPrintf("<parameter name=\"arg%d\" type=\"", argNum++);
+            outDescriptorDot(tmpBuf);
+            outString("\">\n</parameter>\n");
         }
 
         if (constructor)
-            printf("</constructor>\n");
+            outPrintf("</constructor>\n");
         else
-            printf("</method>\n");
+            outPrintf("</method>\n");
+    } else if (gOptions.outputFormat == OUTPUT_JSON) {
+        outPrintf("%s{\"methodIdx\":%u,\"name\":", (i == 0) ? "" : ",",
+            pDexMethod->methodIdx);
+        outJsonString(name);
+        outString(",\"type\":");
+        outJsonString(typeDescriptor);
+        outPrintf(",\"access\":%u", pDexMethod->accessFlags);
+        dumpMethodCodeSummary(pDexFile, pDexMethod);
+        outPutc('}');
+    } else {
+        outUleb128(pDexMethod->methodIdx);
+        outBinaryString(name);
+        outBinaryString(typeDescriptor);
+        outUleb128(pDexMethod->accessFlags);
+        dumpMethodCodeSummary(pDexFile, pDexMethod);
     }
 
 bail:
-    free(typeDescriptor);
-    free(accessStr);
+    dexStringCacheRelease(&typeCache);
 }
 
 /*
@@ -1298,7 +1788,7 @@ void dumpSField(const DexFile* pDexFile, const DexField* pSField, int i)
     const char* backDescriptor;
     const char* name;
     const char* typeDescriptor;
-    char* accessStr;
+    char accessStr[ACCESS_FLAG_STR_LEN];
 
     if (gOptions.exportsOnly &&
         (pSField->accessFlags & (ACC_PUBLIC | ACC_PROTECTED)) == 0)
@@ -1311,39 +1801,47 @@ void dumpSField(const DexFile* pDexFile, const DexField* pSField, int i)
     typeDescriptor = dexStringByTypeIdx(pDexFile, pFieldId->typeIdx);
     backDescriptor = dexStringByTypeIdx(pDexFile, pFieldId->classIdx);
 
-    accessStr = createAccessFlagStr(pSField->accessFlags, kAccessForField);
+    createAccessFlagStr(pSField->accessFlags, kAccessForField, accessStr);
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("    #%d              : (in %s)\n", i, backDescriptor);
-        printf("      name          : '%s'\n", name);
-        printf("      type          : '%s'\n", typeDescriptor);
-        printf("      access        : 0x%04x (%s)\n",
+        outPrintf("    #%d              : (in %s)\n", i, backDescriptor);
+        outPrintf("      name          : '%s'\n", name);
+        outPrintf("      type          : '%s'\n", typeDescriptor);
+        outPrintf("      access        : 0x%04x (%s)\n",
             pSField->accessFlags, accessStr);
     } else if (gOptions.outputFormat == OUTPUT_XML) {
-        char* tmp;
-
-        printf("<field name=\"%s\"\n", name);
+        outPrintf("<field name=\"%s\"\n", name);
 
-        tmp = descriptorToDot(typeDescriptor);
-        printf(" type=\"%s\"\n", tmp);
-        free(tmp);
+        outString(" type=\"");
+        outDescriptorDot(typeDescriptor);
+        outString("\"\n");
 
-        printf(" transient=%s\n",
+        outPrintf(" transient=%s\n",
             quotedBool((pSField->accessFlags & ACC_TRANSIENT) != 0));
-        printf(" volatile=%s\n",
+        outPrintf(" volatile=%s\n",
             quotedBool((pSField->accessFlags & ACC_VOLATILE) != 0));
         // "value=" not knowable w/o parsing annotations
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pSField->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pSField->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pSField->accessFlags));
-        printf(">\n</field>\n");
+        outPrintf(">\n</field>\n");
+    } else if (gOptions.outputFormat == OUTPUT_JSON) {
+        outPrintf("%s{\"fieldIdx\":%u,\"name\":", (i == 0) ? "" : ",",
+            pSField->fieldIdx);
+        outJsonString(name);
+        outString(",\"type\":");
+        outJsonString(typeDescriptor);
+        outPrintf(",\"access\":%u}", pSField->accessFlags);
+    } else {
+        outUleb128(pSField->fieldIdx);
+        outBinaryString(name);
+        outBinaryString(typeDescriptor);
+        outUleb128(pSField->accessFlags);
     }
-
-    free(accessStr);
 }
 
 /*
@@ -1354,6 +1852,29 @@ void dumpIField(const DexFile* pDexFile, const DexField* pIField, int i)
     dumpSField(pDexFile, pIField, i);
 }
 
+/*
+ * Start one of the lists of fields or methods in a class.  For the JSON
+ * layout this also closes the list before it, which starts with the
+ * interfaces.
+ */
+static void dumpMemberListStart(const char* plainHeader, const char* jsonKey,
+    u4 count)
+{
+    switch (gOptions.outputFormat) {
+    case OUTPUT_PLAIN:
+        outString(plainHeader);
+        break;
+    case OUTPUT_JSON:
+        outPrintf("],\"%s\":[", jsonKey);
+        break;
+    case OUTPUT_BINARY:
+        outUleb128(count);
+        break;
+    default:
+        break;
+    }
+}
+
 /*
  * Dump the class.
  *
@@ -1371,7 +1892,8 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     const char* fileName;
     const char* classDescriptor;
     const char* superclassDescriptor;
-    char* accessStr = NULL;
+    char accessStr[ACCESS_FLAG_STR_LEN];
+    size_t recordOffset = 0;
     int i;
 
     pClassDef = dexGetClassDef(pDexFile, idx);
@@ -1383,10 +1905,16 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     }
 
     pEncodedData = dexGetClassData(pDexFile, pClassDef);
-    pClassData = dexReadAndVerifyClassData(&pEncodedData, NULL);
+    pClassData = dexReadAndVerifyClassData(&pEncodedData,
+        pDexFile->baseAddr + pDexFile->pHeader->fileSize);
 
     if (pClassData == NULL) {
-        printf("Trouble reading class data (#%d)\n", idx);
+        if (gOptions.outputFormat == OUTPUT_PLAIN
+                || gOptions.outputFormat == OUTPUT_XML) {
+            outPrintf("Trouble reading class data (#%d)\n", idx);
+        } else {
+            fprintf(stderr, "Trouble reading class data (#%d)\n", idx);
+        }
         goto bail;
     }
 
@@ -1428,8 +1956,8 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
         if (*pLastPackage == NULL || strcmp(mangle, *pLastPackage) != 0) {
             /* start of a new package */
             if (*pLastPackage != NULL)
-                printf("</package>\n");
-            printf("<package name=\"%s\"\n>\n", mangle);
+                outPrintf("</package>\n");
+            outPrintf("<package name=\"%s\"\n>\n", mangle);
             free(*pLastPackage);
             *pLastPackage = mangle;
         } else {
@@ -1437,7 +1965,7 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
         }
     }
 
-    accessStr = createAccessFlagStr(pClassDef->accessFlags, kAccessForClass);
+    createAccessFlagStr(pClassDef->accessFlags, kAccessForClass, accessStr);
 
     if (pClassDef->superclassIdx == kDexNoIndex) {
         superclassDescriptor = NULL;
@@ -1447,37 +1975,53 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
     }
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("Class #%d            -\n", idx);
-        printf("  Class descriptor  : '%s'\n", classDescriptor);
-        printf("  Access flags      : 0x%04x (%s)\n",
+        outPrintf("Class #%d            -\n", idx);
+        outPrintf("  Class descriptor  : '%s'\n", classDescriptor);
+        outPrintf("  Access flags      : 0x%04x (%s)\n",
             pClassDef->accessFlags, accessStr);
 
         if (superclassDescriptor != NULL)
-            printf("  Superclass        : '%s'\n", superclassDescriptor);
-
-        printf("  Interfaces        -\n");
+            outPrintf("  Superclass        : '%s'\n", superclassDescriptor);
+
+        outPrintf("  Interfaces        -\n");
+    } else if (gOptions.outputFormat == OUTPUT_JSON) {
+        outPrintf("{\"record\":\"class\",\"classDefIdx\":%d,\"descriptor\":",
+            idx);
+        outJsonString(classDescriptor);
+        outPrintf(",\"access\":%u,\"superclass\":", pClassDef->accessFlags);
+        if (superclassDescriptor != NULL)
+            outJsonString(superclassDescriptor);
+        else
+            outString("null");
+        outString(",\"interfaces\":[");
+    } else if (gOptions.outputFormat == OUTPUT_BINARY) {
+        recordOffset = outBeginRecord('C');
+        outUleb128(idx);
+        outUleb128(pClassDef->accessFlags);
+        outBinaryString(classDescriptor);
+        outBinaryString(superclassDescriptor != NULL ? superclassDescriptor : "");
+        pInterfaces = dexGetInterfacesList(pDexFile, pClassDef);
+        outUleb128(pInterfaces != NULL ? pInterfaces->size : 0);
     } else {
-        char* tmp;
-
-        tmp = descriptorClassToDot(classDescriptor);
-        printf("<class name=\"%s\"\n", tmp);
-        free(tmp);
+        outString("<class name=\"");
+        outDescriptorClassDot(classDescriptor);
+        outString("\"\n");
 
         if (superclassDescriptor != NULL) {
-            tmp = descriptorToDot(superclassDescriptor);
-            printf(" extends=\"%s\"\n", tmp);
-            free(tmp);
+            outString(" extends=\"");
+            outDescriptorDot(superclassDescriptor);
+            outString("\"\n");
         }
-        printf(" abstract=%s\n",
+        outPrintf(" abstract=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_ABSTRACT) != 0));
-        printf(" static=%s\n",
+        outPrintf(" static=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_STATIC) != 0));
-        printf(" final=%s\n",
+        outPrintf(" final=%s\n",
             quotedBool((pClassDef->accessFlags & ACC_FINAL) != 0));
         // "deprecated=" not knowable w/o parsing annotations
-        printf(" visibility=%s\n",
+        outPrintf(" visibility=%s\n",
             quotedVisibility(pClassDef->accessFlags));
-        printf(">\n");
+        outPrintf(">\n");
     }
     pInterfaces = dexGetInterfacesList(pDexFile, pClassDef);
     if (pInterfaces != NULL) {
@@ -1485,26 +2029,26 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
             dumpInterface(pDexFile, dexGetTypeItem(pInterfaces, i), i);
     }
 
-    if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Static fields     -\n");
+    dumpMemberListStart("  Static fields     -\n", "staticFields",
+        pClassData->header.staticFieldsSize);
     for (i = 0; i < (int) pClassData->header.staticFieldsSize; i++) {
         dumpSField(pDexFile, &pClassData->staticFields[i], i);
     }
 
-    if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Instance fields   -\n");
+    dumpMemberListStart("  Instance fields   -\n", "instanceFields",
+        pClassData->header.instanceFieldsSize);
     for (i = 0; i < (int) pClassData->header.instanceFieldsSize; i++) {
         dumpIField(pDexFile, &pClassData->instanceFields[i], i);
     }
 
-    if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Direct methods    -\n");
+    dumpMemberListStart("  Direct methods    -\n", "directMethods",
+        pClassData->header.directMethodsSize);
     for (i = 0; i < (int) pClassData->header.directMethodsSize; i++) {
         dumpMethod(pDexFile, &pClassData->directMethods[i], i);
     }
 
-    if (gOptions.outputFormat == OUTPUT_PLAIN)
-        printf("  Virtual methods   -\n");
+    dumpMemberListStart("  Virtual methods   -\n", "virtualMethods",
+        pClassData->header.virtualMethodsSize);
     for (i = 0; i < (int) pClassData->header.virtualMethodsSize; i++) {
         dumpMethod(pDexFile, &pClassData->virtualMethods[i], i);
     }
@@ -1517,18 +2061,29 @@ void dumpClass(DexFile* pDexFile, int idx, char** pLastPackage)
         fileName = "unknown";
 
     if (gOptions.outputFormat == OUTPUT_PLAIN) {
-        printf("  source_file_idx   : %d (%s)\n",
+        outPrintf("  source_file_idx   : %d (%s)\n",
             pClassDef->sourceFileIdx, fileName);
-        printf("\n");
+        outPrintf("\n");
     }
 
     if (gOptions.outputFormat == OUTPUT_XML) {
-        printf("</class>\n");
+        outPrintf("</class>\n");
+    }
+
+    if (gOptions.outputFormat == OUTPUT_JSON) {
+        outString("],\"sourceFile\":");
+        if (pClassDef->sourceFileIdx != kDexNoIndex)
+            outJsonString(fileName);
+        else
+            outString("null");
+        outString("}\n");
+    } else if (gOptions.outputFormat == OUTPUT_BINARY) {
+        outBinaryString(pClassDef->sourceFileIdx != kDexNoIndex ? fileName : "");
+        outEndRecord(recordOffset);
     }
 
 bail:
     free(pClassData);
-    free(accessStr);
 }
 
 
@@ -1569,7 +2124,7 @@ void dumpDifferentialCompressedMap(const u1** pData)
     int origLen = 4 + (addrWidth + regWidth) * numEntries;
     int compLen = (data - dataStart) + compressedLen;
 
-    printf("        (differential compression %d -> %d [%d -> %d])\n",
+    outPrintf("        (differential compression %d -> %d [%d -> %d])\n",
         origLen, compLen,
         (addrWidth + regWidth) * numEntries, compressedLen);
 
@@ -1595,7 +2150,7 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
 
     pMethodId = dexGetMethodId(pDexFile, pDexMethod->methodIdx);
     name = dexStringById(pDexFile, pMethodId->nameIdx);
-    printf("      #%d: 0x%08x %s\n", idx, offset, name);
+    outPrintf("      #%d: 0x%08x %s\n", idx, offset, name);
 
     u1 format;
     int addrWidth;
@@ -1603,7 +2158,7 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
     format = *data++;
     if (format == 1) {              /* kRegMapFormatNone */
         /* no map */
-        printf("        (no map)\n");
+        outPrintf("        (no map)\n");
         addrWidth = 0;
     } else if (format == 2) {       /* kRegMapFormatCompact8 */
         addrWidth = 1;
@@ -1613,7 +2168,7 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
         dumpDifferentialCompressedMap(&data);
         goto bail;
     } else {
-        printf("        (unknown format %d!)\n", format);
+        outPrintf("        (unknown format %d!)\n", format);
         /* don't know how to skip data; failure will cascade to end of class */
         goto bail;
     }
@@ -1632,11 +2187,11 @@ void dumpMethodMap(DexFile* pDexFile, const DexMethod* pDexMethod, int idx,
             if (addrWidth > 1)
                 addr |= (*data++) << 8;
 
-            printf("        %4x:", addr);
+            outPrintf("        %4x:", addr);
             for (byte = 0; byte < regWidth; byte++) {
-                printf(" %02x", *data++);
+                outPrintf(" %02x", *data++);
             }
-            printf("\n");
+            outPrintf("\n");
         }
     }
 
@@ -1664,7 +2219,7 @@ void dumpRegisterMaps(DexFile* pDexFile)
     int idx;
 
     if (pClassPool == NULL) {
-        printf("No register maps found\n");
+        outPrintf("No register maps found\n");
         return;
     }
 
@@ -1673,8 +2228,8 @@ void dumpRegisterMaps(DexFile* pDexFile)
     ptr += sizeof(u4);
     classOffsets = (const u4*) ptr;
 
-    printf("RMAP begins at offset 0x%07x\n", baseFileOffset);
-    printf("Maps for %d classes\n", numClasses);
+    outPrintf("RMAP begins at offset 0x%07x\n", baseFileOffset);
+    outPrintf("Maps for %d classes\n", numClasses);
     for (idx = 0; idx < (int) numClasses; idx++) {
         const DexClassDef* pClassDef;
         const char* classDescriptor;
@@ -1682,7 +2237,7 @@ void dumpRegisterMaps(DexFile* pDexFile)
         pClassDef = dexGetClassDef(pDexFile, idx);
         classDescriptor = dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
 
-        printf("%4d: +%d (0x%08x) %s\n", idx, classOffsets[idx],
+        outPrintf("%4d: +%d (0x%08x) %s\n", idx, classOffsets[idx],
             baseFileOffset + classOffsets[idx], classDescriptor);
 
         if (classOffsets[idx] == 0)
@@ -1699,7 +2254,8 @@ void dumpRegisterMaps(DexFile* pDexFile)
         int i;
 
         pEncodedData = dexGetClassData(pDexFile, pClassDef);
-        pClassData = dexReadAndVerifyClassData(&pEncodedData, NULL);
+        pClassData = dexReadAndVerifyClassData(&pEncodedData,
+            pDexFile->baseAddr + pDexFile->pHeader->fileSize);
         if (pClassData == NULL) {
             fprintf(stderr, "Trouble reading class data\n");
             continue;
@@ -1711,19 +2267,19 @@ void dumpRegisterMaps(DexFile* pDexFile)
         if (methodCount != pClassData->header.directMethodsSize
                             + pClassData->header.virtualMethodsSize)
         {
-            printf("NOTE: method count discrepancy (%d != %d + %d)\n",
+            outPrintf("NOTE: method count discrepancy (%d != %d + %d)\n",
                 methodCount, pClassData->header.directMethodsSize,
                 pClassData->header.virtualMethodsSize);
             /* this is bad, but keep going anyway */
         }
 
-        printf("    direct methods: %d\n",
+        outPrintf("    direct methods: %d\n",
             pClassData->header.directMethodsSize);
         for (i = 0; i < (int) pClassData->header.directMethodsSize; i++) {
             dumpMethodMap(pDexFile, &pClassData->directMethods[i], i, &data);
         }
 
-        printf("    virtual methods: %d\n",
+        outPrintf("    virtual methods: %d\n",
             pClassData->header.virtualMethodsSize);
         for (i = 0; i < (int) pClassData->header.virtualMethodsSize; i++) {
             dumpMethodMap(pDexFile, &pClassData->virtualMethods[i], i, &data);
@@ -1733,6 +2289,89 @@ void dumpRegisterMaps(DexFile* pDexFile)
     }
 }
 
+/*
+ * State for rendering a run of classes in parallel.
+ */
+struct ClassDumpBatch {
+    DexFile*        pDexFile;
+    int             firstIdx;
+    OutputBuffer*   bufs;       /* one per class in the batch */
+};
+
+/*
+ * Render one class into its output buffer.  Called from sysRunParallel().
+ */
+static void dumpClassToBuffer(void* arg, size_t index)
+{
+    ClassDumpBatch* pBatch = (ClassDumpBatch*) arg;
+    int idx = pBatch->firstIdx + (int) index;
+
+    gOutputBuf = &pBatch->bufs[index];
+    gOutputBuf->len = 0;
+
+    if (gOptions.showSectionHeaders)
+        dumpClassDef(pBatch->pDexFile, idx);
+
+    /* only the XML layout tracks the package */
+    assert(gOptions.outputFormat != OUTPUT_XML);
+    dumpClass(pBatch->pDexFile, idx, NULL);
+
+    gOutputBuf = NULL;
+}
+
+/*
+ * Dump all classes using gOptions.numThreads threads.  Classes are
+ * handled in batches, so that memory use doesn't grow with the size of
+ * the file; each batch is rendered in parallel and then written out in
+ * class-def order, so the output is the same as a serial run.
+ */
+static void dumpClassesParallel(DexFile* pDexFile)
+{
+    const int kClassesPerThread = 32;
+    int batchSize = gOptions.numThreads * kClassesPerThread;
+    int numClasses = (int) pDexFile->pHeader->classDefsSize;
+    ClassDumpBatch batch;
+    struct iovec* iov;
+    int i;
+
+    batch.pDexFile = pDexFile;
+    batch.bufs = (OutputBuffer*) calloc(batchSize, sizeof(OutputBuffer));
+    iov = (struct iovec*) malloc(batchSize * sizeof(struct iovec));
+    if (batch.bufs == NULL || iov == NULL) {
+        fprintf(stderr, "%s: out of memory\n", gProgName);
+        free(batch.bufs);
+        free(iov);
+        return;
+    }
+
+    for (batch.firstIdx = 0; batch.firstIdx < numClasses;
+            batch.firstIdx += batchSize)
+    {
+        int count = numClasses - batch.firstIdx;
+        if (count > batchSize)
+            count = batchSize;
+
+        sysRunParallel(count, gOptions.numThreads, dumpClassToBuffer, &batch);
+
+        /*
+         * Write the whole batch with as few system calls as possible,
+         * after whatever stdio is still holding.
+         */
+        for (i = 0; i < count; i++) {
+            iov[i].iov_base = batch.bufs[i].data;
+            iov[i].iov_len = batch.bufs[i].len;
+        }
+        fflush(stdout);
+        if (sysWriteFullyV(fileno(stdout), iov, count, gProgName) != 0)
+            break;
+    }
+
+    for (i = 0; i < batchSize; i++)
+        free(batch.bufs[i].data);
+    free(batch.bufs);
+    free(iov);
+}
+
 /*
  * Dump the requested sections of the file.
  */
@@ -1742,7 +2381,7 @@ void processDexFile(const char* fileName, DexFile* pDexFile)
     int i;
 
     if (gOptions.verbose) {
-        printf("Opened '%s', DEX version '%.3s'\n", fileName,
+        outPrintf("Opened '%s', DEX version '%.3s'\n", fileName,
             pDexFile->pHeader->magic +4);
     }
 
@@ -1756,31 +2395,90 @@ void processDexFile(const char* fileName, DexFile* pDexFile)
         dumpOptDirectory(pDexFile);
     }
 
-    if (gOptions.outputFormat == OUTPUT_XML)
-        printf("<api>\n");
+    if (gOptions.showVerifyStats)
+        dumpVerifyStats(pDexFile);
 
-    for (i = 0; i < (int) pDexFile->pHeader->classDefsSize; i++) {
-        if (gOptions.showSectionHeaders)
-            dumpClassDef(pDexFile, i);
+    if (gOptions.outputFormat == OUTPUT_XML) {
+        outPrintf("<api>\n");
+    } else if (gOptions.outputFormat == OUTPUT_JSON) {
+        outString("{\"record\":\"dex\",\"file\":");
+        outJsonString(fileName);
+        outPrintf(",\"version\":\"%.3s\",\"classDefs\":%u}\n",
+            pDexFile->pHeader->magic +4, pDexFile->pHeader->classDefsSize);
+    } else if (gOptions.outputFormat == OUTPUT_BINARY) {
+        char version[4];
+        size_t recordOffset = outBeginRecord('D');
+
+        memcpy(version, pDexFile->pHeader->magic +4, 3);
+        version[3] = '\0';
+        outBinaryString(fileName);
+        outBinaryString(version);
+        outUleb128(pDexFile->pHeader->classDefsSize);
+        outEndRecord(recordOffset);
+    }
+
+    /*
+     * The XML layout groups classes by package, which depends on the
+     * classes that came before, so it's always done serially.  It only
+     * shows the API, so there's not much to gain anyway.
+     */
+    if (gOptions.numThreads > 1 && gOptions.outputFormat != OUTPUT_XML) {
+        dumpClassesParallel(pDexFile);
+    } else {
+        for (i = 0; i < (int) pDexFile->pHeader->classDefsSize; i++) {
+            if (gOptions.showSectionHeaders)
+                dumpClassDef(pDexFile, i);
 
-        dumpClass(pDexFile, i, &package);
+            dumpClass(pDexFile, i, &package);
+        }
     }
 
     /* free the last one allocated */
     if (package != NULL) {
-        printf("</package>\n");
+        outPrintf("</package>\n");
         free(package);
     }
 
     if (gOptions.outputFormat == OUTPUT_XML)
-        printf("</api>\n");
+        outPrintf("</api>\n");
 }
 
 
 /*
- * Process one file.
+ * Process every DEX file in a multi-dex archive.  The first one is shown
+ * under the archive's name, the rest as "archive!classesN.dex".  With
+ * -c, the checksums of all of them were verified when the archive was
+ * opened, and that's reported once for the archive.
+ */
+void processContainer(const char* fileName, const DexContainer* pContainer)
+{
+    size_t i;
+
+    if (gOptions.checksumOnly) {
+        outPrintf("Checksum verified\n");
+        return;
+    }
+
+    for (i = 0; i < pContainer->numEntries; i++) {
+        const DexContainerEntry* pEntry = &pContainer->entries[i];
+
+        if (i == 0) {
+            processDexFile(fileName, pEntry->pDexFile);
+        } else {
+            size_t nameLen = strlen(fileName) + 1 + strlen(pEntry->name) + 1;
+            char* name = (char*) malloc(nameLen);
+            snprintf(name, nameLen, "%s!%s", fileName, pEntry->name);
+            processDexFile(name, pEntry->pDexFile);
+            free(name);
+        }
+    }
+}
+
+/*
+ * Process one file.  "tempFileName" is passed to dexOpenAndMap(), and
+ * may be NULL.
  */
-int process(const char* fileName)
+int process(const char* fileName, const char* tempFileName)
 {
     DexFile* pDexFile = NULL;
     MemMapping map;
@@ -1788,17 +2486,44 @@ int process(const char* fileName)
     int result = -1;
 
     if (gOptions.verbose)
-        printf("Processing '%s'...\n", fileName);
-
-    if (dexOpenAndMap(fileName, gOptions.tempFileName, &map, false) != 0) {
-        return result;
-    }
-    mapped = true;
+        outPrintf("Processing '%s'...\n", fileName);
 
     int flags = kDexParseVerifyChecksum;
     if (gOptions.ignoreBadChecksum)
         flags |= kDexParseContinueOnError;
 
+    /*
+     * Archives can hold more than one DEX file.  If anything goes wrong
+     * here, fall through to the single-file path, which reports the
+     * problem (or copes with a DEX file that just has an odd name).
+     * A bad DEX file has already been reported, though, and the
+     * single-file path would only report it again.
+     *
+     * The container expands everything in memory, so with a temp file
+     * (-t) only the single-file path, and so only classes.dex, is used.
+     */
+    int len = strlen(fileName);
+    if (tempFileName == NULL && len >= 4 &&
+            strcasecmp(fileName + len - 4, ".dex") != 0) {
+        DexContainer* pContainer;
+        UnzipToFileResult containerResult;
+
+        containerResult = dexContainerOpen(fileName, flags,
+            gOptions.numThreads, true, &pContainer);
+        if (containerResult == kUTFRSuccess) {
+            processContainer(fileName, pContainer);
+            dexContainerFree(pContainer);
+            return 0;
+        } else if (containerResult == kUTFRBadDex) {
+            return result;
+        }
+    }
+
+    if (dexOpenAndMap(fileName, tempFileName, &map, false) != 0) {
+        return result;
+    }
+    mapped = true;
+
     pDexFile = dexFileParse((u1*)map.addr, map.length, flags);
     if (pDexFile == NULL) {
         fprintf(stderr, "ERROR: DEX parse failed\n");
@@ -1806,7 +2531,7 @@ int process(const char* fileName)
     }
 
     if (gOptions.checksumOnly) {
-        printf("Checksum verified\n");
+        outPrintf("Checksum verified\n");
     } else {
         processDexFile(fileName, pDexFile);
     }
@@ -1822,6 +2547,201 @@ bail:
 }
 
 
+/*
+ * One file in a batch.  The output buffer is reused by the files that
+ * follow in the same slot.
+ */
+struct BatchTask {
+    const char*     fileName;
+    char*           tempFileName;   /* NULL unless -t was given */
+    OutputBuffer    out;
+    int             result;
+    u8              elapsedUsec;
+};
+
+/*
+ * Get the current time from a monotonic clock, in microseconds.
+ */
+static u8 getMonotonicUsec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u8) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/*
+ * Process one file of a batch into its output buffer.  Called from
+ * sysRunParallel().
+ */
+static void processBatchTask(void* arg, size_t index)
+{
+    BatchTask* pTask = &((BatchTask*) arg)[index];
+    u8 start = getMonotonicUsec();
+
+    gOutputBuf = &pTask->out;
+    gOutputBuf->len = 0;
+    pTask->result = process(pTask->fileName, pTask->tempFileName);
+    gOutputBuf = NULL;
+
+    pTask->elapsedUsec = getMonotonicUsec() - start;
+}
+
+/*
+ * Read the list of files to process, one per line, from "listName" ("-"
+ * for stdin).  Blank lines and lines starting with '#' are ignored.
+ * The names are appended to "*pNames", which has "*pCount" entries.
+ *
+ * Returns 0 on success.
+ */
+static int readBatchList(const char* listName, char*** pNames, size_t* pCount)
+{
+    char line[4096];
+    size_t capacity = *pCount;
+    FILE* fp;
+    int result = -1;
+
+    if (strcmp(listName, "-") == 0) {
+        fp = stdin;
+    } else {
+        fp = fopen(listName, "r");
+        if (fp == NULL) {
+            fprintf(stderr, "%s: unable to open '%s': %s\n", gProgName,
+                listName, strerror(errno));
+            return -1;
+        }
+    }
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        size_t len = strlen(line);
+
+        if (len == sizeof(line) - 1 && line[len-1] != '\n') {
+            fprintf(stderr, "%s: line too long in '%s'\n", gProgName,
+                listName);
+            goto bail;
+        }
+        while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+
+        if (*pCount == capacity) {
+            capacity = (capacity == 0) ? 64 : capacity * 2;
+            char** newNames = (char**) realloc(*pNames,
+                capacity * sizeof(char*));
+            if (newNames == NULL) {
+                fprintf(stderr, "%s: out of memory\n", gProgName);
+                goto bail;
+            }
+            *pNames = newNames;
+        }
+        char* name = strdup(line);
+        if (name == NULL) {
+            fprintf(stderr, "%s: out of memory\n", gProgName);
+            goto bail;
+        }
+        (*pNames)[(*pCount)++] = name;
+    }
+
+    if (ferror(fp)) {
+        fprintf(stderr, "%s: error reading '%s'\n", gProgName, listName);
+        goto bail;
+    }
+
+    result = 0;
+
+bail:
+    if (fp != stdin)
+        fclose(fp);
+    return result;
+}
+
+/*
+ * Process a list of files, "numThreads" at a time.  Each file's output
+ * is collected in memory and written to stdout in list order, so it
+ * looks the same as processing the files one after another.
+ *
+ * A summary line is written for every file to the -s file (or stderr),
+ * with tab-separated fields: status ("ok" or "failed"), elapsed time in
+ * milliseconds, output size in bytes, and the file name.
+ *
+ * Returns 0 if every file was processed successfully.
+ */
+static int processBatch(char* const* fileNames, size_t numFiles,
+    int numThreads)
+{
+    const int kFilesPerThread = 4;
+    size_t batchSize = numThreads * kFilesPerThread;
+    BatchTask* tasks = NULL;
+    FILE* summary = stderr;
+    int result = 0;
+    size_t first, i;
+
+    if (gOptions.summaryFileName != NULL) {
+        summary = fopen(gOptions.summaryFileName, "w");
+        if (summary == NULL) {
+            fprintf(stderr, "%s: unable to create '%s': %s\n", gProgName,
+                gOptions.summaryFileName, strerror(errno));
+            return 1;
+        }
+    }
+
+    tasks = (BatchTask*) calloc(batchSize, sizeof(BatchTask));
+    if (tasks == NULL) {
+        fprintf(stderr, "%s: out of memory\n", gProgName);
+        result = 1;
+        goto bail;
+    }
+
+    /* every slot needs its own temp file */
+    if (gOptions.tempFileName != NULL) {
+        for (i = 0; i < batchSize; i++) {
+            size_t len = strlen(gOptions.tempFileName) + 24;
+            tasks[i].tempFileName = (char*) malloc(len);
+            snprintf(tasks[i].tempFileName, len, "%s-%zu",
+                gOptions.tempFileName, i);
+        }
+    }
+
+    fprintf(summary, "# status\ttime_ms\toutput_bytes\tfile\n");
+
+    for (first = 0; first < numFiles; first += batchSize) {
+        size_t count = numFiles - first;
+        if (count > batchSize)
+            count = batchSize;
+
+        for (i = 0; i < count; i++)
+            tasks[i].fileName = fileNames[first + i];
+
+        sysRunParallel(count, numThreads, processBatchTask, tasks);
+
+        for (i = 0; i < count; i++) {
+            BatchTask* pTask = &tasks[i];
+
+            fwrite(pTask->out.data, 1, pTask->out.len, stdout);
+            fprintf(summary, "%s\t%.3f\t%zu\t%s\n",
+                (pTask->result == 0) ? "ok" : "failed",
+                pTask->elapsedUsec / 1000.0, pTask->out.len,
+                pTask->fileName);
+            result |= pTask->result;
+        }
+        fflush(stdout);
+        fflush(summary);
+    }
+
+bail:
+    if (tasks != NULL) {
+        for (i = 0; i < batchSize; i++) {
+            free(tasks[i].out.data);
+            free(tasks[i].tempFileName);
+        }
+        free(tasks);
+    }
+    if (summary != stderr)
+        fclose(summary);
+    return (result != 0);
+}
+
 /*
  * Show usage.
  */
@@ -1829,17 +2749,33 @@ void usage(void)
 {
     fprintf(stderr, "Copyright (C) 2007 The Android Open Source Project\n\n");
     fprintf(stderr,
-        "%s: [-c] [-d] [-f] [-h] [-i] [-l layout] [-m] [-t tempfile] dexfile...\n",
+        "%s: [-a advice] [-c] [-d] [-f] [-h] [-H] [-i] [-j threads] [-l layout]"
+        " [-m] [-t tempfile] [-v] [-V] dexfile...\n",
+        gProgName);
+    fprintf(stderr,
+        "%s: [options] -b listfile [-s summaryfile] [dexfile...]\n",
         gProgName);
     fprintf(stderr, "\n");
+    fprintf(stderr, " -a : paging hint for the mapped files: 'normal', 'sequential',\n"
+                    "      'random', 'willneed' or 'populate'; also reports page\n"
+                    "      faults per file (not with -b)\n");
+    fprintf(stderr, " -b : process the files listed in 'listfile' ('-' for stdin)\n");
     fprintf(stderr, " -c : verify checksum and exit\n");
     fprintf(stderr, " -d : disassemble code sections\n");
     fprintf(stderr, " -f : display summary information from file header\n");
     fprintf(stderr, " -h : display file header details\n");
+    fprintf(stderr, " -H : read large files into memory backed by huge pages\n");
     fprintf(stderr, " -i : ignore checksum failures\n");
-    fprintf(stderr, " -l : output layout, either 'plain' or 'xml'\n");
+    fprintf(stderr, " -j : number of threads to use (default 1)\n");
+    fprintf(stderr, " -l : output layout, either 'plain', 'xml', 'json' or 'binary'\n");
     fprintf(stderr, " -m : dump register maps (and nothing else)\n");
-    fprintf(stderr, " -t : temp file name (defaults to /sdcard/dex-temp-*)\n");
+    fprintf(stderr, " -s : write per-file status and timing for -b to 'summaryfile'\n");
+    fprintf(stderr, " -t : expand compressed classes.dex into this temp file\n"
+                    "      (by default it is expanded in memory); only\n"
+                    "      classes.dex is dumped from a multi-dex archive\n");
+    fprintf(stderr, " -v : skip verification of files that passed before, using\n"
+                    "      a cache in $ANDROID_DATA/dalvik-cache\n");
+    fprintf(stderr, " -V : show per-section verification time and counts\n");
 }
 
 /*
@@ -1854,13 +2790,33 @@ int main(int argc, char* const argv[])
 
     memset(&gOptions, 0, sizeof(gOptions));
     gOptions.verbose = true;
+    gOptions.numThreads = 1;
 
     while (1) {
-        ic = getopt(argc, argv, "cdfhil:mt:");
+        ic = getopt(argc, argv, "a:b:cdfhHij:l:ms:t:vV");
         if (ic < 0)
             break;
 
         switch (ic) {
+        case 'a':       // madvise() hint for mapped files
+            if (strcmp(optarg, "normal") == 0) {
+                sysSetMapAdvice(kSysMapAdviceNormal);
+            } else if (strcmp(optarg, "sequential") == 0) {
+                sysSetMapAdvice(kSysMapAdviceSequential);
+            } else if (strcmp(optarg, "random") == 0) {
+                sysSetMapAdvice(kSysMapAdviceRandom);
+            } else if (strcmp(optarg, "willneed") == 0) {
+                sysSetMapAdvice(kSysMapAdviceWillNeed);
+            } else if (strcmp(optarg, "populate") == 0) {
+                sysSetMapAdvice(kSysMapAdvicePopulate);
+            } else {
+                wantUsage = true;
+            }
+            gOptions.showPageFaults = true;
+            break;
+        case 'b':       // batch mode, with a list of files
+            gOptions.batchListName = optarg;
+            break;
         case 'c':       // verify the checksum then exit
             gOptions.checksumOnly = true;
             break;
@@ -1873,9 +2829,20 @@ int main(int argc, char* const argv[])
         case 'h':       // dump section headers, i.e. all meta-data
             gOptions.showSectionHeaders = true;
             break;
+        case 'H':       // transparent huge pages for big files
+            sysSetHugePages(true);
+            break;
         case 'i':       // continue even if checksum is bad
             gOptions.ignoreBadChecksum = true;
             break;
+        case 'j':       // number of threads
+            gOptions.numThreads = atoi(optarg);
+            if (gOptions.numThreads < 1) {
+                fprintf(stderr, "%s: bad thread count '%s'\n", gProgName,
+                    optarg);
+                wantUsage = true;
+            }
+            break;
         case 'l':       // layout
             if (strcmp(optarg, "plain") == 0) {
                 gOptions.outputFormat = OUTPUT_PLAIN;
@@ -1883,6 +2850,12 @@ int main(int argc, char* const argv[])
                 gOptions.outputFormat = OUTPUT_XML;
                 gOptions.verbose = false;
                 gOptions.exportsOnly = true;
+            } else if (strcmp(optarg, "json") == 0) {
+                gOptions.outputFormat = OUTPUT_JSON;
+                gOptions.verbose = false;
+            } else if (strcmp(optarg, "binary") == 0) {
+                gOptions.outputFormat = OUTPUT_BINARY;
+                gOptions.verbose = false;
             } else {
                 wantUsage = true;
             }
@@ -1890,16 +2863,25 @@ int main(int argc, char* const argv[])
         case 'm':       // dump register maps only
             gOptions.dumpRegisterMaps = true;
             break;
+        case 's':       // batch summary file
+            gOptions.summaryFileName = optarg;
+            break;
         case 't':       // temp file, used when opening compressed Jar
             gOptions.tempFileName = optarg;
             break;
+        case 'v':       // use the verification cache
+            gOptions.useVerifyCache = true;
+            break;
+        case 'V':       // show verification statistics
+            gOptions.showVerifyStats = true;
+            break;
         default:
             wantUsage = true;
             break;
         }
     }
 
-    if (optind == argc) {
+    if (optind == argc && gOptions.batchListName == NULL) {
         fprintf(stderr, "%s: no file specified\n", gProgName);
         wantUsage = true;
     }
@@ -1909,14 +2891,78 @@ int main(int argc, char* const argv[])
         wantUsage = true;
     }
 
+    if ((gOptions.outputFormat == OUTPUT_JSON
+            || gOptions.outputFormat == OUTPUT_BINARY)
+        && (gOptions.showFileHeaders || gOptions.showSectionHeaders
+            || gOptions.dumpRegisterMaps))
+    {
+        fprintf(stderr, "Can't use -f, -h or -m with the json or binary layout\n");
+        wantUsage = true;
+    }
+
+    if (gOptions.showVerifyStats && gOptions.outputFormat != OUTPUT_PLAIN) {
+        fprintf(stderr, "Can only use -V with the plain layout\n");
+        wantUsage = true;
+    }
+
+    if (gOptions.summaryFileName != NULL && gOptions.batchListName == NULL) {
+        fprintf(stderr, "Can't specify -s without -b\n");
+        wantUsage = true;
+    }
+
     if (wantUsage) {
         usage();
         return 2;
     }
 
+    dexVerifyCacheSetEnabled(gOptions.useVerifyCache);
+
+    if (gOptions.batchListName != NULL) {
+        char** fileNames = NULL;
+        size_t numFiles = 0;
+        size_t i;
+        int result = 1;
+
+        /* files named on the command line come first */
+        fileNames = (char**) malloc((argc - optind + 1) * sizeof(char*));
+        bool okay = (fileNames != NULL);
+        while (okay && optind < argc) {
+            fileNames[numFiles] = strdup(argv[optind++]);
+            okay = (fileNames[numFiles] != NULL);
+            if (okay)
+                numFiles++;
+        }
+
+        if (!okay) {
+            fprintf(stderr, "%s: out of memory\n", gProgName);
+        } else if (readBatchList(gOptions.batchListName, &fileNames,
+                &numFiles) == 0) {
+            /* the threads work on files, not on the classes in a file */
+            int numThreads = gOptions.numThreads;
+            gOptions.numThreads = 1;
+            result = processBatch(fileNames, numFiles, numThreads);
+        }
+
+        for (i = 0; i < numFiles; i++)
+            free(fileNames[i]);
+        free(fileNames);
+        return result;
+    }
+
     int result = 0;
     while (optind < argc) {
-        result |= process(argv[optind++]);
+        const char* fileName = argv[optind++];
+        SysPageFaults before, after;
+
+        if (gOptions.showPageFaults)
+            sysGetPageFaults(&before);
+        result |= process(fileName, gOptions.tempFileName);
+        if (gOptions.showPageFaults) {
+            sysGetPageFaults(&after);
+            fprintf(stderr, "%s: '%s': %ld minor, %ld major page faults\n",
+                gProgName, fileName, after.minor - before.minor,
+                after.major - before.major);
+        }
     }
 
     return (result != 0);
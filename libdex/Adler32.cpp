@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Adler-32 checksum, with vectorized versions for x86.
+ *
+ * The vector versions consume 32-byte blocks. For a block of bytes
+ * b[0..31], s1 grows by the plain sum of the bytes, and s2 grows by
+ * 32 * (s1 before the block) plus the sum of b[i] * (32 - i). The first
+ * part is accumulated separately and scaled once per run of blocks; the
+ * second one is what maddubs/madd compute against a tap vector.
+ */
+
+#include "Adler32.h"
+
+#include <zlib.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define DEX_ADLER32_X86
+#include <immintrin.h>
+#endif
+
+/* largest prime smaller than 65536 */
+static const u4 kAdlerBase = 65521;
+
+/*
+ * Largest n such that 255n(n+1)/2 + (n+1)(kAdlerBase-1) fits in a u4,
+ * i.e. the number of bytes that can be summed before reducing.
+ */
+static const u4 kAdlerNMax = 5552;
+
+static u4 adler32Zlib(u4 adler, const u1* buf, size_t len)
+{
+    return (u4) adler32(adler, buf, len);
+}
+
+#ifdef DEX_ADLER32_X86
+
+static const u4 kAdlerBlockSize = 32;
+
+/*
+ * Finish off the (fewer than kAdlerBlockSize) bytes left over after
+ * the vector loop.
+ */
+static u4 adler32Tail(u4 s1, u4 s2, const u1* buf, size_t len)
+{
+    while (len-- != 0) {
+        s1 += *buf++;
+        s2 += s1;
+    }
+
+    return ((s2 % kAdlerBase) << 16) | (s1 % kAdlerBase);
+}
+
+__attribute__((target("ssse3")))
+static u4 sumLanes(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return (u4) _mm_cvtsi128_si32(v);
+}
+
+__attribute__((target("ssse3")))
+static u4 adler32Ssse3(u4 adler, const u1* buf, size_t len)
+{
+    const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+            24, 23, 22, 21, 20, 19, 18, 17);
+    const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9,
+            8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    u4 s1 = adler & 0xffff;
+    u4 s2 = adler >> 16;
+    size_t blocks = len / kAdlerBlockSize;
+
+    len -= blocks * kAdlerBlockSize;
+
+    while (blocks != 0) {
+        size_t n = kAdlerNMax / kAdlerBlockSize;
+        if (n > blocks) {
+            n = blocks;
+        }
+        blocks -= n;
+
+        /* v_ps collects s1 as of the start of each block */
+        __m128i v_ps = _mm_set_epi32(0, 0, 0, s1 * n);
+        __m128i v_s2 = _mm_set_epi32(0, 0, 0, s2);
+        __m128i v_s1 = _mm_setzero_si128();
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i*) buf);
+            const __m128i bytes2 =
+                _mm_loadu_si128((const __m128i*) (buf + 16));
+
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            v_s2 = _mm_add_epi32(v_s2,
+                    _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            v_s2 = _mm_add_epi32(v_s2,
+                    _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+            buf += kAdlerBlockSize;
+        } while (--n != 0);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        s1 = (s1 + sumLanes(v_s1)) % kAdlerBase;
+        s2 = sumLanes(v_s2) % kAdlerBase;
+    }
+
+    return adler32Tail(s1, s2, buf, len);
+}
+
+__attribute__((target("avx2")))
+static u4 adler32Avx2(u4 adler, const u1* buf, size_t len)
+{
+    const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25,
+            24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9,
+            8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    u4 s1 = adler & 0xffff;
+    u4 s2 = adler >> 16;
+    size_t blocks = len / kAdlerBlockSize;
+
+    len -= blocks * kAdlerBlockSize;
+
+    while (blocks != 0) {
+        size_t n = kAdlerNMax / kAdlerBlockSize;
+        if (n > blocks) {
+            n = blocks;
+        }
+        blocks -= n;
+
+        __m256i v_ps = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, s1 * n);
+        __m256i v_s2 = _mm256_set_epi32(0, 0, 0, 0, 0, 0, 0, s2);
+        __m256i v_s1 = _mm256_setzero_si256();
+
+        do {
+            const __m256i bytes = _mm256_loadu_si256((const __m256i*) buf);
+
+            v_ps = _mm256_add_epi32(v_ps, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+            v_s2 = _mm256_add_epi32(v_s2,
+                    _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+            buf += kAdlerBlockSize;
+        } while (--n != 0);
+
+        v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+
+        __m128i s1Half = _mm_add_epi32(_mm256_castsi256_si128(v_s1),
+                _mm256_extracti128_si256(v_s1, 1));
+        __m128i s2Half = _mm_add_epi32(_mm256_castsi256_si128(v_s2),
+                _mm256_extracti128_si256(v_s2, 1));
+
+        s1 = (s1 + sumLanes(s1Half)) % kAdlerBase;
+        s2 = sumLanes(s2Half) % kAdlerBase;
+    }
+
+    return adler32Tail(s1, s2, buf, len);
+}
+
+#endif  // DEX_ADLER32_X86
+
+typedef u4 Adler32Func(u4 adler, const u1* buf, size_t len);
+
+/*
+ * Pick the best implementation for the CPU we're running on.
+ */
+static Adler32Func* chooseAdler32()
+{
+#ifdef DEX_ADLER32_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return adler32Avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return adler32Ssse3;
+    }
+#endif
+
+    return adler32Zlib;
+}
+
+/* (documented in header file) */
+u4 dexAdler32(u4 adler, const u1* buf, size_t len)
+{
+    static Adler32Func* const func = chooseAdler32();
+
+    return func(adler, buf, len);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Adler-32 checksum, as used for the DEX file checksum.
+ */
+
+#ifndef LIBDEX_ADLER32_H_
+#define LIBDEX_ADLER32_H_
+
+#include "DexFile.h"
+
+/*
+ * Initial value for dexAdler32(), the same as adler32(0, NULL, 0).
+ */
+enum { kDexAdler32Init = 1 };
+
+/*
+ * Update a running Adler-32 checksum with "len" bytes at "buf", and
+ * return the new checksum. The result is the same as zlib's adler32().
+ *
+ * On x86 the vectorized (AVX2 or SSSE3) version is picked at runtime,
+ * based on what the CPU supports. Everywhere else, this is zlib.
+ */
+u4 dexAdler32(u4 adler, const u1* buf, size_t len);
+
+#endif  // LIBDEX_ADLER32_H_
@@ -15,9 +15,12 @@
 LOCAL_PATH:= $(call my-dir)
 
 dex_src_files := \
+	Adler32.cpp \
 	CmdUtils.cpp \
 	DexCatch.cpp \
 	DexClass.cpp \
+	DexCodeIndex.cpp \
+	DexContainer.cpp \
 	DexDataMap.cpp \
 	DexDebugInfo.cpp \
 	DexFile.cpp \
@@ -27,6 +30,7 @@ dex_src_files := \
 	DexProto.cpp \
 	DexSwapVerify.cpp \
 	DexUtf.cpp \
+	DexVerifyCache.cpp \
 	InstrUtils.cpp \
 	Leb128.cpp \
 	OptInvocation.cpp \
@@ -73,7 +73,26 @@ UnzipToFileResult dexUnzipToFile(const char* zipFileName,
         goto bail;
     }
 
-    if (dexZipExtractEntryToFile(archive, &entry, fd) != 0) {
+    if (entry.method == kCompressStored
+        && entry.compressed_length == entry.uncompressed_length)
+    {
+        /*
+         * A stored entry is just a run of bytes in the archive, which
+         * the kernel can copy without it passing through here.  Like a
+         * stored entry mapped in place, its CRC isn't checked; the DEX
+         * checksum is.
+         */
+        int zipFd = dexZipGetArchiveFd(archive);
+
+        if (lseek(zipFd, entry.offset, SEEK_SET) != entry.offset ||
+            sysCopyFileToFile(fd, zipFd, entry.uncompressed_length) != 0)
+        {
+            fprintf(stderr, "Extract of '%s' from '%s' failed\n",
+                kFileToExtract, zipFileName);
+            result = kUTFRBadZip;
+            goto bail;
+        }
+    } else if (dexZipExtractEntryToFile(archive, &entry, fd) != 0) {
         fprintf(stderr, "Extract of '%s' from '%s' failed\n",
             kFileToExtract, zipFileName);
         result = kUTFRBadZip;
@@ -90,19 +109,114 @@ bail:
 }
 
 /*
- * Map the specified DEX file read-only (possibly after expanding it into a
- * temp file from a Jar).  Pass in a MemMapping struct to hold the info.
+ * Extract "classes.dex" from archive file into anonymous memory.
+ *
+ * If "quiet" is set, don't report common errors.
+ */
+UnzipToFileResult dexUnzipToMemory(const char* zipFileName, MemMapping* pMap,
+    bool quiet)
+{
+    UnzipToFileResult result = kUTFRSuccess;
+    static const char* kFileToExtract = "classes.dex";
+    ZipArchiveHandle archive;
+    ZipEntry entry;
+    size_t length;
+
+    if (dexZipOpenArchive(zipFileName, &archive) != 0) {
+        if (!quiet) {
+            fprintf(stderr, "Unable to open '%s' as zip archive\n",
+                zipFileName);
+        }
+        result = kUTFRNotZip;
+        goto bail;
+    }
+
+    if (dexZipFindEntry(archive, kFileToExtract, &entry) != 0) {
+        if (!quiet) {
+            fprintf(stderr, "Unable to find '%s' in '%s'\n",
+                kFileToExtract, zipFileName);
+        }
+        result = kUTFRNoClassesDex;
+        goto bail;
+    }
+
+    length = entry.uncompressed_length;
+    if (length == 0 || sysCreatePrivateMap(length, pMap) != 0) {
+        fprintf(stderr, "Unable to allocate %zu bytes for '%s'\n",
+            length, kFileToExtract);
+        result = kUTFRBadZip;
+        goto bail;
+    }
+
+    if (dexZipExtractEntryToMemory(archive, &entry, (u1*) pMap->addr,
+            length) != 0) {
+        fprintf(stderr, "Extract of '%s' from '%s' failed\n",
+            kFileToExtract, zipFileName);
+        sysReleaseShmem(pMap);
+        result = kUTFRBadZip;
+        goto bail;
+    }
+
+bail:
+    dexZipCloseArchive(archive);
+    return result;
+}
+
+/*
+ * If "classes.dex" is stored uncompressed and 4-byte aligned in the
+ * archive, map it directly out of the archive file.
+ *
+ * Returns true if the entry was mapped. Returns false, without reporting
+ * anything, if it can't be (including when the file isn't an archive or
+ * has no classes.dex); the caller can then fall back to extracting it.
+ */
+static bool mapStoredClassesDex(const char* zipFileName, MemMapping* pMap)
+{
+    static const char* kFileToMap = "classes.dex";
+    ZipArchiveHandle archive;
+    ZipEntry entry;
+    bool mapped = false;
+
+    if (dexZipOpenArchive(zipFileName, &archive) != 0)
+        goto bail;
+
+    if (dexZipFindEntry(archive, kFileToMap, &entry) != 0)
+        goto bail;
+
+    if (!dexZipEntryIsMappable(&entry))
+        goto bail;
+
+    /*
+     * The mapping stays valid after the archive (and its fd) is closed.
+     * It's private, because verification can write to it (e.g. to mask
+     * off unknown class access flags).
+     */
+    if (sysMapFileSegmentWritableReadOnly(dexZipGetArchiveFd(archive),
+            entry.offset, entry.uncompressed_length, pMap) != 0) {
+        goto bail;
+    }
+
+    mapped = true;
+
+bail:
+    dexZipCloseArchive(archive);
+    return mapped;
+}
+
+/*
+ * Map the specified DEX file read-only (possibly after expanding it from
+ * a Jar).  Pass in a MemMapping struct to hold the info.
  * If the file is an unoptimized DEX file, then byte-swapping and structural
  * verification are performed on it before the memory is made read-only.
  *
- * The temp file is deleted after the map succeeds.
+ * If the classes.dex entry is stored uncompressed and suitably aligned,
+ * it is mapped directly out of the archive.  Otherwise it is expanded
+ * into anonymous memory, or into "tempFileName" if that is non-NULL; the
+ * temp file is deleted after the map succeeds.
  *
  * This is intended for use by tools (e.g. dexdump) that need to get a
  * read-only copy of a DEX file that could be in a number of different states.
  *
- * If "tempFileName" is NULL, a default value is used.  The temp file is
- * deleted after the map succeeds.
- *
  * If "quiet" is set, don't report common errors.
  *
  * Returns 0 (kUTFRSuccess) on success.
@@ -112,8 +226,10 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
 {
     UnzipToFileResult result = kUTFRGenericFailure;
     int len = strlen(fileName);
-    char tempNameBuf[32];
     bool removeTemp = false;
+    bool mapped = false;
+    bool mapIsExtracted = false;    /* expanded into anonymous memory */
+    bool haveMap = false;
     int fd = -1;
 
     if (len < 5) {
@@ -125,34 +241,25 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
         goto bail;
     }
 
-    if (strcasecmp(fileName + len -3, "dex") != 0) {
-        if (tempFileName == NULL) {
-            /*
-             * Try .zip/.jar/.apk, all of which are Zip archives with
-             * "classes.dex" inside.  We need to extract the compressed
-             * data to a temp file, the location of which varies.
-             *
-             * On the device we must use /sdcard because most other
-             * directories aren't writable (either because of permissions
-             * or because the volume is mounted read-only).  On desktop
-             * it's nice to use the designated temp directory.
-             */
-            if (access("/tmp", W_OK) == 0) {
-                sprintf(tempNameBuf, "/tmp/dex-temp-%d", getpid());
-            } else if (access("/sdcard", W_OK) == 0) {
-                sprintf(tempNameBuf, "/sdcard/dex-temp-%d", getpid());
-            } else {
-                fprintf(stderr,
-                    "NOTE: /tmp and /sdcard unavailable for temp files\n");
-                sprintf(tempNameBuf, "dex-temp-%d", getpid());
-            }
+    if (strcasecmp(fileName + len -3, "dex") != 0 &&
+        mapStoredClassesDex(fileName, pMap))
+    {
+        mapped = haveMap = true;
+    } else if (strcasecmp(fileName + len -3, "dex") != 0) {
+        /*
+         * Try .zip/.jar/.apk, all of which are Zip archives with
+         * "classes.dex" inside.  The compressed data is expanded into
+         * memory, unless the caller asked for a temp file.
+         */
+        if (tempFileName == NULL)
+            result = dexUnzipToMemory(fileName, pMap, quiet);
+        else
+            result = dexUnzipToFile(fileName, tempFileName, quiet);
 
-            tempFileName = tempNameBuf;
-        }
-
-        result = dexUnzipToFile(fileName, tempFileName, quiet);
-
-        if (result == kUTFRSuccess) {
+        if (result == kUTFRSuccess && tempFileName == NULL) {
+            mapped = haveMap = true;
+            mapIsExtracted = true;
+        } else if (result == kUTFRSuccess) {
             //printf("+++ Good unzip to '%s'\n", tempFileName);
             fileName = tempFileName;
             removeTemp = true;
@@ -170,21 +277,24 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
 
     result = kUTFRGenericFailure;
 
-    /*
-     * Pop open the (presumed) DEX file.
-     */
-    fd = open(fileName, O_RDONLY | O_BINARY);
-    if (fd < 0) {
-        if (!quiet) {
-            fprintf(stderr, "ERROR: unable to open '%s': %s\n",
-                fileName, strerror(errno));
+    if (!mapped) {
+        /*
+         * Pop open the (presumed) DEX file.
+         */
+        fd = open(fileName, O_RDONLY | O_BINARY);
+        if (fd < 0) {
+            if (!quiet) {
+                fprintf(stderr, "ERROR: unable to open '%s': %s\n",
+                    fileName, strerror(errno));
+            }
+            goto bail;
         }
-        goto bail;
-    }
 
-    if (sysMapFileInShmemWritableReadOnly(fd, pMap) != 0) {
-        fprintf(stderr, "ERROR: Unable to map '%s'\n", fileName);
-        goto bail;
+        if (sysMapFileInShmemWritableReadOnly(fd, pMap) != 0) {
+            fprintf(stderr, "ERROR: Unable to map '%s'\n", fileName);
+            goto bail;
+        }
+        haveMap = true;
     }
 
     /*
@@ -193,8 +303,14 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
      * will have already been mapped private-writable by the previous
      * call, so we don't need to do anything special if this call
      * returns non-zero.
+     *
+     * A stored classes.dex mapped straight out of the archive is a
+     * private file mapping too, so it's made writable the same way, and
+     * anything verification writes stays in this process.  One expanded
+     * into anonymous memory is already writable.
      */
-    sysChangeMapAccess(pMap->addr, pMap->length, true, pMap);
+    if (!mapIsExtracted)
+        sysChangeMapAccess(pMap->addr, pMap->length, true, pMap);
 
     if (dexSwapAndVerifyIfNecessary((u1*) pMap->addr, pMap->length)) {
         fprintf(stderr, "ERROR: Failed structural verification of '%s'\n",
@@ -215,6 +331,8 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
     result = kUTFRSuccess;
 
 bail:
+    if (haveMap && result != kUTFRSuccess)
+        sysReleaseShmem(pMap);
     if (fd >= 0)
         close(fd);
     if (removeTemp) {
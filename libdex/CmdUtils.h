@@ -40,22 +40,22 @@ enum UnzipToFileResult {
     kUTFRNoClassesDex,
     kUTFROutputFileProblem,
     kUTFRBadZip,
+    kUTFRBadDex,                /* failed verification or parsing */
 };
 
 /*
- * Map the specified DEX file read-only (possibly after expanding it into a
- * temp file from a Jar).  Pass in a MemMapping struct to hold the info.
+ * Map the specified DEX file read-only (possibly after expanding it from
+ * a Jar).  Pass in a MemMapping struct to hold the info.
  * If the file is an unoptimized DEX file, then byte-swapping and structural
  * verification are performed on it before the memory is made read-only.
  *
- * The temp file is deleted after the map succeeds.
+ * A compressed classes.dex is expanded into anonymous memory, so nothing
+ * is written to the filesystem, unless "tempFileName" is non-NULL; then
+ * it is expanded into that file, which is deleted after the map succeeds.
  *
  * This is intended for use by tools (e.g. dexdump) that need to get a
  * read-only copy of a DEX file that could be in a number of different states.
  *
- * If "tempFileName" is NULL, a default value is used.  The temp file is
- * deleted after the map succeeds.
- *
  * If "quiet" is set, don't report common errors.
  *
  * Returns 0 (kUTFRSuccess) on success.
@@ -70,4 +70,12 @@ UnzipToFileResult dexOpenAndMap(const char* fileName, const char* tempFileName,
 UnzipToFileResult dexUnzipToFile(const char* zipFileName,
     const char* outFileName, bool quiet);
 
+/*
+ * Like dexUnzipToFile(), but extract "classes.dex" into anonymous memory
+ * (see sysCreatePrivateMap()) instead.  The pages are left writable; the
+ * caller releases them with sysReleaseShmem().
+ */
+UnzipToFileResult dexUnzipToMemory(const char* zipFileName, MemMapping* pMap,
+    bool quiet);
+
 #endif  // LIBDEX_CMDUTILS_H_
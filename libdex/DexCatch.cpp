@@ -20,6 +20,8 @@
 
 #include "DexCatch.h"
 
+#include <stdlib.h>
+
 /* Get the first handler offset for the given DexCode.
  * It's not 0 because the handlers list is prefixed with its size
  * (in entries) as a uleb128. */
@@ -88,3 +90,246 @@ u4 dexCatchIteratorGetEndOffset(DexCatchIterator* pIterator,
 
     return (u4) (pIterator->pEncodedData - dexGetCatchHandlerData(pCode));
 }
+
+/*
+ * Side table of decoded catch tables, keyed by code item offset. It's
+ * open-addressed with linear probing, and has room for twice as many
+ * code items as there can be (one per method id). A slot's key and
+ * table are each set once, with a compare-and-swap, and never change
+ * after that, so lookups don't take a lock.
+ */
+struct DexCatchTableSlot {
+    u4              codeOff;        /* 0 if the slot is free */
+    DexCatchTable*  pTable;         /* NULL until built */
+};
+
+struct DexCatchTableMap {
+    u4                  shift;      /* 32 - log2(number of slots) */
+    DexCatchTableSlot   slots[1];   /* really [1 << (32 - shift)] */
+};
+
+/*
+ * Decode the try/catch information of "pCode" into a newly-allocated
+ * DexCatchTable, which is one block that can be free()d. Returns NULL
+ * on allocation failure.
+ */
+static DexCatchTable* buildCatchTable(const DexCode* pCode) {
+    const u1* handlerData = dexGetCatchHandlerData(pCode);
+    u4 triesSize = pCode->triesSize;
+    u4 listsSize = 0;
+    u4 handlersSize = 0;
+    u4 firstOffset = 0;
+    u4 offset;
+    u4 ui;
+
+    if (triesSize != 0) {
+        listsSize = dexGetHandlersSize(pCode);
+        firstOffset = dexGetFirstHandlerOffset(pCode);
+    }
+
+    /* count the handlers, and find where the last list ends */
+    offset = firstOffset;
+    for (ui = 0; ui < listsSize; ui++) {
+        DexCatchIterator iterator;
+
+        dexCatchIteratorInit(&iterator, pCode, offset);
+        while (dexCatchIteratorNext(&iterator) != NULL) {
+            handlersSize++;
+        }
+        offset = (u4) (iterator.pEncodedData - handlerData);
+    }
+
+    /*
+     * Scratch space: the offset of each list, and the index of its first
+     * handler. The lists are in offset order, so the offsets can be
+     * binary searched.
+     */
+    u4* listOffsets = (u4*) malloc(2 * listsSize * sizeof(u4) + 1);
+    u4* listStarts = listOffsets + listsSize;
+    DexCatchTable* pTable = (DexCatchTable*) malloc(sizeof(DexCatchTable) +
+            triesSize * sizeof(DexCatchRange) +
+            handlersSize * sizeof(DexCatchHandler));
+
+    if (pTable == NULL || listOffsets == NULL) {
+        free(pTable);
+        free(listOffsets);
+        return NULL;
+    }
+
+    DexCatchRange* ranges = (DexCatchRange*) (pTable + 1);
+    DexCatchHandler* handlers = (DexCatchHandler*) (ranges + triesSize);
+
+    pTable->codeSize = (u4) (handlerData - (const u1*) pCode) + offset;
+    pTable->rangesSize = triesSize;
+    pTable->ranges = ranges;
+    pTable->handlers = handlers;
+
+    /* decode each list once, even if several tries use it */
+    u4 numHandlers = 0;
+    offset = firstOffset;
+    for (ui = 0; ui < listsSize; ui++) {
+        DexCatchIterator iterator;
+        const DexCatchHandler* pHandler;
+
+        listOffsets[ui] = offset;
+        listStarts[ui] = numHandlers;
+        dexCatchIteratorInit(&iterator, pCode, offset);
+        while ((pHandler = dexCatchIteratorNext(&iterator)) != NULL) {
+            handlers[numHandlers++] = *pHandler;
+        }
+        offset = (u4) (iterator.pEncodedData - handlerData);
+    }
+
+    const DexTry* pTries = dexGetTries(pCode);
+    for (ui = 0; ui < triesSize; ui++) {
+        const DexTry* pTry = &pTries[ui];
+        DexCatchRange* pRange = &ranges[ui];
+        int min = 0;
+        int max = (int) listsSize - 1;
+
+        pRange->startAddr = pTry->startAddr;
+        pRange->endAddr = pTry->startAddr + pTry->insnCount;
+        pRange->firstHandler = 0;
+        pRange->handlerCount = 0;
+
+        while (max >= min) {
+            int guess = (min + max) >> 1;
+
+            if (pTry->handlerOff < listOffsets[guess]) {
+                max = guess - 1;
+            } else if (pTry->handlerOff > listOffsets[guess]) {
+                min = guess + 1;
+            } else {
+                u4 end = ((u4) guess + 1 < listsSize)
+                        ? listStarts[guess + 1] : numHandlers;
+                pRange->firstHandler = listStarts[guess];
+                pRange->handlerCount = end - listStarts[guess];
+                break;
+            }
+        }
+    }
+
+    free(listOffsets);
+    return pTable;
+}
+
+/*
+ * Get the catch table map of "pDexFile", creating it if this is the
+ * first time anyone has asked. Returns NULL on allocation failure.
+ *
+ * As with the interned descriptors (see DexProto.cpp), the map is
+ * attached behind the caller's back, and threads that race to create
+ * it agree on one winner.
+ */
+static DexCatchTableMap* getCatchTableMap(const DexFile* pDexFile) {
+    DexFile* mutableDexFile = (DexFile*) pDexFile;
+    DexCatchTableMap* pMap =
+        __atomic_load_n(&mutableDexFile->pCatchTables, __ATOMIC_ACQUIRE);
+
+    if (pMap != NULL) {
+        return pMap;
+    }
+
+    u4 numSlots = dexRoundUpPower2(pDexFile->pHeader->methodIdsSize * 2);
+    u4 shift = 32;
+
+    if (numSlots < 16) {
+        numSlots = 16;
+    }
+    while ((1u << (32 - shift)) < numSlots) {
+        shift--;
+    }
+
+    pMap = (DexCatchTableMap*) calloc(1, sizeof(DexCatchTableMap) +
+            numSlots * sizeof(DexCatchTableSlot));
+    if (pMap == NULL) {
+        return NULL;
+    }
+    pMap->shift = shift;
+
+    if (!__sync_bool_compare_and_swap(&mutableDexFile->pCatchTables,
+            NULL, pMap)) {
+        free(pMap);
+        pMap = __atomic_load_n(&mutableDexFile->pCatchTables,
+                __ATOMIC_ACQUIRE);
+    }
+
+    return pMap;
+}
+
+/* (documented in header file) */
+const DexCatchTable* dexGetCatchTable(const DexFile* pDexFile,
+        const DexCode* pCode) {
+    DexCatchTableMap* pMap = getCatchTableMap(pDexFile);
+
+    if (pMap == NULL) {
+        return NULL;
+    }
+
+    u4 codeOff = (u4) ((const u1*) pCode - pDexFile->baseAddr);
+    u4 mask = (u4) (((u8) 1 << (32 - pMap->shift)) - 1);
+    u4 index = (u4) ((codeOff * 0x9e3779b1u) >> pMap->shift) & mask;
+    DexCatchTableSlot* pSlot = NULL;
+    u4 probes;
+
+    /* find the slot for "codeOff", claiming a free one if need be */
+    for (probes = 0; probes <= mask; probes++) {
+        DexCatchTableSlot* pCandidate = &pMap->slots[index];
+        u4 key = __atomic_load_n(&pCandidate->codeOff, __ATOMIC_ACQUIRE);
+
+        if (key == 0 && __sync_bool_compare_and_swap(&pCandidate->codeOff,
+                0, codeOff)) {
+            key = codeOff;
+        } else if (key == 0) {
+            key = __atomic_load_n(&pCandidate->codeOff, __ATOMIC_ACQUIRE);
+        }
+
+        if (key == codeOff) {
+            pSlot = pCandidate;
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (pSlot == NULL) {
+        ALOGW("Catch table map full (%u slots)", mask + 1);
+        return NULL;
+    }
+
+    DexCatchTable* pTable = __atomic_load_n(&pSlot->pTable, __ATOMIC_ACQUIRE);
+
+    if (pTable != NULL) {
+        return pTable;
+    }
+
+    pTable = buildCatchTable(pCode);
+    if (pTable == NULL) {
+        return NULL;
+    }
+
+    if (!__sync_bool_compare_and_swap(&pSlot->pTable, NULL, pTable)) {
+        free(pTable);
+        pTable = __atomic_load_n(&pSlot->pTable, __ATOMIC_ACQUIRE);
+    }
+
+    return pTable;
+}
+
+/* (documented in header file) */
+void dexFreeCatchTables(DexFile* pDexFile) {
+    DexCatchTableMap* pMap = pDexFile->pCatchTables;
+    u4 numSlots;
+    u4 i;
+
+    if (pMap == NULL) {
+        return;
+    }
+
+    numSlots = (u4) ((u8) 1 << (32 - pMap->shift));
+    for (i = 0; i < numSlots; i++) {
+        free(pMap->slots[i].pTable);
+    }
+
+    free(pMap);
+    pDexFile->pCatchTables = NULL;
+}
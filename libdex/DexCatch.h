@@ -159,4 +159,83 @@ DEX_INLINE bool dexFindCatchHandler(DexCatchIterator *pIterator,
     }
 }
 
+/*
+ * One try block of a DexCatchTable, with its handlers.
+ */
+struct DexCatchRange {
+    u4          startAddr;      /* first covered code unit */
+    u4          endAddr;        /* one past the last covered code unit */
+    u4          firstHandler;   /* index into the table's handlers[] */
+    u4          handlerCount;
+};
+
+/*
+ * The try/catch information of one code item, fully decoded. Handlers
+ * are in the order they're tried; a catch-all has a typeIdx of
+ * kDexNoIndex and comes last. Try blocks that share a handler list
+ * share its entries in handlers[].
+ */
+struct DexCatchTable {
+    u4                      codeSize;   /* as from dexGetDexCodeSize() */
+    u4                      rangesSize;
+    const DexCatchRange*    ranges;     /* sorted by address, like tries */
+    const DexCatchHandler*  handlers;
+};
+
+/*
+ * Get the decoded try/catch information of "pCode", which must be in
+ * "pDexFile" and have been verified. The table is built the first time
+ * it's asked for, and kept in a side table of "pDexFile" keyed by the
+ * code item's offset, so later calls neither allocate nor decode any
+ * uleb128s. It stays valid until the DexFile is freed. Safe to call from
+ * multiple threads at once.
+ *
+ * Finding the table costs a hash lookup, so this pays off for callers
+ * that look at many addresses of a method, or come back to it often; a
+ * one-off lookup is cheaper with dexFindCatchHandler(). The side table
+ * has two slots per method id, allocated on first use.
+ *
+ * Returns NULL if memory couldn't be allocated, or if the side table is
+ * full (which only happens if more code items are asked for than the
+ * file has method ids).
+ */
+const DexCatchTable* dexGetCatchTable(const DexFile* pDexFile,
+    const DexCode* pCode);
+
+/*
+ * Free the decoded catch tables of the given DexFile, if it has any.
+ * Called from dexFileFree().
+ */
+void dexFreeCatchTables(DexFile* pDexFile);
+
+/*
+ * Find the handlers that apply to the given address. Returns a pointer to
+ * the first one and sets "*pCount", or returns NULL if the address isn't
+ * covered by a try block. Equivalent to dexFindCatchHandler() followed by
+ * iteration, but without decoding anything.
+ */
+DEX_INLINE const DexCatchHandler* dexCatchTableFind(
+        const DexCatchTable* pTable, u4 address, u4* pCount) {
+    const DexCatchRange* ranges = pTable->ranges;
+    // Note: Signed type is important for max and min.
+    int min = 0;
+    int max = (int) pTable->rangesSize - 1;
+
+    while (max >= min) {
+        int guess = (min + max) >> 1;
+        const DexCatchRange* pRange = &ranges[guess];
+
+        if (address < pRange->startAddr) {
+            max = guess - 1;
+        } else if (address >= pRange->endAddr) {
+            min = guess + 1;
+        } else {
+            *pCount = pRange->handlerCount;
+            return &pTable->handlers[pRange->firstHandler];
+        }
+    }
+
+    return NULL;
+}
+
 #endif  // LIBDEX_DEXCATCH_H_
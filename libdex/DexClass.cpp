@@ -18,6 +18,7 @@
  * Functions to deal with class definition structures in DEX files
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "DexClass.h"
@@ -41,12 +42,9 @@ static bool verifyUlebs(const u1* pData, const u1* pLimit, u4 count) {
  * returns an "okay" flag (that is, false == failure). */
 bool dexReadAndVerifyClassDataHeader(const u1** pData, const u1* pLimit,
         DexClassDataHeader *pHeader) {
-    if (! verifyUlebs(*pData, pLimit, 4)) {
-        return false;
-    }
-
-    dexReadClassDataHeader(pData, pHeader);
-    return true;
+    /* the header is four u4s in encoded order */
+    return readAndVerifyUnsignedLeb128Array(pData, pLimit, (u4*) pHeader,
+            sizeof(*pHeader) / sizeof(u4));
 }
 
 /* Read and verify an encoded_field. This updates the
@@ -91,6 +89,107 @@ bool dexReadAndVerifyClassDataMethod(const u1** pData, const u1* pLimit,
     return true;
 }
 
+/* Read and verify a list of "count" encoded_field or encoded_method
+ * items into "out", which is viewed as an array of the DexField or
+ * DexMethod structs that they expand to. Those are made of "width"
+ * u4s in the same order as the values in the encoded form, so the
+ * whole list is decoded in one pass and then the index deltas are
+ * turned into indices. */
+static bool readAndVerifyMemberList(const u1** pData, const u1* pLimit,
+        u4* out, u4 count, u4 width) {
+    u4 index = 0;
+    u4 i;
+
+    if (count > SIZE_MAX / width) {
+        return false;
+    }
+
+    if (! readAndVerifyUnsignedLeb128Array(pData, pLimit, out,
+            (size_t) count * width)) {
+        return false;
+    }
+
+    for (i = 0; i < count; i++, out += width) {
+        index += out[0];
+        out[0] = index;
+    }
+
+    return true;
+}
+
+/* (documented in header file) */
+size_t dexClassDataSize(const DexClassDataHeader* pHeader) {
+    /* four u4 counts times at most 12 bytes can't overflow a u8 */
+    u8 size = sizeof(DexClassData) +
+        ((u8) pHeader->staticFieldsSize * sizeof(DexField)) +
+        ((u8) pHeader->instanceFieldsSize * sizeof(DexField)) +
+        ((u8) pHeader->directMethodsSize * sizeof(DexMethod)) +
+        ((u8) pHeader->virtualMethodsSize * sizeof(DexMethod));
+
+    return (size > SIZE_MAX) ? 0 : (size_t) size;
+}
+
+/* (documented in header file) */
+bool dexClassDataMembersFit(const DexClassDataHeader* pHeader,
+        const u1* pData, const u1* pLimit) {
+    if (pLimit == NULL) {
+        return true;
+    }
+
+    u8 minBytes = 2 * ((u8) pHeader->staticFieldsSize +
+            pHeader->instanceFieldsSize + pHeader->directMethodsSize +
+            pHeader->virtualMethodsSize);
+    return pData <= pLimit && minBytes <= (u8) (pLimit - pData);
+}
+
+/* (documented in header file) */
+bool dexReadAndVerifyClassDataMembers(const u1** pData, const u1* pLimit,
+        const DexClassDataHeader* pHeader, DexClassData* pResult) {
+    u1* ptr = ((u1*) pResult) + sizeof(DexClassData);
+
+    pResult->header = *pHeader;
+
+    if (pHeader->staticFieldsSize != 0) {
+        pResult->staticFields = (DexField*) ptr;
+        ptr += pHeader->staticFieldsSize * sizeof(DexField);
+    } else {
+        pResult->staticFields = NULL;
+    }
+
+    if (pHeader->instanceFieldsSize != 0) {
+        pResult->instanceFields = (DexField*) ptr;
+        ptr += pHeader->instanceFieldsSize * sizeof(DexField);
+    } else {
+        pResult->instanceFields = NULL;
+    }
+
+    if (pHeader->directMethodsSize != 0) {
+        pResult->directMethods = (DexMethod*) ptr;
+        ptr += pHeader->directMethodsSize * sizeof(DexMethod);
+    } else {
+        pResult->directMethods = NULL;
+    }
+
+    if (pHeader->virtualMethodsSize != 0) {
+        pResult->virtualMethods = (DexMethod*) ptr;
+    } else {
+        pResult->virtualMethods = NULL;
+    }
+
+    return readAndVerifyMemberList(pData, pLimit,
+                (u4*) pResult->staticFields, pHeader->staticFieldsSize,
+                sizeof(DexField) / sizeof(u4))
+        && readAndVerifyMemberList(pData, pLimit,
+                (u4*) pResult->instanceFields, pHeader->instanceFieldsSize,
+                sizeof(DexField) / sizeof(u4))
+        && readAndVerifyMemberList(pData, pLimit,
+                (u4*) pResult->directMethods, pHeader->directMethodsSize,
+                sizeof(DexMethod) / sizeof(u4))
+        && readAndVerifyMemberList(pData, pLimit,
+                (u4*) pResult->virtualMethods, pHeader->virtualMethodsSize,
+                sizeof(DexMethod) / sizeof(u4));
+}
+
 /* Read, verify, and return an entire class_data_item. This updates
  * the given data pointer to point past the end of the read data. This
  * function allocates a single chunk of memory for the result, which
@@ -103,7 +202,6 @@ bool dexReadAndVerifyClassDataMethod(const u1** pData, const u1* pLimit,
  * are valid. */
 DexClassData* dexReadAndVerifyClassData(const u1** pData, const u1* pLimit) {
     DexClassDataHeader header;
-    u4 lastIndex;
 
     if (*pData == NULL) {
         DexClassData* result = (DexClassData*) malloc(sizeof(DexClassData));
@@ -115,75 +213,22 @@ DexClassData* dexReadAndVerifyClassData(const u1** pData, const u1* pLimit) {
         return NULL;
     }
 
-    size_t resultSize = sizeof(DexClassData) +
-        (header.staticFieldsSize * sizeof(DexField)) +
-        (header.instanceFieldsSize * sizeof(DexField)) +
-        (header.directMethodsSize * sizeof(DexMethod)) +
-        (header.virtualMethodsSize * sizeof(DexMethod));
-
-    DexClassData* result = (DexClassData*) malloc(resultSize);
-    u1* ptr = ((u1*) result) + sizeof(DexClassData);
-    bool okay = true;
-    u4 i;
-
-    if (result == NULL) {
+    if (! dexClassDataMembersFit(&header, *pData, pLimit)) {
         return NULL;
     }
 
-    result->header = header;
-
-    if (header.staticFieldsSize != 0) {
-        result->staticFields = (DexField*) ptr;
-        ptr += header.staticFieldsSize * sizeof(DexField);
-    } else {
-        result->staticFields = NULL;
-    }
-
-    if (header.instanceFieldsSize != 0) {
-        result->instanceFields = (DexField*) ptr;
-        ptr += header.instanceFieldsSize * sizeof(DexField);
-    } else {
-        result->instanceFields = NULL;
-    }
-
-    if (header.directMethodsSize != 0) {
-        result->directMethods = (DexMethod*) ptr;
-        ptr += header.directMethodsSize * sizeof(DexMethod);
-    } else {
-        result->directMethods = NULL;
-    }
-
-    if (header.virtualMethodsSize != 0) {
-        result->virtualMethods = (DexMethod*) ptr;
-    } else {
-        result->virtualMethods = NULL;
-    }
-
-    lastIndex = 0;
-    for (i = 0; okay && (i < header.staticFieldsSize); i++) {
-        okay = dexReadAndVerifyClassDataField(pData, pLimit,
-                &result->staticFields[i], &lastIndex);
+    size_t size = dexClassDataSize(&header);
+    if (size == 0) {
+        return NULL;
     }
 
-    lastIndex = 0;
-    for (i = 0; okay && (i < header.instanceFieldsSize); i++) {
-        okay = dexReadAndVerifyClassDataField(pData, pLimit,
-                &result->instanceFields[i], &lastIndex);
-    }
+    DexClassData* result = (DexClassData*) malloc(size);
 
-    lastIndex = 0;
-    for (i = 0; okay && (i < header.directMethodsSize); i++) {
-        okay = dexReadAndVerifyClassDataMethod(pData, pLimit,
-                &result->directMethods[i], &lastIndex);
-    }
-
-    lastIndex = 0;
-    for (i = 0; okay && (i < header.virtualMethodsSize); i++) {
-        okay = dexReadAndVerifyClassDataMethod(pData, pLimit,
-                &result->virtualMethods[i], &lastIndex);
+    if (result == NULL) {
+        return NULL;
     }
 
-    if (! okay) {
+    if (! dexReadAndVerifyClassDataMembers(pData, pLimit, &header, result)) {
         free(result);
         return NULL;
     }
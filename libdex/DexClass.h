@@ -90,6 +90,30 @@ bool dexReadAndVerifyClassDataField(const u1** pData, const u1* pLimit,
 bool dexReadAndVerifyClassDataMethod(const u1** pData, const u1* pLimit,
         DexMethod* pMethod, u4* lastIndex);
 
+/* Return the number of bytes needed to hold the DexClassData (plus its
+ * member arrays) for a class_data_item with the given header, or 0 if
+ * that doesn't fit in a size_t. */
+size_t dexClassDataSize(const DexClassDataHeader* pHeader);
+
+/* Every encoded member of a class_data_item takes at least two bytes.
+ * Return false if the member counts in the given header can't possibly
+ * fit in the bytes from pData up to pLimit (which may be NULL, for no
+ * limit). The counts are untrusted until this passes, so check it
+ * before allocating anything based on them. */
+bool dexClassDataMembersFit(const DexClassDataHeader* pHeader,
+        const u1* pData, const u1* pLimit);
+
+/* Read and verify the member lists of a class_data_item whose header
+ * has already been read with dexReadAndVerifyClassDataHeader(), into
+ * caller-supplied memory of at least dexClassDataSize() bytes. This
+ * updates the given data pointer to point past the end of the read
+ * data and returns an "okay" flag (that is, false == failure).
+ *
+ * This is the non-allocating half of dexReadAndVerifyClassData(), for
+ * callers with memory of their own to decode into. */
+bool dexReadAndVerifyClassDataMembers(const u1** pData, const u1* pLimit,
+        const DexClassDataHeader* pHeader, DexClassData* pResult);
+
 /* Read, verify, and return an entire class_data_item. This updates
  * the given data pointer to point past the end of the read data. This
  * function allocates a single chunk of memory for the result, which
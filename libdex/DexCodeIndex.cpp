@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Mapping from code offsets back to the methods that own them.
+ */
+#include "DexCodeIndex.h"
+#include "DexClass.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/*
+ * A method's insns range, while the index is being built.
+ */
+struct CodeRange {
+    u4                  start;      /* file offset of insns */
+    DexCodeIndexEntry   entry;
+};
+
+static int compareCodeRanges(const void* a, const void* b)
+{
+    u4 start1 = ((const CodeRange*) a)->start;
+    u4 start2 = ((const CodeRange*) b)->start;
+
+    return (start1 > start2) - (start1 < start2);
+}
+
+/*
+ * Add the ranges for the methods in "pMethods" to "ranges".
+ */
+static void addCodeRanges(const DexFile* pDexFile, u4 classDefIdx,
+    const DexMethod* pMethods, u4 count, CodeRange* ranges, u4* pNumRanges)
+{
+    u4 i;
+
+    for (i = 0; i < count; i++) {
+        const DexMethod* pMethod = &pMethods[i];
+        const DexCode* pCode = dexGetCode(pDexFile, pMethod);
+        CodeRange* pRange;
+
+        if (pCode == NULL || pCode->insnsSize == 0)
+            continue;
+
+        pRange = &ranges[(*pNumRanges)++];
+        pRange->start = pMethod->codeOff + offsetof(DexCode, insns);
+        pRange->entry.insnsSize = pCode->insnsSize;
+        pRange->entry.classDefIdx = classDefIdx;
+        pRange->entry.methodIdx = pMethod->methodIdx;
+        pRange->entry.codeOffset = pMethod->codeOff;
+    }
+}
+
+/*
+ * Lay out the sorted "ranges" in Eytzinger order, filling in the subtree
+ * rooted at "k".  Returns the index of the next range to place.
+ */
+static u4 layOutCodeIndex(const CodeRange* ranges, u4 next, u4 k, u4 n,
+    u4* keys, DexCodeIndexEntry* entries)
+{
+    if (k <= n) {
+        next = layOutCodeIndex(ranges, next, 2 * k, n, keys, entries);
+        keys[k] = ranges[next].start;
+        entries[k] = ranges[next].entry;
+        next++;
+        next = layOutCodeIndex(ranges, next, 2 * k + 1, n, keys, entries);
+    }
+    return next;
+}
+
+/* (documented in header) */
+DexCodeIndex* dexCreateCodeIndex(const DexFile* pDexFile)
+{
+    const u1* fileEnd = pDexFile->baseAddr + pDexFile->pHeader->fileSize;
+    u4 classDefsSize = pDexFile->pHeader->classDefsSize;
+    DexCodeIndex* pIndex = NULL;
+    CodeRange* ranges = NULL;
+    u4 numRanges = 0;
+    u4 capacity = 0;
+    u4 i, numEntries, keySlots;
+    size_t allocSize;
+
+    for (i = 0; i < classDefsSize; i++) {
+        const DexClassDef* pClassDef = dexGetClassDef(pDexFile, i);
+        const u1* pEncodedData = dexGetClassData(pDexFile, pClassDef);
+        DexClassData* pClassData;
+        u4 numMethods;
+
+        if (pEncodedData == NULL)
+            continue;
+
+        pClassData = dexReadAndVerifyClassData(&pEncodedData, fileEnd);
+        if (pClassData == NULL) {
+            ALOGE("Trouble reading class data for class def %u", i);
+            goto bail;
+        }
+
+        numMethods = pClassData->header.directMethodsSize
+            + pClassData->header.virtualMethodsSize;
+        if (numRanges + numMethods > capacity) {
+            u4 newCapacity = (capacity == 0) ? 256 : capacity * 2;
+            while (newCapacity < numRanges + numMethods)
+                newCapacity *= 2;
+
+            CodeRange* newRanges = (CodeRange*) realloc(ranges,
+                newCapacity * sizeof(CodeRange));
+            if (newRanges == NULL) {
+                free(pClassData);
+                goto bail;
+            }
+            ranges = newRanges;
+            capacity = newCapacity;
+        }
+
+        addCodeRanges(pDexFile, i, pClassData->directMethods,
+            pClassData->header.directMethodsSize, ranges, &numRanges);
+        addCodeRanges(pDexFile, i, pClassData->virtualMethods,
+            pClassData->header.virtualMethodsSize, ranges, &numRanges);
+        free(pClassData);
+    }
+
+    qsort(ranges, numRanges, sizeof(CodeRange), compareCodeRanges);
+
+    /* a code_item could be shared; the first method to claim it wins */
+    numEntries = 0;
+    for (i = 0; i < numRanges; i++) {
+        if (numEntries == 0 || ranges[i].start != ranges[numEntries-1].start)
+            ranges[numEntries++] = ranges[i];
+    }
+
+    keySlots = (numEntries + 1 + 1) & ~1;
+    allocSize = sizeof(DexCodeIndex) + keySlots * sizeof(u4)
+        + (numEntries + 1) * sizeof(DexCodeIndexEntry);
+    pIndex = (DexCodeIndex*) calloc(1, allocSize);
+    if (pIndex == NULL)
+        goto bail;
+    pIndex->size = allocSize;
+    pIndex->version = kDexCodeIndexVersion;
+    pIndex->numEntries = numEntries;
+
+    layOutCodeIndex(ranges, 0, 1, numEntries,
+        (u4*) dexCodeIndexKeys(pIndex),
+        (DexCodeIndexEntry*) dexCodeIndexEntries(pIndex));
+
+    ALOGV("Code index: methods=%u alloc=%zu", numEntries, allocSize);
+
+bail:
+    free(ranges);
+    return pIndex;
+}
+
+/* (documented in header) */
+bool dexCodeIndexIsValid(const DexCodeIndex* pIndex, u4 size, u4 dexLength)
+{
+    if (size < sizeof(DexCodeIndex)) {
+        ALOGE("Undersized code index (%u)", size);
+        return false;
+    }
+
+    if (pIndex->size > size) {
+        ALOGE("Bogus code index size (%u in %u)", pIndex->size, size);
+        return false;
+    }
+
+    if (pIndex->version != kDexCodeIndexVersion) {
+        ALOGW("Ignoring code index with unknown version %u",
+            pIndex->version);
+        return false;
+    }
+
+    u8 keySlots = ((u8) pIndex->numEntries + 1 + 1) & ~1ULL;
+    u8 needed = sizeof(DexCodeIndex) + keySlots * sizeof(u4)
+        + ((u8) pIndex->numEntries + 1) * sizeof(DexCodeIndexEntry);
+    if (needed > pIndex->size) {
+        ALOGE("Bogus code index numEntries (%u)", pIndex->numEntries);
+        return false;
+    }
+
+    /*
+     * dexFindCodeLocation() hands back pointers computed from these, so
+     * they have to be checked once here rather than trusted.
+     */
+    const u4* keys = dexCodeIndexKeys(pIndex);
+    const DexCodeIndexEntry* entries = dexCodeIndexEntries(pIndex);
+    u4 i;
+
+    for (i = 1; i <= pIndex->numEntries; i++) {
+        u8 insnsStart = (u8) entries[i].codeOffset + offsetof(DexCode, insns);
+        if (keys[i] != insnsStart
+                || insnsStart + (u8) entries[i].insnsSize * 2 > dexLength) {
+            ALOGE("Bogus code index entry %u (code @ %#x, %u units)", i,
+                entries[i].codeOffset, entries[i].insnsSize);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* (documented in header) */
+bool dexFindCodeLocation(const DexFile* pDexFile, u4 offset,
+    DexCodeLocation* pLoc)
+{
+    const DexCodeIndex* pIndex = pDexFile->pCodeIndex;
+    const u4* keys = dexCodeIndexKeys(pIndex);
+    u4 n = pIndex->numEntries;
+    u4 k = 1;
+    u4 best = 0;
+
+    /*
+     * Find the last range that starts at or before "offset".  Going left
+     * or right is a conditional move rather than a branch, so the search
+     * costs the same no matter where it ends up.
+     */
+    while (k <= n) {
+        bool atOrBefore = (keys[k] <= offset);
+        best = atOrBefore ? k : best;
+        k = 2 * k + atOrBefore;
+    }
+
+    if (best == 0)
+        return false;
+
+    const DexCodeIndexEntry* pEntry = &dexCodeIndexEntries(pIndex)[best];
+    u4 byteOffset = offset - keys[best];
+    if (byteOffset / 2 >= pEntry->insnsSize)
+        return false;
+
+    pLoc->classDefIdx = pEntry->classDefIdx;
+    pLoc->methodIdx = pEntry->methodIdx;
+    pLoc->dexPc = byteOffset / 2;
+    pLoc->pCode = (const DexCode*) (pDexFile->baseAddr + pEntry->codeOffset);
+    return true;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Mapping from code offsets back to the methods that own them.
+ */
+#ifndef LIBDEX_DEXCODEINDEX_H_
+#define LIBDEX_DEXCODEINDEX_H_
+
+#include "DexFile.h"
+
+/*
+ * Where a code offset was found.
+ */
+struct DexCodeLocation {
+    u4              classDefIdx;
+    u4              methodIdx;
+    u4              dexPc;          /* in code units from the start of insns */
+    const DexCode*  pCode;
+};
+
+/*
+ * Get the keys of a code index (slot 0 is unused).
+ */
+DEX_INLINE const u4* dexCodeIndexKeys(const DexCodeIndex* pIndex)
+{
+    return (const u4*) (pIndex + 1);
+}
+
+/*
+ * Get the entries of a code index (slot 0 is unused).
+ */
+DEX_INLINE const DexCodeIndexEntry* dexCodeIndexEntries(
+    const DexCodeIndex* pIndex)
+{
+    u4 keySlots = (pIndex->numEntries + 1 + 1) & ~1;
+    return (const DexCodeIndexEntry*) (dexCodeIndexKeys(pIndex) + keySlots);
+}
+
+/*
+ * Build the code index for a DEX file, by reading the class_data of
+ * every class.  The result can be stored in a kDexChunkCodeIndex chunk
+ * as-is, or set as pDexFile->pCodeIndex; either way the caller frees it.
+ *
+ * Returns NULL on failure.
+ */
+DexCodeIndex* dexCreateCodeIndex(const DexFile* pDexFile);
+
+/*
+ * Check a code index that is "size" bytes long, for a DEX file that is
+ * "dexLength" bytes long: the header, and that every entry's insns lie
+ * within the file where its key says they start.  Returns false (and
+ * logs) if it is malformed or has a version we don't understand.
+ */
+bool dexCodeIndexIsValid(const DexCodeIndex* pIndex, u4 size, u4 dexLength);
+
+/*
+ * Find the method whose insns contain the byte at "offset" (from the
+ * start of the DEX file), using pDexFile->pCodeIndex, which must be set.
+ *
+ * Returns false if the offset isn't in any method's insns.
+ */
+bool dexFindCodeLocation(const DexFile* pDexFile, u4 offset,
+    DexCodeLocation* pLoc);
+
+/*
+ * Like dexFindCodeLocation(), for a pointer into the mapped DEX file.
+ */
+DEX_INLINE bool dexFindCodeLocationByAddr(const DexFile* pDexFile,
+    const void* addr, DexCodeLocation* pLoc)
+{
+    const u1* ptr = (const u1*) addr;
+
+    if (ptr < pDexFile->baseAddr
+            || (size_t) (ptr - pDexFile->baseAddr) > 0xffffffff)
+        return false;
+    return dexFindCodeLocation(pDexFile, ptr - pDexFile->baseAddr, pLoc);
+}
+
+#endif  // LIBDEX_DEXCODEINDEX_H_
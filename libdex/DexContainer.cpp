@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Multi-dex archive access.
+ */
+#include "DexContainer.h"
+#include "ZipArchive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Per-entry state for the parallel load.
+ */
+struct LoadTask {
+    const char*         fileName;
+    DexContainerEntry*  pEntry;
+    int                 parseFlags;
+    bool                mapIsExtracted; /* expanded into anonymous memory */
+    UnzipToFileResult   result;
+};
+
+/*
+ * Get the archive entry name of the "index"th DEX file, counting from 0.
+ */
+static void getEntryName(size_t index, char* buf, size_t bufLen)
+{
+    if (index == 0) {
+        snprintf(buf, bufLen, "classes.dex");
+    } else {
+        snprintf(buf, bufLen, "classes%zu.dex", index + 1);
+    }
+}
+
+/*
+ * Make the contents of an archive entry available in "pMap", mapping it
+ * straight from the archive if possible. "*pIsExtracted" is set if it
+ * had to be expanded into anonymous memory instead.
+ *
+ * Returns 0 on success.
+ */
+static int mapEntry(ZipArchiveHandle archive, ZipEntry* pEntry,
+    MemMapping* pMap, bool* pIsExtracted)
+{
+    size_t length = pEntry->uncompressed_length;
+
+    /* private, because verification can write to it */
+    if (dexZipEntryIsMappable(pEntry)) {
+        *pIsExtracted = false;
+        return sysMapFileSegmentWritableReadOnly(dexZipGetArchiveFd(archive),
+            pEntry->offset, length, pMap);
+    }
+
+    *pIsExtracted = true;
+    if (length == 0 || sysCreatePrivateMap(length, pMap) != 0)
+        return -1;
+
+    if (dexZipExtractEntryToMemory(archive, pEntry, (u1*) pMap->addr,
+            length) != 0) {
+        sysReleaseShmem(pMap);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Verify and parse one DEX file, and give it a class lookup table.
+ * Called from sysRunParallel().
+ */
+static void loadEntry(void* arg, size_t index)
+{
+    LoadTask* pTask = &((LoadTask*) arg)[index];
+    DexContainerEntry* pEntry = pTask->pEntry;
+    MemMapping* pMap = &pEntry->map;
+
+    /*
+     * A stored entry is a private (copy-on-write) mapping of the archive,
+     * mapped read-only; an extracted one is already writable.
+     */
+    if (!pTask->mapIsExtracted)
+        sysChangeMapAccess(pMap->addr, pMap->length, true, pMap);
+
+    if (dexSwapAndVerifyIfNecessary((u1*) pMap->addr, pMap->length)) {
+        fprintf(stderr, "ERROR: Failed structural verification of '%s!%s'\n",
+            pTask->fileName, pEntry->name);
+        pTask->result = kUTFRBadDex;
+        return;
+    }
+
+    sysChangeMapAccess(pMap->addr, pMap->length, false, pMap);
+
+    pEntry->pDexFile = dexFileParse((const u1*) pMap->addr, pMap->length,
+        pTask->parseFlags);
+    if (pEntry->pDexFile == NULL) {
+        fprintf(stderr, "ERROR: DEX parse of '%s!%s' failed\n",
+            pTask->fileName, pEntry->name);
+        pTask->result = kUTFRBadDex;
+        return;
+    }
+
+    if (pEntry->pDexFile->pClassLookup2 == NULL) {
+        pEntry->pClassLookup = dexCreateClassLookup2(pEntry->pDexFile);
+        if (pEntry->pClassLookup == NULL) {
+            pTask->result = kUTFRGenericFailure;
+            return;
+        }
+        pEntry->pDexFile->pClassLookup2 = pEntry->pClassLookup;
+    }
+
+    pTask->result = kUTFRSuccess;
+}
+
+/* (documented in header file) */
+UnzipToFileResult dexContainerOpen(const char* fileName, int parseFlags,
+    int numThreads, bool quiet, DexContainer** ppContainer)
+{
+    UnzipToFileResult result = kUTFRSuccess;
+    DexContainer* pContainer = NULL;
+    LoadTask* tasks = NULL;
+    size_t capacity = 0;
+    ZipArchiveHandle archive;
+    bool archiveOpen = false;
+    size_t i;
+
+    /* the handle needs to be closed even if the open fails */
+    archiveOpen = true;
+    if (dexZipOpenArchive(fileName, &archive) != 0) {
+        if (!quiet) {
+            fprintf(stderr, "Unable to open '%s' as zip archive\n", fileName);
+        }
+        result = kUTFRNotZip;
+        goto bail;
+    }
+
+    pContainer = (DexContainer*) calloc(1, sizeof(DexContainer));
+    if (pContainer == NULL) {
+        result = kUTFRGenericFailure;
+        goto bail;
+    }
+
+    /*
+     * Find and map the entries. This part is serial, since the archive
+     * handle can't be shared between threads.
+     */
+    while (true) {
+        char name[kDexContainerMaxNameLen];
+        ZipEntry entry;
+
+        getEntryName(pContainer->numEntries, name, sizeof(name));
+        if (dexZipFindEntry(archive, name, &entry) != 0)
+            break;
+
+        if (pContainer->numEntries == capacity) {
+            size_t newCapacity = (capacity == 0) ? 4 : capacity * 2;
+            DexContainerEntry* newEntries = (DexContainerEntry*) realloc(
+                pContainer->entries, newCapacity * sizeof(DexContainerEntry));
+            LoadTask* newTasks = (LoadTask*) realloc(tasks,
+                newCapacity * sizeof(LoadTask));
+
+            if (newEntries != NULL)
+                pContainer->entries = newEntries;
+            if (newTasks != NULL)
+                tasks = newTasks;
+            if (newEntries == NULL || newTasks == NULL) {
+                result = kUTFRGenericFailure;
+                goto bail;
+            }
+            capacity = newCapacity;
+        }
+
+        DexContainerEntry* pEntry =
+            &pContainer->entries[pContainer->numEntries];
+        LoadTask* pTask = &tasks[pContainer->numEntries];
+
+        memset(pEntry, 0, sizeof(*pEntry));
+        strcpy(pEntry->name, name);
+        pContainer->numEntries++;
+
+        if (mapEntry(archive, &entry, &pEntry->map,
+                &pTask->mapIsExtracted) != 0) {
+            if (!quiet) {
+                fprintf(stderr, "Extract of '%s' from '%s' failed\n",
+                    name, fileName);
+            }
+            result = kUTFRBadZip;
+            goto bail;
+        }
+
+        pTask->fileName = fileName;
+        pTask->pEntry = pEntry;
+        pTask->parseFlags = parseFlags;
+        pTask->result = kUTFRGenericFailure;
+    }
+
+    /* the mappings don't depend on the archive staying open */
+    dexZipCloseArchive(archive);
+    archiveOpen = false;
+
+    if (pContainer->numEntries == 0) {
+        if (!quiet) {
+            fprintf(stderr, "Unable to find 'classes.dex' in '%s'\n",
+                fileName);
+        }
+        result = kUTFRNoClassesDex;
+        goto bail;
+    }
+
+    sysRunParallel(pContainer->numEntries, numThreads, loadEntry, tasks);
+
+    for (i = 0; i < pContainer->numEntries; i++) {
+        if (tasks[i].result != kUTFRSuccess) {
+            result = tasks[i].result;
+            goto bail;
+        }
+    }
+
+    *ppContainer = pContainer;
+    pContainer = NULL;
+
+bail:
+    if (archiveOpen)
+        dexZipCloseArchive(archive);
+    dexContainerFree(pContainer);
+    free(tasks);
+    return result;
+}
+
+/* (documented in header file) */
+void dexContainerFree(DexContainer* pContainer)
+{
+    size_t i;
+
+    if (pContainer == NULL)
+        return;
+
+    for (i = 0; i < pContainer->numEntries; i++) {
+        DexContainerEntry* pEntry = &pContainer->entries[i];
+
+        dexFileFree(pEntry->pDexFile);
+        free(pEntry->pClassLookup);
+        sysReleaseShmem(&pEntry->map);
+    }
+
+    free(pContainer->entries);
+    free(pContainer);
+}
+
+/* (documented in header file) */
+const DexClassDef* dexContainerFindClass(const DexContainer* pContainer,
+    const char* descriptor, const DexFile** ppDexFile)
+{
+    size_t i;
+
+    for (i = 0; i < pContainer->numEntries; i++) {
+        const DexFile* pDexFile = pContainer->entries[i].pDexFile;
+        const DexClassDef* pClassDef = dexFindClass(pDexFile, descriptor);
+
+        if (pClassDef != NULL) {
+            if (ppDexFile != NULL)
+                *ppDexFile = pDexFile;
+            return pClassDef;
+        }
+    }
+
+    return NULL;
+}
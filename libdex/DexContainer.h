@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Access to all of the DEX files in a multi-dex archive (classes.dex,
+ * classes2.dex, ..., classesN.dex) as one logical container.
+ */
+#ifndef LIBDEX_DEXCONTAINER_H_
+#define LIBDEX_DEXCONTAINER_H_
+
+#include "DexFile.h"
+#include "CmdUtils.h"
+#include "SysUtil.h"
+
+/* big enough for "classes<N>.dex" */
+enum { kDexContainerMaxNameLen = 32 };
+
+/*
+ * One of the DEX files in a container.
+ */
+struct DexContainerEntry {
+    char            name[kDexContainerMaxNameLen];  /* entry name in archive */
+    MemMapping      map;
+    DexFile*        pDexFile;
+    DexClassLookup2* pClassLookup;     /* ours to free; NULL if from file */
+};
+
+struct DexContainer {
+    size_t              numEntries;
+    DexContainerEntry*  entries;        /* classes.dex first, then 2..N */
+};
+
+/*
+ * Open the archive "fileName" and load classes.dex, classes2.dex, and so
+ * on, up to the first number that is missing. Each entry is mapped
+ * directly out of the archive if it is stored uncompressed and aligned,
+ * and extracted into anonymous memory otherwise; no temp files are used.
+ *
+ * Structural verification and parsing (with dexFileParse() "parseFlags")
+ * are done on up to "numThreads" threads.  Every DexFile gets a class
+ * lookup table, so dexContainerFindClass() works across all of them.
+ *
+ * If "quiet" is set, don't report problems with the archive itself.  A
+ * DEX file that fails verification or parsing is always reported, along
+ * with the messages from the verifier.
+ *
+ * Returns 0 (kUTFRSuccess) and sets "*ppContainer" on success.
+ * Returns kUTFRNotZip if the file isn't an archive, kUTFRNoClassesDex if
+ * it has no classes.dex, and kUTFRBadDex if a DEX file in it is bad.
+ */
+UnzipToFileResult dexContainerOpen(const char* fileName, int parseFlags,
+    int numThreads, bool quiet, DexContainer** ppContainer);
+
+/*
+ * Free a container, along with all of its DexFiles and mappings.
+ */
+void dexContainerFree(DexContainer* pContainer);
+
+/*
+ * Find a class definition by descriptor, looking in each DEX file in
+ * order (so that, as at runtime, classes.dex wins over classes2.dex).
+ * If "ppDexFile" is non-NULL, it is set to the DexFile the class was
+ * found in.
+ *
+ * Returns NULL if the class isn't defined anywhere in the container.
+ */
+const DexClassDef* dexContainerFindClass(const DexContainer* pContainer,
+    const char* descriptor, const DexFile** ppDexFile);
+
+#endif  // LIBDEX_DEXCONTAINER_H_
@@ -21,6 +21,16 @@
 #include "DexDataMap.h"
 #include <safe_iop.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Minimum number of items for dexDataMapBuildIndex() to bother. Below
+ * this, the binary search touches only a few cache lines anyway.
+ */
+static const u4 kIndexMinCount = 1024;
+
+/* index type nibble for slots whose items aren't all of one type */
+static const u1 kIndexMixed = 0xf;
 
 /*
  * Allocate and initialize a DexDataMap. Returns NULL on failure.
@@ -52,6 +62,9 @@ DexDataMap* dexDataMapAlloc(u4 maxCount) {
     map->max = maxCount;
     map->offsets = (u4*) (map + 1);
     map->types = (u2*) (map->offsets + maxCount);
+    map->index = NULL;
+    map->indexBase = 0;
+    map->indexSize = 0;
 
     return map;
 }
@@ -60,10 +73,14 @@ DexDataMap* dexDataMapAlloc(u4 maxCount) {
  * Free a DexDataMap.
  */
 void dexDataMapFree(DexDataMap* map) {
+    if (map != NULL) {
+        free(map->index);
+    }
+
     /*
-     * Since everything got allocated together, everything can be freed
-     * in one fell swoop. Also, free(NULL) is a nop (per spec), so we
-     * don't have to worry about an explicit test for that.
+     * Since everything else got allocated together, everything can be
+     * freed in one fell swoop. Also, free(NULL) is a nop (per spec), so
+     * we don't have to worry about an explicit test for that.
      */
     free(map);
 }
@@ -88,6 +105,65 @@ void dexDataMapAdd(DexDataMap* map, u4 offset, u2 type) {
     map->count++;
 }
 
+/*
+ * Map a data section item type to its index nibble: 0..3 for the 0x100x
+ * types and 4..10 for the 0x200x types. Anything else is "mixed", which
+ * sends lookups to the binary search.
+ */
+static u1 indexTypeCode(u2 type) {
+    if ((type & 0xcff8) != 0) {
+        return kIndexMixed;
+    }
+
+    switch (type >> 12) {
+        case 1:  return (type & 7) <= 3 ? (type & 7) : kIndexMixed;
+        case 2:  return (type & 7) <= 6 ? 4 + (type & 7) : kIndexMixed;
+        default: return kIndexMixed;
+    }
+}
+
+/* Inverse of indexTypeCode(), for anything but kIndexMixed. */
+static int indexType(u1 code) {
+    return (code < 4) ? (0x1000 + code) : (0x2000 + code - 4);
+}
+
+/*
+ * Build the dense index for the given map.
+ */
+void dexDataMapBuildIndex(DexDataMap* map) {
+    assert(map != NULL);
+
+    if ((map->index != NULL) || (map->count < kIndexMinCount)) {
+        return;
+    }
+
+    u4 base = map->offsets[0] & ~3;
+    u4 size = map->offsets[map->count - 1] - base + 1;
+    u1* index = (u1*) calloc((size + 3) >> 2, 1);
+    u4 i;
+
+    if (index == NULL) {
+        return;
+    }
+
+    for (i = 0; i < map->count; i++) {
+        u4 rel = map->offsets[i] - base;
+        u1 code = indexTypeCode(map->types[i]);
+        u1* slot = &index[rel >> 2];
+
+        if ((*slot & 0x0f) == 0) {
+            *slot = code << 4;
+        } else if ((*slot >> 4) != code) {
+            *slot |= kIndexMixed << 4;
+        }
+        *slot |= 1 << (rel & 3);
+    }
+
+    map->index = index;
+    map->indexBase = base;
+    map->indexSize = size;
+}
+
 /*
  * Get the type associated with the given offset. This returns -1 if
  * there is no entry for the given offset.
@@ -95,6 +171,24 @@ void dexDataMapAdd(DexDataMap* map, u4 offset, u2 type) {
 int dexDataMapGet(DexDataMap* map, u4 offset) {
     assert(map != NULL);
 
+    if (map->index != NULL) {
+        u4 rel = offset - map->indexBase;
+
+        if (rel >= map->indexSize) {
+            return -1;
+        }
+
+        u1 slot = map->index[rel >> 2];
+
+        if ((slot & (1 << (rel & 3))) == 0) {
+            return -1;
+        }
+
+        if ((slot >> 4) != kIndexMixed) {
+            return indexType(slot >> 4);
+        }
+    }
+
     // Note: Signed type is important for max and min.
     int min = 0;
     int max = map->count - 1;
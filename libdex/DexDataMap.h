@@ -28,6 +28,17 @@ struct DexDataMap {
     u4 max;      /* maximum number of items that may be held */
     u4* offsets; /* array of item offsets */
     u2* types;   /* corresponding array of item types */
+
+    /*
+     * Optional dense index, built by dexDataMapBuildIndex(): one byte
+     * per four bytes of file, starting at offset indexBase. The low
+     * nibble has a bit set for each of the four offsets that starts an
+     * item, and the high nibble encodes the type of those items, or
+     * says that they aren't all the same (so use the offsets array).
+     */
+    u1* index;
+    u4 indexBase;
+    u4 indexSize; /* in bytes of file covered */
 };
 
 /*
@@ -46,6 +57,14 @@ void dexDataMapFree(DexDataMap* map);
  */
 void dexDataMapAdd(DexDataMap* map, u4 offset, u2 type);
 
+/*
+ * Build the dense index for a map that's done being added to, if the map
+ * is big enough for it to be worth the memory: lookups in the index take
+ * constant time, instead of a binary search over all the offsets. If
+ * the index can't be allocated, lookups just stay with the search.
+ */
+void dexDataMapBuildIndex(DexDataMap* map);
+
 /*
  * Get the type associated with the given offset. This returns -1 if
  * there is no entry for the given offset.
@@ -131,10 +131,11 @@ static void emitLocalCbIfLive(void *cnxt, int reg, u4 endAddress,
 
 static void invalidStream(const char* classDescriptor, const DexProto* proto) {
     IF_ALOGE() {
-        char* methodDescriptor = dexProtoCopyMethodDescriptor(proto);
+        const char* methodDescriptor =
+                dexProtoGetInternedMethodDescriptor(proto);
         ALOGE("Invalid debug info stream. class %s; proto %s",
-                classDescriptor, methodDescriptor);
-        free(methodDescriptor);
+                classDescriptor,
+                methodDescriptor != NULL ? methodDescriptor : "?");
     }
 }
 
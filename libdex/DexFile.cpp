@@ -19,6 +19,7 @@
  */
 
 #include "DexFile.h"
+#include "Adler32.h"
 #include "DexOptData.h"
 #include "DexProto.h"
 #include "DexCatch.h"
@@ -26,14 +27,16 @@
 #include "sha1.h"
 #include "ZipArchive.h"
 
-#include <zlib.h>
-
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 
 /*
  * Verifying checksums is good, but it slows things down and causes us to
@@ -261,6 +264,154 @@ DexClassLookup* dexCreateClassLookup(DexFile* pDexFile)
     return pLookup;
 }
 
+/*
+ * Scramble a class descriptor hash for use with DexClassLookup2. The
+ * tag comes from the top 7 bits, the starting group from the bits below
+ * them.
+ */
+static inline u4 classLookup2Mix(u4 hash)
+{
+    return hash * 0x9e3779b1;
+}
+
+static inline u1 classLookup2Tag(u4 mixed)
+{
+    return (u1) (mixed >> 25);
+}
+
+/*
+ * Return a bit mask with bit N set if tags[N] equals "tag", for the
+ * kDexClassLookupGroupSize tags starting at "tags".
+ */
+static inline u4 classLookup2Match(const u1* tags, u1 tag)
+{
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*) tags);
+    return (u4) _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+#else
+    u4 bits = 0;
+    for (int i = 0; i < kDexClassLookupGroupSize; i++) {
+        if (tags[i] == tag)
+            bits |= 1 << i;
+    }
+    return bits;
+#endif
+}
+
+/*
+ * Create the second-generation class lookup table.
+ *
+ * Returns newly-allocated storage.
+ */
+DexClassLookup2* dexCreateClassLookup2(DexFile* pDexFile)
+{
+    DexClassLookup2* pLookup;
+    DexClassLookupEntry* entries;
+    u4 classDefsSize, numEntries, numGroups, allocSize;
+    int totalProbes = 0, maxProbes = 0;
+    u4 i;
+
+    assert(pDexFile != NULL);
+
+    /*
+     * Keep the load factor at or below 7/8. Since a lookup only has to
+     * look at entries whose tags match, a fuller table costs much less
+     * than it would with linear probing.
+     */
+    classDefsSize = pDexFile->pHeader->classDefsSize;
+    numEntries = dexRoundUpPower2(classDefsSize + classDefsSize / 7 + 1);
+    if (numEntries < kDexClassLookupGroupSize)
+        numEntries = kDexClassLookupGroupSize;
+    numGroups = numEntries / kDexClassLookupGroupSize;
+    allocSize = offsetof(DexClassLookup2, tags) + numEntries
+                    + numEntries * sizeof(DexClassLookupEntry);
+
+    pLookup = (DexClassLookup2*) calloc(1, allocSize);
+    if (pLookup == NULL)
+        return NULL;
+    pLookup->size = allocSize;
+    pLookup->version = kDexClassLookup2Version;
+    pLookup->numEntries = numEntries;
+    memset(pLookup->tags, kDexClassLookupEmptyTag, numEntries);
+    entries = (DexClassLookupEntry*) dexClassLookup2Entries(pLookup);
+
+    for (i = 0; i < classDefsSize; i++) {
+        const DexClassDef* pClassDef = dexGetClassDef(pDexFile, i);
+        const char* pString =
+            dexStringByTypeIdx(pDexFile, pClassDef->classIdx);
+        u4 hash = classDescriptorHash(pString);
+        u4 mixed = classLookup2Mix(hash);
+        u4 group = (mixed >> 7) & (numGroups - 1);
+        int probes = 0;
+
+        /*
+         * Triangular probing over groups visits every group, and we
+         * know there is an empty slot somewhere.
+         */
+        while (true) {
+            u1* tags = pLookup->tags + group * kDexClassLookupGroupSize;
+            u4 empty = classLookup2Match(tags, kDexClassLookupEmptyTag);
+
+            if (empty != 0) {
+                u4 idx = group * kDexClassLookupGroupSize
+                            + __builtin_ctz(empty);
+                pLookup->tags[idx] = classLookup2Tag(mixed);
+                entries[idx].classDescriptorHash = hash;
+                entries[idx].classDescriptorOffset =
+                    (const u1*) pString - pDexFile->baseAddr;
+                entries[idx].classDefOffset =
+                    (const u1*) pClassDef - pDexFile->baseAddr;
+                break;
+            }
+
+            probes++;
+            group = (group + probes) & (numGroups - 1);
+        }
+
+        if (probes > maxProbes)
+            maxProbes = probes;
+        totalProbes += probes;
+    }
+
+    ALOGV("Class lookup 2: classes=%d slots=%d (%d%% occ) alloc=%d"
+         " total=%d max=%d",
+        classDefsSize, numEntries, (100 * classDefsSize) / numEntries,
+        allocSize, totalProbes, maxProbes);
+
+    return pLookup;
+}
+
+/* (documented in header) */
+bool dexClassLookup2IsValid(const DexClassLookup2* pLookup, u4 size)
+{
+    if (size < offsetof(DexClassLookup2, tags)) {
+        ALOGE("Undersized class lookup 2 (%u)", size);
+        return false;
+    }
+
+    if (pLookup->size > size) {
+        ALOGE("Bogus class lookup 2 size (%u in %u)", pLookup->size, size);
+        return false;
+    }
+
+    if (pLookup->version != kDexClassLookup2Version) {
+        ALOGW("Ignoring class lookup 2 with unknown version %u",
+            pLookup->version);
+        return false;
+    }
+
+    u4 numEntries = pLookup->numEntries;
+    if (numEntries < kDexClassLookupGroupSize
+            || (numEntries & (numEntries - 1)) != 0
+            || numEntries > (pLookup->size - offsetof(DexClassLookup2, tags))
+                                / (1 + sizeof(DexClassLookupEntry))) {
+        ALOGE("Bogus class lookup 2 numEntries (%u)", numEntries);
+        return false;
+    }
+
+    return true;
+}
+
 
 /*
  * Set up the basic raw data pointers of a DexFile. This function isn't
@@ -280,6 +431,29 @@ void dexFileSetupBasicPointers(DexFile* pDexFile, const u1* data) {
     pDexFile->pLinkData = (const DexLink*) (data + pHeader->linkOff);
 }
 
+/* (documented in header file) */
+void dexAdviseSections(const u1* data, size_t length, const u2* types,
+    size_t numTypes, SysMapAdvice advice)
+{
+    const DexHeader* pHeader = (const DexHeader*) data;
+    const DexMapList* pMap = (const DexMapList*) (data + pHeader->mapOff);
+    u4 i;
+    size_t j;
+
+    for (i = 0; i < pMap->size; i++) {
+        const DexMapItem* pItem = &pMap->list[i];
+        u4 end = (i + 1 < pMap->size) ? pMap->list[i + 1].offset : length;
+
+        for (j = 0; j < numTypes; j++) {
+            if (pItem->type == types[j] && pItem->offset < end) {
+                sysAdviseRange(data + pItem->offset, end - pItem->offset,
+                    advice);
+                break;
+            }
+        }
+    }
+}
+
 /*
  * Parse an optimized or unoptimized .dex file sitting in memory.  This is
  * called after the byte-ordering and structure alignment has been fixed up.
@@ -291,6 +465,10 @@ DexFile* dexFileParse(const u1* data, size_t length, int flags)
     DexFile* pDexFile = NULL;
     const DexHeader* pHeader;
     const u1* magic;
+    unsigned char sha1Digest[kSHA1DigestLen];
+    bool verifySignature;
+    bool haveChecksum = false;
+    u4 adler = 0;
     int result = -1;
 
     if (length < sizeof(DexHeader)) {
@@ -340,13 +518,37 @@ DexFile* dexFileParse(const u1* data, size_t length, int flags)
         goto bail;
     }
 
+    /*
+     * Verify the SHA-1 digest?  (Normally we don't want to do this --
+     * the digest is used to uniquely identify the original DEX file, and
+     * can't be computed for verification after the DEX is byte-swapped
+     * and optimized.)
+     */
+    verifySignature = kVerifySignature ||
+        ((flags & kDexParseVerifySignature) && pDexFile->pOptHeader == NULL);
+
+    if (verifySignature) {
+        const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum) +
+                            kSHA1DigestLen;
+
+        if ((flags & kDexParseVerifyChecksum) && pHeader->fileSize == length) {
+            /* both were asked for; get them in one pass */
+            dexComputeChecksumAndSignature(pHeader, &adler, sha1Digest);
+            haveChecksum = true;
+        } else {
+            dexComputeSHA1Digest(data + nonSum, length - nonSum, sha1Digest);
+        }
+    }
+
     /*
      * Verify the checksum(s).  This is reasonably quick, but does require
      * touching every byte in the DEX file.  The base checksum changes after
      * byte-swapping and DEX optimization.
      */
     if (flags & kDexParseVerifyChecksum) {
-        u4 adler = dexComputeChecksum(pHeader);
+        if (!haveChecksum) {
+            adler = dexComputeChecksum(pHeader);
+        }
         if (adler != pHeader->checksum) {
             ALOGE("ERROR: bad checksum (%08x vs %08x)",
                 adler, pHeader->checksum);
@@ -370,18 +572,7 @@ DexFile* dexFileParse(const u1* data, size_t length, int flags)
         }
     }
 
-    /*
-     * Verify the SHA-1 digest.  (Normally we don't want to do this --
-     * the digest is used to uniquely identify the original DEX file, and
-     * can't be computed for verification after the DEX is byte-swapped
-     * and optimized.)
-     */
-    if (kVerifySignature) {
-        unsigned char sha1Digest[kSHA1DigestLen];
-        const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum) +
-                            kSHA1DigestLen;
-
-        dexComputeSHA1Digest(data + nonSum, length - nonSum, sha1Digest);
+    if (verifySignature) {
         if (memcmp(sha1Digest, pHeader->signature, kSHA1DigestLen) != 0) {
             char tmpBuf1[kSHA1DigestOutputLen];
             char tmpBuf2[kSHA1DigestOutputLen];
@@ -430,9 +621,61 @@ void dexFileFree(DexFile* pDexFile)
     if (pDexFile == NULL)
         return;
 
+    dexFreeDescriptorTable(pDexFile);
+    dexFreeCatchTables(pDexFile);
     free(pDexFile);
 }
 
+/*
+ * dexFindClass() for the second-generation lookup table.
+ */
+static const DexClassDef* findClass2(const DexFile* pDexFile,
+    const char* descriptor)
+{
+    const DexClassLookup2* pLookup = pDexFile->pClassLookup2;
+    const DexClassLookupEntry* entries = dexClassLookup2Entries(pLookup);
+    u4 hash = classDescriptorHash(descriptor);
+    u4 mixed = classLookup2Mix(hash);
+    u1 tag = classLookup2Tag(mixed);
+    u4 groupMask = pLookup->numEntries / kDexClassLookupGroupSize - 1;
+    u4 group = (mixed >> 7) & groupMask;
+    u4 probes = 0;
+
+    /*
+     * Check the candidates in each group, and stop at the first group
+     * that has an empty slot, since an insert would have used it.
+     */
+    while (true) {
+        u4 base = group * kDexClassLookupGroupSize;
+        const u1* tags = pLookup->tags + base;
+        u4 match = classLookup2Match(tags, tag);
+
+        while (match != 0) {
+            const DexClassLookupEntry* pEntry =
+                &entries[base + __builtin_ctz(match)];
+
+            if (pEntry->classDescriptorHash == hash) {
+                const char* str = (const char*)
+                    (pDexFile->baseAddr + pEntry->classDescriptorOffset);
+                if (strcmp(str, descriptor) == 0) {
+                    return (const DexClassDef*)
+                        (pDexFile->baseAddr + pEntry->classDefOffset);
+                }
+            }
+
+            match &= match - 1;
+        }
+
+        if (classLookup2Match(tags, kDexClassLookupEmptyTag) != 0)
+            return NULL;
+
+        probes++;
+        if (probes > groupMask)
+            return NULL;        /* full table; only if it's corrupt */
+        group = (group + probes) & groupMask;
+    }
+}
+
 /*
  * Look up a class definition entry by descriptor.
  *
@@ -445,6 +688,9 @@ const DexClassDef* dexFindClass(const DexFile* pDexFile,
     u4 hash;
     int idx, mask;
 
+    if (pDexFile->pClassLookup2 != NULL)
+        return findClass2(pDexFile, descriptor);
+
     hash = classDescriptorHash(descriptor);
     mask = pLookup->numEntries - 1;
     idx = hash & mask;
@@ -481,10 +727,51 @@ u4 dexComputeChecksum(const DexHeader* pHeader)
 {
     const u1* start = (const u1*) pHeader;
 
-    uLong adler = adler32(0L, Z_NULL, 0);
     const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum);
 
-    return (u4) adler32(adler, start + nonSum, pHeader->fileSize - nonSum);
+    return dexAdler32(kDexAdler32Init, start + nonSum,
+            pHeader->fileSize - nonSum);
+}
+
+/*
+ * Size of the pieces that dexComputeChecksumAndSignature() feeds to the
+ * two hashes in turn. Small enough that the second pass over a piece
+ * hits in the L1/L2 cache.
+ */
+static const size_t kChecksumChunkSize = 16 * 1024;
+
+/*
+ * Compute the DEX checksum and the SHA-1 signature together, touching
+ * each byte of the file only once.
+ */
+void dexComputeChecksumAndSignature(const DexHeader* pHeader, u4* pChecksum,
+    unsigned char digest[])
+{
+    const u1* start = (const u1*) pHeader;
+    const u1* end = start + pHeader->fileSize;
+    const u1* ptr;
+
+    /* the checksum covers the signature, the signature doesn't */
+    const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum);
+    const int nonSig = nonSum + kSHA1DigestLen;
+
+    u4 adler = dexAdler32(kDexAdler32Init, start + nonSum, nonSig - nonSum);
+
+    SHA1_CTX context;
+    SHA1Init(&context);
+
+    for (ptr = start + nonSig; ptr < end; ptr += kChecksumChunkSize) {
+        size_t len = end - ptr;
+        if (len > kChecksumChunkSize) {
+            len = kChecksumChunkSize;
+        }
+
+        adler = dexAdler32(adler, ptr, len);
+        SHA1Update(&context, ptr, len);
+    }
+
+    SHA1Final(digest, &context);
+    *pChecksum = adler;
 }
 
 /*
@@ -230,7 +230,9 @@ enum {
 /* auxillary data section chunk codes */
 enum {
     kDexChunkClassLookup            = 0x434c4b50,   /* CLKP */
+    kDexChunkClassLookup2           = 0x434c4b32,   /* CLK2 */
     kDexChunkRegisterMaps           = 0x524d4150,   /* RMAP */
+    kDexChunkCodeIndex              = 0x43444958,   /* CDIX */
 
     kDexChunkEnd                    = 0x41454e44,   /* AEND */
 };
@@ -505,6 +507,68 @@ struct DexClassLookup {
     } table[1];
 };
 
+/*
+ * Second-generation class lookup table, stored in its own chunk so that
+ * files can carry it alongside (or instead of) the original one.
+ *
+ * Slots are probed in groups of kDexClassLookupGroupSize. Each slot has
+ * a one-byte tag holding 7 bits of the hash (or kDexClassLookupEmptyTag),
+ * so a whole group can be checked for candidates with a single vector
+ * compare, and string_data is only touched when the full hash matches.
+ *
+ * The tags[] array is followed by numEntries entries, in the same form as
+ * DexClassLookup.table[]; use dexClassLookup2Entries() to find them.
+ */
+enum {
+    kDexClassLookup2Version     = 1,
+    kDexClassLookupGroupSize    = 16,
+    kDexClassLookupEmptyTag     = 0x80,
+};
+
+struct DexClassLookupEntry {
+    u4      classDescriptorHash;        // class descriptor hash code
+    int     classDescriptorOffset;      // in bytes, from start of DEX
+    int     classDefOffset;             // in bytes, from start of DEX
+};
+
+struct DexClassLookup2 {
+    u4      size;                       // total size, including "size"
+    u4      version;                    // kDexClassLookup2Version
+    u4      numEntries;                 // power of 2, >= group size
+    u4      reserved;
+    u1      tags[kDexClassLookupGroupSize]; // really numEntries
+};
+
+/*
+ * Index from file offsets in code to the methods that own them, stored
+ * in its own chunk, or built with dexCreateCodeIndex().
+ *
+ * There is one entry per method with code, for the range of its insns.
+ * The ranges are sorted by start offset and laid out in Eytzinger
+ * (breadth-first search tree) order, 1-based, so that a search walks
+ * down from index 1 and the first few levels share cache lines.  The
+ * header is followed by numEntries+1 u4 start offsets (the "keys", with
+ * slot 0 unused), padded to 8 bytes, then numEntries+1 entries in the
+ * same order; use dexCodeIndexKeys() and dexCodeIndexEntries().
+ */
+enum {
+    kDexCodeIndexVersion        = 1,
+};
+
+struct DexCodeIndexEntry {
+    u4      insnsSize;                  // in code units
+    u4      classDefIdx;
+    u4      methodIdx;
+    u4      codeOffset;                 // of the DexCode, from start of DEX
+};
+
+struct DexCodeIndex {
+    u4      size;                       // total size, including "size"
+    u4      version;                    // kDexCodeIndexVersion
+    u4      numEntries;
+    u4      reserved;
+};
+
 /*
  * Header added by DEX optimization pass.  Values are always written in
  * local byte and structure padding.  The first field (magic + version)
@@ -539,6 +603,9 @@ struct DexOptHeader {
  * Code should regard DexFile as opaque, using the API calls provided here
  * to access specific structures.
  */
+struct DexDescriptorTable;
+struct DexCatchTableMap;
+
 struct DexFile {
     /* directly-mapped "opt" header */
     const DexOptHeader* pOptHeader;
@@ -558,7 +625,15 @@ struct DexFile {
      * included in the file.
      */
     const DexClassLookup* pClassLookup;
+    const DexClassLookup2* pClassLookup2;       // preferred if present
     const void*         pRegisterMapPool;       // RegisterMapClassPool
+    const DexCodeIndex* pCodeIndex;
+
+    /* interned method descriptors, built on demand (see DexProto.h) */
+    DexDescriptorTable* pDescriptorTable;
+
+    /* decoded catch handlers by code offset, built on demand (DexCatch.h) */
+    DexCatchTableMap*   pCatchTables;
 
     /* points to start of DEX file data */
     const u1*           baseAddr;
@@ -587,6 +662,7 @@ enum {
     kDexParseDefault            = 0,
     kDexParseVerifyChecksum     = 1,
     kDexParseContinueOnError    = (1 << 1),
+    kDexParseVerifySignature    = (1 << 2), /* ignored for optimized DEX */
 };
 
 /*
@@ -596,11 +672,100 @@ enum {
  *
  * Return 0 on success.
  */
-int dexSwapAndVerify(u1* addr, int len);
+int dexSwapAndVerify(u1* addr, size_t len);
+
+/*
+ * Like dexSwapAndVerify(), but swap and verify independent sections
+ * concurrently on up to "numThreads" threads. The result, and the
+ * errors reported on failure, are the same as for dexSwapAndVerify(),
+ * which remains the reference implementation (and is what reports the
+ * errors). A "numThreads" of 1 (or less) is exactly equivalent to
+ * calling dexSwapAndVerify().
+ *
+ * Return 0 on success.
+ */
+int dexSwapAndVerifyParallel(u1* addr, size_t len, int numThreads);
+
+/*
+ * Per-section numbers from dexSwapAndVerifyWithStats(). Byte swapping
+ * is done in the same pass over the items as intra-item verification
+ * (and does nothing on little-endian hosts), so the two are timed
+ * together.
+ */
+struct DexVerifySectionStats {
+    u2  type;               /* map item type (kDexType*) */
+    u4  itemCount;
+    u4  byteCount;          /* section start to the end of its last item */
+    u8  swapNanos;          /* byte swapping + intra-item verification */
+    u8  crossNanos;         /* cross-item verification */
+};
+
+/* a map can't list a section type more than once */
+enum { kDexVerifyMaxSections = 18 };
+
+struct DexVerifyStats {
+    u8  headerNanos;        /* checksum, header and map */
+    u8  totalNanos;
+    u8  dataMapLookups;     /* references checked against the data map */
+    u4  numSections;        /* "sections" in use, in map order */
+    DexVerifySectionStats sections[kDexVerifyMaxSections];
+};
+
+/*
+ * Like dexSwapAndVerifyParallel(), but also fill in "*pStats" with the
+ * time spent on (and size of) each section, for finding out why a file
+ * is slow to verify. If verification fails, the stats cover the work
+ * done up to that point.
+ *
+ * Return 0 on success.
+ */
+int dexSwapAndVerifyWithStats(u1* addr, size_t len, int numThreads,
+    DexVerifyStats* pStats);
+
+/*
+ * Lazy alternative to dexSwapAndVerify(), for callers that only look at
+ * a few classes of a large file. The header, the map, the id sections,
+ * string data and type lists are verified up front. Class data, code,
+ * debug info, annotations and static values are left alone until
+ * dexLazyVerifyClass() is called for a class that uses them.
+ *
+ * The checks that need the whole data section (item boundaries and
+ * types, padding between items, etc.) are only made by
+ * dexLazyVerifyAll(), which does a complete dexSwapAndVerify(). On the
+ * other hand, a class fails if one of its methods has a bad
+ * debug_info_off, which the full verification doesn't look at.
+ *
+ * Returns NULL on failure. The memory must stay mapped until the
+ * verifier is freed with dexLazyVerifierFree().
+ */
+struct DexLazyVerifier;
+DexLazyVerifier* dexSwapAndVerifyLazy(u1* addr, size_t len);
+
+/*
+ * Verify everything that the class_def_item with index "classDefIdx"
+ * refers to, if that hasn't already been done. A per-class bitmap of
+ * verified classes makes repeat calls cheap. May be called from
+ * several threads at once.
+ *
+ * Returns true if the class is good to use.
+ */
+bool dexLazyVerifyClass(DexLazyVerifier* pVerifier, u4 classDefIdx);
+
+/*
+ * Verify everything now, as dexSwapAndVerify() would, for callers that
+ * need the whole file checked after all. Returns true on success.
+ */
+bool dexLazyVerifyAll(DexLazyVerifier* pVerifier);
+
+/*
+ * Free a lazy verifier. NULL is allowed.
+ */
+void dexLazyVerifierFree(DexLazyVerifier* pVerifier);
 
 /*
  * Detect the file type of the given memory buffer via magic number.
- * Call dexSwapAndVerify() on an unoptimized DEX file, do nothing
+ * Call dexSwapAndVerify() (or dexSwapAndVerifyCached(), if the cache is
+ * enabled; see DexVerifyCache.h) on an unoptimized DEX file, do nothing
  * but return successfully on an optimized DEX file, and report an
  * error for all other cases.
  *
@@ -620,6 +785,13 @@ bool dexHasValidMagic(const DexHeader* pHeader);
  */
 u4 dexComputeChecksum(const DexHeader* pHeader);
 
+/*
+ * Compute DEX checksum and SHA-1 signature in a single pass over the
+ * file. "digest" must be able to hold kSHA1DigestLen bytes.
+ */
+void dexComputeChecksumAndSignature(const DexHeader* pHeader, u4* pChecksum,
+    unsigned char digest[]);
+
 /*
  * Free a DexFile structure, along with any associated structures.
  */
@@ -631,7 +803,31 @@ void dexFileFree(DexFile* pDexFile);
 DexClassLookup* dexCreateClassLookup(DexFile* pDexFile);
 
 /*
- * Find a class definition by descriptor.
+ * Create a class lookup table in the second-generation format. The
+ * result can be stored in a kDexChunkClassLookup2 chunk as-is.
+ */
+DexClassLookup2* dexCreateClassLookup2(DexFile* pDexFile);
+
+/*
+ * Check the header of a second-generation class lookup table that is
+ * "size" bytes long. Returns false (and logs) if it is malformed or has
+ * a version we don't understand, in which case the caller should fall
+ * back to the original table.
+ */
+bool dexClassLookup2IsValid(const DexClassLookup2* pLookup, u4 size);
+
+/*
+ * Get the entries of a second-generation class lookup table.
+ */
+DEX_INLINE const DexClassLookupEntry* dexClassLookup2Entries(
+    const DexClassLookup2* pLookup)
+{
+    return (const DexClassLookupEntry*) (pLookup->tags + pLookup->numEntries);
+}
+
+/*
+ * Find a class definition by descriptor. Uses pClassLookup2 if it is
+ * set, otherwise pClassLookup.
  */
 const DexClassDef* dexFindClass(const DexFile* pFile, const char* descriptor);
 
@@ -641,6 +837,16 @@ const DexClassDef* dexFindClass(const DexFile* pFile, const char* descriptor);
  */
 void dexFileSetupBasicPointers(DexFile* pDexFile, const u1* data);
 
+/*
+ * Pass "advice" on to the kernel for the pages holding the sections of
+ * the "length"-byte DEX file at "data" whose map item types are among
+ * the "numTypes" entries of "types". Each section is taken to run up to
+ * the start of the next one in the map, so the map must have been
+ * verified.
+ */
+void dexAdviseSections(const u1* data, size_t length, const u2* types,
+    size_t numTypes, SysMapAdvice advice);
+
 /* return the DexMapList of the file, if any */
 DEX_INLINE const DexMapList* dexGetMap(const DexFile* pDexFile) {
     u4 mapOff = pDexFile->pHeader->mapOff;
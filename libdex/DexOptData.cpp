@@ -19,9 +19,9 @@
  * to optimized .dex files.
  */
 
-#include <zlib.h>
-
 #include "DexOptData.h"
+#include "DexCodeIndex.h"
+#include "Adler32.h"
 
 /*
  * Check to see if a given data pointer is a valid double-word-aligned
@@ -40,9 +40,7 @@ u4 dexComputeOptChecksum(const DexOptHeader* pOptHeader)
     const u1* end = (const u1*) pOptHeader +
         pOptHeader->optOffset + pOptHeader->optLength;
 
-    uLong adler = adler32(0L, Z_NULL, 0);
-
-    return (u4) adler32(adler, start, end - start);
+    return dexAdler32(kDexAdler32Init, start, end - start);
 }
 
 /* (documented in header file) */
@@ -108,6 +106,22 @@ bool dexParseOptData(const u1* data, size_t length, DexFile* pDexFile)
         case kDexChunkClassLookup:
             pDexFile->pClassLookup = (const DexClassLookup*) pOptData;
             break;
+        case kDexChunkClassLookup2: {
+            const DexClassLookup2* pLookup2 =
+                (const DexClassLookup2*) pOptData;
+            if (dexClassLookup2IsValid(pLookup2, size)) {
+                pDexFile->pClassLookup2 = pLookup2;
+            }
+            break;
+        }
+        case kDexChunkCodeIndex: {
+            const DexCodeIndex* pCodeIndex = (const DexCodeIndex*) pOptData;
+            if (dexCodeIndexIsValid(pCodeIndex, size,
+                    pDexFile->pOptHeader->dexLength)) {
+                pDexFile->pCodeIndex = pCodeIndex;
+            }
+            break;
+        }
         case kDexChunkRegisterMaps:
             ALOGV("+++ found register maps, size=%u", size);
             pDexFile->pRegisterMapPool = pOptData;
@@ -129,11 +129,21 @@ const char* dexProtoGetShorty(const DexProto* pProto) {
     return dexStringById(pProto->dexFile, protoId->shortyIdx);
 }
 
-/* (documented in header file) */
-const char* dexProtoGetMethodDescriptor(const DexProto* pProto,
-        DexStringCache* pCache) {
-    const DexFile* dexFile = pProto->dexFile;
-    const DexProtoId* protoId = getProtoId(pProto);
+/*
+ * Per-DexFile table of interned method descriptors, indexed by proto idx.
+ * Slots are filled in on first use and never change after that.
+ */
+struct DexDescriptorTable {
+    u4 numEntries;
+    const char* descriptors[1];     /* really [numEntries] */
+};
+
+/*
+ * Return the length of the full method descriptor for "protoId",
+ * including the terminating '\0'.
+ */
+static size_t methodDescriptorLength(const DexFile* dexFile,
+        const DexProtoId* protoId) {
     const DexTypeList* typeList = dexGetProtoParameters(dexFile, protoId);
     size_t length = 3; // parens and terminating '\0'
     u4 paramCount = (typeList == NULL) ? 0 : typeList->size;
@@ -145,22 +155,134 @@ const char* dexProtoGetMethodDescriptor(const DexProto* pProto,
     }
 
     length += strlen(dexStringByTypeIdx(dexFile, protoId->returnTypeIdx));
+    return length;
+}
 
-    dexStringCacheAlloc(pCache, length);
+/*
+ * Write the full method descriptor for "protoId" into "at", which must
+ * have room for methodDescriptorLength() bytes.
+ */
+static void writeMethodDescriptor(const DexFile* dexFile,
+        const DexProtoId* protoId, char* at) {
+    const DexTypeList* typeList = dexGetProtoParameters(dexFile, protoId);
+    u4 paramCount = (typeList == NULL) ? 0 : typeList->size;
+    u4 i;
 
-    char *at = (char*) pCache->value;
     *(at++) = '(';
 
     for (i = 0; i < paramCount; i++) {
         u4 idx = dexTypeListGetIdx(typeList, i);
         const char* desc = dexStringByTypeIdx(dexFile, idx);
-        strcpy(at, desc);
-        at += strlen(desc);
+        size_t len = strlen(desc);
+        memcpy(at, desc, len);
+        at += len;
     }
 
     *(at++) = ')';
 
     strcpy(at, dexStringByTypeIdx(dexFile, protoId->returnTypeIdx));
+}
+
+/*
+ * Get the descriptor table for "dexFile", creating it if this is the
+ * first time anyone has asked. Returns NULL on allocation failure.
+ *
+ * The table is attached to the DexFile behind the caller's back, so
+ * this casts away the const. Threads that race to create it agree on
+ * one winner, and the losers throw theirs away.
+ */
+static DexDescriptorTable* getDescriptorTable(const DexFile* dexFile) {
+    DexFile* mutableDexFile = (DexFile*) dexFile;
+    DexDescriptorTable* pTable =
+        __atomic_load_n(&mutableDexFile->pDescriptorTable, __ATOMIC_ACQUIRE);
+
+    if (pTable != NULL) {
+        return pTable;
+    }
+
+    u4 numEntries = dexFile->pHeader->protoIdsSize;
+    pTable = (DexDescriptorTable*) calloc(1, sizeof(DexDescriptorTable) +
+            numEntries * sizeof(const char*));
+    if (pTable == NULL) {
+        return NULL;
+    }
+    pTable->numEntries = numEntries;
+
+    if (!__sync_bool_compare_and_swap(&mutableDexFile->pDescriptorTable,
+            NULL, pTable)) {
+        free(pTable);
+        pTable = __atomic_load_n(&mutableDexFile->pDescriptorTable,
+                __ATOMIC_ACQUIRE);
+    }
+
+    return pTable;
+}
+
+/* (documented in header file) */
+const char* dexProtoGetInternedMethodDescriptor(const DexProto* pProto) {
+    DexDescriptorTable* pTable = getDescriptorTable(pProto->dexFile);
+
+    if (pTable == NULL) {
+        return NULL;
+    }
+
+    const char** pSlot = &pTable->descriptors[pProto->protoIdx];
+    const char* descriptor = __atomic_load_n(pSlot, __ATOMIC_ACQUIRE);
+
+    if (descriptor != NULL) {
+        return descriptor;
+    }
+
+    const DexFile* dexFile = pProto->dexFile;
+    const DexProtoId* protoId = getProtoId(pProto);
+    char* newDescriptor =
+        (char*) malloc(methodDescriptorLength(dexFile, protoId));
+
+    if (newDescriptor == NULL) {
+        return NULL;
+    }
+    writeMethodDescriptor(dexFile, protoId, newDescriptor);
+
+    if (!__sync_bool_compare_and_swap(pSlot, NULL, newDescriptor)) {
+        free(newDescriptor);
+        return __atomic_load_n(pSlot, __ATOMIC_ACQUIRE);
+    }
+
+    return newDescriptor;
+}
+
+/* (documented in header file) */
+void dexFreeDescriptorTable(DexFile* pDexFile) {
+    DexDescriptorTable* pTable = pDexFile->pDescriptorTable;
+    u4 i;
+
+    if (pTable == NULL) {
+        return;
+    }
+
+    for (i = 0; i < pTable->numEntries; i++) {
+        free((void*) pTable->descriptors[i]);
+    }
+
+    free(pTable);
+    pDexFile->pDescriptorTable = NULL;
+}
+
+/* (documented in header file) */
+const char* dexProtoGetMethodDescriptor(const DexProto* pProto,
+        DexStringCache* pCache) {
+    const char* descriptor = dexProtoGetInternedMethodDescriptor(pProto);
+
+    if (descriptor != NULL) {
+        return descriptor;
+    }
+
+    /* couldn't intern it; build it in the cache the old way */
+    const DexFile* dexFile = pProto->dexFile;
+    const DexProtoId* protoId = getProtoId(pProto);
+
+    dexStringCacheAlloc(pCache, methodDescriptorLength(dexFile, protoId));
+    writeMethodDescriptor(dexFile, protoId, pCache->value);
     return pCache->value;
 }
 
@@ -98,11 +98,30 @@ DEX_INLINE void dexProtoSetFromMethodId(DexProto* pProto,
 const char* dexProtoGetShorty(const DexProto* pProto);
 
 /*
- * Get the full method descriptor for the given prototype.
+ * Get the full method descriptor for the given prototype. This is the
+ * interned copy (see below) if there is one, and is only built in
+ * "pCache" if interning fails.
  */
 const char* dexProtoGetMethodDescriptor(const DexProto* pProto,
     DexStringCache* pCache);
 
+/*
+ * Get the interned full method descriptor for the given prototype.
+ * Each DexFile keeps a table of these, indexed by proto idx and filled
+ * in on first use; the returned string stays valid until the DexFile is
+ * freed, and later lookups of the same proto don't allocate. Safe to
+ * call from multiple threads at once.
+ *
+ * Returns NULL if memory couldn't be allocated.
+ */
+const char* dexProtoGetInternedMethodDescriptor(const DexProto* pProto);
+
+/*
+ * Free the interned descriptor table of the given DexFile, if it has
+ * one. Called from dexFileFree().
+ */
+void dexFreeDescriptorTable(DexFile* pDexFile);
+
 /*
  * Get a copy of the descriptor string associated with the given prototype.
  * The returned pointer must be free()ed by the caller.
@@ -129,6 +148,19 @@ DEX_INLINE const char* dexGetDescriptorFromMethodId(const DexFile* pDexFile,
     return dexProtoGetMethodDescriptor(&proto, pCache);
 }
 
+/*
+ * Return the interned utf-8 encoded descriptor string from the proto of
+ * a MethodId, or NULL if memory couldn't be allocated.
+ */
+DEX_INLINE const char* dexGetInternedDescriptorFromMethodId(
+        const DexFile* pDexFile, const DexMethodId* pMethodId)
+{
+    DexProto proto;
+
+    dexProtoSetFromMethodId(&proto, pDexFile, pMethodId);
+    return dexProtoGetInternedMethodDescriptor(&proto);
+}
+
 /*
  * Get a copy of the utf-8 encoded method descriptor string from the
  * proto of a MethodId. The returned pointer must be free()ed by the
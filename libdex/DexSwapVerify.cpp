@@ -19,25 +19,122 @@
  */
 
 #include "DexFile.h"
+#include "Adler32.h"
 #include "DexClass.h"
 #include "DexDataMap.h"
 #include "DexProto.h"
 #include "DexUtf.h"
+#include "DexVerifyCache.h"
 #include "Leb128.h"
+#include "SysUtil.h"
 
 #include <safe_iop.h>
-#include <zlib.h>
 
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+/*
+ * Set on the threads of the parallel verifier, whose checks run in no
+ * particular order: their messages aren't logged, and if one of them
+ * fails the serial verifier is run to report the error (see
+ * swapEverythingButHeaderAndMapParallel()).
+ */
+static __thread bool gQuietVerify = false;
+
+/*
+ * Log a verification failure, unless this is a parallel verify thread.
+ * Everything a parallel task can reach logs through these rather than
+ * ALOGE() and ALOGW().
+ */
+#define VERIFY_LOGE(...)                                                    \
+    do { if (!gQuietVerify) ALOGE(__VA_ARGS__); } while (0)
+#define VERIFY_LOGW(...)                                                    \
+    do { if (!gQuietVerify) ALOGW(__VA_ARGS__); } while (0)
 
 #define SWAP2(_value)      (_value)
 #define SWAP4(_value)      (_value)
 #define SWAP8(_value)      (_value)
 
-#define SWAP_FIELD2(_field) (_field) = SWAP2(_field)
-#define SWAP_FIELD4(_field) (_field) = SWAP4(_field)
-#define SWAP_FIELD8(_field) (_field) = SWAP8(_field)
+/*
+ * Swapping is the identity on the (little-endian) hosts we support, so
+ * don't store anything back: that way the pages of a file mapped
+ * read-only (or private) aren't written to or copied just to verify it.
+ */
+#define SWAP_FIELD2(_field) ((void) (_field))
+#define SWAP_FIELD4(_field) ((void) (_field))
+#define SWAP_FIELD8(_field) ((void) (_field))
+
+/*
+ * How references to the deferred data items (see isDeferredDataType())
+ * are checked.
+ */
+enum DataItemMode {
+    /* everything was swapped into the data map; look items up there */
+    kDataItemsMapped = 0,
+
+    /* lazy open: deferred items haven't been looked at; skip them */
+    kDataItemsDeferred,
+
+    /* lazy, per class: verify each deferred item where it's referenced */
+    kDataItemsInPlace,
+};
+
+/*
+ * Scratch memory for the verifier, for things that only live as long as
+ * the check of one item (or one section): decoded class_data_items, the
+ * handler offsets of a code_item, the defined-class bits. Allocations are
+ * carved out of a chain of blocks and handed back in LIFO order with
+ * verifyArenaRelease(), and the blocks are kept, so once the arena has
+ * grown to fit the largest item nothing more is malloc()ed.
+ */
+struct VerifyArenaBlock {
+    VerifyArenaBlock* next;
+    size_t            size;         // usable bytes following this header
+    bool              owned;        // malloc()ed (vs. supplied by caller)
+};
+
+struct VerifyArena {
+    VerifyArenaBlock* first;
+    VerifyArenaBlock* current;      // block allocations are coming from
+    size_t            used;         // bytes of "current" in use
+};
+
+/* A point to roll the arena back to; see verifyArenaMark(). */
+struct VerifyArenaMark {
+    VerifyArenaBlock* block;
+    size_t            used;
+};
+
+/* minimum size of the blocks the arena allocates for itself */
+static const size_t kVerifyArenaBlockSize = 64 * 1024;
+
+/* size of the on-stack first block that entry points start with */
+#define VERIFY_ARENA_STACK_SIZE 4096
+
+/*
+ * A deferred section as seen by the lazy verifier. Its items are
+ * intra-verified and entered into a data map of their own in order,
+ * as far into the section as the furthest reference checked so far.
+ */
+struct DeferredSection {
+    u2                type;
+    u4                offset;       // of the section, from the map
+    u4                end;          // where the next section starts
+    u4                size;         // item count, from the map
+    u4                walked;       // items verified and mapped so far
+    u4                nextOffset;   // just past the last of those
+    const void*       previousItem;
+    bool              failed;       // stop walking; an item was bad
+    DexDataMap*       pDataMap;     // NULL until first walked
+};
+
+struct DeferredSections {
+    pthread_mutex_t   lock;         // guards everything below
+    u4                count;
+    DeferredSection   sections[8];  // one per isDeferredDataType() type
+};
 
 /*
  * Some information we pass around to help verify values.
@@ -58,8 +155,191 @@ struct CheckState {
     u4*               pDefinedClassBits;
 
     const void*       previousItem; // set during section iteration
+
+    DataItemMode      dataItemMode;
+    DeferredSections* pDeferred;    // set for kDataItemsInPlace
+
+    /*
+     * scratch memory; each thread verifying with a copy of the state
+     * needs its own
+     */
+    VerifyArena*      pArena;
+
+    /*
+     * where dexSwapAndVerifyWithStats() wants its numbers, or NULL; only
+     * the section loops write to pStats, and each thread gets its own
+     * lookup counter
+     */
+    DexVerifyStats*   pStats;
+    u8*               pDataMapLookups;
 };
 
+/*
+ * Get the current time from a monotonic clock, in nanoseconds.
+ */
+static u8 getMonotonicNsec(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u8) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/*
+ * Get the stats entry of the given section, or NULL if no stats are
+ * being collected.
+ */
+static DexVerifySectionStats* getSectionStats(const CheckState* state,
+        const DexMapList* pMap, const DexMapItem* item) {
+    u4 index = item - pMap->list;
+
+    if (state->pStats == NULL || index >= state->pStats->numSections) {
+        return NULL;
+    }
+
+    return &state->pStats->sections[index];
+}
+
+/*
+ * Set up an arena, optionally with a first block carved out of "buf"
+ * (which must be suitably aligned and outlive the arena).
+ */
+static void verifyArenaInit(VerifyArena* pArena, void* buf, size_t bufLen) {
+    memset(pArena, 0, sizeof(*pArena));
+
+    if (buf != NULL && bufLen > sizeof(VerifyArenaBlock)) {
+        VerifyArenaBlock* block = (VerifyArenaBlock*) buf;
+        block->next = NULL;
+        block->size = bufLen - sizeof(VerifyArenaBlock);
+        block->owned = false;
+        pArena->first = block;
+    }
+}
+
+/*
+ * Free the blocks of an arena. Everything allocated from it goes away.
+ */
+static void verifyArenaFree(VerifyArena* pArena) {
+    VerifyArenaBlock* block = pArena->first;
+
+    while (block != NULL) {
+        VerifyArenaBlock* next = block->next;
+        if (block->owned) {
+            free(block);
+        }
+        block = next;
+    }
+
+    memset(pArena, 0, sizeof(*pArena));
+}
+
+/*
+ * Allocate "size" bytes, aligned well enough for the pointers and u4s
+ * the verifier keeps there. The memory is not cleared.
+ * Returns NULL if a new block is needed and can't be had.
+ *
+ * The blocks after "current" are always unused, so the first one that
+ * is big enough can be picked up as is; a block that is skipped stays
+ * in the chain for later.
+ */
+static void* verifyArenaAlloc(VerifyArena* pArena, size_t size) {
+    VerifyArenaBlock* block = pArena->current;
+
+    size = (size + 7) & ~((size_t) 7);
+
+    if (block != NULL && size <= block->size - pArena->used) {
+        void* result = ((u1*) (block + 1)) + pArena->used;
+        pArena->used += size;
+        return result;
+    }
+
+    VerifyArenaBlock** pNext = (block == NULL) ? &pArena->first : &block->next;
+
+    while (*pNext != NULL && (*pNext)->size < size) {
+        pNext = &(*pNext)->next;
+    }
+
+    if (*pNext == NULL) {
+        size_t blockSize = (size > kVerifyArenaBlockSize)
+                ? size : kVerifyArenaBlockSize;
+
+        if (blockSize > SIZE_MAX - sizeof(VerifyArenaBlock)) {
+            return NULL;
+        }
+
+        VerifyArenaBlock* newBlock = (VerifyArenaBlock*)
+                malloc(sizeof(VerifyArenaBlock) + blockSize);
+        if (newBlock == NULL) {
+            VERIFY_LOGE("Unable to allocate %zu bytes of verifier scratch",
+                    size);
+            return NULL;
+        }
+
+        newBlock->next = NULL;
+        newBlock->size = blockSize;
+        newBlock->owned = true;
+        *pNext = newBlock;
+    }
+
+    pArena->current = *pNext;
+    pArena->used = size;
+    return pArena->current + 1;
+}
+
+/*
+ * Remember the current top of the arena.
+ */
+static inline VerifyArenaMark verifyArenaMark(const VerifyArena* pArena) {
+    VerifyArenaMark mark = { pArena->current, pArena->used };
+    return mark;
+}
+
+/*
+ * Hand back everything allocated since "mark" was taken.
+ */
+static inline void verifyArenaRelease(VerifyArena* pArena,
+        VerifyArenaMark mark) {
+    pArena->current = mark.block;
+    pArena->used = mark.used;
+}
+
+/*
+ * Read and verify a class_data_item into arena memory, as
+ * dexReadAndVerifyClassData() does into malloc()ed memory. The result
+ * lasts until the arena is released back past it. Returns NULL if the
+ * data is bad (or there's no memory to decode it into).
+ */
+static DexClassData* readClassData(const CheckState* state, const u1** pData,
+        const u1* pLimit) {
+    DexClassDataHeader header;
+
+    if (!dexReadAndVerifyClassDataHeader(pData, pLimit, &header)) {
+        return NULL;
+    }
+
+    /*
+     * Counts that can't possibly fit in the rest of the file are bad,
+     * and not worth growing the arena for.
+     */
+    if (!dexClassDataMembersFit(&header, *pData, pLimit)) {
+        return NULL;
+    }
+
+    size_t size = dexClassDataSize(&header);
+    if (size == 0) {
+        return NULL;
+    }
+
+    DexClassData* result = (DexClassData*)
+            verifyArenaAlloc(state->pArena, size);
+
+    if (result == NULL ||
+            !dexReadAndVerifyClassDataMembers(pData, pLimit, &header, result)) {
+        return NULL;
+    }
+
+    return result;
+}
+
 /*
  * Return the file offset of the given pointer.
  */
@@ -88,7 +368,7 @@ static inline bool checkPtrRange(const CheckState* state,
     const void* fileEnd = state->fileEnd;
     if ((start < fileStart) || (start > fileEnd)
             || (end < start) || (end > fileEnd)) {
-        ALOGW("Bad offset range for %s: %#x..%#x", label,
+        VERIFY_LOGW("Bad offset range for %s: %#x..%#x", label,
                 fileOffset(state, start), fileOffset(state, end));
         return false;
     }
@@ -161,7 +441,7 @@ static inline bool checkPtrRange(const CheckState* state,
  */
 #define CHECK_INDEX(_field, _limit) {                                       \
         if ((_field) >= (_limit)) {                                         \
-            ALOGW("Bad index: %s(%u) > %s(%u)",                             \
+            VERIFY_LOGW("Bad index: %s(%u) > %s(%u)",                       \
                 #_field, (u4)(_field), #_limit, (u4)(_limit));              \
             return 0;                                                       \
         }                                                                   \
@@ -180,7 +460,7 @@ static inline bool checkPtrRange(const CheckState* state,
  */
 #define CHECK_INDEX_OR_NOINDEX(_field, _limit) {                            \
         if ((_field) != kDexNoIndex && (_field) >= (_limit)) {              \
-            ALOGW("Bad index: %s(%u) > %s(%u)",                             \
+            VERIFY_LOGW("Bad index: %s(%u) > %s(%u)",                       \
                 #_field, (u4)(_field), #_limit, (u4)(_limit));              \
             return 0;                                                       \
         }                                                                   \
@@ -203,6 +483,58 @@ static inline bool checkPtrRange(const CheckState* state,
         CHECK_INDEX_OR_NOINDEX((_field), (_limit));                         \
     }
 
+/* defined below */
+static bool isDeferredDataType(int mapType);
+static bool verifyItemInPlace(const CheckState* state, u4 offset, u2 type);
+
+/*
+ * Verify that "offset" refers to a data item of the given type. This is
+ * a data map lookup, except for deferred items in lazy mode.
+ */
+static bool verifyDataItem(const CheckState* state, u4 offset, u2 type) {
+    if ((state->dataItemMode == kDataItemsMapped)
+            || !isDeferredDataType(type)) {
+        if (state->pDataMapLookups != NULL) {
+            (*state->pDataMapLookups)++;
+        }
+
+        /*
+         * This is dexDataMapVerify(), but logging with VERIFY_LOGE(), so
+         * that a parallel task stays quiet.
+         */
+        int found = dexDataMapGet(state->pDataMap, offset);
+        if (found == type) {
+            return true;
+        }
+
+        if (found < 0) {
+            VERIFY_LOGE("No data map entry found @ %#x; expected %x",
+                    offset, type);
+        } else {
+            VERIFY_LOGE("Unexpected data map entry @ %#x: "
+                    "expected %x, found %x", offset, type, found);
+        }
+        return false;
+    }
+
+    if (state->dataItemMode == kDataItemsDeferred) {
+        return true;
+    }
+
+    return verifyItemInPlace(state, offset, type);
+}
+
+/*
+ * Like verifyDataItem(), but also accept a 0 offset as valid.
+ */
+static bool verifyDataItem0Ok(const CheckState* state, u4 offset, u2 type) {
+    if (offset == 0) {
+        return true;
+    }
+
+    return verifyDataItem(state, offset, type);
+}
+
 /* Verify the definer of a given field_idx. */
 static bool verifyFieldDefiner(const CheckState* state, u4 definingClass,
         u4 fieldIdx) {
@@ -297,12 +629,12 @@ static bool swapDexHeader(const CheckState* state, DexHeader* pHeader)
 static bool checkHeaderSection(const CheckState* state, u4 sectionOffset,
         u4 sectionCount, u4* endOffset) {
     if (sectionCount != 1) {
-        ALOGE("Multiple header items");
+        VERIFY_LOGE("Multiple header items");
         return false;
     }
 
     if (sectionOffset != 0) {
-        ALOGE("Header at %#x; not at start of file", sectionOffset);
+        VERIFY_LOGE("Header at %#x; not at start of file", sectionOffset);
         return false;
     }
 
@@ -336,7 +668,7 @@ static u4 mapTypeToBitMask(int mapType) {
         case kDexTypeEncodedArrayItem:         return 1 << 16;
         case kDexTypeAnnotationsDirectoryItem: return 1 << 17;
         default: {
-            ALOGE("Unknown map item type %04x", mapType);
+            VERIFY_LOGE("Unknown map item type %04x", mapType);
             return 0;
         }
     }
@@ -362,6 +694,29 @@ static bool isDataSectionType(int mapType) {
     return true;
 }
 
+/*
+ * Indicates if an item type is one whose verification is put off until
+ * the class referring to it is verified, when verifying lazily. These
+ * are the items that only matter once a class's members, code or
+ * annotations are looked at; everything else is verified up front.
+ */
+static bool isDeferredDataType(int mapType) {
+    switch (mapType) {
+        case kDexTypeAnnotationSetRefList:
+        case kDexTypeAnnotationSetItem:
+        case kDexTypeClassDataItem:
+        case kDexTypeCodeItem:
+        case kDexTypeDebugInfoItem:
+        case kDexTypeAnnotationItem:
+        case kDexTypeEncodedArrayItem:
+        case kDexTypeAnnotationsDirectoryItem: {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 /*
  * Swap the map_list and verify what we can about it. Also, if verification
  * passes, allocate the state's DexDataMap.
@@ -500,12 +855,12 @@ static bool swapMap(CheckState* state, DexMapList* pMap)
 static bool checkMapSection(const CheckState* state, u4 sectionOffset,
         u4 sectionCount, u4* endOffset) {
     if (sectionCount != 1) {
-        ALOGE("Multiple map list items");
+        VERIFY_LOGE("Multiple map list items");
         return false;
     }
 
     if (sectionOffset != state->pHeader->mapOff) {
-        ALOGE("Map not at header-defined offset: %#x, expected %#x",
+        VERIFY_LOGE("Map not at header-defined offset: %#x, expected %#x",
                 sectionOffset, state->pHeader->mapOff);
         return false;
     }
@@ -531,8 +886,8 @@ static void* swapStringIdItem(const CheckState* state, void* ptr) {
 static void* crossVerifyStringIdItem(const CheckState* state, void* ptr) {
     const DexStringId* item = (const DexStringId*) ptr;
 
-    if (!dexDataMapVerify(state->pDataMap,
-                    item->stringDataOff, kDexTypeStringDataItem)) {
+    if (!verifyDataItem(state, item->stringDataOff,
+                    kDexTypeStringDataItem)) {
         return NULL;
     }
 
@@ -542,7 +897,7 @@ static void* crossVerifyStringIdItem(const CheckState* state, void* ptr) {
         const char* s0 = dexGetStringData(state->pDexFile, item0);
         const char* s1 = dexGetStringData(state->pDexFile, item);
         if (dexUtf8Cmp(s0, s1) >= 0) {
-            ALOGE("Out-of-order string_ids: '%s' then '%s'", s0, s1);
+            VERIFY_LOGE("Out-of-order string_ids: '%s' then '%s'", s0, s1);
             return NULL;
         }
     }
@@ -567,7 +922,7 @@ static void* crossVerifyTypeIdItem(const CheckState* state, void* ptr) {
         dexStringById(state->pDexFile, item->descriptorIdx);
 
     if (!dexIsValidTypeDescriptor(descriptor)) {
-        ALOGE("Invalid type descriptor: '%s'", descriptor);
+        VERIFY_LOGE("Invalid type descriptor: '%s'", descriptor);
         return NULL;
     }
 
@@ -575,7 +930,7 @@ static void* crossVerifyTypeIdItem(const CheckState* state, void* ptr) {
     if (item0 != NULL) {
         // Check ordering. This relies on string_ids being in order.
         if (item0->descriptorIdx >= item->descriptorIdx) {
-            ALOGE("Out-of-order type_ids: %#x then %#x",
+            VERIFY_LOGE("Out-of-order type_ids: %#x then %#x",
                     item0->descriptorIdx, item->descriptorIdx);
             return NULL;
         }
@@ -604,7 +959,7 @@ static bool shortyDescMatch(char shorty, const char* descriptor, bool
     switch (shorty) {
         case 'V': {
             if (!isReturnType) {
-                ALOGE("Invalid use of void");
+                VERIFY_LOGE("Invalid use of void");
                 return false;
             }
             // Fall through.
@@ -618,7 +973,7 @@ static bool shortyDescMatch(char shorty, const char* descriptor, bool
         case 'S':
         case 'Z': {
             if ((descriptor[0] != shorty) || (descriptor[1] != '\0')) {
-                ALOGE("Shorty vs. primitive type mismatch: '%c', '%s'",
+                VERIFY_LOGE("Shorty vs. primitive type mismatch: '%c', '%s'",
                         shorty, descriptor);
                 return false;
             }
@@ -626,14 +981,14 @@ static bool shortyDescMatch(char shorty, const char* descriptor, bool
         }
         case 'L': {
             if ((descriptor[0] != 'L') && (descriptor[0] != '[')) {
-                ALOGE("Shorty vs. type mismatch: '%c', '%s'",
+                VERIFY_LOGE("Shorty vs. type mismatch: '%c', '%s'",
                         shorty, descriptor);
                 return false;
             }
             break;
         }
         default: {
-            ALOGE("Bogus shorty: '%c'", shorty);
+            VERIFY_LOGE("Bogus shorty: '%c'", shorty);
             return false;
         }
     }
@@ -647,8 +1002,7 @@ static void* crossVerifyProtoIdItem(const CheckState* state, void* ptr) {
     const char* shorty =
         dexStringById(state->pDexFile, item->shortyIdx);
 
-    if (!dexDataMapVerify0Ok(state->pDataMap,
-                    item->parametersOff, kDexTypeTypeList)) {
+    if (!verifyDataItem0Ok(state, item->parametersOff, kDexTypeTypeList)) {
         return NULL;
     }
 
@@ -673,7 +1027,7 @@ static void* crossVerifyProtoIdItem(const CheckState* state, void* ptr) {
         }
 
         if (*shorty == '\0') {
-            ALOGE("Shorty is too short");
+            VERIFY_LOGE("Shorty is too short");
             return NULL;
         }
 
@@ -685,7 +1039,7 @@ static void* crossVerifyProtoIdItem(const CheckState* state, void* ptr) {
     }
 
     if (*shorty != '\0') {
-        ALOGE("Shorty is too long");
+        VERIFY_LOGE("Shorty is too long");
         return NULL;
     }
 
@@ -693,7 +1047,7 @@ static void* crossVerifyProtoIdItem(const CheckState* state, void* ptr) {
     if (item0 != NULL) {
         // Check ordering. This relies on type_ids being in order.
         if (item0->returnTypeIdx > item->returnTypeIdx) {
-            ALOGE("Out-of-order proto_id return types");
+            VERIFY_LOGE("Out-of-order proto_id return types");
             return NULL;
         } else if (item0->returnTypeIdx == item->returnTypeIdx) {
             bool badOrder = false;
@@ -725,7 +1079,7 @@ static void* crossVerifyProtoIdItem(const CheckState* state, void* ptr) {
             }
 
             if (badOrder) {
-                ALOGE("Out-of-order proto_id arguments");
+                VERIFY_LOGE("Out-of-order proto_id arguments");
                 return NULL;
             }
         }
@@ -753,19 +1107,19 @@ static void* crossVerifyFieldIdItem(const CheckState* state, void* ptr) {
 
     s = dexStringByTypeIdx(state->pDexFile, item->classIdx);
     if (!dexIsClassDescriptor(s)) {
-        ALOGE("Invalid descriptor for class_idx: '%s'", s);
+        VERIFY_LOGE("Invalid descriptor for class_idx: '%s'", s);
         return NULL;
     }
 
     s = dexStringByTypeIdx(state->pDexFile, item->typeIdx);
     if (!dexIsFieldDescriptor(s)) {
-        ALOGE("Invalid descriptor for type_idx: '%s'", s);
+        VERIFY_LOGE("Invalid descriptor for type_idx: '%s'", s);
         return NULL;
     }
 
     s = dexStringById(state->pDexFile, item->nameIdx);
     if (!dexIsValidMemberName(s)) {
-        ALOGE("Invalid name: '%s'", s);
+        VERIFY_LOGE("Invalid name: '%s'", s);
         return NULL;
     }
 
@@ -798,7 +1152,7 @@ static void* crossVerifyFieldIdItem(const CheckState* state, void* ptr) {
         }
 
         if (bogus) {
-            ALOGE("Out-of-order field_ids");
+            VERIFY_LOGE("Out-of-order field_ids");
             return NULL;
         }
     }
@@ -825,13 +1179,13 @@ static void* crossVerifyMethodIdItem(const CheckState* state, void* ptr) {
 
     s = dexStringByTypeIdx(state->pDexFile, item->classIdx);
     if (!dexIsReferenceDescriptor(s)) {
-        ALOGE("Invalid descriptor for class_idx: '%s'", s);
+        VERIFY_LOGE("Invalid descriptor for class_idx: '%s'", s);
         return NULL;
     }
 
     s = dexStringById(state->pDexFile, item->nameIdx);
     if (!dexIsValidMemberName(s)) {
-        ALOGE("Invalid name: '%s'", s);
+        VERIFY_LOGE("Invalid name: '%s'", s);
         return NULL;
     }
 
@@ -864,7 +1218,7 @@ static void* crossVerifyMethodIdItem(const CheckState* state, void* ptr) {
         }
 
         if (bogus) {
-            ALOGE("Out-of-order method_ids");
+            VERIFY_LOGE("Out-of-order method_ids");
             return NULL;
         }
     }
@@ -909,10 +1263,12 @@ static bool verifyClassDataIsForDef(const CheckState* state, u4 offset,
     }
 
     const u1* data = (const u1*) filePointer(state, offset);
-    DexClassData* classData = dexReadAndVerifyClassData(&data, NULL);
+    VerifyArenaMark mark = verifyArenaMark(state->pArena);
+    DexClassData* classData = readClassData(state, &data, NULL);
 
     if (classData == NULL) {
         // Shouldn't happen, but bail here just in case.
+        verifyArenaRelease(state->pArena, mark);
         return false;
     }
 
@@ -924,7 +1280,7 @@ static bool verifyClassDataIsForDef(const CheckState* state, u4 offset,
     u4 dataDefiner = findFirstClassDataDefiner(state, classData);
     bool result = (dataDefiner == definerIdx) || (dataDefiner == kDexNoIndex);
 
-    free(classData);
+    verifyArenaRelease(state->pArena, mark);
     return result;
 }
 
@@ -944,41 +1300,31 @@ static bool verifyAnnotationsDirectoryIsForDef(const CheckState* state,
     return (annoDefiner == definerIdx) || (annoDefiner == kDexNoIndex);
 }
 
-/* Perform cross-item verification of class_def_item. */
-static void* crossVerifyClassDefItem(const CheckState* state, void* ptr) {
-    const DexClassDef* item = (const DexClassDef*) ptr;
-    u4 classIdx = item->classIdx;
-    const char* descriptor = dexStringByTypeIdx(state->pDexFile, classIdx);
-
-    if (!dexIsClassDescriptor(descriptor)) {
-        ALOGE("Invalid class: '%s'", descriptor);
-        return NULL;
-    }
-
-    if (setDefinedClassBit(state, classIdx)) {
-        ALOGE("Duplicate class definition: '%s'", descriptor);
-        return NULL;
-    }
+/* Helper for crossVerifyClassDefItem(), which checks everything that
+ * a class_def_item refers to. In lazy mode this is done per class, on
+ * first use. */
+static bool crossVerifyClassDefRefs(const CheckState* state,
+        const DexClassDef* item) {
+    const char* descriptor;
 
     bool okay =
-        dexDataMapVerify0Ok(state->pDataMap,
-                item->interfacesOff, kDexTypeTypeList)
-        && dexDataMapVerify0Ok(state->pDataMap,
+        verifyDataItem0Ok(state, item->interfacesOff, kDexTypeTypeList)
+        && verifyDataItem0Ok(state,
                 item->annotationsOff, kDexTypeAnnotationsDirectoryItem)
-        && dexDataMapVerify0Ok(state->pDataMap,
+        && verifyDataItem0Ok(state,
                 item->classDataOff, kDexTypeClassDataItem)
-        && dexDataMapVerify0Ok(state->pDataMap,
+        && verifyDataItem0Ok(state,
                 item->staticValuesOff, kDexTypeEncodedArrayItem);
 
     if (!okay) {
-        return NULL;
+        return false;
     }
 
     if (item->superclassIdx != kDexNoIndex) {
         descriptor = dexStringByTypeIdx(state->pDexFile, item->superclassIdx);
         if (!dexIsClassDescriptor(descriptor)) {
-            ALOGE("Invalid superclass: '%s'", descriptor);
-            return NULL;
+            VERIFY_LOGE("Invalid superclass: '%s'", descriptor);
+            return false;
         }
     }
 
@@ -996,8 +1342,8 @@ static void* crossVerifyClassDefItem(const CheckState* state, void* ptr) {
             descriptor = dexStringByTypeIdx(state->pDexFile,
                     dexTypeListGetIdx(interfaces, i));
             if (!dexIsClassDescriptor(descriptor)) {
-                ALOGE("Invalid interface: '%s'", descriptor);
-                return NULL;
+                VERIFY_LOGE("Invalid interface: '%s'", descriptor);
+                return false;
             }
         }
 
@@ -1014,22 +1360,46 @@ static void* crossVerifyClassDefItem(const CheckState* state, void* ptr) {
             for (j = 0; j < i; j++) {
                 u4 idx2 = dexTypeListGetIdx(interfaces, j);
                 if (idx1 == idx2) {
-                    ALOGE("Duplicate interface: '%s'",
+                    VERIFY_LOGE("Duplicate interface: '%s'",
                             dexStringByTypeIdx(state->pDexFile, idx1));
-                    return NULL;
+                    return false;
                 }
             }
         }
     }
 
     if (!verifyClassDataIsForDef(state, item->classDataOff, item->classIdx)) {
-        ALOGE("Invalid class_data_item");
-        return NULL;
+        VERIFY_LOGE("Invalid class_data_item");
+        return false;
     }
 
     if (!verifyAnnotationsDirectoryIsForDef(state, item->annotationsOff,
                     item->classIdx)) {
-        ALOGE("Invalid annotations_directory_item");
+        VERIFY_LOGE("Invalid annotations_directory_item");
+        return false;
+    }
+
+    return true;
+}
+
+/* Perform cross-item verification of class_def_item. */
+static void* crossVerifyClassDefItem(const CheckState* state, void* ptr) {
+    const DexClassDef* item = (const DexClassDef*) ptr;
+    u4 classIdx = item->classIdx;
+    const char* descriptor = dexStringByTypeIdx(state->pDexFile, classIdx);
+
+    if (!dexIsClassDescriptor(descriptor)) {
+        VERIFY_LOGE("Invalid class: '%s'", descriptor);
+        return NULL;
+    }
+
+    if (setDefinedClassBit(state, classIdx)) {
+        VERIFY_LOGE("Duplicate class definition: '%s'", descriptor);
+        return NULL;
+    }
+
+    if ((state->dataItemMode != kDataItemsDeferred)
+            && !crossVerifyClassDefRefs(state, item)) {
         return NULL;
     }
 
@@ -1054,7 +1424,7 @@ static u1* swapFieldAnnotations(const CheckState* state, u4 count, u1* addr) {
         if (first) {
             first = false;
         } else if (lastIdx >= item->fieldIdx) {
-            ALOGE("Out-of-order field_idx: %#x then %#x", lastIdx,
+            VERIFY_LOGE("Out-of-order field_idx: %#x then %#x", lastIdx,
                  item->fieldIdx);
             return NULL;
         }
@@ -1084,7 +1454,7 @@ static u1* swapMethodAnnotations(const CheckState* state, u4 count, u1* addr) {
         if (first) {
             first = false;
         } else if (lastIdx >= item->methodIdx) {
-            ALOGE("Out-of-order method_idx: %#x then %#x", lastIdx,
+            VERIFY_LOGE("Out-of-order method_idx: %#x then %#x", lastIdx,
                  item->methodIdx);
             return NULL;
         }
@@ -1115,7 +1485,7 @@ static u1* swapParameterAnnotations(const CheckState* state, u4 count,
         if (first) {
             first = false;
         } else if (lastIdx >= item->methodIdx) {
-            ALOGE("Out-of-order method_idx: %#x then %#x", lastIdx,
+            VERIFY_LOGE("Out-of-order method_idx: %#x then %#x", lastIdx,
                  item->methodIdx);
             return NULL;
         }
@@ -1174,7 +1544,7 @@ static const u1* crossVerifyFieldAnnotations(const CheckState* state, u4 count,
         if (!verifyFieldDefiner(state, definingClass, item->fieldIdx)) {
             return NULL;
         }
-        if (!dexDataMapVerify(state->pDataMap, item->annotationsOff,
+        if (!verifyDataItem(state, item->annotationsOff,
                         kDexTypeAnnotationSetItem)) {
             return NULL;
         }
@@ -1194,7 +1564,7 @@ static const u1* crossVerifyMethodAnnotations(const CheckState* state,
         if (!verifyMethodDefiner(state, definingClass, item->methodIdx)) {
             return NULL;
         }
-        if (!dexDataMapVerify(state->pDataMap, item->annotationsOff,
+        if (!verifyDataItem(state, item->annotationsOff,
                         kDexTypeAnnotationSetItem)) {
             return NULL;
         }
@@ -1215,7 +1585,7 @@ static const u1* crossVerifyParameterAnnotations(const CheckState* state,
         if (!verifyMethodDefiner(state, definingClass, item->methodIdx)) {
             return NULL;
         }
-        if (!dexDataMapVerify(state->pDataMap, item->annotationsOff,
+        if (!verifyDataItem(state, item->annotationsOff,
                         kDexTypeAnnotationSetRefList)) {
             return NULL;
         }
@@ -1263,7 +1633,7 @@ static void* crossVerifyAnnotationsDirectoryItem(const CheckState* state,
     const DexAnnotationsDirectoryItem* item = (const DexAnnotationsDirectoryItem*) ptr;
     u4 definingClass = findFirstAnnotationsDirectoryDefiner(state, item);
 
-    if (!dexDataMapVerify0Ok(state->pDataMap,
+    if (!verifyDataItem0Ok(state,
                     item->classAnnotationsOff, kDexTypeAnnotationSetItem)) {
         return NULL;
     }
@@ -1351,7 +1721,7 @@ static void* crossVerifyAnnotationSetRefList(const CheckState* state,
     int count = list->size;
 
     while (count--) {
-        if (!dexDataMapVerify0Ok(state->pDataMap,
+        if (!verifyDataItem0Ok(state,
                         item->annotationsOff, kDexTypeAnnotationSetItem)) {
             return NULL;
         }
@@ -1400,7 +1770,7 @@ static void* crossVerifyAnnotationSetItem(const CheckState* state, void* ptr) {
     int i;
 
     for (i = 0; i < count; i++) {
-        if (!dexDataMapVerify0Ok(state->pDataMap,
+        if (!verifyDataItem0Ok(state,
                         dexGetAnnotationOff(set, i), kDexTypeAnnotationItem)) {
             return NULL;
         }
@@ -1412,7 +1782,7 @@ static void* crossVerifyAnnotationSetItem(const CheckState* state, void* ptr) {
         if (first) {
             first = false;
         } else if (lastIdx >= idx) {
-            ALOGE("Out-of-order entry types: %#x then %#x",
+            VERIFY_LOGE("Out-of-order entry types: %#x then %#x",
                     lastIdx, idx);
             return NULL;
         }
@@ -1436,7 +1806,7 @@ static bool verifyFields(const CheckState* state, u4 size,
         CHECK_INDEX(field->fieldIdx, state->pHeader->fieldIdsSize);
 
         if (isStatic != expectStatic) {
-            ALOGE("Field in wrong list @ %d", i);
+            VERIFY_LOGE("Field in wrong list @ %d", i);
             return false;
         }
 
@@ -1468,12 +1838,13 @@ static bool verifyMethods(const CheckState* state, u4 size,
         bool allowSynchronized = (accessFlags & ACC_NATIVE) != 0;
 
         if (isDirect != expectDirect) {
-            ALOGE("Method in wrong list @ %d", i);
+            VERIFY_LOGE("Method in wrong list @ %d", i);
             return false;
         }
 
         if (isSynchronized && !allowSynchronized) {
-            ALOGE("Bogus method access flags (synchronization) %x @ %d", accessFlags, i);
+            VERIFY_LOGE("Bogus method access flags (synchronization) %x @ %d",
+                    accessFlags, i);
             return false;
         }
 
@@ -1485,12 +1856,12 @@ static bool verifyMethods(const CheckState* state, u4 size,
 
         if (expectCode) {
             if (method->codeOff == 0) {
-                ALOGE("Unexpected zero code_off for access_flags %x",
+                VERIFY_LOGE("Unexpected zero code_off for access_flags %x",
                         accessFlags);
                 return false;
             }
         } else if (method->codeOff != 0) {
-            ALOGE("Unexpected non-zero code_off %#x for access_flags %x",
+            VERIFY_LOGE("Unexpected non-zero code_off %#x for access_flags %x",
                     method->codeOff, accessFlags);
             return false;
         }
@@ -1508,7 +1879,7 @@ static bool verifyClassDataItem0(const CheckState* state,
             classData->staticFields, true);
 
     if (!okay) {
-        ALOGE("Trouble with static fields");
+        VERIFY_LOGE("Trouble with static fields");
         return false;
     }
 
@@ -1516,7 +1887,7 @@ static bool verifyClassDataItem0(const CheckState* state,
             classData->instanceFields, false);
 
     if (!okay) {
-        ALOGE("Trouble with instance fields");
+        VERIFY_LOGE("Trouble with instance fields");
         return false;
     }
 
@@ -1524,7 +1895,7 @@ static bool verifyClassDataItem0(const CheckState* state,
             classData->directMethods, true);
 
     if (!okay) {
-        ALOGE("Trouble with direct methods");
+        VERIFY_LOGE("Trouble with direct methods");
         return false;
     }
 
@@ -1532,7 +1903,7 @@ static bool verifyClassDataItem0(const CheckState* state,
             classData->virtualMethods, false);
 
     if (!okay) {
-        ALOGE("Trouble with virtual methods");
+        VERIFY_LOGE("Trouble with virtual methods");
         return false;
     }
 
@@ -1542,16 +1913,18 @@ static bool verifyClassDataItem0(const CheckState* state,
 /* Perform intra-item verification on class_data_item. */
 static void* intraVerifyClassDataItem(const CheckState* state, void* ptr) {
     const u1* data = (const u1*) ptr;
-    DexClassData* classData = dexReadAndVerifyClassData(&data, state->fileEnd);
+    VerifyArenaMark mark = verifyArenaMark(state->pArena);
+    DexClassData* classData = readClassData(state, &data, state->fileEnd);
 
     if (classData == NULL) {
-        ALOGE("Unable to parse class_data_item");
+        VERIFY_LOGE("Unable to parse class_data_item");
+        verifyArenaRelease(state->pArena, mark);
         return NULL;
     }
 
     bool okay = verifyClassDataItem0(state, classData);
 
-    free(classData);
+    verifyArenaRelease(state->pArena, mark);
 
     if (!okay) {
         return NULL;
@@ -1595,7 +1968,8 @@ static u4 findFirstClassDataDefiner(const CheckState* state,
 /* Perform cross-item verification of class_data_item. */
 static void* crossVerifyClassDataItem(const CheckState* state, void* ptr) {
     const u1* data = (const u1*) ptr;
-    DexClassData* classData = dexReadAndVerifyClassData(&data, state->fileEnd);
+    VerifyArenaMark mark = verifyArenaMark(state->pArena);
+    DexClassData* classData = readClassData(state, &data, state->fileEnd);
     u4 definingClass = findFirstClassDataDefiner(state, classData);
     bool okay = true;
     u4 i;
@@ -1615,7 +1989,7 @@ static void* crossVerifyClassDataItem(const CheckState* state, void* ptr) {
     for (i = classData->header.directMethodsSize; okay && (i > 0); /*i*/) {
         i--;
         const DexMethod* meth = &classData->directMethods[i];
-        okay = dexDataMapVerify0Ok(state->pDataMap, meth->codeOff,
+        okay = verifyDataItem0Ok(state, meth->codeOff,
                 kDexTypeCodeItem)
             && verifyMethodDefiner(state, definingClass, meth->methodIdx);
     }
@@ -1623,12 +1997,12 @@ static void* crossVerifyClassDataItem(const CheckState* state, void* ptr) {
     for (i = classData->header.virtualMethodsSize; okay && (i > 0); /*i*/) {
         i--;
         const DexMethod* meth = &classData->virtualMethods[i];
-        okay = dexDataMapVerify0Ok(state->pDataMap, meth->codeOff,
+        okay = verifyDataItem0Ok(state, meth->codeOff,
                 kDexTypeCodeItem)
             && verifyMethodDefiner(state, definingClass, meth->methodIdx);
     }
 
-    free(classData);
+    verifyArenaRelease(state->pArena, mark);
 
     if (!okay) {
         return NULL;
@@ -1654,12 +2028,12 @@ static u4 setHandlerOffsAndVerify(const CheckState* state,
         bool catchAll;
 
         if (!okay) {
-            ALOGE("Bogus size");
+            VERIFY_LOGE("Bogus size");
             return 0;
         }
 
         if ((size < -65536) || (size > 65536)) {
-            ALOGE("Invalid size: %d", size);
+            VERIFY_LOGE("Invalid size: %d", size);
             return 0;
         }
 
@@ -1677,7 +2051,7 @@ static u4 setHandlerOffsAndVerify(const CheckState* state,
                 readAndVerifyUnsignedLeb128(&ptr, fileEnd, &okay);
 
             if (!okay) {
-                ALOGE("Bogus type_idx");
+                VERIFY_LOGE("Bogus type_idx");
                 return 0;
             }
 
@@ -1686,12 +2060,12 @@ static u4 setHandlerOffsAndVerify(const CheckState* state,
             u4 addr = readAndVerifyUnsignedLeb128(&ptr, fileEnd, &okay);
 
             if (!okay) {
-                ALOGE("Bogus addr");
+                VERIFY_LOGE("Bogus addr");
                 return 0;
             }
 
             if (addr >= code->insnsSize) {
-                ALOGE("Invalid addr: %#x", addr);
+                VERIFY_LOGE("Invalid addr: %#x", addr);
                 return 0;
             }
         }
@@ -1700,12 +2074,12 @@ static u4 setHandlerOffsAndVerify(const CheckState* state,
             u4 addr = readAndVerifyUnsignedLeb128(&ptr, fileEnd, &okay);
 
             if (!okay) {
-                ALOGE("Bogus catch_all_addr");
+                VERIFY_LOGE("Bogus catch_all_addr");
                 return 0;
             }
 
             if (addr >= code->insnsSize) {
-                ALOGE("Invalid catch_all_addr: %#x", addr);
+                VERIFY_LOGE("Invalid catch_all_addr: %#x", addr);
                 return 0;
             }
         }
@@ -1716,41 +2090,14 @@ static u4 setHandlerOffsAndVerify(const CheckState* state,
     return offset;
 }
 
-/* Helper for swapCodeItem(), which does all the try-catch related
- * swapping and verification. */
-static void* swapTriesAndCatches(const CheckState* state, DexCode* code) {
-    const u1* encodedHandlers = dexGetCatchHandlerData(code);
-    const u1* encodedPtr = encodedHandlers;
-    bool okay = true;
-    u4 handlersSize =
-        readAndVerifyUnsignedLeb128(&encodedPtr, state->fileEnd, &okay);
-
-    if (!okay) {
-        ALOGE("Bogus handlers_size");
-        return NULL;
-    }
-
-    if ((handlersSize == 0) || (handlersSize >= 65536)) {
-        ALOGE("Invalid handlers_size: %d", handlersSize);
-        return NULL;
-    }
-
-    u4 handlerOffs[handlersSize]; // list of valid handlerOff values
-    u4 endOffset = setHandlerOffsAndVerify(state, code,
-            encodedPtr - encodedHandlers,
-            handlersSize, handlerOffs);
-
-    if (endOffset == 0) {
-        return NULL;
-    }
-
+/* Helper for swapTriesAndCatches(), which swaps and verifies the
+ * try_items against the list of valid handlerOff values. */
+static bool swapTries(DexCode* code, u4 handlersSize,
+        const u4* handlerOffs) {
     DexTry* tries = (DexTry*) dexGetTries(code);
     u4 count = code->triesSize;
     u4 lastEnd = 0;
 
-    const u4 sizeOfItem = (u4) sizeof(DexTry);
-    CHECK_LIST_SIZE(tries, count, sizeOfItem);
-
     while (count--) {
         u4 i;
 
@@ -1759,13 +2106,13 @@ static void* swapTriesAndCatches(const CheckState* state, DexCode* code) {
         SWAP_FIELD2(tries->handlerOff);
 
         if (tries->startAddr < lastEnd) {
-            ALOGE("Out-of-order try");
-            return NULL;
+            VERIFY_LOGE("Out-of-order try");
+            return false;
         }
 
         if (tries->startAddr >= code->insnsSize) {
-            ALOGE("Invalid start_addr: %#x", tries->startAddr);
-            return NULL;
+            VERIFY_LOGE("Invalid start_addr: %#x", tries->startAddr);
+            return false;
         }
 
         for (i = 0; i < handlersSize; i++) {
@@ -1775,53 +2122,102 @@ static void* swapTriesAndCatches(const CheckState* state, DexCode* code) {
         }
 
         if (i == handlersSize) {
-            ALOGE("Bogus handler offset: %#x", tries->handlerOff);
-            return NULL;
+            VERIFY_LOGE("Bogus handler offset: %#x", tries->handlerOff);
+            return false;
         }
 
         lastEnd = tries->startAddr + tries->insnCount;
 
         if (lastEnd > code->insnsSize) {
-            ALOGE("Invalid insn_count: %#x (end addr %#x)",
+            VERIFY_LOGE("Invalid insn_count: %#x (end addr %#x)",
                     tries->insnCount, lastEnd);
-            return NULL;
+            return false;
         }
 
         tries++;
     }
 
-    return (u1*) encodedHandlers + endOffset;
+    return true;
 }
 
-/* Perform byte-swapping and intra-item verification on code_item. */
-static void* swapCodeItem(const CheckState* state, void* ptr) {
-    DexCode* item = (DexCode*) ptr;
-    u2* insns;
-    u4 count;
+/* Helper for swapCodeItem(), which does all the try-catch related
+ * swapping and verification. */
+static void* swapTriesAndCatches(const CheckState* state, DexCode* code) {
+    const DexTry* tries = dexGetTries(code);
+    u4 count = code->triesSize;
 
-    CHECK_PTR_RANGE(item, item + 1);
-    SWAP_FIELD2(item->registersSize);
-    SWAP_FIELD2(item->insSize);
-    SWAP_FIELD2(item->outsSize);
-    SWAP_FIELD2(item->triesSize);
-    SWAP_OFFSET4(item->debugInfoOff);
-    SWAP_FIELD4(item->insnsSize);
+    const u4 sizeOfItem = (u4) sizeof(DexTry);
+    CHECK_LIST_SIZE(tries, count, sizeOfItem);
 
-    if (item->insSize > item->registersSize) {
-        ALOGE("insSize (%u) > registersSize (%u)", item->insSize,
-                item->registersSize);
+    const u1* encodedHandlers = dexGetCatchHandlerData(code);
+    const u1* encodedPtr = encodedHandlers;
+    bool okay = true;
+
+    CHECK_PTR_RANGE(encodedHandlers, encodedHandlers + 1);
+    u4 handlersSize =
+        readAndVerifyUnsignedLeb128(&encodedPtr, state->fileEnd, &okay);
+
+    if (!okay) {
+        VERIFY_LOGE("Bogus handlers_size");
         return NULL;
     }
 
-    if ((item->outsSize > 5) && (item->outsSize > item->registersSize)) {
-        /*
+    if ((handlersSize == 0) || (handlersSize >= 65536)) {
+        VERIFY_LOGE("Invalid handlers_size: %d", handlersSize);
+        return NULL;
+    }
+
+    VerifyArenaMark mark = verifyArenaMark(state->pArena);
+    u4* handlerOffs = (u4*) verifyArenaAlloc(state->pArena,
+            handlersSize * sizeof(u4)); // list of valid handlerOff values
+    u4 endOffset = 0;
+
+    if (handlerOffs != NULL) {
+        endOffset = setHandlerOffsAndVerify(state, code,
+                encodedPtr - encodedHandlers,
+                handlersSize, handlerOffs);
+    }
+
+    okay = (endOffset != 0) && swapTries(code, handlersSize, handlerOffs);
+
+    verifyArenaRelease(state->pArena, mark);
+
+    if (!okay) {
+        return NULL;
+    }
+
+    return (u1*) encodedHandlers + endOffset;
+}
+
+/* Perform byte-swapping and intra-item verification on code_item. */
+static void* swapCodeItem(const CheckState* state, void* ptr) {
+    DexCode* item = (DexCode*) ptr;
+    u2* insns;
+    u4 count;
+
+    CHECK_PTR_RANGE(item, item + 1);
+    SWAP_FIELD2(item->registersSize);
+    SWAP_FIELD2(item->insSize);
+    SWAP_FIELD2(item->outsSize);
+    SWAP_FIELD2(item->triesSize);
+    SWAP_OFFSET4(item->debugInfoOff);
+    SWAP_FIELD4(item->insnsSize);
+
+    if (item->insSize > item->registersSize) {
+        VERIFY_LOGE("insSize (%u) > registersSize (%u)", item->insSize,
+                item->registersSize);
+        return NULL;
+    }
+
+    if ((item->outsSize > 5) && (item->outsSize > item->registersSize)) {
+        /*
          * It's okay for outsSize to be up to five, even if registersSize
          * is smaller, since the short forms of method invocation allow
          * repetition of a register multiple times within a single parameter
          * list. Longer parameter lists, though, need to be represented
          * in-order in the register file.
          */
-        ALOGE("outsSize (%u) > registersSize (%u)", item->outsSize,
+        VERIFY_LOGE("outsSize (%u) > registersSize (%u)", item->outsSize,
                 item->registersSize);
         return NULL;
     }
@@ -1832,10 +2228,7 @@ static void* swapCodeItem(const CheckState* state, void* ptr) {
     const u4 sizeOfItem = (u4) sizeof(u2);
     CHECK_LIST_SIZE(insns, count, sizeOfItem);
 
-    while (count--) {
-        *insns = SWAP2(*insns);
-        insns++;
-    }
+    insns += count;
 
     if (item->triesSize == 0) {
         ptr = insns;
@@ -1843,7 +2236,7 @@ static void* swapCodeItem(const CheckState* state, void* ptr) {
         if ((((uintptr_t) insns) & 3) != 0) {
             // Four-byte alignment for the tries. Verify the spacer is a 0.
             if (*insns != 0) {
-                ALOGE("Non-zero padding: %#x", (u4) *insns);
+                VERIFY_LOGE("Non-zero padding: %#x", (u4) *insns);
                 return NULL;
             }
         }
@@ -1863,13 +2256,31 @@ static void* intraVerifyStringDataItem(const CheckState* state, void* ptr) {
     u4 i;
 
     if (!okay) {
-        ALOGE("Bogus utf16_size");
+        VERIFY_LOGE("Bogus utf16_size");
         return NULL;
     }
 
     for (i = 0; i < utf16Size; i++) {
+        /*
+         * Plain ASCII characters need no checks beyond being there, so
+         * skip a run of them at once.
+         */
+        size_t maxLen = utf16Size - i;
+        if (data >= fileEnd) {
+            maxLen = 0;
+        } else if ((size_t) (fileEnd - data) < maxLen) {
+            maxLen = fileEnd - data;
+        }
+
+        size_t asciiLen = dexUtf8AsciiSpan(data, maxLen);
+        data += asciiLen;
+        i += asciiLen;
+        if (i == utf16Size) {
+            break;
+        }
+
         if (data >= fileEnd) {
-            ALOGE("String data would go beyond end-of-file");
+            VERIFY_LOGE("String data would go beyond end-of-file");
             return NULL;
         }
 
@@ -1880,7 +2291,7 @@ static void* intraVerifyStringDataItem(const CheckState* state, void* ptr) {
             case 0x00: {
                 // Special case of bit pattern 0xxx.
                 if (byte1 == 0) {
-                    ALOGE("String shorter than indicated utf16_size %#x",
+                    VERIFY_LOGE("String shorter than indicated utf16_size %#x",
                             utf16Size);
                     return NULL;
                 }
@@ -1906,25 +2317,25 @@ static void* intraVerifyStringDataItem(const CheckState* state, void* ptr) {
                  * Note: 1111 is valid for normal UTF-8, but not the
                  * modified UTF-8 used here.
                  */
-                ALOGE("Illegal start byte %#x", byte1);
+                VERIFY_LOGE("Illegal start byte %#x", byte1);
                 return NULL;
             }
             case 0x0e: {
                 // Bit pattern 1110, so there are two additional bytes.
                 u1 byte2 = *(data++);
                 if ((byte2 & 0xc0) != 0x80) {
-                    ALOGE("Illegal continuation byte %#x", byte2);
+                    VERIFY_LOGE("Illegal continuation byte %#x", byte2);
                     return NULL;
                 }
                 u1 byte3 = *(data++);
                 if ((byte3 & 0xc0) != 0x80) {
-                    ALOGE("Illegal continuation byte %#x", byte3);
+                    VERIFY_LOGE("Illegal continuation byte %#x", byte3);
                     return NULL;
                 }
                 u2 value = ((byte1 & 0x0f) << 12) | ((byte2 & 0x3f) << 6)
                     | (byte3 & 0x3f);
                 if (value < 0x800) {
-                    ALOGE("Illegal representation for value %x", value);
+                    VERIFY_LOGE("Illegal representation for value %x", value);
                     return NULL;
                 }
                 break;
@@ -1934,12 +2345,12 @@ static void* intraVerifyStringDataItem(const CheckState* state, void* ptr) {
                 // Bit pattern 110x, so there is one additional byte.
                 u1 byte2 = *(data++);
                 if ((byte2 & 0xc0) != 0x80) {
-                    ALOGE("Illegal continuation byte %#x", byte2);
+                    VERIFY_LOGE("Illegal continuation byte %#x", byte2);
                     return NULL;
                 }
                 u2 value = ((byte1 & 0x1f) << 6) | (byte2 & 0x3f);
                 if ((value != 0) && (value < 0x80)) {
-                    ALOGE("Illegal representation for value %x", value);
+                    VERIFY_LOGE("Illegal representation for value %x", value);
                     return NULL;
                 }
                 break;
@@ -1948,7 +2359,7 @@ static void* intraVerifyStringDataItem(const CheckState* state, void* ptr) {
     }
 
     if (*(data++) != '\0') {
-        ALOGE("String longer than indicated utf16_size %#x", utf16Size);
+        VERIFY_LOGE("String longer than indicated utf16_size %#x", utf16Size);
         return NULL;
     }
 
@@ -1965,7 +2376,7 @@ static void* intraVerifyDebugInfoItem(const CheckState* state, void* ptr) {
     readAndVerifyUnsignedLeb128(&data, fileEnd, &okay);
 
     if (!okay) {
-        ALOGE("Bogus line_start");
+        VERIFY_LOGE("Bogus line_start");
         return NULL;
     }
 
@@ -1973,12 +2384,12 @@ static void* intraVerifyDebugInfoItem(const CheckState* state, void* ptr) {
         readAndVerifyUnsignedLeb128(&data, fileEnd, &okay);
 
     if (!okay) {
-        ALOGE("Bogus parameters_size");
+        VERIFY_LOGE("Bogus parameters_size");
         return NULL;
     }
 
     if (parametersSize > 65536) {
-        ALOGE("Invalid parameters_size: %#x", parametersSize);
+        VERIFY_LOGE("Invalid parameters_size: %#x", parametersSize);
         return NULL;
     }
 
@@ -1987,7 +2398,7 @@ static void* intraVerifyDebugInfoItem(const CheckState* state, void* ptr) {
             readAndVerifyUnsignedLeb128(&data, fileEnd, &okay);
 
         if (!okay) {
-            ALOGE("Bogus parameter_name");
+            VERIFY_LOGE("Bogus parameter_name");
             return NULL;
         }
 
@@ -2089,7 +2500,7 @@ static void* intraVerifyDebugInfoItem(const CheckState* state, void* ptr) {
         }
 
         if (!okay) {
-            ALOGE("Bogus syntax for opcode %02x", opcode);
+            VERIFY_LOGE("Bogus syntax for opcode %02x", opcode);
             return NULL;
         }
     }
@@ -2129,14 +2540,14 @@ static const u1* verifyEncodedArray(const CheckState* state,
     u4 size = readAndVerifyUnsignedLeb128(&data, state->fileEnd, &okay);
 
     if (!okay) {
-        ALOGE("Bogus encoded_array size");
+        VERIFY_LOGE("Bogus encoded_array size");
         return NULL;
     }
 
     while (size--) {
         data = verifyEncodedValue(state, data, crossVerify);
         if (data == NULL) {
-            ALOGE("Bogus encoded_array value");
+            VERIFY_LOGE("Bogus encoded_array value");
             return NULL;
         }
     }
@@ -2157,7 +2568,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
     switch (valueType) {
         case kDexAnnotationByte: {
             if (valueArg != 0) {
-                ALOGE("Bogus byte size %#x", valueArg);
+                VERIFY_LOGE("Bogus byte size %#x", valueArg);
                 return NULL;
             }
             data++;
@@ -2166,7 +2577,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         case kDexAnnotationShort:
         case kDexAnnotationChar: {
             if (valueArg > 1) {
-                ALOGE("Bogus char/short size %#x", valueArg);
+                VERIFY_LOGE("Bogus char/short size %#x", valueArg);
                 return NULL;
             }
             data += valueArg + 1;
@@ -2175,7 +2586,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         case kDexAnnotationInt:
         case kDexAnnotationFloat: {
             if (valueArg > 3) {
-                ALOGE("Bogus int/float size %#x", valueArg);
+                VERIFY_LOGE("Bogus int/float size %#x", valueArg);
                 return NULL;
             }
             data += valueArg + 1;
@@ -2188,7 +2599,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationString: {
             if (valueArg > 3) {
-                ALOGE("Bogus string size %#x", valueArg);
+                VERIFY_LOGE("Bogus string size %#x", valueArg);
                 return NULL;
             }
             u4 idx = readUnsignedLittleEndian(state, &data, valueArg + 1);
@@ -2197,7 +2608,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationType: {
             if (valueArg > 3) {
-                ALOGE("Bogus type size %#x", valueArg);
+                VERIFY_LOGE("Bogus type size %#x", valueArg);
                 return NULL;
             }
             u4 idx = readUnsignedLittleEndian(state, &data, valueArg + 1);
@@ -2207,7 +2618,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         case kDexAnnotationField:
         case kDexAnnotationEnum: {
             if (valueArg > 3) {
-                ALOGE("Bogus field/enum size %#x", valueArg);
+                VERIFY_LOGE("Bogus field/enum size %#x", valueArg);
                 return NULL;
             }
             u4 idx = readUnsignedLittleEndian(state, &data, valueArg + 1);
@@ -2216,7 +2627,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationMethod: {
             if (valueArg > 3) {
-                ALOGE("Bogus method size %#x", valueArg);
+                VERIFY_LOGE("Bogus method size %#x", valueArg);
                 return NULL;
             }
             u4 idx = readUnsignedLittleEndian(state, &data, valueArg + 1);
@@ -2225,7 +2636,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationArray: {
             if (valueArg != 0) {
-                ALOGE("Bogus array value_arg %#x", valueArg);
+                VERIFY_LOGE("Bogus array value_arg %#x", valueArg);
                 return NULL;
             }
             data = verifyEncodedArray(state, data, crossVerify);
@@ -2233,7 +2644,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationAnnotation: {
             if (valueArg != 0) {
-                ALOGE("Bogus annotation value_arg %#x", valueArg);
+                VERIFY_LOGE("Bogus annotation value_arg %#x", valueArg);
                 return NULL;
             }
             data = verifyEncodedAnnotation(state, data, crossVerify);
@@ -2241,7 +2652,7 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationNull: {
             if (valueArg != 0) {
-                ALOGE("Bogus null value_arg %#x", valueArg);
+                VERIFY_LOGE("Bogus null value_arg %#x", valueArg);
                 return NULL;
             }
             // Nothing else to do for this type.
@@ -2249,14 +2660,14 @@ static const u1* verifyEncodedValue(const CheckState* state,
         }
         case kDexAnnotationBoolean: {
             if (valueArg > 1) {
-                ALOGE("Bogus boolean value_arg %#x", valueArg);
+                VERIFY_LOGE("Bogus boolean value_arg %#x", valueArg);
                 return NULL;
             }
             // Nothing else to do for this type.
             break;
         }
         default: {
-            ALOGE("Bogus value_type %#x", valueType);
+            VERIFY_LOGE("Bogus value_type %#x", valueType);
             return NULL;
         }
     }
@@ -2273,7 +2684,7 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
     u4 idx = readAndVerifyUnsignedLeb128(&data, fileEnd, &okay);
 
     if (!okay) {
-        ALOGE("Bogus encoded_annotation type_idx");
+        VERIFY_LOGE("Bogus encoded_annotation type_idx");
         return NULL;
     }
 
@@ -2282,7 +2693,7 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
     if (crossVerify) {
         const char* descriptor = dexStringByTypeIdx(state->pDexFile, idx);
         if (!dexIsClassDescriptor(descriptor)) {
-            ALOGE("Bogus annotation type: '%s'", descriptor);
+            VERIFY_LOGE("Bogus annotation type: '%s'", descriptor);
             return NULL;
         }
     }
@@ -2292,7 +2703,7 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
     bool first = true;
 
     if (!okay) {
-        ALOGE("Bogus encoded_annotation size");
+        VERIFY_LOGE("Bogus encoded_annotation size");
         return NULL;
     }
 
@@ -2300,7 +2711,7 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
         idx = readAndVerifyUnsignedLeb128(&data, fileEnd, &okay);
 
         if (!okay) {
-            ALOGE("Bogus encoded_annotation name_idx");
+            VERIFY_LOGE("Bogus encoded_annotation name_idx");
             return NULL;
         }
 
@@ -2309,7 +2720,7 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
         if (crossVerify) {
             const char* name = dexStringById(state->pDexFile, idx);
             if (!dexIsValidMemberName(name)) {
-                ALOGE("Bogus annotation member name: '%s'", name);
+                VERIFY_LOGE("Bogus annotation member name: '%s'", name);
                 return NULL;
             }
         }
@@ -2317,8 +2728,8 @@ static const u1* verifyEncodedAnnotation(const CheckState* state,
         if (first) {
             first = false;
         } else if (lastIdx >= idx) {
-            ALOGE("Out-of-order encoded_annotation name_idx: %#x then %#x",
-                    lastIdx, idx);
+            VERIFY_LOGE("Out-of-order encoded_annotation name_idx: "
+                    "%#x then %#x", lastIdx, idx);
             return NULL;
         }
 
@@ -2351,7 +2762,7 @@ static void* intraVerifyAnnotationItem(const CheckState* state, void* ptr) {
             break;
         }
         default: {
-            ALOGE("Bogus annotation visibility: %#x", *data);
+            VERIFY_LOGE("Bogus annotation visibility: %#x", *data);
             return NULL;
         }
     }
@@ -2377,20 +2788,193 @@ static void* crossVerifyAnnotationItem(const CheckState* state, void* ptr) {
  */
 typedef void* ItemVisitorFunction(const CheckState* state, void* ptr);
 
+/* defined below */
+static bool iterateSectionItems(CheckState* state, u4 offset,
+        u4 firstIndex, u4 count, ItemVisitorFunction* func, u4 alignment,
+        u4* nextOffset, int mapType);
+
 /*
- * Iterate over all the items in a section, optionally updating the
- * data map (done if mapType is passed as non-negative). The section
- * must consist of concatenated items of the same type.
+ * Verify that "offset" is the start of an item of the given deferred
+ * type, which is what the data map lookup checks in the eager case.
+ * The section's items are swapped and intra-verified in order, up to
+ * the one at "offset" if that hasn't been done already, and entered
+ * into the section's own map, where the offset is then looked up.
+ *
+ * The walk is serialized, so that concurrent callers never mask the
+ * access flags of the same item at once.
  */
-static bool iterateSectionWithOptionalUpdate(CheckState* state,
-        u4 offset, u4 count, ItemVisitorFunction* func, u4 alignment,
+static bool lookUpDeferredItem(const CheckState* state, u4 offset, u2 type,
+        ItemVisitorFunction* intraFunc, u4 alignment) {
+    DeferredSections* pDeferred = state->pDeferred;
+    DeferredSection* section = NULL;
+    int found = -1;
+    u4 i;
+
+    for (i = 0; i < pDeferred->count; i++) {
+        if (pDeferred->sections[i].type == type) {
+            section = &pDeferred->sections[i];
+            break;
+        }
+    }
+
+    if (section != NULL) {
+        pthread_mutex_lock(&pDeferred->lock);
+
+        if ((section->pDataMap == NULL) && !section->failed) {
+            section->pDataMap = dexDataMapAlloc(section->size);
+            if (section->pDataMap == NULL) {
+                VERIFY_LOGE("Unable to allocate data map (size %#x)",
+                        section->size);
+                section->failed = true;
+            }
+        }
+
+        /*
+         * Nothing intra-item verification checks refers to a deferred
+         * item, so the walk can't come back here.
+         */
+        CheckState walkState = *state;
+        walkState.pDataMap = section->pDataMap;
+        walkState.dataItemMode = kDataItemsDeferred;
+
+        while (!section->failed && (section->walked < section->size)
+                && (section->nextOffset <= offset)) {
+            walkState.previousItem = section->previousItem;
+
+            if (!iterateSectionItems(&walkState, section->nextOffset,
+                        section->walked, 1, intraFunc, alignment,
+                        &section->nextOffset, type)
+                    || (section->nextOffset > section->end)) {
+                VERIFY_LOGE("Swap of section type %04x failed", type);
+                section->failed = true;
+                break;
+            }
+
+            section->previousItem = walkState.previousItem;
+            section->walked++;
+        }
+
+        if (section->pDataMap != NULL) {
+            found = dexDataMapGet(section->pDataMap, offset);
+        }
+
+        pthread_mutex_unlock(&pDeferred->lock);
+    }
+
+    if (found != type) {
+        VERIFY_LOGE("No data map entry found @ %#x; expected %x",
+                offset, type);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Check that a deferred data item of the given type starts at "offset"
+ * (swapping and intra-verifying it, if need be), and then cross-verify
+ * it, which in turn verifies whatever deferred items it refers to. A code_item's debug_info_item has
+ * nothing else to check it, so it is verified here as well.
+ *
+ * Only used in lazy mode, where these items aren't in the data map.
+ */
+static bool verifyItemInPlace(const CheckState* state, u4 offset, u2 type) {
+    u4 dataStart = state->pHeader->dataOff;
+    u4 dataEnd = dataStart + state->pHeader->dataSize;
+    ItemVisitorFunction* intraFunc;
+    ItemVisitorFunction* crossFunc = NULL;
+    u4 alignment = sizeof(u4);
+
+    switch (type) {
+        case kDexTypeAnnotationSetRefList: {
+            intraFunc = swapAnnotationSetRefList;
+            crossFunc = crossVerifyAnnotationSetRefList;
+            break;
+        }
+        case kDexTypeAnnotationSetItem: {
+            intraFunc = swapAnnotationSetItem;
+            crossFunc = crossVerifyAnnotationSetItem;
+            break;
+        }
+        case kDexTypeClassDataItem: {
+            intraFunc = intraVerifyClassDataItem;
+            crossFunc = crossVerifyClassDataItem;
+            alignment = sizeof(u1);
+            break;
+        }
+        case kDexTypeCodeItem: {
+            intraFunc = swapCodeItem;
+            break;
+        }
+        case kDexTypeDebugInfoItem: {
+            intraFunc = intraVerifyDebugInfoItem;
+            alignment = sizeof(u1);
+            break;
+        }
+        case kDexTypeAnnotationItem: {
+            intraFunc = intraVerifyAnnotationItem;
+            alignment = sizeof(u1);
+            break;
+        }
+        case kDexTypeEncodedArrayItem: {
+            intraFunc = intraVerifyEncodedArrayItem;
+            alignment = sizeof(u1);
+            break;
+        }
+        case kDexTypeAnnotationsDirectoryItem: {
+            intraFunc = swapAnnotationsDirectoryItem;
+            crossFunc = crossVerifyAnnotationsDirectoryItem;
+            break;
+        }
+        default: {
+            VERIFY_LOGE("Unexpected deferred item type %04x", type);
+            return false;
+        }
+    }
+
+    if ((offset < dataStart) || (offset >= dataEnd)
+            || ((offset & (alignment - 1)) != 0)) {
+        VERIFY_LOGE("Bogus offset for item type %04x: %#x", type, offset);
+        return false;
+    }
+
+    if (!lookUpDeferredItem(state, offset, type, intraFunc, alignment)) {
+        return false;
+    }
+
+    void* ptr = filePointer(state, offset);
+
+    if ((crossFunc != NULL) && (crossFunc(state, ptr) == NULL)) {
+        VERIFY_LOGE("Cross-item verify of item type %04x @ offset %#x failed",
+                type, offset);
+        return false;
+    }
+
+    if (type == kDexTypeCodeItem) {
+        const DexCode* code = (const DexCode*) ptr;
+        return verifyDataItem0Ok(state, code->debugInfoOff,
+                kDexTypeDebugInfoItem);
+    }
+
+    return true;
+}
+
+/*
+ * Iterate over "count" items of a section, starting with the one whose
+ * index within the section is "firstIndex" and which lives at (or, after
+ * alignment, just past) "offset". The caller is responsible for setting
+ * up state->previousItem. Optionally updates the data map (done if
+ * mapType is passed as non-negative). The section must consist of
+ * concatenated items of the same type.
+ */
+static bool iterateSectionItems(CheckState* state, u4 offset,
+        u4 firstIndex, u4 count, ItemVisitorFunction* func, u4 alignment,
         u4* nextOffset, int mapType) {
     u4 alignmentMask = alignment - 1;
+    u4 endIndex = firstIndex + count;
     u4 i;
 
-    state->previousItem = NULL;
-
-    for (i = 0; i < count; i++) {
+    for (i = firstIndex; i < endIndex; i++) {
         u4 newOffset = (offset + alignmentMask) & ~alignmentMask;
         u1* ptr = (u1*) filePointer(state, newOffset);
 
@@ -2400,7 +2984,8 @@ static bool iterateSectionWithOptionalUpdate(CheckState* state,
                 CHECK_OFFSET_RANGE(offset, newOffset);
                 while (offset < newOffset) {
                     if (*ptr != '\0') {
-                        ALOGE("Non-zero padding 0x%02x @ %x", *ptr, offset);
+                        VERIFY_LOGE("Non-zero padding 0x%02x @ %x",
+                                *ptr, offset);
                         return false;
                     }
                     ptr++;
@@ -2413,12 +2998,12 @@ static bool iterateSectionWithOptionalUpdate(CheckState* state,
         newOffset = fileOffset(state, newPtr);
 
         if (newPtr == NULL) {
-            ALOGE("Trouble with item %d @ offset %#x", i, offset);
+            VERIFY_LOGE("Trouble with item %d @ offset %#x", i, offset);
             return false;
         }
 
         if (newOffset > state->fileLen) {
-            ALOGE("Item %d @ offset %#x ends out of bounds", i, offset);
+            VERIFY_LOGE("Item %d @ offset %#x ends out of bounds", i, offset);
             return false;
         }
 
@@ -2437,6 +3022,20 @@ static bool iterateSectionWithOptionalUpdate(CheckState* state,
     return true;
 }
 
+/*
+ * Iterate over all the items in a section, optionally updating the
+ * data map (done if mapType is passed as non-negative). The section
+ * must consist of concatenated items of the same type.
+ */
+static bool iterateSectionWithOptionalUpdate(CheckState* state,
+        u4 offset, u4 count, ItemVisitorFunction* func, u4 alignment,
+        u4* nextOffset, int mapType) {
+    state->previousItem = NULL;
+
+    return iterateSectionItems(state, offset, 0, count, func, alignment,
+            nextOffset, mapType);
+}
+
 /*
  * Iterate over all the items in a section. The section must consist of
  * concatenated items of the same type. This variant will not update the data
@@ -2456,13 +3055,13 @@ static bool checkBoundsAndIterateSection(CheckState* state,
         u4 offset, u4 count, u4 expectedOffset, u4 expectedCount,
         ItemVisitorFunction* func, u4 alignment, u4* nextOffset) {
     if (offset != expectedOffset) {
-        ALOGE("Bogus offset for section: got %#x; expected %#x",
+        VERIFY_LOGE("Bogus offset for section: got %#x; expected %#x",
                 offset, expectedOffset);
         return false;
     }
 
     if (count != expectedCount) {
-        ALOGE("Bogus size for section: got %#x; expected %#x",
+        VERIFY_LOGE("Bogus size for section: got %#x; expected %#x",
                 count, expectedCount);
         return false;
     }
@@ -2482,7 +3081,7 @@ static bool iterateDataSection(CheckState* state, u4 offset, u4 count,
     assert(nextOffset != NULL);
 
     if ((offset < dataStart) || (offset >= dataEnd)) {
-        ALOGE("Bogus offset for data subsection: %#x", offset);
+        VERIFY_LOGE("Bogus offset for data subsection: %#x", offset);
         return false;
     }
 
@@ -2492,13 +3091,153 @@ static bool iterateDataSection(CheckState* state, u4 offset, u4 count,
     }
 
     if (*nextOffset > dataEnd) {
-        ALOGE("Out-of-bounds end of data subsection: %#x", *nextOffset);
+        VERIFY_LOGE("Out-of-bounds end of data subsection: %#x", *nextOffset);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Check the gap between the end of one section and the start of the
+ * next: it must consist solely of zero padding, and sections must not
+ * overlap.
+ */
+static bool checkSectionPadding(const CheckState* state, u4 lastOffset,
+        u4 sectionOffset) {
+    if (lastOffset < sectionOffset) {
+        CHECK_OFFSET_RANGE(lastOffset, sectionOffset);
+        const u1* ptr = (const u1*) filePointer(state, lastOffset);
+        while (lastOffset < sectionOffset) {
+            if (*ptr != '\0') {
+                VERIFY_LOGE("Non-zero padding 0x%02x before section "
+                        "start @ %x", *ptr, lastOffset);
+                return false;
+            }
+            ptr++;
+            lastOffset++;
+        }
+    } else if (lastOffset > sectionOffset) {
+        VERIFY_LOGE("Section overlap or out-of-order map: %x, %x",
+                lastOffset, sectionOffset);
         return false;
     }
 
     return true;
 }
 
+/*
+ * Byte-swap and intra-verify all the items of a single section, storing
+ * the offset just past its last item in "*endOffset".
+ */
+static bool swapSection(CheckState* state, const DexMapItem* item,
+        u4* endOffset) {
+    u4 sectionOffset = item->offset;
+    u4 sectionCount = item->size;
+    u2 type = item->type;
+
+    switch (type) {
+        case kDexTypeHeaderItem: {
+            /*
+             * The header got swapped very early on, but do some
+             * additional sanity checking here.
+             */
+            return checkHeaderSection(state, sectionOffset, sectionCount,
+                    endOffset);
+        }
+        case kDexTypeStringIdItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->stringIdsOff,
+                    state->pHeader->stringIdsSize, swapStringIdItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeTypeIdItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->typeIdsOff,
+                    state->pHeader->typeIdsSize, swapTypeIdItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeProtoIdItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->protoIdsOff,
+                    state->pHeader->protoIdsSize, swapProtoIdItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeFieldIdItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->fieldIdsOff,
+                    state->pHeader->fieldIdsSize, swapFieldIdItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeMethodIdItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->methodIdsOff,
+                    state->pHeader->methodIdsSize, swapMethodIdItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeClassDefItem: {
+            return checkBoundsAndIterateSection(state, sectionOffset,
+                    sectionCount, state->pHeader->classDefsOff,
+                    state->pHeader->classDefsSize, swapClassDefItem,
+                    sizeof(u4), endOffset);
+        }
+        case kDexTypeMapList: {
+            /*
+             * The map section was swapped early on, but do some
+             * additional sanity checking here.
+             */
+            return checkMapSection(state, sectionOffset, sectionCount,
+                    endOffset);
+        }
+        case kDexTypeTypeList: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    swapTypeList, sizeof(u4), endOffset, type);
+        }
+        case kDexTypeAnnotationSetRefList: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    swapAnnotationSetRefList, sizeof(u4), endOffset, type);
+        }
+        case kDexTypeAnnotationSetItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    swapAnnotationSetItem, sizeof(u4), endOffset, type);
+        }
+        case kDexTypeClassDataItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    intraVerifyClassDataItem, sizeof(u1), endOffset, type);
+        }
+        case kDexTypeCodeItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    swapCodeItem, sizeof(u4), endOffset, type);
+        }
+        case kDexTypeStringDataItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    intraVerifyStringDataItem, sizeof(u1), endOffset, type);
+        }
+        case kDexTypeDebugInfoItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    intraVerifyDebugInfoItem, sizeof(u1), endOffset, type);
+        }
+        case kDexTypeAnnotationItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    intraVerifyAnnotationItem, sizeof(u1), endOffset, type);
+        }
+        case kDexTypeEncodedArrayItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    intraVerifyEncodedArrayItem, sizeof(u1), endOffset,
+                    type);
+        }
+        case kDexTypeAnnotationsDirectoryItem: {
+            return iterateDataSection(state, sectionOffset, sectionCount,
+                    swapAnnotationsDirectoryItem, sizeof(u4), endOffset,
+                    type);
+        }
+        default: {
+            VERIFY_LOGE("Unknown map item type %04x", type);
+            return false;
+        }
+    }
+}
+
 /*
  * Byte-swap all items in the given map except the header and the map
  * itself, both of which should have already gotten swapped. This also
@@ -2516,159 +3255,23 @@ static bool swapEverythingButHeaderAndMap(CheckState* state,
     bool okay = true;
 
     while (okay && count--) {
-        u4 sectionOffset = item->offset;
-        u4 sectionCount = item->size;
-        u2 type = item->type;
-
-        if (lastOffset < sectionOffset) {
-            CHECK_OFFSET_RANGE(lastOffset, sectionOffset);
-            const u1* ptr = (const u1*) filePointer(state, lastOffset);
-            while (lastOffset < sectionOffset) {
-                if (*ptr != '\0') {
-                    ALOGE("Non-zero padding 0x%02x before section start @ %x",
-                            *ptr, lastOffset);
-                    okay = false;
-                    break;
-                }
-                ptr++;
-                lastOffset++;
-            }
-        } else if (lastOffset > sectionOffset) {
-            ALOGE("Section overlap or out-of-order map: %x, %x",
-                    lastOffset, sectionOffset);
-            okay = false;
-        }
+        DexVerifySectionStats* pSectionStats =
+            getSectionStats(state, pMap, item);
+        u8 start = (pSectionStats != NULL) ? getMonotonicNsec() : 0;
+
+        okay = checkSectionPadding(state, lastOffset, item->offset);
 
         if (!okay) {
             break;
         }
 
-        switch (type) {
-            case kDexTypeHeaderItem: {
-                /*
-                 * The header got swapped very early on, but do some
-                 * additional sanity checking here.
-                 */
-                okay = checkHeaderSection(state, sectionOffset, sectionCount,
-                        &lastOffset);
-                break;
-            }
-            case kDexTypeStringIdItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->stringIdsOff,
-                        state->pHeader->stringIdsSize, swapStringIdItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeTypeIdItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->typeIdsOff,
-                        state->pHeader->typeIdsSize, swapTypeIdItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeProtoIdItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->protoIdsOff,
-                        state->pHeader->protoIdsSize, swapProtoIdItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeFieldIdItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->fieldIdsOff,
-                        state->pHeader->fieldIdsSize, swapFieldIdItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeMethodIdItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->methodIdsOff,
-                        state->pHeader->methodIdsSize, swapMethodIdItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeClassDefItem: {
-                okay = checkBoundsAndIterateSection(state, sectionOffset,
-                        sectionCount, state->pHeader->classDefsOff,
-                        state->pHeader->classDefsSize, swapClassDefItem,
-                        sizeof(u4), &lastOffset);
-                break;
-            }
-            case kDexTypeMapList: {
-                /*
-                 * The map section was swapped early on, but do some
-                 * additional sanity checking here.
-                 */
-                okay = checkMapSection(state, sectionOffset, sectionCount,
-                        &lastOffset);
-                break;
-            }
-            case kDexTypeTypeList: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        swapTypeList, sizeof(u4), &lastOffset, type);
-                break;
-            }
-            case kDexTypeAnnotationSetRefList: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        swapAnnotationSetRefList, sizeof(u4), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeAnnotationSetItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        swapAnnotationSetItem, sizeof(u4), &lastOffset, type);
-                break;
-            }
-            case kDexTypeClassDataItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        intraVerifyClassDataItem, sizeof(u1), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeCodeItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        swapCodeItem, sizeof(u4), &lastOffset, type);
-                break;
-            }
-            case kDexTypeStringDataItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        intraVerifyStringDataItem, sizeof(u1), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeDebugInfoItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        intraVerifyDebugInfoItem, sizeof(u1), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeAnnotationItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        intraVerifyAnnotationItem, sizeof(u1), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeEncodedArrayItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        intraVerifyEncodedArrayItem, sizeof(u1), &lastOffset,
-                        type);
-                break;
-            }
-            case kDexTypeAnnotationsDirectoryItem: {
-                okay = iterateDataSection(state, sectionOffset, sectionCount,
-                        swapAnnotationsDirectoryItem, sizeof(u4), &lastOffset,
-                        type);
-                break;
-            }
-            default: {
-                ALOGE("Unknown map item type %04x", type);
-                return false;
-            }
-        }
+        okay = swapSection(state, item, &lastOffset);
 
         if (!okay) {
-            ALOGE("Swap of section type %04x failed", type);
+            ALOGE("Swap of section type %04x failed", item->type);
+        } else if (pSectionStats != NULL) {
+            pSectionStats->byteCount = lastOffset - item->offset;
+            pSectionStats->swapNanos = getMonotonicNsec() - start;
         }
 
         item++;
@@ -2678,95 +3281,218 @@ static bool swapEverythingButHeaderAndMap(CheckState* state,
 }
 
 /*
- * Perform cross-item verification on everything that needs it. This
- * pass is only called after all items are byte-swapped and
- * intra-verified (checked for internal consistency).
+ * Lazy version of swapEverythingButHeaderAndMap(), which skips the
+ * sections of deferred items (see isDeferredDataType()) apart from
+ * checking that they start in the data section. Since the end of a
+ * skipped section isn't known, neither is the padding after it.
  */
-static bool crossVerifyEverything(CheckState* state, DexMapList* pMap)
-{
+static bool swapEverythingButDeferred(CheckState* state, DexMapList* pMap) {
     const DexMapItem* item = pMap->list;
+    u4 dataStart = state->pHeader->dataOff;
+    u4 dataEnd = dataStart + state->pHeader->dataSize;
+    u4 lastOffset = 0;
+    bool afterDeferred = false;
     u4 count = pMap->size;
     bool okay = true;
 
     while (okay && count--) {
-        u4 sectionOffset = item->offset;
-        u4 sectionCount = item->size;
-
-        switch (item->type) {
-            case kDexTypeHeaderItem:
-            case kDexTypeMapList:
-            case kDexTypeTypeList:
-            case kDexTypeCodeItem:
-            case kDexTypeStringDataItem:
-            case kDexTypeDebugInfoItem:
-            case kDexTypeAnnotationItem:
-            case kDexTypeEncodedArrayItem: {
-                // There is no need for cross-item verification for these.
-                break;
-            }
-            case kDexTypeStringIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyStringIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeTypeIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyTypeIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeProtoIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyProtoIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeFieldIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyFieldIdItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeMethodIdItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyMethodIdItem, sizeof(u4), NULL);
+        if (!afterDeferred) {
+            okay = checkSectionPadding(state, lastOffset, item->offset);
+            if (!okay) {
                 break;
             }
-            case kDexTypeClassDefItem: {
-                // Allocate (on the stack) the "observed class_def" bits.
-                size_t arraySize = calcDefinedClassBitsSize(state);
-                u4 definedClassBits[arraySize];
-                memset(definedClassBits, 0, arraySize * sizeof(u4));
-                state->pDefinedClassBits = definedClassBits;
-
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyClassDefItem, sizeof(u4), NULL);
+        }
 
-                state->pDefinedClassBits = NULL;
-                break;
+        if (isDeferredDataType(item->type)) {
+            if ((item->offset < dataStart) || (item->offset >= dataEnd)) {
+                ALOGE("Bogus offset for data subsection: %#x", item->offset);
+                okay = false;
             }
-            case kDexTypeAnnotationSetRefList: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationSetRefList, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeAnnotationSetItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationSetItem, sizeof(u4), NULL);
-                break;
-            }
-            case kDexTypeClassDataItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyClassDataItem, sizeof(u1), NULL);
-                break;
-            }
-            case kDexTypeAnnotationsDirectoryItem: {
-                okay = iterateSection(state, sectionOffset, sectionCount,
-                        crossVerifyAnnotationsDirectoryItem, sizeof(u4), NULL);
-                break;
-            }
-            default: {
-                ALOGE("Unknown map item type %04x", item->type);
+            afterDeferred = true;
+        } else {
+            okay = swapSection(state, item, &lastOffset);
+            afterDeferred = false;
+        }
+
+        if (!okay) {
+            ALOGE("Swap of section type %04x failed", item->type);
+        }
+
+        item++;
+    }
+
+    return okay;
+}
+
+/*
+ * Return the size of a single item of the given fixed-size id section
+ * type, or 0 if the section type isn't one of those.
+ */
+static u4 idItemSize(int mapType) {
+    switch (mapType) {
+        case kDexTypeStringIdItem: return sizeof(DexStringId);
+        case kDexTypeTypeIdItem:   return sizeof(DexTypeId);
+        case kDexTypeProtoIdItem:  return sizeof(DexProtoId);
+        case kDexTypeFieldIdItem:  return sizeof(DexFieldId);
+        case kDexTypeMethodIdItem: return sizeof(DexMethodId);
+        default:                   return 0;
+    }
+}
+
+/*
+ * Perform cross-item verification on "count" items of the given section,
+ * starting at index "firstIndex". Ranges other than the whole section are
+ * only supported for the fixed-size id sections (see idItemSize()).
+ */
+static bool crossVerifySection(CheckState* state, const DexMapItem* item,
+        u4 firstIndex, u4 count) {
+    u4 sectionOffset = item->offset;
+    ItemVisitorFunction* func;
+    u4 alignment = sizeof(u4);
+
+    if ((state->dataItemMode == kDataItemsDeferred)
+            && isDeferredDataType(item->type)) {
+        return true;
+    }
+
+    switch (item->type) {
+        case kDexTypeHeaderItem:
+        case kDexTypeMapList:
+        case kDexTypeTypeList:
+        case kDexTypeCodeItem:
+        case kDexTypeStringDataItem:
+        case kDexTypeDebugInfoItem:
+        case kDexTypeAnnotationItem:
+        case kDexTypeEncodedArrayItem: {
+            // There is no need for cross-item verification for these.
+            return true;
+        }
+        case kDexTypeStringIdItem: {
+            func = crossVerifyStringIdItem;
+            break;
+        }
+        case kDexTypeTypeIdItem: {
+            func = crossVerifyTypeIdItem;
+            break;
+        }
+        case kDexTypeProtoIdItem: {
+            func = crossVerifyProtoIdItem;
+            break;
+        }
+        case kDexTypeFieldIdItem: {
+            func = crossVerifyFieldIdItem;
+            break;
+        }
+        case kDexTypeMethodIdItem: {
+            func = crossVerifyMethodIdItem;
+            break;
+        }
+        case kDexTypeClassDefItem: {
+            func = crossVerifyClassDefItem;
+            break;
+        }
+        case kDexTypeAnnotationSetRefList: {
+            func = crossVerifyAnnotationSetRefList;
+            break;
+        }
+        case kDexTypeAnnotationSetItem: {
+            func = crossVerifyAnnotationSetItem;
+            break;
+        }
+        case kDexTypeClassDataItem: {
+            func = crossVerifyClassDataItem;
+            alignment = sizeof(u1);
+            break;
+        }
+        case kDexTypeAnnotationsDirectoryItem: {
+            func = crossVerifyAnnotationsDirectoryItem;
+            break;
+        }
+        default: {
+            VERIFY_LOGE("Unknown map item type %04x", item->type);
+            return false;
+        }
+    }
+
+    if (firstIndex == 0) {
+        state->previousItem = NULL;
+    } else {
+        u4 itemSize = idItemSize(item->type);
+
+        assert(itemSize != 0);
+        sectionOffset += firstIndex * itemSize;
+        state->previousItem = filePointer(state, sectionOffset - itemSize);
+
+        /*
+         * The ordering check for string_ids reads the previous item's
+         * string data, which belongs to the preceding range and may not
+         * have been verified yet. If it is bogus, the preceding range
+         * fails (and reports it) anyway.
+         */
+        if (item->type == kDexTypeStringIdItem) {
+            const DexStringId* item0 =
+                (const DexStringId*) state->previousItem;
+            if (dexDataMapGet(state->pDataMap, item0->stringDataOff)
+                    != kDexTypeStringDataItem) {
                 return false;
             }
         }
+    }
+
+    return iterateSectionItems(state, sectionOffset, firstIndex, count,
+            func, alignment, NULL, -1);
+}
+
+/*
+ * Cross-verify (a range of) the class_defs section, with the "observed
+ * class_def" bits allocated from the arena for the duration.
+ */
+static bool crossVerifyClassDefSection(CheckState* state,
+        const DexMapItem* item, u4 firstIndex, u4 count) {
+    VerifyArenaMark mark = verifyArenaMark(state->pArena);
+    size_t arraySize = calcDefinedClassBitsSize(state);
+    u4* definedClassBits = (u4*) verifyArenaAlloc(state->pArena,
+            arraySize * sizeof(u4));
+
+    if (definedClassBits == NULL) {
+        return false;
+    }
+
+    memset(definedClassBits, 0, arraySize * sizeof(u4));
+    state->pDefinedClassBits = definedClassBits;
+
+    bool okay = crossVerifySection(state, item, firstIndex, count);
+
+    state->pDefinedClassBits = NULL;
+    verifyArenaRelease(state->pArena, mark);
+    return okay;
+}
+
+/*
+ * Perform cross-item verification on everything that needs it. This
+ * pass is only called after all items are byte-swapped and
+ * intra-verified (checked for internal consistency).
+ */
+static bool crossVerifyEverything(CheckState* state, DexMapList* pMap)
+{
+    const DexMapItem* item = pMap->list;
+    u4 count = pMap->size;
+    bool okay = true;
+
+    while (okay && count--) {
+        DexVerifySectionStats* pSectionStats =
+            getSectionStats(state, pMap, item);
+        u8 start = (pSectionStats != NULL) ? getMonotonicNsec() : 0;
+
+        if (item->type == kDexTypeClassDefItem) {
+            okay = crossVerifyClassDefSection(state, item, 0, item->size);
+        } else {
+            okay = crossVerifySection(state, item, 0, item->size);
+        }
+
+        if (pSectionStats != NULL) {
+            pSectionStats->crossNanos = getMonotonicNsec() - start;
+        }
 
         if (!okay) {
             ALOGE("Cross-item verify of section type %04x failed",
@@ -2779,6 +3505,319 @@ static bool crossVerifyEverything(CheckState* state, DexMapList* pMap)
     return okay;
 }
 
+/*
+ * Number of id items handled by one cross-verification task in the
+ * parallel verifier.
+ */
+static const u4 kCrossVerifyItemsPerTask = 4096;
+
+/*
+ * One unit of work for the parallel verifier: either the swap +
+ * intra-verification of a whole section, or the cross-verification of
+ * a range of items of a section. Each task gets a private copy of the
+ * CheckState, so that previousItem (and, during the swap pass, the data
+ * map and the end of the bytes it may touch) aren't shared between
+ * threads, and uses an arena of its own.
+ */
+struct VerifyTask {
+    const DexMapItem* item;         // map entry for the section
+    CheckState        state;        // private copy of the shared state
+    DexDataMap        dataMap;      // this section's slice of the data map
+    u4                firstIndex;   // first item to cross-verify
+    u4                count;        // number of items to cross-verify
+    u4                endOffset;    // offset just past the swapped section
+    u8                nanos;        // time taken, for DexVerifyStats
+    u8                dataMapLookups; // for DexVerifyStats
+    bool              okay;         // result
+};
+
+/* sysRunParallel() callback for the swap pass. */
+static void swapSectionTask(void* arg, size_t index) {
+    VerifyTask* task = &((VerifyTask*) arg)[index];
+    u8 arenaBuf[VERIFY_ARENA_STACK_SIZE / sizeof(u8)];
+    VerifyArena arena;
+
+    bool timed = (task->state.pStats != NULL);
+    u8 start = timed ? getMonotonicNsec() : 0;
+
+    verifyArenaInit(&arena, arenaBuf, sizeof(arenaBuf));
+    task->state.pArena = &arena;
+    gQuietVerify = true;
+
+    task->okay = swapSection(&task->state, task->item, &task->endOffset);
+    task->nanos = timed ? getMonotonicNsec() - start : 0;
+
+    gQuietVerify = false;
+    task->state.pArena = NULL;
+    verifyArenaFree(&arena);
+}
+
+/* sysRunParallel() callback for the cross-verification pass. */
+static void crossVerifySectionTask(void* arg, size_t index) {
+    VerifyTask* task = &((VerifyTask*) arg)[index];
+    u8 arenaBuf[VERIFY_ARENA_STACK_SIZE / sizeof(u8)];
+    VerifyArena arena;
+
+    verifyArenaInit(&arena, arenaBuf, sizeof(arenaBuf));
+    task->state.pArena = &arena;
+    gQuietVerify = true;
+
+    if (task->item->type == kDexTypeClassDefItem) {
+        /*
+         * The class_defs section is never split, since duplicate
+         * detection needs to see the classes in order.
+         */
+        task->okay = crossVerifyClassDefSection(&task->state, task->item,
+                task->firstIndex, task->count);
+    } else {
+        task->okay = crossVerifySection(&task->state, task->item,
+                task->firstIndex, task->count);
+    }
+
+    gQuietVerify = false;
+    task->state.pArena = NULL;
+    verifyArenaFree(&arena);
+}
+
+/*
+ * Get the size in bytes of a section whose items are all the same size,
+ * or 0 for the ones whose size isn't known until they've been swapped.
+ */
+static u8 fixedSectionSize(const DexMapItem* item) {
+    u4 itemSize = idItemSize(item->type);
+
+    switch (item->type) {
+        case kDexTypeHeaderItem:   itemSize = sizeof(DexHeader);   break;
+        case kDexTypeClassDefItem: itemSize = sizeof(DexClassDef); break;
+        default:                                                   break;
+    }
+
+    return (u8) item->size * itemSize;
+}
+
+/*
+ * Check that the sections of the map are in order, and that the ones
+ * of known size (see fixedSectionSize()) end before the next one
+ * starts, without logging anything. The parallel swap pass is only
+ * safe for a map that passes.
+ */
+static bool sectionsAreDisjoint(const CheckState* state,
+        const DexMapList* pMap) {
+    u4 count = pMap->size;
+    u4 i;
+
+    for (i = 0; i < count; i++) {
+        const DexMapItem* item = &pMap->list[i];
+        u4 limit = (i + 1 < count) ? pMap->list[i + 1].offset
+                : state->fileLen;
+
+        if (item->offset >= limit
+                || item->offset + fixedSectionSize(item) > limit) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Parallel version of swapEverythingButHeaderAndMap(). Every section is
+ * swapped and intra-verified as an independent task, each one filling
+ * in its own slice of the data map. Each task only gets to see the
+ * bytes up to the start of the next section, so no two tasks touch the
+ * same bytes; a map that doesn't allow that gets the serial pass.
+ *
+ * The padding between sections and the task results are then checked
+ * in map order. The tasks don't log anything, so if something failed,
+ * the serial pass is run to report it just as it would have without
+ * the threads. (The only thing the swap pass writes to the file is the
+ * masking of unknown access flags, which doesn't change the outcome
+ * of a second pass.)
+ */
+static bool swapEverythingButHeaderAndMapParallel(CheckState* state,
+        DexMapList* pMap, int numThreads) {
+    DexDataMap* pDataMap = state->pDataMap;
+    u4 count = pMap->size;
+    u4 lastOffset = 0;
+    u4 nextSlot = 0;
+    bool okay = true;
+    u4 i;
+
+    if (!sectionsAreDisjoint(state, pMap)) {
+        return swapEverythingButHeaderAndMap(state, pMap);
+    }
+
+    VerifyTask* tasks = (VerifyTask*) calloc(count, sizeof(VerifyTask));
+    if (tasks == NULL) {
+        ALOGE("Unable to allocate %u verify tasks", count);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        VerifyTask* task = &tasks[i];
+        const DexMapItem* item = &pMap->list[i];
+        u4 limit = (i + 1 < count) ? pMap->list[i + 1].offset
+                : state->fileLen;
+
+        task->item = item;
+        task->state = *state;
+        task->state.fileEnd = state->fileStart + limit;
+        task->state.fileLen = limit;
+        task->state.pDataMapLookups = NULL;
+
+        if (isDataSectionType(item->type)) {
+            /* swapMap() made sure all of these fit in the data map */
+            task->dataMap.max = item->size;
+            task->dataMap.offsets = pDataMap->offsets + nextSlot;
+            task->dataMap.types = pDataMap->types + nextSlot;
+            task->state.pDataMap = &task->dataMap;
+            nextSlot += item->size;
+        } else {
+            task->state.pDataMap = NULL;
+        }
+    }
+
+    sysRunParallel(count, numThreads, swapSectionTask, tasks);
+
+    for (i = 0; okay && (i < count); i++) {
+        VerifyTask* task = &tasks[i];
+
+        gQuietVerify = true;
+        okay = checkSectionPadding(state, lastOffset, task->item->offset)
+                && task->okay;
+        gQuietVerify = false;
+
+        if (!okay) {
+            break;
+        }
+
+        DexVerifySectionStats* pSectionStats =
+            getSectionStats(state, pMap, task->item);
+        if (pSectionStats != NULL) {
+            pSectionStats->byteCount = task->endOffset - task->item->offset;
+            pSectionStats->swapNanos = task->nanos;
+        }
+
+        /*
+         * Pack this section's entries down against the previous ones;
+         * some sections (e.g. the map itself) don't add any.
+         */
+        if (task->dataMap.count != 0) {
+            memmove(pDataMap->offsets + pDataMap->count,
+                    task->dataMap.offsets, task->dataMap.count * sizeof(u4));
+            memmove(pDataMap->types + pDataMap->count,
+                    task->dataMap.types, task->dataMap.count * sizeof(u2));
+            pDataMap->count += task->dataMap.count;
+        }
+
+        lastOffset = task->endOffset;
+    }
+
+    free(tasks);
+
+    if (!okay) {
+        pDataMap->count = 0;
+        okay = swapEverythingButHeaderAndMap(state, pMap);
+    }
+
+    return okay;
+}
+
+/*
+ * Parallel version of crossVerifyEverything(). Sections are still
+ * handled one at a time in map order, since the checks for a section
+ * rely on the sections before it having been verified (e.g., type_ids
+ * look at the string data referred to by string_ids). Within a
+ * section, the fixed-size id items are split into ranges of
+ * kCrossVerifyItemsPerTask items that are verified in parallel. As
+ * in the swap pass, the tasks don't log anything, and a section that
+ * fails is verified again without threads to report why.
+ */
+static bool crossVerifyEverythingParallel(CheckState* state,
+        DexMapList* pMap, int numThreads) {
+    u4 count = pMap->size;
+    u4 maxTasks = 1;
+    bool okay = true;
+    u4 i;
+
+    for (i = 0; i < count; i++) {
+        const DexMapItem* item = &pMap->list[i];
+
+        if (idItemSize(item->type) != 0) {
+            u4 ranges = (item->size + kCrossVerifyItemsPerTask - 1)
+                    / kCrossVerifyItemsPerTask;
+            if (ranges > maxTasks) {
+                maxTasks = ranges;
+            }
+        }
+    }
+
+    VerifyTask* tasks = (VerifyTask*) calloc(maxTasks, sizeof(VerifyTask));
+    if (tasks == NULL) {
+        ALOGE("Unable to allocate %u verify tasks", maxTasks);
+        return false;
+    }
+
+    for (i = 0; okay && (i < count); i++) {
+        const DexMapItem* item = &pMap->list[i];
+        u4 rangeSize = (idItemSize(item->type) != 0)
+                ? kCrossVerifyItemsPerTask : item->size;
+        u4 firstIndex = 0;
+        u4 numTasks = 0;
+        u4 j;
+
+        do {
+            VerifyTask* task = &tasks[numTasks++];
+            u4 remaining = item->size - firstIndex;
+
+            task->item = item;
+            task->state = *state;
+            task->dataMapLookups = 0;
+            if (state->pDataMapLookups != NULL) {
+                task->state.pDataMapLookups = &task->dataMapLookups;
+            }
+            task->firstIndex = firstIndex;
+            task->count = (remaining < rangeSize) ? remaining : rangeSize;
+            firstIndex += task->count;
+        } while (firstIndex < item->size);
+        assert(numTasks <= maxTasks);
+
+        DexVerifySectionStats* pSectionStats =
+            getSectionStats(state, pMap, item);
+        u8 start = (pSectionStats != NULL) ? getMonotonicNsec() : 0;
+
+        sysRunParallel(numTasks, numThreads, crossVerifySectionTask, tasks);
+
+        if (pSectionStats != NULL) {
+            pSectionStats->crossNanos = getMonotonicNsec() - start;
+        }
+
+        for (j = 0; j < numTasks; j++) {
+            if (state->pDataMapLookups != NULL) {
+                *state->pDataMapLookups += tasks[j].dataMapLookups;
+            }
+
+            okay = okay && tasks[j].okay;
+        }
+
+        if (!okay) {
+            if (item->type == kDexTypeClassDefItem) {
+                okay = crossVerifyClassDefSection(state, item, 0, item->size);
+            } else {
+                okay = crossVerifySection(state, item, 0, item->size);
+            }
+
+            if (!okay) {
+                ALOGE("Cross-item verify of section type %04x failed",
+                        item->type);
+            }
+        }
+    }
+
+    free(tasks);
+    return okay;
+}
+
 /* (documented in header file) */
 bool dexHasValidMagic(const DexHeader* pHeader)
 {
@@ -2807,20 +3846,20 @@ bool dexHasValidMagic(const DexHeader* pHeader)
 }
 
 /*
- * Fix the byte ordering of all fields in the DEX file, and do
- * structural verification. This is only required for code that opens
- * "raw" DEX files, such as the DEX optimizer.
+ * Check the magic number, length and (if "checkChecksum" is set)
+ * checksum of the DEX file at "addr", then swap and check its header and
+ * map. On success, "state" is ready for the section passes, and "*ppMap"
+ * points at the map.
  *
- * Returns 0 on success, nonzero on failure.
+ * On failure, state->pDataMap may still need to be freed.
  */
-int dexSwapAndVerify(u1* addr, size_t len)
+static bool swapHeaderAndMap(u1* addr, size_t len, bool checkChecksum,
+        CheckState* state, DexMapList** ppMap)
 {
     DexHeader* pHeader;
-    CheckState state;
     bool okay = true;
 
-    memset(&state, 0, sizeof(state));
-    ALOGV("+++ swapping and verifying");
+    memset(state, 0, sizeof(*state));
 
     /*
      * Note: The caller must have verified that "len" is at least as
@@ -2844,7 +3883,7 @@ int dexSwapAndVerify(u1* addr, size_t len)
         }
     }
 
-    if (okay) {
+    if (okay && checkChecksum) {
         /*
          * Compute the adler32 checksum and compare it to what's stored in
          * the file.  This isn't free, but chances are good that we just
@@ -2854,38 +3893,37 @@ int dexSwapAndVerify(u1* addr, size_t len)
          * This might be a big-endian system, so we need to do this before
          * we byte-swap the header.
          */
-        uLong adler = adler32(0L, Z_NULL, 0);
         const int nonSum = sizeof(pHeader->magic) + sizeof(pHeader->checksum);
         u4 storedFileSize = SWAP4(pHeader->fileSize);
         u4 expectedChecksum = SWAP4(pHeader->checksum);
 
-        adler = adler32(adler, ((const u1*) pHeader) + nonSum,
-                    storedFileSize - nonSum);
+        u4 adler = dexAdler32(kDexAdler32Init,
+                ((const u1*) pHeader) + nonSum, storedFileSize - nonSum);
 
         if (adler != expectedChecksum) {
-            ALOGE("ERROR: bad checksum (%08lx, expected %08x)",
+            ALOGE("ERROR: bad checksum (%08x, expected %08x)",
                 adler, expectedChecksum);
             okay = false;
         }
     }
 
     if (okay) {
-        state.fileStart = addr;
-        state.fileEnd = addr + len;
-        state.fileLen = len;
-        state.pDexFile = NULL;
-        state.pDataMap = NULL;
-        state.pDefinedClassBits = NULL;
-        state.previousItem = NULL;
+        state->fileStart = addr;
+        state->fileEnd = addr + len;
+        state->fileLen = len;
+        state->pDexFile = NULL;
+        state->pDataMap = NULL;
+        state->pDefinedClassBits = NULL;
+        state->previousItem = NULL;
 
         /*
          * Swap the header and check the contents.
          */
-        okay = swapDexHeader(&state, pHeader);
+        okay = swapDexHeader(state, pHeader);
     }
 
     if (okay) {
-        state.pHeader = pHeader;
+        state->pHeader = pHeader;
 
         if (pHeader->headerSize < sizeof(DexHeader)) {
             ALOGE("ERROR: Small header size %d, struct %d",
@@ -2900,23 +3938,96 @@ int dexSwapAndVerify(u1* addr, size_t len)
 
     if (okay) {
         /*
-         * Look for the map. Swap it and then use it to find and swap
+         * Look for the map. Swap it; the caller uses it to find and swap
          * everything else.
          */
         if (pHeader->mapOff != 0) {
-            DexFile dexFile;
-            DexMapList* pDexMap = (DexMapList*) (addr + pHeader->mapOff);
+            *ppMap = (DexMapList*) (addr + pHeader->mapOff);
+            okay = swapMap(state, *ppMap);
+        } else {
+            ALOGE("ERROR: No map found; impossible to byte-swap and verify");
+            okay = false;
+        }
+    }
 
-            okay = okay && swapMap(&state, pDexMap);
-            okay = okay && swapEverythingButHeaderAndMap(&state, pDexMap);
+    return okay;
+}
 
-            dexFileSetupBasicPointers(&dexFile, addr);
-            state.pDexFile = &dexFile;
+/*
+ * Fix the byte ordering of all fields in the DEX file, and do
+ * structural verification, using up to "numThreads" threads for the
+ * section passes. With one thread this is the original serial verifier.
+ * The checksum is checked unless "checkChecksum" is false. If "pStats"
+ * is non-NULL, it is filled in as for dexSwapAndVerifyWithStats().
+ *
+ * Returns 0 on success, nonzero on failure.
+ */
+static int swapAndVerify(u1* addr, size_t len, int numThreads,
+        bool checkChecksum, DexVerifyStats* pStats)
+{
+    CheckState state;
+    DexMapList* pDexMap = NULL;
+    u8 arenaBuf[VERIFY_ARENA_STACK_SIZE / sizeof(u8)];
+    VerifyArena arena;
+    u8 start = 0;
+    bool okay;
 
-            okay = okay && crossVerifyEverything(&state, pDexMap);
+    ALOGV("+++ swapping and verifying");
+
+    if (pStats != NULL) {
+        memset(pStats, 0, sizeof(*pStats));
+        start = getMonotonicNsec();
+    }
+
+    /*
+     * Every byte of the file is going to be read, starting with the
+     * checksum; get the kernel reading it all in now, rather than a
+     * fault at a time. The lazy verifier does this for only the
+     * sections it reads up front.
+     */
+    sysAdviseRange(addr, len, kSysMapAdviceWillNeed);
+
+    verifyArenaInit(&arena, arenaBuf, sizeof(arenaBuf));
+    okay = swapHeaderAndMap(addr, len, checkChecksum, &state, &pDexMap);
+    state.pArena = &arena;
+
+    if (okay && pStats != NULL) {
+        u4 i;
+
+        pStats->headerNanos = getMonotonicNsec() - start;
+        pStats->numSections = (pDexMap->size < (u4) kDexVerifyMaxSections)
+                ? pDexMap->size : (u4) kDexVerifyMaxSections;
+        for (i = 0; i < pStats->numSections; i++) {
+            pStats->sections[i].type = pDexMap->list[i].type;
+            pStats->sections[i].itemCount = pDexMap->list[i].size;
+        }
+
+        state.pStats = pStats;
+        state.pDataMapLookups = &pStats->dataMapLookups;
+    }
+
+    if (okay) {
+        DexFile dexFile;
+
+        if (numThreads > 1) {
+            okay = swapEverythingButHeaderAndMapParallel(&state,
+                    pDexMap, numThreads);
         } else {
-            ALOGE("ERROR: No map found; impossible to byte-swap and verify");
-            okay = false;
+            okay = swapEverythingButHeaderAndMap(&state, pDexMap);
+        }
+
+        if (okay) {
+            dexDataMapBuildIndex(state.pDataMap);
+        }
+
+        dexFileSetupBasicPointers(&dexFile, addr);
+        state.pDexFile = &dexFile;
+
+        if (numThreads > 1) {
+            okay = okay && crossVerifyEverythingParallel(&state, pDexMap,
+                    numThreads);
+        } else {
+            okay = okay && crossVerifyEverything(&state, pDexMap);
         }
     }
 
@@ -2928,12 +4039,261 @@ int dexSwapAndVerify(u1* addr, size_t len)
         dexDataMapFree(state.pDataMap);
     }
 
+    verifyArenaFree(&arena);
+
+    if (pStats != NULL) {
+        pStats->totalNanos = getMonotonicNsec() - start;
+    }
+
     return !okay;       // 0 == success
 }
 
+/*
+ * Fix the byte ordering of all fields in the DEX file, and do
+ * structural verification. This is only required for code that opens
+ * "raw" DEX files, such as the DEX optimizer.
+ *
+ * Returns 0 on success, nonzero on failure.
+ */
+int dexSwapAndVerify(u1* addr, size_t len)
+{
+    return swapAndVerify(addr, len, 1, true, NULL);
+}
+
+/* (documented in header file) */
+int dexSwapAndVerifyParallel(u1* addr, size_t len, int numThreads)
+{
+    return swapAndVerify(addr, len, numThreads, true, NULL);
+}
+
+/* (documented in header file) */
+int dexSwapAndVerifyWithStats(u1* addr, size_t len, int numThreads,
+    DexVerifyStats* pStats)
+{
+    return swapAndVerify(addr, len, numThreads, true, pStats);
+}
+
+/*
+ * State kept between the calls of a lazy verification. The CheckState
+ * is the one left by the up-front passes; its pDexFile points at
+ * "dexFile", and its data map holds everything but the deferred items.
+ */
+struct DexLazyVerifier {
+    CheckState  state;
+    DexFile     dexFile;
+    DeferredSections deferred;
+    u4*         verifiedClassBits;  // one bit per class_def_item
+    bool        allVerified;        // dexLazyVerifyAll() succeeded
+};
+
+/*
+ * Record where each deferred section is, for lookUpDeferredItem(). The
+ * map has been verified; in particular, no type appears in it twice.
+ */
+static void setUpDeferredSections(DeferredSections* pDeferred,
+        const CheckState* state, const DexMapList* pMap) {
+    u4 dataEnd = state->pHeader->dataOff + state->pHeader->dataSize;
+    u4 i;
+
+    for (i = 0; i < pMap->size; i++) {
+        const DexMapItem* item = &pMap->list[i];
+
+        if (!isDeferredDataType(item->type)) {
+            continue;
+        }
+
+        DeferredSection* section = &pDeferred->sections[pDeferred->count++];
+        section->type = item->type;
+        section->offset = item->offset;
+        section->end = dataEnd;
+        if ((i + 1 < pMap->size) && (pMap->list[i + 1].offset < dataEnd)) {
+            section->end = pMap->list[i + 1].offset;
+        }
+        section->size = item->size;
+        section->nextOffset = item->offset;
+    }
+}
+
+/* (documented in header file) */
+DexLazyVerifier* dexSwapAndVerifyLazy(u1* addr, size_t len)
+{
+    DexLazyVerifier* pVerifier;
+    DexMapList* pDexMap = NULL;
+    u8 arenaBuf[VERIFY_ARENA_STACK_SIZE / sizeof(u8)];
+    VerifyArena arena;
+    bool okay;
+
+    ALOGV("+++ swapping and verifying lazily");
+
+    pVerifier = (DexLazyVerifier*) calloc(1, sizeof(DexLazyVerifier));
+    if (pVerifier == NULL) {
+        ALOGE("Unable to allocate lazy verifier");
+        return NULL;
+    }
+
+    pthread_mutex_init(&pVerifier->deferred.lock, NULL);
+
+    verifyArenaInit(&arena, arenaBuf, sizeof(arenaBuf));
+
+    CheckState* state = &pVerifier->state;
+    okay = swapHeaderAndMap(addr, len, true, state, &pDexMap);
+    state->pArena = &arena;
+
+    if (okay) {
+        /*
+         * Only the sections read below are needed now; the rest are
+         * read a class at a time, if at all. Get the kernel started on
+         * reading these in while the ids are being swapped.
+         */
+        static const u2 kUpFrontTypes[] = {
+            kDexTypeStringIdItem, kDexTypeTypeIdItem, kDexTypeProtoIdItem,
+            kDexTypeFieldIdItem, kDexTypeMethodIdItem, kDexTypeClassDefItem,
+            kDexTypeTypeList, kDexTypeStringDataItem,
+        };
+
+        dexAdviseSections(addr, len, kUpFrontTypes,
+                sizeof(kUpFrontTypes) / sizeof(kUpFrontTypes[0]),
+                kSysMapAdviceWillNeed);
+    }
+
+    if (okay) {
+        state->dataItemMode = kDataItemsDeferred;
+        okay = swapEverythingButDeferred(state, pDexMap);
+    }
+
+    if (okay) {
+        dexDataMapBuildIndex(state->pDataMap);
+    }
+
+    if (okay) {
+        dexFileSetupBasicPointers(&pVerifier->dexFile, addr);
+        state->pDexFile = &pVerifier->dexFile;
+        okay = crossVerifyEverything(state, pDexMap);
+    }
+
+    if (okay) {
+        pVerifier->verifiedClassBits = (u4*) calloc(
+                (state->pHeader->classDefsSize + 0x1f) >> 5, sizeof(u4));
+        if (pVerifier->verifiedClassBits == NULL) {
+            ALOGE("Unable to allocate verified class bits");
+            okay = false;
+        }
+    }
+
+    /*
+     * Each call verifying a class brings an arena of its own, so that
+     * the calls can be concurrent.
+     */
+    verifyArenaFree(&arena);
+    state->pArena = NULL;
+
+    if (!okay) {
+        ALOGE("ERROR: Byte swap + lazy verify failed");
+        dexLazyVerifierFree(pVerifier);
+        return NULL;
+    }
+
+    setUpDeferredSections(&pVerifier->deferred, state, pDexMap);
+    state->pDeferred = &pVerifier->deferred;
+    state->previousItem = NULL;
+    state->dataItemMode = kDataItemsInPlace;
+    return pVerifier;
+}
+
+/* (documented in header file) */
+bool dexLazyVerifyClass(DexLazyVerifier* pVerifier, u4 classDefIdx)
+{
+    const CheckState* sharedState = &pVerifier->state;
+
+    if (classDefIdx >= sharedState->pHeader->classDefsSize) {
+        ALOGE("Bad class_def index %u", classDefIdx);
+        return false;
+    }
+
+    u4* element = &pVerifier->verifiedClassBits[classDefIdx >> 5];
+    u4 bit = 1 << (classDefIdx & 0x1f);
+
+    if ((__atomic_load_n(element, __ATOMIC_ACQUIRE) & bit) != 0) {
+        return true;
+    }
+
+    /*
+     * Nothing in the shared state is written during per-class
+     * verification, so concurrent callers can each use a copy. Two
+     * threads may end up verifying the same class, which is harmless.
+     */
+    CheckState state = *sharedState;
+    const DexClassDef* pClassDef =
+        dexGetClassDef(&pVerifier->dexFile, classDefIdx);
+    u8 arenaBuf[VERIFY_ARENA_STACK_SIZE / sizeof(u8)];
+    VerifyArena arena;
+
+    verifyArenaInit(&arena, arenaBuf, sizeof(arenaBuf));
+    state.pArena = &arena;
+
+    bool okay = crossVerifyClassDefRefs(&state, pClassDef);
+
+    verifyArenaFree(&arena);
+
+    if (!okay) {
+        ALOGE("ERROR: Lazy verify of class_def %u failed", classDefIdx);
+        return false;
+    }
+
+    __sync_fetch_and_or(element, bit);
+    return true;
+}
+
+/* (documented in header file) */
+bool dexLazyVerifyAll(DexLazyVerifier* pVerifier)
+{
+    const CheckState* state = &pVerifier->state;
+
+    if (!pVerifier->allVerified) {
+        /*
+         * The checksum was checked when the file was opened. It may not
+         * match any more, since verification masks off bogus access
+         * flags in place.
+         */
+        if (swapAndVerify((u1*) state->fileStart, state->fileLen, 1,
+                false, NULL) != 0) {
+            return false;
+        }
+
+        memset(pVerifier->verifiedClassBits, 0xff,
+                ((state->pHeader->classDefsSize + 0x1f) >> 5) * sizeof(u4));
+        pVerifier->allVerified = true;
+    }
+
+    return true;
+}
+
+/* (documented in header file) */
+void dexLazyVerifierFree(DexLazyVerifier* pVerifier)
+{
+    u4 i;
+
+    if (pVerifier == NULL) {
+        return;
+    }
+
+    if (pVerifier->state.pDataMap != NULL) {
+        dexDataMapFree(pVerifier->state.pDataMap);
+    }
+
+    for (i = 0; i < pVerifier->deferred.count; i++) {
+        dexDataMapFree(pVerifier->deferred.sections[i].pDataMap);
+    }
+    pthread_mutex_destroy(&pVerifier->deferred.lock);
+
+    free(pVerifier->verifiedClassBits);
+    free(pVerifier);
+}
+
 /*
  * Detect the file type of the given memory buffer via magic number.
- * Call dexSwapAndVerify() on an unoptimized DEX file, do nothing
+ * Call dexSwapAndVerify() (or dexSwapAndVerifyCached(), if the cache is
+ * enabled) on an unoptimized DEX file, do nothing
  * but return successfully on an optimized DEX file, and report an
  * error for all other cases.
  *
@@ -2948,6 +4308,9 @@ int dexSwapAndVerifyIfNecessary(u1* addr, size_t len)
 
     if (memcmp(addr, DEX_MAGIC, 4) == 0) {
         // It is an unoptimized dex file.
+        if (dexVerifyCacheIsEnabled()) {
+            return dexSwapAndVerifyCached(addr, len);
+        }
         return dexSwapAndVerify(addr, len);
     }
 
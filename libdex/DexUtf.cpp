@@ -20,6 +20,123 @@
 
 #include "DexUtf.h"
 
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#else
+#include <string.h>
+#endif
+
+/* Number of bytes looked at by each step of the ASCII fast paths. */
+enum { kAsciiBlockSize = 16 };
+
+/* The smallest page size we might be running with. A block load that
+ * doesn't cross one of these boundaries can't fault, even if it reads
+ * past the end of a string. */
+enum { kMinPageSize = 4096 };
+
+#ifndef __SSE2__
+/* Without SSE2, blocks are looked at a machine word at a time. */
+typedef size_t AsciiWord;
+
+/* 0x01 and 0x80 in every byte of a word. */
+static const AsciiWord kAsciiWordOnes = (AsciiWord) -1 / 0xff;
+static const AsciiWord kAsciiWordHighs = kAsciiWordOnes * 0x80;
+
+static inline AsciiWord loadAsciiWord(const u1* ptr) {
+    AsciiWord word;
+    memcpy(&word, ptr, sizeof(word));
+    return word;
+}
+
+/* Return the index of the lowest addressed nonzero byte of "word",
+ * which must not be 0. Only little-endian hosts are supported. */
+static inline u4 firstNonzeroByte(AsciiWord word) {
+    return __builtin_ctzll((unsigned long long) word) / 8;
+}
+#endif
+
+/* Return a bit mask with bit N set if byte N of the kAsciiBlockSize
+ * bytes at "ptr" is not plain ASCII, that is, if it is '\0' or has its
+ * high bit set. Without SSE2, only the lowest set bit is returned,
+ * which is all that the callers look at. */
+static inline u4 nonAsciiMask(const u1* ptr) {
+#ifdef __SSE2__
+    __m128i block = _mm_loadu_si128((const __m128i*) ptr);
+    __m128i nul = _mm_cmpeq_epi8(block, _mm_setzero_si128());
+    return (u4) _mm_movemask_epi8(_mm_or_si128(block, nul));
+#else
+    for (u4 i = 0; i < kAsciiBlockSize; i += sizeof(AsciiWord)) {
+        AsciiWord word = loadAsciiWord(ptr + i);
+
+        /*
+         * The high bit of a byte ends up set if the byte had it set or
+         * was '\0'. The borrow out of a '\0' can also set it in the
+         * bytes above, but never below, the first one that counts.
+         */
+        AsciiWord stop = (word | ((word - kAsciiWordOnes) & ~word))
+            & kAsciiWordHighs;
+        if (stop != 0) {
+            return 1u << (i + firstNonzeroByte(stop));
+        }
+    }
+    return 0;
+#endif
+}
+
+/* Return a bit mask with bit N set if byte N of the kAsciiBlockSize
+ * bytes at "ptr1" differs from byte N of the ones at "ptr2". Without
+ * SSE2, only the lowest set bit is returned. */
+static inline u4 blockDiffMask(const u1* ptr1, const u1* ptr2) {
+#ifdef __SSE2__
+    __m128i block1 = _mm_loadu_si128((const __m128i*) ptr1);
+    __m128i block2 = _mm_loadu_si128((const __m128i*) ptr2);
+    return ~(u4) _mm_movemask_epi8(_mm_cmpeq_epi8(block1, block2)) & 0xffff;
+#else
+    for (u4 i = 0; i < kAsciiBlockSize; i += sizeof(AsciiWord)) {
+        AsciiWord diff = loadAsciiWord(ptr1 + i) ^ loadAsciiWord(ptr2 + i);
+
+        if (diff != 0) {
+            return 1u << (i + firstNonzeroByte(diff));
+        }
+    }
+    return 0;
+#endif
+}
+
+/* Return whether a block load at "ptr" stays inside one page. */
+static inline bool blockInPage(const void* ptr) {
+    return ((uintptr_t) ptr & (kMinPageSize - 1))
+        <= kMinPageSize - kAsciiBlockSize;
+}
+
+/* Skip past the bytes at the start of "*pS1" and "*pS2" that are the
+ * same plain ASCII characters in both, which compare as equal code
+ * points. The loads may read past the end of a string (never past the
+ * end of its page), which the address sanitizer doesn't know is safe. */
+__attribute__((no_sanitize_address))
+static void skipCommonAscii(const u1** pS1, const u1** pS2) {
+    const u1* s1 = *pS1;
+    const u1* s2 = *pS2;
+
+    while (blockInPage(s1) && blockInPage(s2)) {
+        u4 stop = nonAsciiMask(s1) | blockDiffMask(s1, s2);
+
+        if (stop != 0) {
+            s1 += __builtin_ctz(stop);
+            s2 += __builtin_ctz(stop);
+            break;
+        }
+
+        s1 += kAsciiBlockSize;
+        s2 += kAsciiBlockSize;
+    }
+
+    *pS1 = s1;
+    *pS2 = s2;
+}
+
 /* Compare two '\0'-terminated modified UTF-8 strings, using Unicode
  * code point values for comparison. This treats different encodings
  * for the same code point as equivalent, except that only a real '\0'
@@ -27,6 +144,9 @@
  * for strcmp(). */
 int dexUtf8Cmp(const char* s1, const char* s2) {
     for (;;) {
+        /* runs of identical ASCII are common, and need no decoding */
+        skipCommonAscii((const u1**) &s1, (const u1**) &s2);
+
         if (*s1 == '\0') {
             if (*s2 == '\0') {
                 return 0;
@@ -46,6 +166,29 @@ int dexUtf8Cmp(const char* s1, const char* s2) {
     }
 }
 
+/* Return the number of bytes at the start of "ptr", up to "maxLen",
+ * that are plain ASCII characters (0x01 through 0x7f). Each of those
+ * bytes is a complete character in modified UTF-8. */
+size_t dexUtf8AsciiSpan(const u1* ptr, size_t maxLen) {
+    size_t len = 0;
+
+    while (maxLen - len >= kAsciiBlockSize) {
+        u4 nonAscii = nonAsciiMask(ptr + len);
+
+        if (nonAscii != 0) {
+            return len + __builtin_ctz(nonAscii);
+        }
+
+        len += kAsciiBlockSize;
+    }
+
+    while (len < maxLen && ptr[len] != 0 && ptr[len] < 0x80) {
+        len++;
+    }
+
+    return len;
+}
+
 /* for dexIsValidMemberNameUtf8(), a bit vector indicating valid low ascii */
 u4 DEX_MEMBER_VALID_LOW_ASCII[4] = {
     0x00000000, // 00..1f low control characters; nothing valid
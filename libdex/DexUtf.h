@@ -69,6 +69,11 @@ DEX_INLINE u2 dexGetUtf16FromUtf8(const char** pUtf8Ptr)
  * for strcmp(). */
 int dexUtf8Cmp(const char* s1, const char* s2);
 
+/* Return the number of bytes at the start of "ptr", up to "maxLen",
+ * that are plain ASCII characters (0x01 through 0x7f). Each of those
+ * bytes is a complete character in modified UTF-8. */
+size_t dexUtf8AsciiSpan(const u1* ptr, size_t maxLen);
+
 /* for dexIsValidMemberNameUtf8(), a bit vector indicating valid low ascii */
 extern u4 DEX_MEMBER_VALID_LOW_ASCII[4];
 
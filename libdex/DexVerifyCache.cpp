@@ -0,0 +1,257 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Persistent cache of structural verification results.
+ */
+#include "DexVerifyCache.h"
+#include "OptInvocation.h"
+#include "SysUtil.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char kEntryMagic[4] = { 'd', 'v', 'c', '\n' };
+
+/*
+ * Contents of a cache entry. The key is also spelled out in the file
+ * name; it's repeated here so that a renamed or truncated file can't
+ * produce a false hit.
+ */
+struct DexVerifyCacheEntry {
+    char    magic[4];
+    u4      verifierVersion;
+    u4      fileSize;
+    u4      checksum;
+    u1      signature[kSHA1DigestLen];
+};
+
+static bool gVerifyCacheEnabled = false;
+
+/* (documented in header file) */
+void dexVerifyCacheSetEnabled(bool enabled)
+{
+    gVerifyCacheEnabled = enabled;
+}
+
+/* (documented in header file) */
+bool dexVerifyCacheIsEnabled()
+{
+    return gVerifyCacheEnabled;
+}
+
+/*
+ * Fill in the entry for the given header.
+ */
+static void makeEntry(const DexHeader* pHeader, DexVerifyCacheEntry* pEntry)
+{
+    memset(pEntry, 0, sizeof(*pEntry));
+    memcpy(pEntry->magic, kEntryMagic, sizeof(pEntry->magic));
+    pEntry->verifierVersion = kDexVerifierVersion;
+    pEntry->fileSize = pHeader->fileSize;
+    pEntry->checksum = pHeader->checksum;
+    memcpy(pEntry->signature, pHeader->signature, kSHA1DigestLen);
+}
+
+/*
+ * Get the name of the cache file for the given header. The key is
+ * dressed up as an absolute path, which dexOptGenerateCacheFileName()
+ * flattens into a single file in the dalvik-cache directory.
+ *
+ * Returns a newly-allocated string, or NULL on failure.
+ */
+static char* entryFileName(const DexHeader* pHeader)
+{
+    char keyPath[64 + 2 * kSHA1DigestLen];
+    char* cp;
+    int i;
+
+    cp = keyPath + sprintf(keyPath, "/verified/");
+    for (i = 0; i < kSHA1DigestLen; i++) {
+        cp += sprintf(cp, "%02x", pHeader->signature[i]);
+    }
+    sprintf(cp, "-%u-v%d", pHeader->fileSize, kDexVerifierVersion);
+
+    return dexOptGenerateCacheFileName(keyPath, NULL);
+}
+
+/*
+ * Check that the DEX file at "addr" is the one its header describes:
+ * the magic and size, and the checksum and SHA-1 signature recomputed
+ * over the data. Entries are keyed on the signature, and a header with
+ * a matching Adler-32 is easy to forge, so the signature is what has
+ * to be recomputed before an entry can be trusted or recorded.
+ */
+static bool checkContents(const u1* addr, size_t len)
+{
+    const DexHeader* pHeader = (const DexHeader*) addr;
+    unsigned char digest[kSHA1DigestLen];
+    u4 checksum;
+
+    if (len < sizeof(DexHeader) || memcmp(addr, DEX_MAGIC, 4) != 0 ||
+            pHeader->fileSize < sizeof(DexHeader) || pHeader->fileSize > len) {
+        return false;
+    }
+
+    dexComputeChecksumAndSignature(pHeader, &checksum, digest);
+    return checksum == pHeader->checksum &&
+        memcmp(digest, pHeader->signature, kSHA1DigestLen) == 0;
+}
+
+/*
+ * Look for an entry matching the header at "addr", without checking
+ * that the data matches the header.
+ */
+static bool findEntry(const u1* addr, size_t len)
+{
+    const DexHeader* pHeader = (const DexHeader*) addr;
+    DexVerifyCacheEntry expected, actual;
+    char* fileName = NULL;
+    bool result = false;
+    int fd = -1;
+
+    if (len < sizeof(DexHeader) || memcmp(addr, DEX_MAGIC, 4) != 0)
+        goto bail;
+
+    fileName = entryFileName(pHeader);
+    if (fileName == NULL)
+        goto bail;
+
+    fd = open(fileName, O_RDONLY);
+    if (fd < 0)
+        goto bail;      /* no entry; the common miss */
+
+    if (TEMP_FAILURE_RETRY(read(fd, &actual, sizeof(actual)))
+            != (ssize_t) sizeof(actual)) {
+        ALOGW("Short verify cache entry '%s'", fileName);
+        goto bail;
+    }
+
+    makeEntry(pHeader, &expected);
+    if (memcmp(&expected, &actual, sizeof(expected)) != 0) {
+        ALOGW("Verify cache entry '%s' doesn't match", fileName);
+        goto bail;
+    }
+
+    ALOGV("Verify cache hit '%s'", fileName);
+    result = true;
+
+bail:
+    if (fd >= 0)
+        close(fd);
+    free(fileName);
+    return result;
+}
+
+/* (documented in header file) */
+bool dexVerifyCacheLookup(const u1* addr, size_t len)
+{
+    if (!findEntry(addr, len))
+        return false;
+
+    if (!checkContents(addr, len)) {
+        ALOGW("DEX data doesn't match its header; ignoring verify cache "
+            "entry");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Write the entry for the header at "addr".
+ */
+static void writeEntry(const u1* addr)
+{
+    const DexHeader* pHeader = (const DexHeader*) addr;
+    DexVerifyCacheEntry entry;
+    char* fileName = NULL;
+    char* tempName = NULL;
+    int fd = -1;
+
+    fileName = entryFileName(pHeader);
+    if (fileName == NULL)
+        goto bail;
+
+    /*
+     * Write to a private temp file and rename it into place, so that
+     * concurrent readers never see a partial entry.
+     */
+    tempName = (char*) malloc(strlen(fileName) + 32);
+    if (tempName == NULL)
+        goto bail;
+    sprintf(tempName, "%s.%d.tmp", fileName, (int) getpid());
+
+    fd = open(tempName, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        ALOGW("Unable to create verify cache entry '%s': %s", tempName,
+            strerror(errno));
+        goto bail;
+    }
+
+    makeEntry(pHeader, &entry);
+    if (sysWriteFully(fd, &entry, sizeof(entry), "verify cache") != 0) {
+        unlink(tempName);
+        goto bail;
+    }
+
+    close(fd);
+    fd = -1;
+
+    if (rename(tempName, fileName) != 0) {
+        ALOGW("Unable to rename '%s' to '%s': %s", tempName, fileName,
+            strerror(errno));
+        unlink(tempName);
+    }
+
+bail:
+    if (fd >= 0)
+        close(fd);
+    free(tempName);
+    free(fileName);
+}
+
+/* (documented in header file) */
+void dexVerifyCacheRecord(const u1* addr, size_t len)
+{
+    if (checkContents(addr, len))
+        writeEntry(addr);
+}
+
+/*
+ * The contents are checked against the header before verifying, since
+ * verification may rewrite parts of the data in place (e.g., masking
+ * unknown access flags), after which the checksum and signature no
+ * longer match.
+ */
+int dexSwapAndVerifyCached(u1* addr, size_t len)
+{
+    if (!checkContents(addr, len))
+        return dexSwapAndVerify(addr, len);
+
+    if (findEntry(addr, len))
+        return 0;
+
+    int result = dexSwapAndVerify(addr, len);
+    if (result == 0)
+        writeEntry(addr);
+
+    return result;
+}
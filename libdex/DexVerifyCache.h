@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * On-disk cache of successful structural verifications, so that the same
+ * DEX file doesn't have to be verified over and over.
+ *
+ * An entry is keyed by the SHA-1 signature and size from the DEX header,
+ * plus kDexVerifierVersion, and lives in the dalvik-cache directory (see
+ * dexOptGenerateCacheFileName()). A hit also requires the checksum and
+ * the SHA-1 signature, recomputed over the data, to match the header,
+ * so a file can't borrow another's entry by copying its header.
+ */
+#ifndef LIBDEX_DEXVERIFYCACHE_H_
+#define LIBDEX_DEXVERIFYCACHE_H_
+
+#include "DexFile.h"
+
+/*
+ * Version of the structural verification rules. Bump this whenever
+ * dexSwapAndVerify() starts rejecting something it used to accept, so
+ * that old cache entries stop matching.
+ */
+enum { kDexVerifierVersion = 1 };
+
+/*
+ * Turn use of the cache by dexSwapAndVerifyIfNecessary() on or off.
+ * It is off by default. Not meant to be changed while other threads
+ * are verifying.
+ */
+void dexVerifyCacheSetEnabled(bool enabled);
+
+/*
+ * Returns true if the cache is enabled.
+ */
+bool dexVerifyCacheIsEnabled();
+
+/*
+ * Returns true if the unoptimized DEX file at "addr" is recorded as
+ * having passed verification before, and its checksum and signature
+ * are good.
+ */
+bool dexVerifyCacheLookup(const u1* addr, size_t len);
+
+/*
+ * Record that the DEX file at "addr" passed verification. Nothing is
+ * recorded unless its checksum and signature are good, so this has to
+ * be called on the data as it was before verification, which may have
+ * modified it (dexSwapAndVerifyCached() takes care of that). Failure to
+ * write the entry is logged but otherwise ignored.
+ */
+void dexVerifyCacheRecord(const u1* addr, size_t len);
+
+/*
+ * dexSwapAndVerify(), skipped on a cache hit and recorded in the cache
+ * on success. The signature is computed either way, so a miss costs a
+ * pass over the data on top of the verification.
+ *
+ * Return 0 on success.
+ */
+int dexSwapAndVerifyCached(u1* addr, size_t len);
+
+#endif  // LIBDEX_DEXVERIFYCACHE_H_
@@ -676,3 +676,321 @@ size_t dexGetWidthFromInstruction(const u2* insns)
 
     return width;
 }
+
+/*
+ * Point the arrays of "pInsns" into "storage", which has room for
+ * "capacity" instructions.
+ */
+static void setDecodedInsnsStorage(DecodedInsns* pInsns, void* storage,
+    u4 capacity)
+{
+    u4* words = (u4*) storage;
+
+    pInsns->offsets = words;
+    words += capacity + 1;
+    pInsns->vA = words;
+    words += capacity;
+    pInsns->vB = words;
+    words += capacity;
+    pInsns->vC = words;
+    words += capacity;
+    pInsns->args = words;
+    words += capacity;
+    pInsns->opcodes = (u1*) words;
+    pInsns->kinds = pInsns->opcodes + capacity;
+    pInsns->capacity = capacity;
+}
+
+/*
+ * Initialize the given DecodedInsns. Use this function before passing
+ * one into any other function.
+ */
+void dexDecodedInsnsInit(DecodedInsns* pInsns)
+{
+    pInsns->count = 0;
+    pInsns->allocated = NULL;
+    setDecodedInsnsStorage(pInsns, pInsns->inlineStorage,
+        kDecodedInsnsInlineUnits);
+    pInsns->offsets[0] = 0;
+}
+
+/*
+ * Release the allocated contents of the given DecodedInsns, if any.
+ */
+void dexDecodedInsnsRelease(DecodedInsns* pInsns)
+{
+    free(pInsns->allocated);
+    dexDecodedInsnsInit(pInsns);
+}
+
+/*
+ * Make sure "pInsns" can hold "capacity" instructions.  Returns false
+ * on allocation failure.
+ */
+static bool ensureDecodedInsnsCapacity(DecodedInsns* pInsns, u4 capacity)
+{
+    if (capacity <= pInsns->capacity)
+        return true;
+
+    /* (capacity + 1) offsets, four more words and two bytes apiece */
+    size_t size = ((size_t) capacity + 1) * sizeof(u4)
+        + (size_t) capacity * (4 * sizeof(u4) + 2);
+    void* storage = malloc(size);
+    if (storage == NULL)
+        return false;
+
+    free(pInsns->allocated);
+    pInsns->allocated = storage;
+    setDecodedInsnsStorage(pInsns, storage, capacity);
+    return true;
+}
+
+/*
+ * Instructions are dispatched to their format's handler with a computed
+ * goto where the compiler supports it, so that each handler ends with
+ * its own indirect jump, and with a switch otherwise.
+ */
+#ifdef __GNUC__
+# define THREADED_INSNS_DECODE
+#endif
+
+#ifdef THREADED_INSNS_DECODE
+# define HANDLE_FORMAT(_fmt)    H_##_fmt:
+# define GOTO_FORMAT(_fmt)      goto *kFormatHandlers[(_fmt)]
+#else
+# define HANDLE_FORMAT(_fmt)    case _fmt:
+# define GOTO_FORMAT(_fmt)      do { format = (_fmt); goto dispatch; } while (0)
+#endif
+
+/*
+ * Start on the instruction at "pos": stop at the end or at anything that
+ * can't be decoded, otherwise jump to the handler for its format.
+ */
+#define NEXT_INSN()                                                         \
+    do {                                                                    \
+        if (pos == insnsSize)                                               \
+            goto done;                                                      \
+        inst = insns[pos];                                                  \
+        opcode = dexOpcodeFromCodeUnit(inst);                               \
+        if ((u4) opcode >= kNumPackedOpcodes)                               \
+            goto bail;                                                      \
+        width = gInstructionWidthTable[opcode];                             \
+        if (width == 0 || width > insnsSize - pos)                          \
+            goto bail;                                                      \
+        vA = vB = vC = args = 0;                                            \
+        kind = kInsnNormal;                                                 \
+        GOTO_FORMAT(gInstructionFormatTable[opcode]);                       \
+    } while (0)
+
+/*
+ * Store the instruction that was just decoded, and go on to the next.
+ */
+#define FINISH_INSN()                                                       \
+    do {                                                                    \
+        pInsns->offsets[count] = pos;                                       \
+        pInsns->opcodes[count] = opcode;                                    \
+        pInsns->kinds[count] = kind;                                        \
+        pInsns->vA[count] = vA;                                             \
+        pInsns->vB[count] = vB;                                             \
+        pInsns->vC[count] = vC;                                             \
+        pInsns->args[count] = args;                                         \
+        count++;                                                            \
+        pos += width;                                                       \
+        NEXT_INSN();                                                        \
+    } while (0)
+
+/*
+ * Decode the "insnsSize" code units of instructions at "insns" into
+ * "pInsns", replacing what was there.
+ *
+ * The work for each format is the same as in dexDecodeInstruction().
+ */
+bool dexDecodeInsns(const u2* insns, u4 insnsSize, DecodedInsns* pInsns)
+{
+#ifdef THREADED_INSNS_DECODE
+    static const void* const kFormatHandlers[] = {
+        &&H_kFmt00x,  &&H_kFmt10x,  &&H_kFmt12x,  &&H_kFmt11n,
+        &&H_kFmt11x,  &&H_kFmt10t,  &&H_kFmt20bc, &&H_kFmt20t,
+        &&H_kFmt22x,  &&H_kFmt21t,  &&H_kFmt21s,  &&H_kFmt21h,
+        &&H_kFmt21c,  &&H_kFmt23x,  &&H_kFmt22b,  &&H_kFmt22t,
+        &&H_kFmt22s,  &&H_kFmt22c,  &&H_kFmt22cs, &&H_kFmt30t,
+        &&H_kFmt32x,  &&H_kFmt31i,  &&H_kFmt31t,  &&H_kFmt31c,
+        &&H_kFmt35c,  &&H_kFmt35ms, &&H_kFmt3rc,  &&H_kFmt3rms,
+        &&H_kFmt51l,  &&H_kFmt35mi, &&H_kFmt3rmi,
+    };
+#else
+    InstructionFormat format;
+#endif
+    u4 count = 0;
+    u4 pos = 0;
+    u4 width;
+    u2 inst;
+    Opcode opcode;
+    u4 vA, vB, vC, args;
+    u1 kind;
+    bool result = false;
+
+    /* every instruction is at least one unit wide */
+    if (!ensureDecodedInsnsCapacity(pInsns, insnsSize))
+        goto bail;
+
+    NEXT_INSN();
+
+#ifndef THREADED_INSNS_DECODE
+dispatch:
+    switch (format) {
+#endif
+    HANDLE_FORMAT(kFmt10x)      // op
+        /* the switch and array data tables are nops with a non-zero AA */
+        if (inst == kPackedSwitchSignature || inst == kSparseSwitchSignature
+            || inst == kArrayDataSignature)
+        {
+            /* the size is in the next unit, or the next three */
+            if (insnsSize - pos < ((inst == kArrayDataSignature) ? 4 : 2))
+                goto bail;
+            width = dexGetWidthFromInstruction(insns + pos);
+            if (width > insnsSize - pos)
+                goto bail;
+            kind = (inst == kPackedSwitchSignature) ? kInsnPackedSwitchPayload
+                : (inst == kSparseSwitchSignature) ? kInsnSparseSwitchPayload
+                : kInsnArrayDataPayload;
+        } else {
+            vA = INST_AA(inst);
+        }
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt12x)      // op vA, vB
+        vA = INST_A(inst);
+        vB = INST_B(inst);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt11n)      // op vA, #+B
+        vA = INST_A(inst);
+        vB = (s4) (INST_B(inst) << 28) >> 28;
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt11x)      // op vAA
+        vA = INST_AA(inst);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt10t)      // op +AA
+        vA = (s1) INST_AA(inst);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt20t)      // op +AAAA
+        vA = (s2) insns[pos + 1];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt20bc)     // [opt] op AA, thing@BBBB
+    HANDLE_FORMAT(kFmt21c)      // op vAA, thing@BBBB
+    HANDLE_FORMAT(kFmt22x)      // op vAA, vBBBB
+    HANDLE_FORMAT(kFmt21h)      // op vAA, #+BBBB0000[00000000]
+        vA = INST_AA(inst);
+        vB = insns[pos + 1];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt21s)      // op vAA, #+BBBB
+    HANDLE_FORMAT(kFmt21t)      // op vAA, +BBBB
+        vA = INST_AA(inst);
+        vB = (s2) insns[pos + 1];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt23x)      // op vAA, vBB, vCC
+        vA = INST_AA(inst);
+        vB = insns[pos + 1] & 0xff;
+        vC = insns[pos + 1] >> 8;
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt22b)      // op vAA, vBB, #+CC
+        vA = INST_AA(inst);
+        vB = insns[pos + 1] & 0xff;
+        vC = (s1) (insns[pos + 1] >> 8);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt22s)      // op vA, vB, #+CCCC
+    HANDLE_FORMAT(kFmt22t)      // op vA, vB, +CCCC
+        vA = INST_A(inst);
+        vB = INST_B(inst);
+        vC = (s2) insns[pos + 1];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt22c)      // op vA, vB, thing@CCCC
+    HANDLE_FORMAT(kFmt22cs)     // [opt] op vA, vB, field offset CCCC
+        vA = INST_A(inst);
+        vB = INST_B(inst);
+        vC = insns[pos + 1];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt30t)      // op +AAAAAAAA
+        vA = fetch_u4_impl(pos + 1, insns);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt31t)      // op vAA, +BBBBBBBB
+    HANDLE_FORMAT(kFmt31c)      // op vAA, string@BBBBBBBB
+    HANDLE_FORMAT(kFmt31i)      // op vAA, #+BBBBBBBB
+        vA = INST_AA(inst);
+        vB = fetch_u4_impl(pos + 1, insns);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt32x)      // op vAAAA, vBBBB
+        vA = insns[pos + 1];
+        vB = insns[pos + 2];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt35c)      // op {vC, vD, vE, vF, vG}, thing@BBBB
+    HANDLE_FORMAT(kFmt35ms)     // [opt] invoke-virtual+super
+    HANDLE_FORMAT(kFmt35mi)     // [opt] inline invoke
+        /* as in dexDecodeInstruction(), the count is in vA */
+        vA = INST_B(inst);
+        vB = insns[pos + 1];
+        if (vA > 5 || (vA == 5 && gInstructionFormatTable[opcode] == kFmt35mi)) {
+            ALOGW("Invalid arg count in 35c/35ms/35mi (%d)", vA);
+        } else {
+            /* the fifth argument comes from the A field */
+            args = insns[pos + 2] | (INST_A(inst) << 16);
+            args &= ~(0xffffffff << (4 * vA));
+            vC = args & 0x0f;
+        }
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt3rc)      // op {vCCCC .. v(CCCC+AA-1)}, meth@BBBB
+    HANDLE_FORMAT(kFmt3rms)     // [opt] invoke-virtual+super/range
+    HANDLE_FORMAT(kFmt3rmi)     // [opt] execute-inline/range
+        vA = INST_AA(inst);
+        vB = insns[pos + 1];
+        vC = insns[pos + 2];
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt51l)      // op vAA, #+BBBBBBBBBBBBBBBB
+        vA = INST_AA(inst);
+        vB = fetch_u4_impl(pos + 1, insns);
+        vC = fetch_u4_impl(pos + 3, insns);
+        FINISH_INSN();
+    HANDLE_FORMAT(kFmt00x)
+        /* not reached; these all have a width of zero */
+        goto bail;
+#ifndef THREADED_INSNS_DECODE
+    }
+#endif
+
+done:
+    result = true;
+
+bail:
+    pInsns->count = count;
+    pInsns->offsets[count] = pos;
+    return result;
+}
+
+#undef HANDLE_FORMAT
+#undef GOTO_FORMAT
+#undef NEXT_INSN
+#undef FINISH_INSN
+
+/*
+ * Get entry "idx" of a DecodedInsns table in DecodedInstruction form.
+ */
+void dexGetDecodedInsn(const DecodedInsns* pInsns, u4 idx,
+    DecodedInstruction* pDec)
+{
+    Opcode opcode = (Opcode) pInsns->opcodes[idx];
+    u4 args = pInsns->args[idx];
+    int i;
+
+    assert(idx < pInsns->count);
+
+    pDec->opcode = opcode;
+    pDec->indexType = dexGetIndexTypeFromOpcode(opcode);
+    pDec->vA = pInsns->vA[idx];
+    pDec->vB = pInsns->vB[idx];
+    pDec->vC = pInsns->vC[idx];
+    if (dexGetFormatFromOpcode(opcode) == kFmt51l)
+        pDec->vB_wide = pDec->vB | ((u8) pDec->vC << 32);
+    else
+        pDec->vB_wide = 0;
+    for (i = 0; i < 5; i++)
+        pDec->arg[i] = (args >> (4 * i)) & 0x0f;
+}
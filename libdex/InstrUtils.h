@@ -192,4 +192,79 @@ DEX_INLINE InstructionIndexType dexGetIndexTypeFromOpcode(Opcode opcode)
  */
 void dexDecodeInstruction(const u2* insns, DecodedInstruction* pDec);
 
+/*
+ * What an entry in a DecodedInsns table is.  The payloads are the
+ * switch and array data tables, which look like nops.
+ */
+enum DecodedInsnKind {
+    kInsnNormal = 0,
+    kInsnPackedSwitchPayload,
+    kInsnSparseSwitchPayload,
+    kInsnArrayDataPayload,
+};
+
+/* code units that a DecodedInsns can hold without allocating */
+enum { kDecodedInsnsInlineUnits = 64 };
+
+/*
+ * All of the instructions in an insns array, decoded into parallel
+ * arrays, so that a scan over one field only touches that field.
+ * Entry N is the instruction at code unit offsets[N], and is
+ * offsets[N+1] - offsets[N] units wide ("offsets" has count+1 entries).
+ *
+ * vA, vB and vC are as in DecodedInstruction, and are 0 if the format
+ * doesn't use them, with these differences:
+ *   - 35c/35ms/35mi: "args" holds the argument registers, 4 bits each,
+ *     with arg[0] in the low bits.
+ *   - 51l: vB holds the low 32 bits of the literal, and vC the high.
+ *   - payloads: the opcode is OP_NOP and only "kinds" says what it is.
+ */
+struct DecodedInsns {
+    u4      count;
+    u4*     offsets;
+    u1*     opcodes;        /* Opcode elements */
+    u1*     kinds;          /* DecodedInsnKind elements */
+    u4*     vA;
+    u4*     vB;
+    u4*     vC;
+    u4*     args;
+
+    void*   allocated;      /* storage, if bigger than inlineStorage */
+    u4      capacity;       /* instructions that fit in the storage */
+    u4      inlineStorage[(kDecodedInsnsInlineUnits + 1)
+                + kDecodedInsnsInlineUnits * 4
+                + kDecodedInsnsInlineUnits * 2 / sizeof(u4)];
+};
+
+/*
+ * Initialize the given DecodedInsns. Use this function before passing
+ * one into any other function.
+ */
+void dexDecodedInsnsInit(DecodedInsns* pInsns);
+
+/*
+ * Release the allocated contents of the given DecodedInsns, if any.
+ */
+void dexDecodedInsnsRelease(DecodedInsns* pInsns);
+
+/*
+ * Decode the "insnsSize" code units of instructions at "insns" into
+ * "pInsns", replacing what was there.  This is the same as calling
+ * dexDecodeInstruction() on each instruction in turn, but it's done in
+ * one pass with a jump per format, and the payloads are recognized as
+ * they are reached.
+ *
+ * Returns false if an undefined opcode is reached, if an instruction
+ * runs past the end, or if memory runs out.  The instructions before
+ * the trouble spot are still in the table, and offsets[count] is where
+ * it is.
+ */
+bool dexDecodeInsns(const u2* insns, u4 insnsSize, DecodedInsns* pInsns);
+
+/*
+ * Get entry "idx" of a DecodedInsns table in DecodedInstruction form.
+ */
+void dexGetDecodedInsn(const DecodedInsns* pInsns, u4 idx,
+    DecodedInstruction* pDec);
+
 #endif  // LIBDEX_INSTRUTILS_H_
@@ -20,6 +20,12 @@
 
 #include "Leb128.h"
 
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /*
  * Reads an unsigned LEB128 value, updating the given pointer to point
  * just past the end of the read value and also indicating whether the
@@ -63,3 +69,158 @@ int readAndVerifySignedLeb128(const u1** pStream, const u1* limit,
 
     return result;
 }
+
+/* bytes examined at a time by the array decoders */
+enum { kLeb128BlockSize = 16 };
+
+/*
+ * Return a bit mask with bit N set if byte N of the kLeb128BlockSize
+ * bytes at "ptr" is the last byte of a value (i.e. its high bit is
+ * clear).
+ */
+static inline u4 leb128BlockEnds(const u1* ptr)
+{
+#ifdef __SSE2__
+    __m128i block = _mm_loadu_si128((const __m128i*) ptr);
+    return ~(u4) _mm_movemask_epi8(block) & 0xffff;
+#else
+    u4 bits = 0;
+    for (int i = 0; i < kLeb128BlockSize; i++) {
+        if (ptr[i] < 0x80)
+            bits |= 1 << i;
+    }
+    return bits;
+#endif
+}
+
+/*
+ * Store a block of kLeb128BlockSize single-byte values.
+ */
+static inline void leb128StoreBytes(const u1* ptr, u4* out)
+{
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i block = _mm_loadu_si128((const __m128i*) ptr);
+    __m128i lo = _mm_unpacklo_epi8(block, zero);
+    __m128i hi = _mm_unpackhi_epi8(block, zero);
+    _mm_storeu_si128((__m128i*) out, _mm_unpacklo_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*) (out + 4), _mm_unpackhi_epi16(lo, zero));
+    _mm_storeu_si128((__m128i*) (out + 8), _mm_unpacklo_epi16(hi, zero));
+    _mm_storeu_si128((__m128i*) (out + 12), _mm_unpackhi_epi16(hi, zero));
+#else
+    for (int i = 0; i < kLeb128BlockSize; i++)
+        out[i] = ptr[i];
+#endif
+}
+
+/*
+ * Assemble a value from its "len" (1 to 4) encoded bytes, which are the
+ * low bytes of the little-endian word "bits".
+ */
+static inline u4 leb128Assemble(u4 bits, int len)
+{
+    bits &= 0xffffffff >> (32 - 8 * len);
+    return (bits & 0x7f)
+        | ((bits >> 1) & 0x3f80)
+        | ((bits >> 2) & 0x1fc000)
+        | ((bits >> 3) & 0xfe00000);
+}
+
+/*
+ * Shared body of the array decoders.  One load per block finds where
+ * all of the values in the next kLeb128BlockSize bytes end, and each
+ * value is then pulled out with a 4-byte load, so there is no branch
+ * per byte.  Five-byte values, which are rare and the only ones that
+ * need checking, and values too close to "limit" for a block load are
+ * read one at a time.
+ */
+static inline bool readLeb128Array(const u1** pStream, const u1* limit,
+        u4* out, size_t count, bool verify)
+{
+    /* the 4-byte loads for leb128Assemble() assume little-endian order */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (limit != NULL) {
+        const u1* ptr = *pStream;
+
+        while (count != 0 && limit - ptr >= kLeb128BlockSize) {
+            u4 ends = leb128BlockEnds(ptr);
+            int start = 0;
+
+            if (ends == 0xffff && count >= kLeb128BlockSize) {
+                leb128StoreBytes(ptr, out);
+                ptr += kLeb128BlockSize;
+                out += kLeb128BlockSize;
+                count -= kLeb128BlockSize;
+                continue;
+            }
+
+            while (ends != 0 && count != 0) {
+                int end = __builtin_ctz(ends);
+                int len = end - start + 1;
+                u4 bits;
+
+                if (len > 4 || start > kLeb128BlockSize - 4)
+                    break;
+
+                memcpy(&bits, ptr + start, sizeof(bits));
+                *out++ = leb128Assemble(bits, len);
+                ends &= ends - 1;
+                start = end + 1;
+                count--;
+            }
+            ptr += start;
+
+            if (start == 0) {
+                /* starts with a long value */
+                if (verify) {
+                    bool okay = true;
+                    *out++ = readAndVerifyUnsignedLeb128(&ptr, limit, &okay);
+                    if (!okay)
+                        return false;
+                } else {
+                    *out++ = readUnsignedLeb128(&ptr);
+                }
+                count--;
+            }
+        }
+
+        *pStream = ptr;
+    }
+#endif
+
+    while (count-- != 0) {
+        if (verify) {
+            bool okay = true;
+            *out++ = readAndVerifyUnsignedLeb128(pStream, limit, &okay);
+            if (!okay)
+                return false;
+        } else {
+            *out++ = readUnsignedLeb128(pStream);
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Reads "count" unsigned LEB128 values into "out", updating the given
+ * pointer to point just past the end of the last one.  The result is
+ * the same as calling readUnsignedLeb128() "count" times, but runs of
+ * values are decoded a 16-byte block at a time.  "limit" is the end of
+ * the readable data, which the block loads stay inside of; if it is
+ * NULL, every value is decoded one at a time.
+ */
+void readUnsignedLeb128Array(const u1** pStream, const u1* limit, u4* out,
+        size_t count) {
+    readLeb128Array(pStream, limit, out, count, false);
+}
+
+/*
+ * Like readUnsignedLeb128Array(), but with the checks done by
+ * readAndVerifyUnsignedLeb128().  Returns false, with "*pStream" and
+ * "out" in an unspecified state, as soon as an invalid value is seen.
+ */
+bool readAndVerifyUnsignedLeb128Array(const u1** pStream, const u1* limit,
+        u4* out, size_t count) {
+    return readLeb128Array(pStream, limit, out, count, true);
+}
@@ -124,6 +124,24 @@ int readAndVerifyUnsignedLeb128(const u1** pStream, const u1* limit,
  */
 int readAndVerifySignedLeb128(const u1** pStream, const u1* limit, bool* okay);
 
+/*
+ * Reads "count" unsigned LEB128 values into "out", updating the given
+ * pointer to point just past the end of the last one.  The result is
+ * the same as calling readUnsignedLeb128() "count" times, but runs of
+ * values are decoded a 16-byte block at a time.  "limit" is the end of
+ * the readable data, which the block loads stay inside of; if it is
+ * NULL, every value is decoded one at a time.
+ */
+void readUnsignedLeb128Array(const u1** pStream, const u1* limit, u4* out,
+        size_t count);
+
+/*
+ * Like readUnsignedLeb128Array(), but with the checks done by
+ * readAndVerifyUnsignedLeb128().  Returns false, with "*pStream" and
+ * "out" in an unspecified state, as soon as an invalid value is seen.
+ */
+bool readAndVerifyUnsignedLeb128Array(const u1** pStream, const u1* limit,
+        u4* out, size_t count);
 
 /*
  * Writes a 32-bit value in unsigned ULEB128 format.
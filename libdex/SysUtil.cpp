@@ -26,6 +26,12 @@
 #include <string.h>
 #if !defined(__MINGW32__)
 # include <sys/mman.h>
+# include <sys/resource.h>
+# include <pthread.h>
+#endif
+#if defined(__linux__)
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
 #endif
 #include <limits.h>
 #include <errno.h>
@@ -33,6 +39,64 @@
 #include <JNIHelp.h>        // TEMP_FAILURE_RETRY may or may not be in unistd
 
 
+/* hint for new file mappings; see sysSetMapAdvice() */
+static SysMapAdvice gMapAdvice = kSysMapAdviceNormal;
+
+/* see sysSetHugePages() */
+static bool gUseHugePages = false;
+
+/*
+ * Create a private anonymous mapping of "length" bytes starting on a
+ * huge page boundary, and ask for it to be backed by transparent huge
+ * pages.  The size of the mapping, which is "length" rounded up to a
+ * whole number of pages, is returned in "*pMappedLength".
+ *
+ * The area is carved out of one that is a huge page larger, with the
+ * unaligned ends unmapped again.  It's private rather than shared
+ * because shared anonymous memory only gets huge pages if the
+ * administrator enables them for shmem.
+ */
+static void* createHugePageMap(size_t length, size_t* pMappedLength)
+{
+#if !defined(__MINGW32__)
+    size_t mappedLength = (length + SYSTEM_PAGE_SIZE - 1)
+        & ~((size_t) SYSTEM_PAGE_SIZE - 1);
+    size_t reserveLength = mappedLength + SYSTEM_HUGE_PAGE_SIZE;
+    u1* reserve;
+    u1* aligned;
+
+    reserve = (u1*) mmap(NULL, reserveLength, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (reserve == MAP_FAILED) {
+        ALOGW("mmap(%zd, RW, PRIVATE|ANON) failed: %s", reserveLength,
+            strerror(errno));
+        return NULL;
+    }
+
+    aligned = (u1*) (((uintptr_t) reserve + SYSTEM_HUGE_PAGE_SIZE - 1)
+        & ~((uintptr_t) SYSTEM_HUGE_PAGE_SIZE - 1));
+    if (aligned != reserve)
+        munmap(reserve, aligned - reserve);
+    if (aligned + mappedLength != reserve + reserveLength) {
+        munmap(aligned + mappedLength,
+            (reserve + reserveLength) - (aligned + mappedLength));
+    }
+
+#if defined(MADV_HUGEPAGE)
+    if (madvise(aligned, mappedLength, MADV_HUGEPAGE) != 0) {
+        /* e.g. THP not configured; the memory is still usable */
+        ALOGV("madvise(%p, %zd, MADV_HUGEPAGE) failed: %s",
+            aligned, mappedLength, strerror(errno));
+    }
+#endif
+
+    *pMappedLength = mappedLength;
+    return aligned;
+#else
+    return NULL;
+#endif
+}
+
 /*
  * Create an anonymous shared memory segment large enough to hold "length"
  * bytes.  The actual segment may be larger because mmap() operates on
@@ -65,6 +129,18 @@ int sysCreatePrivateMap(size_t length, MemMapping* pMap)
 {
     void* memPtr;
 
+    if (gUseHugePages && length >= SYSTEM_HUGE_PAGE_SIZE) {
+        size_t mappedLength;
+
+        memPtr = createHugePageMap(length, &mappedLength);
+        if (memPtr != NULL) {
+            pMap->addr = pMap->baseAddr = memPtr;
+            pMap->length = length;
+            pMap->baseLength = mappedLength;
+            return 0;
+        }
+    }
+
     memPtr = sysCreateAnonShmem(length);
     if (memPtr == NULL)
         return -1;
@@ -137,13 +213,59 @@ int sysFakeMapFile(int fd, MemMapping* pMap)
 }
 #endif
 
+#if !defined(__MINGW32__)
+/*
+ * Read "length" bytes of the file from offset "start" into huge page
+ * backed anonymous memory, for sysMapFileInShmemWritableReadOnly().
+ * Private file pages can't be huge, so this trades a copy of the file
+ * for fewer TLB misses later.
+ *
+ * Returns 0 on success.
+ */
+static int readFileIntoHugePages(int fd, off_t start, size_t length,
+    MemMapping* pMap)
+{
+    size_t mappedLength;
+    size_t done = 0;
+    u1* memPtr;
+
+    memPtr = (u1*) createHugePageMap(length, &mappedLength);
+    if (memPtr == NULL)
+        return -1;
+
+    while (done < length) {
+        ssize_t actual = TEMP_FAILURE_RETRY(pread(fd, memPtr + done,
+                length - done, start + done));
+        if (actual <= 0) {
+            ALOGW("pread(fd=%d, %zd bytes at %lld) failed: %s", fd,
+                length - done, (long long) (start + done),
+                (actual == 0) ? "unexpected EOF" : strerror(errno));
+            munmap(memPtr, mappedLength);
+            return -1;
+        }
+        done += actual;
+    }
+
+    if (mprotect(memPtr, mappedLength, PROT_READ) < 0) {
+        ALOGW("mprotect(%p, %zd, PROT_READ) failed: %s",
+            memPtr, mappedLength, strerror(errno));
+    }
+
+    pMap->baseAddr = pMap->addr = memPtr;
+    pMap->length = length;
+    pMap->baseLength = mappedLength;
+    return 0;
+}
+#endif
+
 /*
  * Map a file (from fd's current offset) into a private, read-write memory
  * segment that will be marked read-only (a/k/a "writable read-only").  The
  * file offset must be a multiple of the system page size.
  *
  * In some cases the mapping will be fully writable (e.g. for files on
- * FAT filesystems).
+ * FAT filesystems).  If huge pages were asked for (see sysSetHugePages()),
+ * a large file is read into anonymous memory instead of being mapped.
  *
  * On success, returns 0 and fills out "pMap".  On failure, returns a nonzero
  * value and does not disturb "pMap".
@@ -160,6 +282,11 @@ int sysMapFileInShmemWritableReadOnly(int fd, MemMapping* pMap)
     if (getFileStartAndLength(fd, &start, &length) < 0)
         return -1;
 
+    if (gUseHugePages && length >= SYSTEM_HUGE_PAGE_SIZE
+            && readFileIntoHugePages(fd, start, length, pMap) == 0) {
+        return 0;
+    }
+
     memPtr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE,
             fd, start);
     if (memPtr == MAP_FAILED) {
@@ -178,6 +305,9 @@ int sysMapFileInShmemWritableReadOnly(int fd, MemMapping* pMap)
     pMap->baseAddr = pMap->addr = memPtr;
     pMap->baseLength = pMap->length = length;
 
+    if (gMapAdvice != kSysMapAdviceNormal)
+        sysAdviseMap(pMap, gMapAdvice);
+
     return 0;
 #else
     return sysFakeMapFile(fd, pMap);
@@ -185,13 +315,13 @@ int sysMapFileInShmemWritableReadOnly(int fd, MemMapping* pMap)
 }
 
 /*
- * Map part of a file into a shared, read-only memory segment.  The "start"
- * offset is absolute, not relative.
+ * Map part of a file read-only, with the given mmap() flags (MAP_SHARED
+ * or MAP_PRIVATE).  The "start" offset is absolute, not relative.
  *
  * On success, returns 0 and fills out "pMap".  On failure, returns a nonzero
  * value and does not disturb "pMap".
  */
-int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
+static int mapFileSegment(int fd, off_t start, size_t length, int flags,
     MemMapping* pMap)
 {
 #if !defined(__MINGW32__)
@@ -207,11 +337,13 @@ int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
     actualStart = start - adjust;
     actualLength = length + adjust;
 
-    memPtr = mmap(NULL, actualLength, PROT_READ, MAP_FILE | MAP_SHARED,
+    memPtr = mmap(NULL, actualLength, PROT_READ, MAP_FILE | flags,
                 fd, actualStart);
     if (memPtr == MAP_FAILED) {
-        ALOGW("mmap(%d, R, FILE|SHARED, %d, %d) failed: %s",
-            (int) actualLength, fd, (int) actualStart, strerror(errno));
+        ALOGW("mmap(%d, R, FILE|%s, %d, %d) failed: %s",
+            (int) actualLength,
+            (flags == MAP_PRIVATE) ? "PRIVATE" : "SHARED",
+            fd, (int) actualStart, strerror(errno));
         return -1;
     }
 
@@ -225,6 +357,9 @@ int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
         pMap->baseAddr, (int) pMap->baseLength,
         pMap->addr, (int) pMap->length);
 
+    if (gMapAdvice != kSysMapAdviceNormal)
+        sysAdviseMap(pMap, gMapAdvice);
+
     return 0;
 #else
     ALOGE("sysMapFileSegmentInShmem not implemented.");
@@ -232,6 +367,42 @@ int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
 #endif
 }
 
+/*
+ * Map part of a file into a shared, read-only memory segment.  The "start"
+ * offset is absolute, not relative.
+ *
+ * On success, returns 0 and fills out "pMap".  On failure, returns a nonzero
+ * value and does not disturb "pMap".
+ */
+int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
+    MemMapping* pMap)
+{
+#if !defined(__MINGW32__)
+    return mapFileSegment(fd, start, length, MAP_SHARED, pMap);
+#else
+    return mapFileSegment(fd, start, length, 0, pMap);
+#endif
+}
+
+/*
+ * Map part of a file into a private, read-only memory segment that can
+ * be made writable with sysChangeMapAccess().  Writes go to private
+ * copies of the pages, never to the file, so this works on a file opened
+ * read-only.
+ *
+ * On success, returns 0 and fills out "pMap".  On failure, returns a nonzero
+ * value and does not disturb "pMap".
+ */
+int sysMapFileSegmentWritableReadOnly(int fd, off_t start, size_t length,
+    MemMapping* pMap)
+{
+#if !defined(__MINGW32__)
+    return mapFileSegment(fd, start, length, MAP_PRIVATE, pMap);
+#else
+    return mapFileSegment(fd, start, length, 0, pMap);
+#endif
+}
+
 /*
  * Change the access rights on one or more pages to read-only or read-write.
  *
@@ -301,6 +472,92 @@ void sysReleaseShmem(MemMapping* pMap)
 #endif
 }
 
+/* See documentation comment in header file. */
+void sysSetMapAdvice(SysMapAdvice advice)
+{
+    gMapAdvice = advice;
+}
+
+/* See documentation comment in header file. */
+SysMapAdvice sysGetMapAdvice(void)
+{
+    return gMapAdvice;
+}
+
+/* See documentation comment in header file. */
+void sysSetHugePages(bool enable)
+{
+    gUseHugePages = enable;
+}
+
+/* See documentation comment in header file. */
+bool sysGetHugePages(void)
+{
+    return gUseHugePages;
+}
+
+/* See documentation comment in header file. */
+void sysAdviseRange(const void* addr, size_t length, SysMapAdvice advice)
+{
+#if !defined(__MINGW32__)
+    uintptr_t start = (uintptr_t) addr & ~((uintptr_t) SYSTEM_PAGE_SIZE - 1);
+    size_t alignedLength = ((uintptr_t) addr + length) - start;
+    int behavior;
+
+    if (length == 0)
+        return;
+
+    switch (advice) {
+    case kSysMapAdviceNormal:       behavior = MADV_NORMAL;         break;
+    case kSysMapAdviceSequential:   behavior = MADV_SEQUENTIAL;     break;
+    case kSysMapAdviceRandom:       behavior = MADV_RANDOM;         break;
+    case kSysMapAdviceWillNeed:     behavior = MADV_WILLNEED;       break;
+    case kSysMapAdvicePopulate: {
+#if defined(MADV_POPULATE_READ)
+        if (madvise((void*) start, alignedLength, MADV_POPULATE_READ) == 0)
+            return;
+#endif
+        /* older kernels: read a byte of every page */
+        const volatile u1* ptr = (const volatile u1*) start;
+        size_t offset;
+
+        for (offset = 0; offset < alignedLength; offset += SYSTEM_PAGE_SIZE)
+            (void) ptr[offset];
+        return;
+    }
+    default:
+        ALOGW("Unknown map advice %d", advice);
+        return;
+    }
+
+    if (madvise((void*) start, alignedLength, behavior) != 0) {
+        ALOGW("madvise(%p, %zd, %d) failed: %s", (void*) start,
+            alignedLength, behavior, strerror(errno));
+    }
+#endif
+}
+
+/* See documentation comment in header file. */
+void sysAdviseMap(const MemMapping* pMap, SysMapAdvice advice)
+{
+    sysAdviseRange(pMap->baseAddr, pMap->baseLength, advice);
+}
+
+/* See documentation comment in header file. */
+void sysGetPageFaults(SysPageFaults* pFaults)
+{
+#if !defined(__MINGW32__)
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        pFaults->minor = usage.ru_minflt;
+        pFaults->major = usage.ru_majflt;
+        return;
+    }
+#endif
+    pFaults->minor = pFaults->major = 0;
+}
+
 /*
  * Make a copy of a MemMapping.
  */
@@ -333,12 +590,142 @@ int sysWriteFully(int fd, const void* buf, size_t count, const char* logMsg)
     return 0;
 }
 
+/* See documentation comment in header file. */
+int sysWriteFullyV(int fd, const struct iovec* iov, int iovcnt,
+    const char* logMsg)
+{
+#if !defined(__MINGW32__)
+    /* how many buffers to hand to one writev() */
+    enum { kMaxIov = 64 };
+    struct iovec window[kMaxIov];
+    size_t skip = 0;        /* bytes of iov[0] already written */
+
+    while (true) {
+        int count;
+
+        /* step over the buffers that are done (or were empty) */
+        while (iovcnt > 0 && iov->iov_len == skip) {
+            iov++;
+            iovcnt--;
+            skip = 0;
+        }
+        if (iovcnt == 0)
+            break;
+
+        count = (iovcnt < kMaxIov) ? iovcnt : kMaxIov;
+        memcpy(window, iov, count * sizeof(struct iovec));
+        window[0].iov_base = (u1*) window[0].iov_base + skip;
+        window[0].iov_len -= skip;
+
+        ssize_t actual = TEMP_FAILURE_RETRY(writev(fd, window, count));
+        if (actual < 0) {
+            int err = errno;
+            ALOGE("%s: writev failed: %s", logMsg, strerror(err));
+            return err;
+        }
+
+        /* advance past what got written */
+        size_t left = actual;
+        while (left != 0) {
+            size_t remaining = iov->iov_len - skip;
+            if (left < remaining) {
+                skip += left;
+                left = 0;
+            } else {
+                left -= remaining;
+                iov++;
+                iovcnt--;
+                skip = 0;
+            }
+        }
+    }
+
+    return 0;
+#else
+    int i;
+
+    for (i = 0; i < iovcnt; i++) {
+        int err = sysWriteFully(fd, iov[i].iov_base, iov[i].iov_len, logMsg);
+        if (err != 0)
+            return err;
+    }
+
+    return 0;
+#endif
+}
+
+#if defined(__linux__)
+/*
+ * Set once copy_file_range() turns out not to exist, so that it isn't
+ * tried on every copy.  Copies can run on several threads at once, so
+ * it's only accessed atomically; nothing else depends on it, so relaxed
+ * ordering is enough.
+ */
+static bool gNoCopyFileRange = false;
+
+/*
+ * Copy up to "count" bytes from "inFd" to "outFd", starting at (and
+ * advancing) the current offset of each, without bringing the data into
+ * user space.  copy_file_range() can share or clone blocks on the same
+ * filesystem; sendfile() works between any file and any output fd.
+ *
+ * Returns the number of bytes copied, which is short if the kernel can't
+ * do (the rest of) the copy this way, or the input ends early; the caller
+ * sorts that out.
+ */
+static size_t copyInKernel(int outFd, int inFd, size_t count)
+{
+    /* at most this much per call, to stay clear of ssize_t limits */
+    const size_t kMaxChunk = 0x40000000;
+    size_t copied = 0;
+
+#if defined(__NR_copy_file_range)
+    while (!__atomic_load_n(&gNoCopyFileRange, __ATOMIC_RELAXED)
+            && copied < count) {
+        size_t chunk = count - copied;
+        if (chunk > kMaxChunk)
+            chunk = kMaxChunk;
+
+        ssize_t actual = TEMP_FAILURE_RETRY(syscall(__NR_copy_file_range,
+            inFd, NULL, outFd, NULL, chunk, 0));
+        if (actual <= 0) {
+            if (actual < 0 && errno == ENOSYS)
+                __atomic_store_n(&gNoCopyFileRange, true, __ATOMIC_RELAXED);
+            break;          /* e.g. EXDEV, EINVAL: try sendfile() */
+        }
+
+        copied += actual;
+    }
+#endif
+
+    while (copied < count) {
+        size_t chunk = count - copied;
+        if (chunk > kMaxChunk)
+            chunk = kMaxChunk;
+
+        ssize_t actual = TEMP_FAILURE_RETRY(sendfile(outFd, inFd, NULL,
+            chunk));
+        if (actual <= 0)
+            break;
+
+        copied += actual;
+    }
+
+    return copied;
+}
+#endif
+
 /* See documentation comment in header file. */
 int sysCopyFileToFile(int outFd, int inFd, size_t count)
 {
     const size_t kBufSize = 32768;
     unsigned char buf[kBufSize];
 
+#if defined(__linux__)
+    count -= copyInKernel(outFd, inFd, count);
+#endif
+
+    /* whatever the kernel didn't do, the slow way (which reports EOF) */
     while (count != 0) {
         size_t getSize = (count > kBufSize) ? kBufSize : count;
 
@@ -357,3 +744,93 @@ int sysCopyFileToFile(int outFd, int inFd, size_t count)
 
     return 0;
 }
+
+#if !defined(__MINGW32__)
+/*
+ * Shared state for sysRunParallel().  "next" is the next index to hand
+ * out, protected by "lock".
+ */
+struct ParallelWork {
+    pthread_mutex_t     lock;
+    size_t              next;
+    size_t              count;
+    SysParallelFunc*    func;
+    void*               arg;
+};
+
+/*
+ * Pull indices off the shared counter until they're all gone.
+ */
+static void runParallelWork(ParallelWork* pWork)
+{
+    while (true) {
+        size_t index;
+
+        pthread_mutex_lock(&pWork->lock);
+        index = pWork->next;
+        if (index < pWork->count)
+            pWork->next++;
+        pthread_mutex_unlock(&pWork->lock);
+
+        if (index >= pWork->count)
+            break;
+
+        (*pWork->func)(pWork->arg, index);
+    }
+}
+
+static void* parallelWorkerStart(void* arg)
+{
+    runParallelWork((ParallelWork*) arg);
+    return NULL;
+}
+#endif
+
+/* See documentation comment in header file. */
+void sysRunParallel(size_t count, int numThreads, SysParallelFunc* func,
+    void* arg)
+{
+#if !defined(__MINGW32__)
+    if (numThreads > 1 && count > 1) {
+        ParallelWork work;
+        pthread_t* threads;
+        int numWorkers, started;
+
+        if ((size_t) numThreads > count)
+            numThreads = count;
+        numWorkers = numThreads - 1;
+
+        threads = (pthread_t*) malloc(numWorkers * sizeof(pthread_t));
+        if (threads == NULL)
+            numWorkers = 0;
+
+        pthread_mutex_init(&work.lock, NULL);
+        work.next = 0;
+        work.count = count;
+        work.func = func;
+        work.arg = arg;
+
+        for (started = 0; started < numWorkers; started++) {
+            int cc = pthread_create(&threads[started], NULL,
+                        parallelWorkerStart, &work);
+            if (cc != 0) {
+                ALOGW("sysRunParallel: pthread_create failed: %s",
+                    strerror(cc));
+                break;
+            }
+        }
+
+        runParallelWork(&work);
+
+        while (started > 0)
+            pthread_join(threads[--started], NULL);
+
+        pthread_mutex_destroy(&work.lock);
+        free(threads);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++)
+        (*func)(arg, i);
+}
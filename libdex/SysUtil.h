@@ -21,6 +21,15 @@
 #define LIBDEX_SYSUTIL_H_
 
 #include <sys/types.h>
+#if !defined(__MINGW32__)
+# include <sys/uio.h>
+#else
+/* for sysWriteFullyV(), which writes the buffers one at a time here */
+struct iovec {
+    void*   iov_base;
+    size_t  iov_len;
+};
+#endif
 
 /*
  * System page size.  Normally you're expected to get this from
@@ -37,6 +46,11 @@
 #define SYSTEM_PAGE_SIZE        4096
 #endif
 
+/*
+ * Size of a transparent huge page (a PMD mapping on x86 and ARM).
+ */
+#define SYSTEM_HUGE_PAGE_SIZE   (2 * 1024 * 1024)
+
 /*
  * Use this to keep track of mapped segments.
  */
@@ -70,6 +84,16 @@ int sysMapFileInShmemWritableReadOnly(int fd, MemMapping* pMap);
 int sysMapFileSegmentInShmem(int fd, off_t start, size_t length,
     MemMapping* pMap);
 
+/*
+ * Map part of a file into a private, read-only memory segment that can be
+ * made writable with sysChangeMapAccess().  Writes are copy-on-write, and
+ * never reach the file.
+ *
+ * On success, "pMap" is filled in, and zero is returned.
+ */
+int sysMapFileSegmentWritableReadOnly(int fd, off_t start, size_t length,
+    MemMapping* pMap);
+
 /*
  * Create a private anonymous mapping, useful for large allocations.
  *
@@ -93,6 +117,60 @@ int sysChangeMapAccess(void* addr, size_t length, int wantReadWrite,
  */
 void sysReleaseShmem(MemMapping* pMap);
 
+/*
+ * How a mapping is going to be read, for the kernel's paging decisions.
+ */
+enum SysMapAdvice {
+    kSysMapAdviceNormal = 0,    /* no hint; default readahead */
+    kSysMapAdviceSequential,    /* read front to back (MADV_SEQUENTIAL) */
+    kSysMapAdviceRandom,        /* scattered reads, no readahead */
+    kSysMapAdviceWillNeed,      /* start reading it all in now */
+    kSysMapAdvicePopulate,      /* fault it all in before returning */
+};
+
+/*
+ * Set the hint that sysMapFileInShmemWritableReadOnly() and the
+ * sysMapFileSegment*() functions give for every new mapping.  The default
+ * is kSysMapAdviceNormal, which leaves the mapping alone.
+ */
+void sysSetMapAdvice(SysMapAdvice advice);
+SysMapAdvice sysGetMapAdvice(void);
+
+/*
+ * Give the kernel a hint about the pages covering "length" bytes at
+ * "addr" (rounded out to whole pages), which must be mapped.  Only a
+ * hint: failures are logged, and otherwise ignored.
+ */
+void sysAdviseRange(const void* addr, size_t length, SysMapAdvice advice);
+
+/*
+ * Same, for a whole mapping.
+ */
+void sysAdviseMap(const MemMapping* pMap, SysMapAdvice advice);
+
+/*
+ * Page faults taken by the process so far.  "major" faults had to wait
+ * for I/O.
+ */
+struct SysPageFaults {
+    long    minor;
+    long    major;
+};
+
+void sysGetPageFaults(SysPageFaults* pFaults);
+
+/*
+ * Ask for transparent huge pages for mappings of at least
+ * SYSTEM_HUGE_PAGE_SIZE bytes made from now on by sysCreatePrivateMap()
+ * and sysMapFileInShmemWritableReadOnly().  The memory is aligned to a
+ * huge page and marked with MADV_HUGEPAGE, which cuts down on TLB misses
+ * when a big DEX file is read in random order.  A file is read into
+ * anonymous memory rather than mapped, so its pages are no longer shared
+ * with the page cache.  Off by default.
+ */
+void sysSetHugePages(bool enable);
+bool sysGetHugePages(void);
+
 /*
  * Write until all bytes have been written.
  *
@@ -101,9 +179,38 @@ void sysReleaseShmem(MemMapping* pMap);
 int sysWriteFully(int fd, const void* buf, size_t count, const char* logMsg);
 
 /*
- * Copy the given number of bytes from one fd to another. Returns
+ * Like sysWriteFully(), but write the "iovcnt" buffers described by "iov"
+ * one after the other, with as few writev() calls as possible.  The
+ * array itself is not modified.
+ *
+ * Returns 0 on success, or an errno value on failure.
+ */
+int sysWriteFullyV(int fd, const struct iovec* iov, int iovcnt,
+    const char* logMsg);
+
+/*
+ * Copy the given number of bytes from one fd to another, starting at the
+ * current offset of each. Where the kernel supports it (copy_file_range()
+ * or sendfile()), the data doesn't pass through user space. Returns
  * 0 on success, -1 on failure.
  */
 int sysCopyFileToFile(int outFd, int inFd, size_t count);
 
+/*
+ * Function called by sysRunParallel() for each work item.
+ */
+typedef void SysParallelFunc(void* arg, size_t index);
+
+/*
+ * Call "func(arg, index)" once for every index in [0, count), spreading
+ * the calls across up to "numThreads" threads (the calling thread is
+ * one of them).  Indices are handed out in ascending order, but may
+ * complete in any order.  Returns when all calls have finished.
+ *
+ * If worker threads can't be created, the remaining work is done on the
+ * calling thread.
+ */
+void sysRunParallel(size_t count, int numThreads, SysParallelFunc* func,
+    void* arg);
+
 #endif  // LIBDEX_SYSUTIL_H_
@@ -83,4 +83,24 @@ DEX_INLINE int dexZipExtractEntryToFile(ZipArchiveHandle handle,
     return ExtractEntryToFile(handle, entry, fd);
 }
 
+/*
+ * Uncompress an entry into the "size" bytes at "buf".
+ *
+ * Returns 0 on success.
+ */
+DEX_INLINE int dexZipExtractEntryToMemory(ZipArchiveHandle handle,
+    ZipEntry* entry, u1* buf, size_t size) {
+    return ExtractToMemory(handle, entry, buf, size);
+}
+
+/*
+ * Return true if the entry is stored uncompressed at a 4-byte aligned
+ * offset, so that its data can be mapped and used in place.
+ */
+DEX_INLINE bool dexZipEntryIsMappable(const ZipEntry* entry) {
+    return entry->method == kCompressStored
+        && entry->compressed_length == entry->uncompressed_length
+        && (entry->offset & 3) == 0;
+}
+
 #endif  // LIBDEX_ZIPARCHIVE_H_
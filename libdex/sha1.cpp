@@ -6,6 +6,11 @@
  *    trashing the input.
  *  - Include <endian.h> to get endian info.
  *  - Split a small piece into a header file.
+ *  - Use uint32_t for the state and block words, so that the results are
+ *    correct where long is 64 bits, and made the SHA1HANDSOFF workspace
+ *    a local so that separate contexts can be used from separate threads.
+ *  - Added a SHA-NI version of the block transform for x86, picked at
+ *    runtime when the CPU supports it.
  */
 
 /*
@@ -101,7 +106,7 @@ A million repetitions of "a"
 
 #define LINESIZE 2048
 
-static void SHA1Transform(unsigned long state[5],
+static void SHA1Transform(uint32_t state[5],
     const unsigned char buffer[64]);
 
 #define rol(value,bits) \
@@ -129,18 +134,18 @@ static void SHA1Transform(unsigned long state[5],
 
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 
-static void SHA1Transform(unsigned long state[5],
+static void SHA1Transform(uint32_t state[5],
     const unsigned char buffer[64])
 {
-unsigned long a, b, c, d, e;
+uint32_t a, b, c, d, e;
 union CHAR64LONG16 {
     unsigned char c[64];
-    unsigned long l[16];
+    uint32_t l[16];
 };
 CHAR64LONG16* block;
 #ifdef SHA1HANDSOFF
-static unsigned char workspace[64];
-    block = (CHAR64LONG16*)workspace;
+CHAR64LONG16 workspace;
+    block = &workspace;
     memcpy(block, buffer, 64);
 #else
     block = (CHAR64LONG16*)buffer;
@@ -193,6 +198,132 @@ warning. */
 }
 
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define SHA1_X86
+#include <immintrin.h>
+
+/*
+ * One group of four rounds using the SHA extensions. "e" is the E
+ * value for this group, and "eNext" receives the rotated A for the
+ * next one; "m0" holds the message words for this group, and the
+ * schedule for later groups is advanced in "m1".."m3".
+ */
+#define SHA1NI_ROUNDS(e, eNext, m0, m1, m2, m3, func) \
+    e = _mm_sha1nexte_epu32(e, m0);                   \
+    eNext = abcd;                                     \
+    m1 = _mm_sha1msg2_epu32(m1, m0);                  \
+    abcd = _mm_sha1rnds4_epu32(abcd, e, func);        \
+    m3 = _mm_sha1msg1_epu32(m3, m0);                  \
+    m2 = _mm_xor_si128(m2, m0);
+
+/* Hash "count" 512-bit blocks using the SHA extensions. */
+
+__attribute__((target("sha,sse4.1")))
+static void SHA1TransformShaNi(uint32_t state[5],
+    const unsigned char* data, unsigned long count)
+{
+    const __m128i byteSwap =
+        _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, abcdSave, e0, e0Save, e1;
+    __m128i msg0, msg1, msg2, msg3;
+
+    abcd = _mm_loadu_si128((const __m128i*) state);
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+    while (count-- != 0) {
+        abcdSave = abcd;
+        e0Save = e0;
+
+        /* rounds 0-15 also load the message */
+        msg0 = _mm_loadu_si128((const __m128i*) (data + 0));
+        msg0 = _mm_shuffle_epi8(msg0, byteSwap);
+        e0 = _mm_add_epi32(e0, msg0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        msg1 = _mm_loadu_si128((const __m128i*) (data + 16));
+        msg1 = _mm_shuffle_epi8(msg1, byteSwap);
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        msg2 = _mm_loadu_si128((const __m128i*) (data + 32));
+        msg2 = _mm_shuffle_epi8(msg2, byteSwap);
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        msg3 = _mm_loadu_si128((const __m128i*) (data + 48));
+        msg3 = _mm_shuffle_epi8(msg3, byteSwap);
+        SHA1NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 0);
+
+        SHA1NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 0);
+        SHA1NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHA1NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 1);
+        SHA1NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 1);
+        SHA1NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 1);
+        SHA1NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 1);
+        SHA1NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHA1NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 2);
+        SHA1NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 2);
+        SHA1NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 2);
+        SHA1NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 2);
+        SHA1NI_ROUNDS(e1, e0, msg3, msg0, msg1, msg2, 3);
+        SHA1NI_ROUNDS(e0, e1, msg0, msg1, msg2, msg3, 3);
+        SHA1NI_ROUNDS(e1, e0, msg1, msg2, msg3, msg0, 3);
+        SHA1NI_ROUNDS(e0, e1, msg2, msg3, msg0, msg1, 3);
+
+        /* rounds 76-79 */
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0Save);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+
+        data += 64;
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    _mm_storeu_si128((__m128i*) state, abcd);
+    state[4] = (uint32_t) _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1NI_ROUNDS
+
+static bool SHA1HaveShaNi()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+}
+#endif  // SHA1_X86
+
+
+/* Hash "count" consecutive 512-bit blocks. */
+
+static void SHA1Blocks(uint32_t state[5], const unsigned char* data,
+    unsigned long count)
+{
+#ifdef SHA1_X86
+    static const bool haveShaNi = SHA1HaveShaNi();
+
+    if (haveShaNi) {
+        SHA1TransformShaNi(state, data, count);
+        return;
+    }
+#endif
+
+    while (count-- != 0) {
+        SHA1Transform(state, data);
+        data += 64;
+    }
+}
+
+
 /* SHA1Init - Initialize new context */
 
 void SHA1Init(SHA1_CTX* context)
@@ -214,17 +345,18 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data,
 {
     unsigned long i, j; /* JHB */
 
+    uint32_t bits = (uint32_t) (len << 3);
+
     j = (context->count[0] >> 3) & 63;
-    if ((context->count[0] += len << 3) < (len << 3))
+    if ((context->count[0] += bits) < bits)
         context->count[1]++;
-    context->count[1] += (len >> 29);
+    context->count[1] += (uint32_t) (len >> 29);
     if ((j + len) > 63)
     {
         memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            SHA1Transform(context->state, &data[i]);
-        }
+        SHA1Blocks(context->state, context->buffer, 1);
+        SHA1Blocks(context->state, &data[i], (len - i) / 64);
+        i += (len - i) & ~63UL;
         j = 0;
     }
     else
@@ -262,10 +394,6 @@ unsigned char finalcount[8];
     memset(context->state, 0, HASHSIZE);
     memset(context->count, 0, 8);
     memset(&finalcount, 0, 8);
-#ifdef SHA1HANDSOFF
-    /* make SHA1Transform overwrite it's own static vars */
-    SHA1Transform(context->state, context->buffer);
-#endif
 }
 
 
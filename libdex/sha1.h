@@ -4,9 +4,11 @@
 #ifndef LIBDEX_SHA1_H_
 #define LIBDEX_SHA1_H_
 
+#include <stdint.h>
+
 struct SHA1_CTX {
-    unsigned long state[5];
-    unsigned long count[2];
+    uint32_t state[5];
+    uint32_t count[2];
     unsigned char buffer[64];
 };
 
@@ -19,12 +19,16 @@
  * 1.0.3 to 1.0.2.  This removes some useful information, but allows
  * Android hprof data to be handled by widely-available tools (like "jhat").
  */
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 //#define VERBOSE_DEBUG
@@ -154,22 +158,6 @@ static inline unsigned char* ebGetBuffer(ExpandBuf* pBuf)
     return pBuf->storage;
 }
 
-/*
- * Get the amount of data currently in the buffer.
- */
-static inline size_t ebGetLength(ExpandBuf* pBuf)
-{
-    return pBuf->curLen;
-}
-
-/*
- * Empty the buffer.
- */
-static void ebClear(ExpandBuf* pBuf)
-{
-    pBuf->curLen = 0;
-}
-
 /*
  * Ensure that the buffer can hold at least "size" additional bytes.
  */
@@ -193,17 +181,6 @@ static int ebEnsureCapacity(ExpandBuf* pBuf, int size)
     return 0;
 }
 
-/*
- * Add data to the buffer after ensuring it can hold it.
- */
-static int ebAddData(ExpandBuf* pBuf, const void* data, size_t count)
-{
-    ebEnsureCapacity(pBuf, count);
-    memcpy(pBuf->storage + pBuf->curLen, data, count);
-    pBuf->curLen += count;
-    return 0;
-}
-
 /*
  * Read a NULL-terminated string from the input.
  */
@@ -277,6 +254,166 @@ static int ebWriteData(ExpandBuf* pBuf, FILE* out)
 }
 
 
+/*
+ * ===========================================================================
+ *      Record streaming
+ * ===========================================================================
+ */
+
+/*
+ * Records are converted a piece at a time through a fixed-size buffer, so
+ * memory use doesn't depend on the size of the heap dump.  A heap dump
+ * record can be several gigabytes long.
+ */
+#define kStreamBufSize  (64 * 1024)
+
+typedef struct {
+    FILE* in;
+    FILE* out;              /* NULL if we're just measuring the output */
+    int inSeekable;
+    int outSeekable;
+
+    uint32_t length;        /* length of the current input record */
+    uint32_t remaining;     /* input bytes left in the current record */
+    uint32_t written;       /* output bytes generated for the record */
+
+    unsigned char* buf;
+} RecordStream;
+
+/*
+ * Determine whether we can seek around in "fp".  Pipes and terminals
+ * can't be.  Neither can a file opened for appending (e.g. stdout
+ * redirected with ">>"): the seeks succeed, but every write still goes
+ * to the end of the file, so a patched length would land there instead.
+ */
+static int isSeekable(FILE* fp)
+{
+    int flags = fcntl(fileno(fp), F_GETFL);
+
+    if (flags < 0 || (flags & O_APPEND) != 0)
+        return 0;
+    return ftello(fp) >= 0;
+}
+
+/*
+ * Read exactly "count" bytes of the current record.
+ */
+static int rsRead(RecordStream* pStream, void* dst, size_t count)
+{
+    size_t actual;
+
+    if (count > pStream->remaining) {
+        fprintf(stderr, "ERROR: sub-record overruns record (%zu of %u bytes)\n",
+            count, pStream->remaining);
+        return -1;
+    }
+
+    actual = fread(dst, 1, count, pStream->in);
+    if (actual != count) {
+        fprintf(stderr, "ERROR: read %zu of %zu bytes\n", actual, count);
+        return -1;
+    }
+
+    pStream->remaining -= count;
+    return 0;
+}
+
+/*
+ * Append data to the output record.  When measuring, this just updates
+ * the count.
+ */
+static int rsWrite(RecordStream* pStream, const void* src, size_t count)
+{
+    if (pStream->out != NULL) {
+        size_t actual = fwrite(src, 1, count, pStream->out);
+        if (actual != count) {
+            fprintf(stderr, "ERROR: write %zu of %zu bytes\n", actual, count);
+            return -1;
+        }
+    }
+
+    pStream->written += count;
+    return 0;
+}
+
+/*
+ * Copy "count" bytes of the current record from input to output.
+ */
+static int rsCopy(RecordStream* pStream, uint64_t count)
+{
+    if (count > pStream->remaining) {
+        fprintf(stderr, "ERROR: sub-record overruns record (%llu of %u bytes)\n",
+            (unsigned long long) count, pStream->remaining);
+        return -1;
+    }
+
+    if (pStream->out == NULL && pStream->inSeekable) {
+        /* just measuring, don't bother reading it */
+        if (fseeko(pStream->in, (off_t) count, SEEK_CUR) != 0) {
+            fprintf(stderr, "ERROR: seek failed: %s\n", strerror(errno));
+            return -1;
+        }
+        pStream->remaining -= count;
+        pStream->written += count;
+        return 0;
+    }
+
+    while (count > 0) {
+        size_t chunk = count < kStreamBufSize ? (size_t) count : kStreamBufSize;
+
+        if (rsRead(pStream, pStream->buf, chunk) != 0)
+            return -1;
+        if (rsWrite(pStream, pStream->buf, chunk) != 0)
+            return -1;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Discard "count" bytes of the current record.
+ */
+static int rsSkip(RecordStream* pStream, uint64_t count)
+{
+    if (count > pStream->remaining) {
+        fprintf(stderr, "ERROR: sub-record overruns record (%llu of %u bytes)\n",
+            (unsigned long long) count, pStream->remaining);
+        return -1;
+    }
+
+    if (pStream->inSeekable) {
+        if (fseeko(pStream->in, (off_t) count, SEEK_CUR) != 0) {
+            fprintf(stderr, "ERROR: seek failed: %s\n", strerror(errno));
+            return -1;
+        }
+        pStream->remaining -= count;
+        return 0;
+    }
+
+    while (count > 0) {
+        size_t chunk = count < kStreamBufSize ? (size_t) count : kStreamBufSize;
+
+        if (rsRead(pStream, pStream->buf, chunk) != 0)
+            return -1;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy a tag byte, which may have been rewritten, followed by "len" bytes
+ * of fixed-length sub-record data.
+ */
+static int rsCopyTagged(RecordStream* pStream, unsigned char tag, size_t len)
+{
+    if (rsWrite(pStream, &tag, 1) != 0)
+        return -1;
+    return rsCopy(pStream, len);
+}
+
+
 /*
  * ===========================================================================
  *      Hprof stuff
@@ -331,270 +468,346 @@ static int computeBasicLen(HprofBasicType basicType)
 }
 
 /*
- * Compute the length of a HPROF_CLASS_DUMP block.
+ * Copy the body of a HPROF_CLASS_DUMP block, which has three
+ * variable-length lists after the fixed part.
  */
-static int computeClassDumpLen(const unsigned char* origBuf, int len)
+static int copyClassDump(RecordStream* pStream)
 {
-    const unsigned char* buf = origBuf;
-    int blockLen = 0;
+    unsigned char buf[kIdentSize + 1];
     int i, count;
 
-    blockLen += kIdentSize * 7 + 8;
-    buf += blockLen;
-    len -= blockLen;
-
-    if (len < 0)
+    if (rsCopy(pStream, kIdentSize * 7 + 8) != 0)
         return -1;
 
+    /* constant pool: (2b) index, (1b) type, value */
+    if (rsRead(pStream, buf, 2) != 0 || rsWrite(pStream, buf, 2) != 0)
+        return -1;
     count = get2BE(buf);
-    buf += 2;
-    len -= 2;
     DBUG("CDL: 1st count is %d\n", count);
     for (i = 0; i < count; i++) {
-        HprofBasicType basicType;
         int basicLen;
 
-        basicType = buf[2];
-        basicLen = computeBasicLen(basicType);
+        if (rsRead(pStream, buf, 3) != 0 || rsWrite(pStream, buf, 3) != 0)
+            return -1;
+        basicLen = computeBasicLen(buf[2]);
         if (basicLen < 0) {
-            DBUG("ERROR: invalid basicType %d\n", basicType);
+            fprintf(stderr, "ERROR: invalid basicType %d\n", buf[2]);
             return -1;
         }
-
-        buf += 2 + 1 + basicLen;
-        len -= 2 + 1 + basicLen;
-        if (len < 0)
+        if (rsCopy(pStream, basicLen) != 0)
             return -1;
     }
 
+    /* static fields: (id) name, (1b) type, value */
+    if (rsRead(pStream, buf, 2) != 0 || rsWrite(pStream, buf, 2) != 0)
+        return -1;
     count = get2BE(buf);
-    buf += 2;
-    len -= 2;
     DBUG("CDL: 2nd count is %d\n", count);
     for (i = 0; i < count; i++) {
-        HprofBasicType basicType;
         int basicLen;
 
-        basicType = buf[kIdentSize];
-        basicLen = computeBasicLen(basicType);
+        if (rsRead(pStream, buf, kIdentSize + 1) != 0
+                || rsWrite(pStream, buf, kIdentSize + 1) != 0)
+            return -1;
+        basicLen = computeBasicLen(buf[kIdentSize]);
         if (basicLen < 0) {
-            fprintf(stderr, "ERROR: invalid basicType %d\n", basicType);
+            fprintf(stderr, "ERROR: invalid basicType %d\n", buf[kIdentSize]);
             return -1;
         }
-
-        buf += kIdentSize + 1 + basicLen;
-        len -= kIdentSize + 1 + basicLen;
-        if (len < 0)
+        if (rsCopy(pStream, basicLen) != 0)
             return -1;
     }
 
+    /* instance fields: (id) name, (1b) type */
+    if (rsRead(pStream, buf, 2) != 0 || rsWrite(pStream, buf, 2) != 0)
+        return -1;
     count = get2BE(buf);
-    buf += 2;
-    len -= 2;
     DBUG("CDL: 3rd count is %d\n", count);
-    for (i = 0; i < count; i++) {
-        buf += kIdentSize + 1;
-        len -= kIdentSize + 1;
-        if (len < 0)
-            return -1;
-    }
-
-    DBUG("Total class dump len: %d\n", buf - origBuf);
-    return buf - origBuf;
+    return rsCopy(pStream, (uint64_t) count * (kIdentSize + 1));
 }
 
 /*
- * Compute the length of a HPROF_INSTANCE_DUMP block.
+ * Handle one of the instance or array dumps, which have a fixed-length
+ * header of "hdrLen" bytes followed by a variable amount of data whose
+ * size comes from the header.
+ *
+ * If "ignore" is set the whole thing is dropped.
  */
-static int computeInstanceDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
+static int processObjectDump(RecordStream* pStream, unsigned char subType,
+    size_t hdrLen, int ignore)
 {
-    int extraCount = get4BE(origBuf + kIdentSize * 2 + 4);
-    return kIdentSize * 2 + 8 + extraCount;
-}
+    unsigned char hdr[1 + kIdentSize * 2 + 8];
+    const unsigned char* body = hdr + 1;
+    uint64_t dataLen;
 
-/*
- * Compute the length of a HPROF_OBJECT_ARRAY_DUMP block.
- */
-static int computeObjectArrayDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
-{
-    int arrayCount = get4BE(origBuf + kIdentSize + 4);
-    return kIdentSize * 2 + 8 + arrayCount * kIdentSize;
-}
+    assert(hdrLen < sizeof(hdr));
+    hdr[0] = subType;
+    if (rsRead(pStream, hdr + 1, hdrLen) != 0)
+        return -1;
 
-/*
- * Compute the length of a HPROF_PRIMITIVE_ARRAY_DUMP block.
- */
-static int computePrimitiveArrayDumpLen(const unsigned char* origBuf, int len ATTRIBUTE_UNUSED)
-{
-    int arrayCount = get4BE(origBuf + kIdentSize + 4);
-    HprofBasicType basicType = origBuf[kIdentSize + 8];
-    int basicLen = computeBasicLen(basicType);
+    switch (subType) {
+    case HPROF_INSTANCE_DUMP:
+        dataLen = get4BE(body + kIdentSize * 2 + 4);
+        break;
+    case HPROF_OBJECT_ARRAY_DUMP:
+        dataLen = (uint64_t) get4BE(body + kIdentSize + 4) * kIdentSize;
+        break;
+    case HPROF_PRIMITIVE_ARRAY_DUMP:
+        {
+            HprofBasicType basicType = body[kIdentSize + 8];
+            int basicLen = computeBasicLen(basicType);
+
+            if (basicLen < 0) {
+                fprintf(stderr, "ERROR: invalid basicType %d\n", basicType);
+                return -1;
+            }
+            dataLen = (uint64_t) get4BE(body + kIdentSize + 4) * basicLen;
+        }
+        break;
+    default:
+        assert(FALSE);
+        return -1;
+    }
+
+    if (ignore) {
+        DBUG("(skip %llu)\n", (unsigned long long) (1 + hdrLen + dataLen));
+        return rsSkip(pStream, dataLen);
+    }
 
-    return kIdentSize + 9 + arrayCount * basicLen;
+    DBUG("(%llu)\n", (unsigned long long) (1 + hdrLen + dataLen));
+    if (rsWrite(pStream, hdr, 1 + hdrLen) != 0)
+        return -1;
+    return rsCopy(pStream, dataLen);
 }
 
 /*
- * Crunch through a heap dump record, writing the original or converted
- * data to "out".
+ * Crunch through the body of a heap dump record, writing the original or
+ * converted sub-records to the stream.  The record header has already
+ * been consumed; "pStream->remaining" holds the length of the body.
  */
-static int processHeapDump(ExpandBuf* pBuf, FILE* out, int flags)
+static int convertHeapDump(RecordStream* pStream, int flags)
 {
-    ExpandBuf* pOutBuf = ebAlloc();
-    unsigned char* origBuf = ebGetBuffer(pBuf);
-    unsigned char* buf = origBuf;
-    int len = ebGetLength(pBuf);
-    int result = -1;
     int heapType = HPROF_HEAP_DEFAULT;
     int heapIgnore = FALSE;
 
-    pBuf = NULL;        /* we just use the raw pointer from here forward */
-
-    /* copy the original header to the output buffer */
-    if (ebAddData(pOutBuf, buf, kRecHdrLen) != 0)
-        goto bail;
+    while (pStream->remaining > 0) {
+        unsigned char subType;
+        unsigned char buf[1 + kIdentSize + 9];
+        int result;
 
-    buf += kRecHdrLen;      /* skip past record header */
-    len -= kRecHdrLen;
-
-    while (len > 0) {
-        unsigned char subType = buf[0];
-        int justCopy = TRUE;
-        int subLen;
+        if (rsRead(pStream, &subType, 1) != 0)
+            return -1;
 
         DBUG("--- 0x%02x  ", subType);
         switch (subType) {
         /* 1.0.2 types */
         case HPROF_ROOT_UNKNOWN:
-            subLen = kIdentSize;
+            result = rsCopyTagged(pStream, subType, kIdentSize);
             break;
         case HPROF_ROOT_JNI_GLOBAL:
-            subLen = kIdentSize * 2;
+            result = rsCopyTagged(pStream, subType, kIdentSize * 2);
             break;
         case HPROF_ROOT_JNI_LOCAL:
-            subLen = kIdentSize + 8;
+            result = rsCopyTagged(pStream, subType, kIdentSize + 8);
             break;
         case HPROF_ROOT_JAVA_FRAME:
-            subLen = kIdentSize + 8;
+            result = rsCopyTagged(pStream, subType, kIdentSize + 8);
             break;
         case HPROF_ROOT_NATIVE_STACK:
-            subLen = kIdentSize + 4;
+            result = rsCopyTagged(pStream, subType, kIdentSize + 4);
             break;
         case HPROF_ROOT_STICKY_CLASS:
-            subLen = kIdentSize;
+            result = rsCopyTagged(pStream, subType, kIdentSize);
             break;
         case HPROF_ROOT_THREAD_BLOCK:
-            subLen = kIdentSize + 4;
+            result = rsCopyTagged(pStream, subType, kIdentSize + 4);
             break;
         case HPROF_ROOT_MONITOR_USED:
-            subLen = kIdentSize;
+            result = rsCopyTagged(pStream, subType, kIdentSize);
             break;
         case HPROF_ROOT_THREAD_OBJECT:
-            subLen = kIdentSize + 8;
+            result = rsCopyTagged(pStream, subType, kIdentSize + 8);
             break;
         case HPROF_CLASS_DUMP:
-            subLen = computeClassDumpLen(buf+1, len-1);
+            result = rsWrite(pStream, &subType, 1);
+            if (result == 0)
+                result = copyClassDump(pStream);
             break;
         case HPROF_INSTANCE_DUMP:
-            subLen = computeInstanceDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
-            break;
         case HPROF_OBJECT_ARRAY_DUMP:
-            subLen = computeObjectArrayDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
+            result = processObjectDump(pStream, subType, kIdentSize * 2 + 8,
+                heapIgnore);
             break;
         case HPROF_PRIMITIVE_ARRAY_DUMP:
-            subLen = computePrimitiveArrayDumpLen(buf+1, len-1);
-            if (heapIgnore) {
-                justCopy = FALSE;
-            }
+            result = processObjectDump(pStream, subType, kIdentSize + 9,
+                heapIgnore);
             break;
         /* these were added for Android in 1.0.3 */
         case HPROF_HEAP_DUMP_INFO:
-            heapType = get4BE(buf+1);
+            result = rsRead(pStream, buf, kIdentSize + 4);
+            if (result != 0)
+                break;
+            heapType = get4BE(buf);
             if ((flags & kFlagAppOnly) != 0
                     && (heapType == HPROF_HEAP_ZYGOTE || heapType == HPROF_HEAP_IMAGE)) {
                 heapIgnore = TRUE;
             } else {
                 heapIgnore = FALSE;
             }
-            justCopy = FALSE;
-            subLen = kIdentSize + 4;
             // no 1.0.2 equivalent for this
             break;
         case HPROF_ROOT_INTERNED_STRING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_FINALIZING:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_DEBUGGER:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_REFERENCE_CLEANUP:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
-            break;
         case HPROF_ROOT_VM_INTERNAL:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
+        case HPROF_UNREACHABLE:
+            result = rsCopyTagged(pStream, HPROF_ROOT_UNKNOWN, kIdentSize);
             break;
         case HPROF_ROOT_JNI_MONITOR:
             /* keep the ident, drop the next 8 bytes */
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            justCopy = FALSE;
-            ebAddData(pOutBuf, buf, 1 + kIdentSize);
-            subLen = kIdentSize + 8;
-            break;
-        case HPROF_UNREACHABLE:
-            buf[0] = HPROF_ROOT_UNKNOWN;
-            subLen = kIdentSize;
+            result = rsCopyTagged(pStream, HPROF_ROOT_UNKNOWN, kIdentSize);
+            if (result == 0)
+                result = rsSkip(pStream, 8);
             break;
         case HPROF_PRIMITIVE_ARRAY_NODATA_DUMP:
             buf[0] = HPROF_PRIMITIVE_ARRAY_DUMP;
+            result = rsRead(pStream, buf + 1, kIdentSize + 9);
+            if (result != 0)
+                break;
             buf[5] = buf[6] = buf[7] = buf[8] = 0;  /* set array len to 0 */
-            subLen = kIdentSize + 9;
+            result = rsWrite(pStream, buf, 1 + kIdentSize + 9);
             break;
 
         /* shouldn't get here */
         default:
-            fprintf(stderr, "ERROR: unexpected subtype 0x%02x at offset %zu\n",
-                subType, (size_t) (buf - origBuf));
+            fprintf(stderr, "ERROR: unexpected subtype 0x%02x at offset %u\n",
+                subType, kRecHdrLen + pStream->length - pStream->remaining - 1);
+            return -1;
+        }
+
+        if (result != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Write a record header with the given length.
+ */
+static int writeRecordHeader(FILE* out, const unsigned char* origHdr,
+    uint32_t length)
+{
+    unsigned char hdr[kRecHdrLen];
+
+    memcpy(hdr, origHdr, kRecHdrLen);
+    set4BE(hdr + 5, length);
+    if (fwrite(hdr, 1, kRecHdrLen, out) != kRecHdrLen) {
+        fprintf(stderr, "ERROR: failed writing record header\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Convert a heap dump record.  "hdr" is the original record header, and
+ * the stream is positioned at the start of the record body.
+ *
+ * The output length isn't known until the whole record has been
+ * converted.  If the output is seekable we write a placeholder and patch
+ * it afterward.  Otherwise, if the input is seekable, we run through the
+ * record once to compute the length, then back up and convert it for
+ * real.  If neither is, the converted record is spooled to a temp file.
+ */
+static int processHeapDump(RecordStream* pStream, const unsigned char* hdr,
+    int flags)
+{
+    FILE* out = pStream->out;
+    FILE* spool = NULL;
+    unsigned char lenBuf[4];
+    off_t start;
+    int result = -1;
+
+    pStream->written = 0;
+
+    if (pStream->outSeekable) {
+        start = ftello(out);
+        if (writeRecordHeader(out, hdr, 0) != 0)
+            goto bail;
+        if (convertHeapDump(pStream, flags) != 0)
+            goto bail;
+
+        /* go back and fill in the length */
+        set4BE(lenBuf, pStream->written);
+        if (fseeko(out, start + 5, SEEK_SET) != 0
+                || fwrite(lenBuf, 1, 4, out) != 4
+                || fseeko(out, 0, SEEK_END) != 0) {
+            fprintf(stderr, "ERROR: failed updating record length: %s\n",
+                strerror(errno));
             goto bail;
         }
+    } else if (pStream->inSeekable) {
+        start = ftello(pStream->in);
 
-        if (justCopy) {
-            /* copy source data */
-            DBUG("(%d)\n", 1 + subLen);
-            ebAddData(pOutBuf, buf, 1 + subLen);
-        } else {
-            /* other data has been written, or the sub-record omitted */
-            DBUG("(adv %d)\n", 1 + subLen);
+        /* first pass: compute the output length */
+        pStream->out = NULL;
+        if (convertHeapDump(pStream, flags) != 0)
+            goto bail;
+        DBUG("Heap dump output is %u bytes\n", pStream->written);
+
+        if (fseeko(pStream->in, start, SEEK_SET) != 0) {
+            fprintf(stderr, "ERROR: seek failed: %s\n", strerror(errno));
+            goto bail;
         }
+        pStream->out = out;
+        pStream->remaining = pStream->length;
 
-        /* advance to next entry */
-        buf += 1 + subLen;
-        len -= 1 + subLen;
-    }
+        /* second pass: do the conversion */
+        if (writeRecordHeader(out, hdr, pStream->written) != 0)
+            goto bail;
+        pStream->written = 0;
+        if (convertHeapDump(pStream, flags) != 0)
+            goto bail;
+    } else {
+        spool = tmpfile();
+        if (spool == NULL) {
+            fprintf(stderr, "ERROR: unable to create temp file: %s\n",
+                strerror(errno));
+            goto bail;
+        }
 
-    /*
-     * Update the record length.
-     */
-    set4BE(ebGetBuffer(pOutBuf) + 5, ebGetLength(pOutBuf) - kRecHdrLen);
+        pStream->out = spool;
+        if (convertHeapDump(pStream, flags) != 0)
+            goto bail;
+        pStream->out = out;
 
-    if (ebWriteData(pOutBuf, out) != 0)
-        goto bail;
+        if (writeRecordHeader(out, hdr, pStream->written) != 0)
+            goto bail;
+
+        /* copy the spooled output; it's already been counted */
+        rewind(spool);
+        while (1) {
+            size_t actual = fread(pStream->buf, 1, kStreamBufSize, spool);
+            if (actual == 0)
+                break;
+            if (fwrite(pStream->buf, 1, actual, out) != actual) {
+                fprintf(stderr, "ERROR: write of spooled data failed\n");
+                goto bail;
+            }
+        }
+        if (ferror(spool)) {
+            fprintf(stderr, "ERROR: read of spooled data failed\n");
+            goto bail;
+        }
+    }
 
     result = 0;
 
 bail:
-    ebFree(pOutBuf);
+    pStream->out = out;
+    if (spool != NULL)
+        fclose(spool);
     return result;
 }
 
@@ -605,10 +818,18 @@ static int filterData(FILE* in, FILE* out, int flags)
 {
     const char *magicString;
     ExpandBuf* pBuf;
+    RecordStream stream;
     int result = -1;
 
+    memset(&stream, 0, sizeof(stream));
+    stream.in = in;
+    stream.out = out;
+    stream.inSeekable = isSeekable(in);
+    stream.outSeekable = isSeekable(out);
+    stream.buf = (unsigned char*) malloc(kStreamBufSize);
+
     pBuf = ebAlloc();
-    if (pBuf == NULL)
+    if (pBuf == NULL || stream.buf == NULL)
         goto bail;
 
     /*
@@ -649,52 +870,49 @@ static int filterData(FILE* in, FILE* out, int flags)
      * (4b) length of data that follows
      */
     while (1) {
-        assert(ebGetLength(pBuf) == 0);
+        unsigned char hdr[kRecHdrLen];
+        unsigned char type;
+        size_t actual;
 
-        /* read type char */
-        if (ebReadData(pBuf, in, 1, TRUE) != 0)
-            goto bail;
-        if (feof(in))
+        actual = fread(hdr, 1, kRecHdrLen, in);
+        if (actual == 0 && feof(in) && !ferror(in))
             break;
-
-        /* read the rest of the header */
-        if (ebReadData(pBuf, in, kRecHdrLen-1, FALSE) != 0)
+        if (actual != kRecHdrLen) {
+            fprintf(stderr, "ERROR: read %zu of %d bytes\n", actual, kRecHdrLen);
             goto bail;
-
-        unsigned char* buf = ebGetBuffer(pBuf);
-        unsigned char type;
-        unsigned int timestamp, length;
-
-        type = buf[0];
-        timestamp = get4BE(buf + 1);
-        length = get4BE(buf + 5);
-        buf = NULL;     /* ptr invalid after next read op */
-
-        /* read the record data */
-        if (length != 0) {
-            if (ebReadData(pBuf, in, length, FALSE) != 0)
-                goto bail;
         }
 
+        type = hdr[0];
+        stream.length = stream.remaining = get4BE(hdr + 5);
+
         if (type == HPROF_TAG_HEAP_DUMP
                 || type == HPROF_TAG_HEAP_DUMP_SEGMENT) {
-            DBUG("Processing heap dump 0x%02x (%d bytes)\n",
-                type, length);
-            if (processHeapDump(pBuf, out, flags) != 0)
+            DBUG("Processing heap dump 0x%02x (%u bytes)\n",
+                type, stream.length);
+            if (processHeapDump(&stream, hdr, flags) != 0)
                 goto bail;
-            ebClear(pBuf);
         } else {
             /* keep */
-            DBUG("Keeping 0x%02x (%d bytes)\n", type, length);
-            if (ebWriteData(pBuf, out) != 0)
+            DBUG("Keeping 0x%02x (%u bytes)\n", type, stream.length);
+            if (fwrite(hdr, 1, kRecHdrLen, out) != kRecHdrLen) {
+                fprintf(stderr, "ERROR: failed writing record header\n");
+                goto bail;
+            }
+            if (rsCopy(&stream, stream.length) != 0)
                 goto bail;
         }
     }
 
+    if (fflush(out) != 0) {
+        fprintf(stderr, "ERROR: failed writing output: %s\n", strerror(errno));
+        goto bail;
+    }
+
     result = 0;
 
 bail:
     ebFree(pBuf);
+    free(stream.buf);
     return result;
 }
 